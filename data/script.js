@@ -13,20 +13,16 @@ const ssidInput = document.getElementById("ssid");
 const pwdInput = document.getElementById("pwd");
 const minLapInput = document.getElementById("minLap");
 const alarmThreshold = document.getElementById("alarmThreshold");
+const calibStatus = document.getElementById("calibStatus");
 
-const freqLookup = [
-  [5865, 5845, 5825, 5805, 5785, 5765, 5745, 5725],
-  [5733, 5752, 5771, 5790, 5809, 5828, 5847, 5866],
-  [5705, 5685, 5665, 5645, 5885, 5905, 5925, 5945],
-  [5740, 5760, 5780, 5800, 5820, 5840, 5860, 5880],
-  [5658, 5695, 5732, 5769, 5806, 5843, 5880, 5917],
-  [5362, 5399, 5436, 5473, 5510, 5547, 5584, 5621],
-];
+// band table of the timer, from /bands
+var freqLookup = [];
 
 const config = document.getElementById("config");
 const race = document.getElementById("race");
 const calib = document.getElementById("calib");
 const ota = document.getElementById("ota");
+const scan = document.getElementById("scan");
 
 var enterRssi = 120,
   exitRssi = 100;
@@ -37,22 +33,47 @@ var lapNo = -1;
 var lapTimes = [];
 
 var timerInterval;
+var calibInterval;
 const timer = document.getElementById("timer");
 const startRaceButton = document.getElementById("startRaceButton");
 const stopRaceButton = document.getElementById("stopRaceButton");
 
 const batteryVoltageDisplay = document.getElementById("bvolt");
 
-const rssiBuffer = [];
+// binary frames on /ws, see lib/STREAM/wsframe.h
+const WS_FRAME_RSSI = 1;
+const WS_FRAME_LAP = 2;
+const WS_FRAME_BATTERY = 3;
+const WS_FRAME_HISTORY = 4;
+const WS_FRAME_SPECTRUM = 5;
+const WS_CMD_START = 1;
+const WS_CMD_STOP = 2;
+const WS_CMD_RSSI = 3;
+const WS_CMD_HISTORY = 4;
+const WS_CMD_SCAN = 5;
+const WS_RSSI_HEADER_SIZE = 14;
+const WS_HISTORY_HEADER_SIZE = 12;
+const WS_SPECTRUM_HEADER_SIZE = 15;
+const WS_RSSI_ESCAPE = 0x8;
+const rssiStreamHz = 50; // every bucket carries its min and max, no pass is missed at any rate
+const rssiChartMillisPerPixel = 50;
+
+var socket;
+var deviceTimeOffset = null;
 var rssiValue = 0;
 var rssiSending = false;
 var rssiChart;
 var crossing = false;
 var rssiSeries = new TimeSeries();
+var rssiMaxSeries = new TimeSeries();
+var rssiMinSeries = new TimeSeries();
+var rssiLiveStart = null;
 var rssiCrossingSeries = new TimeSeries();
 var maxRssiValue = enterRssi + 10;
 var minRssiValue = exitRssi - 10;
 
+var scanning = false;
+
 var audioEnabled = false;
 var speakObjsQueue = [];
 
@@ -61,7 +82,13 @@ onload = function (e) {
   race.style.display = "none";
   calib.style.display = "none";
   ota.style.display = "none";
-  fetch("/config")
+  scan.style.display = "none";
+  fetch("/bands")
+    .then((response) => response.json())
+    .then((bands) => {
+      setBands(bands);
+      return fetch("/config");
+    })
     .then((response) => response.json())
     .then((config) => {
       console.log(config);
@@ -90,31 +117,29 @@ onload = function (e) {
     });
 };
 
-function getBatteryVoltage() {
-  fetch("/status")
-    .then((response) => response.text())
-    .then((response) => {
-      const batteryVoltageMatch = response.match(/Battery Voltage:\s*([\d.]+v)/);
-      const batteryVoltage = batteryVoltageMatch ? batteryVoltageMatch[1] : null;
-      batteryVoltageDisplay.innerText = batteryVoltage;
-    });
+function addRssiSample(time, min, max, mean) {
+  rssiValue = mean;
+  if (crossing && min < exitRssi) {
+    crossing = false;
+  } else if (!crossing && max > enterRssi) {
+    crossing = true;
+  }
+  maxRssiValue = Math.max(maxRssiValue, max);
+  minRssiValue = Math.min(minRssiValue, min);
+
+  rssiSeries.append(time, mean);
+  rssiMaxSeries.append(time, max);
+  rssiMinSeries.append(time, min);
+  if (crossing) {
+    rssiCrossingSeries.append(time, 256);
+  } else {
+    rssiCrossingSeries.append(time, -10);
+  }
 }
 
-setInterval(getBatteryVoltage, 2000);
-
-function addRssiPoint() {
+function updateRssiChart() {
   if (calib.style.display != "none") {
     rssiChart.start();
-    if (rssiBuffer.length > 0) {
-      rssiValue = parseInt(rssiBuffer.shift());
-      if (crossing && rssiValue < exitRssi) {
-        crossing = false;
-      } else if (!crossing && rssiValue > enterRssi) {
-        crossing = true;
-      }
-      maxRssiValue = Math.max(maxRssiValue, rssiValue);
-      minRssiValue = Math.min(minRssiValue, rssiValue);
-    }
 
     // update horizontal lines and min max values
     rssiChart.options.horizontalLines = [
@@ -125,14 +150,6 @@ function addRssiPoint() {
     rssiChart.options.maxValue = Math.max(maxRssiValue, enterRssi + 10);
 
     rssiChart.options.minValue = Math.max(0, Math.min(minRssiValue, exitRssi - 10));
-
-    var now = Date.now();
-    rssiSeries.append(now, rssiValue);
-    if (crossing) {
-      rssiCrossingSeries.append(now, 256);
-    } else {
-      rssiCrossingSeries.append(now, -10);
-    }
   } else {
     rssiChart.stop();
     maxRssiValue = enterRssi + 10;
@@ -140,12 +157,12 @@ function addRssiPoint() {
   }
 }
 
-setInterval(addRssiPoint, 200);
+setInterval(updateRssiChart, 200);
 
 function createRssiChart() {
   rssiChart = new SmoothieChart({
     responsive: true,
-    millisPerPixel: 50,
+    millisPerPixel: rssiChartMillisPerPixel,
     grid: {
       strokeStyle: "rgba(255,255,255,0.25)",
       sharpLines: true,
@@ -163,12 +180,20 @@ function createRssiChart() {
     strokeStyle: "hsl(214, 53%, 60%)",
     fillStyle: "hsla(214, 53%, 60%, 0.4)",
   });
+  rssiChart.addTimeSeries(rssiMaxSeries, {
+    lineWidth: 1,
+    strokeStyle: "hsl(214, 53%, 80%)",
+  });
+  rssiChart.addTimeSeries(rssiMinSeries, {
+    lineWidth: 1,
+    strokeStyle: "hsl(214, 53%, 40%)",
+  });
   rssiChart.addTimeSeries(rssiCrossingSeries, {
     lineWidth: 1.7,
     strokeStyle: "none",
     fillStyle: "hsla(136, 71%, 70%, 0.3)",
   });
-  rssiChart.streamTo(document.getElementById("rssiChart"), 200);
+  rssiChart.streamTo(document.getElementById("rssiChart"), 400); // samples come in batches every 100ms
 }
 
 function openTab(evt, tabName) {
@@ -191,33 +216,17 @@ function openTab(evt, tabName) {
   document.getElementById(tabName).style.display = "block";
   evt.currentTarget.className += " active";
 
-  // if event comes from calibration tab, signal to start sending RSSI events
+  // RSSI is only streamed while the calibration tab is open, subscribing again when the socket reconnects
   if (tabName === "calib" && !rssiSending) {
-    fetch("/timer/rssiStart", {
-      method: "POST",
-      headers: {
-        Accept: "application/json",
-        "Content-Type": "application/json",
-      },
-    })
-      .then((response) => {
-        if (response.ok) rssiSending = true;
-        return response.json();
-      })
-      .then((response) => console.log("/timer/rssiStart:" + JSON.stringify(response)));
-  } else if (rssiSending) {
-    fetch("/timer/rssiStop", {
-      method: "POST",
-      headers: {
-        Accept: "application/json",
-        "Content-Type": "application/json",
-      },
-    })
-      .then((response) => {
-        if (response.ok) rssiSending = false;
-        return response.json();
-      })
-      .then((response) => console.log("/timer/rssiStop:" + JSON.stringify(response)));
+    rssiSending = true;
+    sendRssiSubscription();
+  } else if (tabName !== "calib" && rssiSending) {
+    rssiSending = false;
+    sendRssiSubscription();
+  }
+  // no laps are timed while scanning
+  if (tabName !== "scan" && scanning) {
+    stopScan();
   }
 }
 
@@ -241,6 +250,47 @@ function updateExitRssi(obj, value) {
   }
 }
 
+function startCalibration() {
+  fetch("/calibration/start", { method: "POST" }).then((response) => {
+    if (!response.ok) {
+      calibStatus.textContent = "Stop the race to calibrate";
+      return;
+    }
+    clearInterval(calibInterval);
+    calibInterval = setInterval(pollCalibration, 500);
+  });
+}
+
+function pollCalibration() {
+  fetch("/calibration")
+    .then((response) => response.json())
+    .then((pilots) => {
+      let c = pilots[0];
+      if (c.state == "floor") {
+        calibStatus.textContent = "Measuring the noise floor, keep the drone away from the gate";
+      } else if (c.state == "passes") {
+        calibStatus.textContent = "Noise floor " + c.floor + ", fly through the gate a few times (" + c.passes + " so far)";
+      } else {
+        clearInterval(calibInterval);
+        if (c.state == "done") applyCalibration();
+      }
+    });
+}
+
+function applyCalibration() {
+  fetch("/calibration/apply", { method: "POST" })
+    .then((response) => response.json())
+    .then((pilots) => {
+      let c = pilots[0];
+      enterRssiInput.value = c.enterRssi;
+      updateEnterRssi(enterRssiInput, c.enterRssi);
+      exitRssiInput.value = c.exitRssi;
+      updateExitRssi(exitRssiInput, c.exitRssi);
+      calibStatus.textContent =
+        "Saved enter " + c.enterRssi + " and exit " + c.exitRssi + " (noise floor " + c.floor + ", weakest pass " + c.peakMin + ")";
+    });
+}
+
 function saveConfig() {
   fetch("/config", {
     method: "POST",
@@ -400,15 +450,7 @@ function startTimer() {
     timer.innerHTML = `${m}:${s}:${ms}s`;
   }, 10);
 
-  fetch("/timer/start", {
-    method: "POST",
-    headers: {
-      Accept: "application/json",
-      "Content-Type": "application/json",
-    },
-  })
-    .then((response) => response.json())
-    .then((response) => console.log("/timer/start:" + JSON.stringify(response)));
+  timerCommand(WS_CMD_START, "/timer/start");
 }
 
 function queueSpeak(obj) {
@@ -479,15 +521,7 @@ function stopRace() {
   clearInterval(timerInterval);
   timer.innerHTML = "00:00:00s";
 
-  fetch("/timer/stop", {
-    method: "POST",
-    headers: {
-      Accept: "application/json",
-      "Content-Type": "application/json",
-    },
-  })
-    .then((response) => response.json())
-    .then((response) => console.log("/timer/stop:" + JSON.stringify(response)));
+  timerCommand(WS_CMD_STOP, "/timer/stop");
 
   stopRaceButton.disabled = true;
   startRaceButton.disabled = false;
@@ -506,48 +540,252 @@ function clearLaps() {
   lapTimes = [];
 }
 
-if (!!window.EventSource) {
-  var source = new EventSource("/events");
+function sendCommand(bytes) {
+  if (!socket || socket.readyState != WebSocket.OPEN) {
+    return false;
+  }
+  socket.send(new Uint8Array(bytes));
+  return true;
+}
 
-  source.addEventListener(
-    "open",
-    function (e) {
-      console.log("Events Connected");
-    },
-    false
-  );
-
-  source.addEventListener(
-    "error",
-    function (e) {
-      if (e.target.readyState != EventSource.OPEN) {
-        console.log("Events Disconnected");
-      }
+// the stream for new samples and, to fill the chart right away, what the timer has from before
+function sendRssiSubscription() {
+  var rate = rssiSending ? rssiStreamHz : 0;
+  sendCommand([WS_CMD_RSSI, rate & 0xff, rate >> 8]);
+  if (rssiSending) {
+    var canvas = document.getElementById("rssiChart");
+    var buckets = Math.min(canvas.width, 1000);
+    var spanMs = Math.min(canvas.width * rssiChartMillisPerPixel, 60000);
+    rssiLiveStart = null;
+    sendCommand([WS_CMD_HISTORY, 0, spanMs & 0xff, spanMs >> 8, buckets & 0xff, buckets >> 8]);
+  }
+}
+
+// over the socket, or the REST endpoint while it is reconnecting
+function timerCommand(command, path) {
+  if (sendCommand([command])) {
+    return;
+  }
+  fetch(path, {
+    method: "POST",
+    headers: {
+      Accept: "application/json",
+      "Content-Type": "application/json",
     },
-    false
-  );
-
-  source.addEventListener(
-    "rssi",
-    function (e) {
-      rssiBuffer.push(e.data);
-      if (rssiBuffer.length > 10) {
-        rssiBuffer.shift();
+  })
+    .then((response) => response.json())
+    .then((response) => console.log(path + ":" + JSON.stringify(response)));
+}
+
+// device time in us to local ms, anchored on the newest time of each frame, again when the device clock wraps or drifts away
+function anchorDeviceTime(timeUs) {
+  var timeMs = timeUs / 1000;
+  var now = Date.now();
+  if (deviceTimeOffset == null || Math.abs(now - (timeMs + deviceTimeOffset)) > 1000) {
+    deviceTimeOffset = now - timeMs;
+  }
+}
+
+function deviceToLocalTime(timeUs) {
+  return timeUs / 1000 + deviceTimeOffset;
+}
+
+function decodeRssiFrame(view, pos) {
+  var pilot = view.getUint8(pos + 1);
+  var count = view.getUint8(pos + 2);
+  var time = view.getUint32(pos + 5, true);
+  var period = view.getUint16(pos + 9, true);
+  var values = [view.getUint8(pos + 11), view.getUint8(pos + 12), view.getUint8(pos + 13)]; // min, max, mean
+  var codes = pos + WS_RSSI_HEADER_SIZE;
+  var nibble = 0;
+  function nextNibble() {
+    var b = view.getUint8(codes + (nibble >> 1));
+    return nibble++ & 1 ? b & 0xf : b >> 4;
+  }
+  if (pilot != 0) {
+    return;
+  }
+  anchorDeviceTime(time + (count - 1) * period);
+  for (var i = 0; i < count; i++) {
+    for (var v = 0; i > 0 && v < 3; v++) {
+      var code = nextNibble();
+      if (code == WS_RSSI_ESCAPE) {
+        values[v] = (nextNibble() << 4) | nextNibble();
+      } else {
+        values[v] = (values[v] + (code < 8 ? code : code - 16)) & 0xff;
       }
-      console.log("rssi", e.data, "buffer size", rssiBuffer.length);
-    },
-    false
-  );
-
-  source.addEventListener(
-    "lap",
-    function (e) {
-      var lap = (parseFloat(e.data) / 1000).toFixed(2);
-      addLap(lap);
-      console.log("lap raw:", e.data, " formatted:", lap);
-    },
-    false
-  );
+    }
+    var sampleTime = deviceToLocalTime(time + i * period);
+    if (rssiLiveStart == null) {
+      rssiLiveStart = sampleTime;
+    }
+    addRssiSample(sampleTime, values[0], values[1], values[2]);
+  }
+}
+
+function decodeHistoryFrame(view, pos) {
+  var pilot = view.getUint8(pos + 1);
+  var count = view.getUint16(pos + 2, true);
+  var time = view.getUint32(pos + 4, true);
+  var width = view.getUint32(pos + 8, true);
+  if (pilot != 0 || count == 0) {
+    return;
+  }
+  anchorDeviceTime(time + count * width);
+  for (var i = 0; i < count; i++) {
+    var b = pos + WS_HISTORY_HEADER_SIZE + i * 3;
+    var bucketTime = deviceToLocalTime(time + i * width);
+    // empty while the receiver was elsewhere, and the stream already has the newest ones
+    if (view.getUint8(b) > view.getUint8(b + 1) || (rssiLiveStart != null && bucketTime + width / 1000 > rssiLiveStart)) {
+      continue;
+    }
+    addRssiSample(bucketTime, view.getUint8(b), view.getUint8(b + 1), view.getUint8(b + 2));
+  }
+}
+
+function decodeSpectrumFrame(view, pos) {
+  var hold = view.getUint8(pos + 1);
+  var first = view.getUint16(pos + 2, true);
+  var step = view.getUint8(pos + 4);
+  var count = view.getUint16(pos + 5, true);
+  var sweepUs = view.getUint32(pos + 7, true);
+  var sweeps = view.getUint32(pos + 11, true);
+  var peak = [];
+  var mean = [];
+  for (var i = 0; i < count; i++) {
+    peak.push(view.getUint8(pos + WS_SPECTRUM_HEADER_SIZE + i * 2));
+    mean.push(view.getUint8(pos + WS_SPECTRUM_HEADER_SIZE + i * 2 + 1));
+  }
+  document.getElementById("scanStatus").textContent =
+    sweeps + " sweeps, " + (sweepUs / 1000).toFixed(0) + " ms per sweep" + (hold ? ", peak held" : "");
+  drawSpectrum(first, step, peak, mean);
+}
+
+function decodeFrames(view) {
+  var pos = 0;
+  while (pos < view.byteLength) {
+    switch (view.getUint8(pos)) {
+      case WS_FRAME_RSSI:
+        decodeRssiFrame(view, pos);
+        pos += WS_RSSI_HEADER_SIZE + view.getUint16(pos + 3, true);
+        break;
+      case WS_FRAME_HISTORY:
+        decodeHistoryFrame(view, pos);
+        pos += WS_HISTORY_HEADER_SIZE + view.getUint16(pos + 2, true) * 3;
+        break;
+      case WS_FRAME_SPECTRUM:
+        decodeSpectrumFrame(view, pos);
+        pos += WS_SPECTRUM_HEADER_SIZE + view.getUint16(pos + 5, true) * 2;
+        break;
+      case WS_FRAME_LAP:
+        if (view.getUint8(pos + 1) == 0) {
+          // the app times pilot 1
+          var lap = (view.getUint32(pos + 2, true) / 1000000).toFixed(2);
+          addLap(lap);
+          console.log("lap raw:", view.getUint32(pos + 2, true), " formatted:", lap);
+        }
+        pos += 6;
+        break;
+      case WS_FRAME_BATTERY:
+        batteryVoltageDisplay.innerText = (view.getUint8(pos + 1) / 10).toFixed(1) + "v";
+        pos += 2;
+        break;
+      default:
+        console.log("Unknown frame type", view.getUint8(pos));
+        return;
+    }
+  }
+}
+
+function connectSocket() {
+  socket = new WebSocket("ws://" + location.host + "/ws");
+  socket.binaryType = "arraybuffer";
+
+  socket.onopen = function (e) {
+    console.log("WebSocket Connected");
+    deviceTimeOffset = null;
+    if (rssiSending) {
+      sendRssiSubscription();
+    }
+  };
+
+  socket.onclose = function (e) {
+    console.log("WebSocket Disconnected");
+    setTimeout(connectSocket, 1000);
+  };
+
+  socket.onmessage = function (e) {
+    decodeFrames(new DataView(e.data));
+  };
+}
+
+connectSocket();
+
+function setBands(bands) {
+  freqLookup = bands.freq;
+  bandSelect.innerHTML = "";
+  for (var i = 0; i < bands.names.length; i++) {
+    bandSelect.add(new Option(bands.names[i], bands.names[i]));
+  }
+}
+
+function bandChannelName(freq) {
+  for (var i = 0; i < freqLookup.length; i++) {
+    var j = freqLookup[i].indexOf(freq);
+    if (j >= 0) {
+      return bandSelect.options[i].value + (j + 1);
+    }
+  }
+  return "";
+}
+
+function startScan() {
+  var from = parseInt(document.getElementById("scanFrom").value);
+  var to = parseInt(document.getElementById("scanTo").value);
+  var step = parseInt(document.getElementById("scanStep").value);
+  var hold = document.getElementById("scanHold").selectedIndex;
+  var settle = parseInt(document.getElementById("scanSettle").value);
+  if (sendCommand([WS_CMD_SCAN, from & 0xff, from >> 8, to & 0xff, to >> 8, step, hold, settle])) {
+    scanning = true;
+  }
+}
+
+function stopScan() {
+  sendCommand([WS_CMD_SCAN, 0, 0, 0, 0, 0, 0, 0]);
+  scanning = false;
+}
+
+// peak as bars, mean as a line, band channels marked under the axis
+function drawSpectrum(first, step, peak, mean) {
+  var canvas = document.getElementById("scanChart");
+  canvas.width = canvas.clientWidth;
+  canvas.height = canvas.clientHeight;
+  var ctx = canvas.getContext("2d");
+  var axis = 16;
+  var h = canvas.height - axis;
+  var w = canvas.width / Math.max(peak.length, 1);
+  ctx.clearRect(0, 0, canvas.width, canvas.height);
+  ctx.fillStyle = "hsla(136, 71%, 50%, 0.6)";
+  for (var i = 0; i < peak.length; i++) {
+    var y = (peak[i] / 255) * h;
+    ctx.fillRect(i * w, h - y, Math.max(w - 1, 1), y);
+  }
+  ctx.strokeStyle = "#333";
+  ctx.beginPath();
+  for (var i = 0; i < mean.length; i++) {
+    ctx.lineTo(i * w + w / 2, h - (mean[i] / 255) * h);
+  }
+  ctx.stroke();
+  ctx.fillStyle = "#333";
+  ctx.font = "10px sans-serif";
+  var lastLabel = -100;
+  for (var i = 0; i < peak.length; i++) {
+    var name = bandChannelName(first + i * step);
+    if (name && i * w - lastLabel > 24) {
+      ctx.fillText(name, i * w, canvas.height - 4);
+      lastLabel = i * w;
+    }
+  }
 }
 
 function setBandChannelIndex(freq) {
@@ -0,0 +1,117 @@
+#include "assets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hal.h"
+
+#define ASSETS_LINE_SIZE 192
+#define ASSETS_FIELDS 7
+
+static bool copyField(char *dest, const char *src, size_t size) {
+    if (strlen(src) >= size) return false;
+    strcpy(dest, src);
+    return true;
+}
+
+bool AssetManifest::parseLine(char *line, asset_t *asset) {
+    char *fields[ASSETS_FIELDS];
+    uint8_t n = 0;
+    fields[n++] = line;
+    for (char *c = line; *c && n < ASSETS_FIELDS; c++) {
+        if (*c == '\t') {
+            *c = 0;
+            fields[n++] = c + 1;
+        }
+    }
+    if (n != ASSETS_FIELDS || fields[0][0] != '/') return false;
+    bool ok = copyField(asset->url, fields[0], sizeof(asset->url));
+    ok = ok && copyField(asset->hashed, strcmp(fields[1], "-") ? fields[1] : "", sizeof(asset->hashed));
+    ok = ok && copyField(asset->file, fields[2], sizeof(asset->file));
+    ok = ok && copyField(asset->type, fields[3], sizeof(asset->type));
+    asset->crc = strtoul(fields[4], NULL, 16);
+    asset->length = strtoul(fields[5], NULL, 10);
+    asset->size = strtoul(fields[6], NULL, 10);
+    return ok;
+}
+
+bool AssetManifest::load(const char *path) {
+    count = 0;
+    int8_t file = halFileOpen(path, HAL_FILE_READ);
+    if (file < 0) {
+        DEBUG("No asset manifest %s\n", path);
+        return false;
+    }
+
+    char line[ASSETS_LINE_SIZE];
+    char chunk[64];
+    size_t length = 0, got = 0, pos = 0;
+    bool ok = true;
+    for (;;) {
+        if (pos == got) {
+            got = halFileRead(file, chunk, sizeof(chunk));
+            pos = 0;
+        }
+        bool end = got == 0;
+        char c = end ? '\n' : chunk[pos++];  // the end of the file ends the last line too
+        if (c == '\r') continue;
+        if (c != '\n') {
+            if (length + 1 >= sizeof(line)) {
+                ok = false;
+                break;
+            }
+            line[length++] = c;
+            continue;
+        }
+        line[length] = 0;
+        if (length && line[0] != '#') {
+            ok = count < ASSETS_MAX && parseLine(line, &assets[count]);
+            if (!ok) break;
+            count++;
+        }
+        length = 0;
+        if (end) break;
+    }
+    halFileClose(file);
+
+    if (!ok) {
+        DEBUG("Broken asset manifest %s\n", path);
+        count = 0;
+        return false;
+    }
+    DEBUG("Asset manifest: %u files\n", count);
+    return count > 0;
+}
+
+asset_status_e AssetManifest::resolve(const char *url, const char *ifNoneMatch, asset_response_t *response) {
+    if (!strcmp(url, "/")) url = ASSETS_ENTRY;
+    response->status = ASSET_NOT_FOUND;
+    response->asset = NULL;
+    for (uint8_t i = 0; i < count && !response->asset; i++) {
+        const asset_t &a = assets[i];
+        if (a.hashed[0] && !strcmp(url, a.hashed)) {
+            response->asset = &a;
+            response->cacheControl = ASSETS_IMMUTABLE;
+        } else if (!strcmp(url, a.url)) {
+            response->asset = &a;
+            response->cacheControl = ASSETS_REVALIDATE;
+        }
+    }
+    if (!response->asset) return response->status;
+
+    snprintf(response->etag, sizeof(response->etag), "\"%08x\"", (unsigned)response->asset->crc);
+    // a list, possibly weak (W/"..."), or * for any
+    bool match = ifNoneMatch && (strstr(ifNoneMatch, response->etag) || !strcmp(ifNoneMatch, "*"));
+    response->status = match ? ASSET_NOT_MODIFIED : ASSET_SEND;
+    return response->status;
+}
+
+uint8_t AssetManifest::getCount() {
+    return count;
+}
+
+const asset_t *AssetManifest::getAsset(uint8_t index) {
+    return index < count ? &assets[index] : NULL;
+}
@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#pragma once
+
+#define ASSETS_MANIFEST "/assets.txt"  // written by scripts/assets.py
+#define ASSETS_MAX 16
+#define ASSETS_PATH_SIZE 48
+#define ASSETS_TYPE_SIZE 32
+#define ASSETS_ETAG_SIZE 12  // "crc32" with the quotes
+#define ASSETS_ENTRY "/index.html"
+#define ASSETS_IMMUTABLE "public, max-age=31536000, immutable"
+#define ASSETS_REVALIDATE "no-cache"
+
+typedef struct {
+    char url[ASSETS_PATH_SIZE];     // as in data/
+    char hashed[ASSETS_PATH_SIZE];  // fingerprinted, empty for the entry page
+    char file[ASSETS_PATH_SIZE];    // gzipped, on the data partition
+    char type[ASSETS_TYPE_SIZE];
+    uint32_t crc;     // CRC32 of the content, the fingerprint and the ETag
+    uint32_t length;  // of the content
+    uint32_t size;    // of the file
+} asset_t;
+
+typedef enum {
+    ASSET_NOT_FOUND,
+    ASSET_SEND,          // the file, with Content-Encoding: gzip
+    ASSET_NOT_MODIFIED,  // 304
+} asset_status_e;
+
+typedef struct {
+    asset_status_e status;
+    const asset_t *asset;
+    const char *cacheControl;
+    char etag[ASSETS_ETAG_SIZE];
+} asset_response_t;
+
+/*
+ * The web UI as scripts/assets.py builds it: every file minified and
+ * gzipped under a name with its CRC32, plus a manifest. A fingerprinted URL
+ * never changes content and is cached for good; the plain names, the entry
+ * page among them, are revalidated against the strong ETag every time.
+ */
+class AssetManifest {
+   public:
+    bool load(const char *path = ASSETS_MANIFEST);  // false without a manifest or when it is broken
+    asset_status_e resolve(const char *url, const char *ifNoneMatch, asset_response_t *response);
+    uint8_t getCount();
+    const asset_t *getAsset(uint8_t index);
+
+   private:
+    asset_t assets[ASSETS_MAX];
+    uint8_t count = 0;
+
+    bool parseLine(char *line, asset_t *asset);
+};
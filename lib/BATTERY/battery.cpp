@@ -1,8 +1,11 @@
 #include "battery.h"
 
-#include <Arduino.h>
+#include <string.h>
 
 #include "debug.h"
+#include "hal.h"
+
+static uint16_t averageSum = 0;
 
 void BatteryMonitor::init(uint8_t pin, uint8_t batScale, uint8_t batAdd, Buzzer *buzzer, Led *l) {
     buz = buzzer;
@@ -12,30 +15,29 @@ void BatteryMonitor::init(uint8_t pin, uint8_t batScale, uint8_t batAdd, Buzzer
     add = batAdd;
     state = ALARM_OFF;
     memset(measurements, 0, sizeof(measurements));
+    averageSum = 0;
     measurementIndex = 0;
-    lastCheckTimeMs = millis();
-    pinMode(vbatPin, INPUT);
+    lastCheckTimeMs = halMillis();
+    halPinMode(vbatPin, HAL_INPUT);
 
     for (int i = 0; i < AVERAGING_SIZE; i++) {
         getBatteryVoltage();  // kick averaging sum up to speed.
     }
 }
 
-static uint16_t averageSum = 0;
-
 uint8_t BatteryMonitor::getBatteryVoltage() {
     // 0-3.3V maps to 0-4095, battery voltage ranges from 4.2V to 3.0V, but the voltage is divided, so 2.1V - 1.5V
-    volatile uint16_t raw = analogRead(vbatPin);
+    volatile uint16_t raw = halAnalogRead(vbatPin);
     averageSum = averageSum - measurements[measurementIndex];  // substract oldest val
     measurements[measurementIndex] = raw;                      // replace old with new val
     averageSum += raw;                                         // update averageSum
     measurementIndex = (measurementIndex + 1) % AVERAGING_SIZE;
-    uint8_t scaled = map(round(averageSum / AVERAGING_SIZE), 0, 4095, 0, 33 * scale) + add;  // 3.3v ref accuracy, divider + voltage drop
+    uint8_t scaled = (uint32_t)(averageSum / AVERAGING_SIZE) * (33 * scale) / 4095 + add;  // 3.3v ref accuracy, divider + voltage drop
     DEBUG("Battery raw:%u, scaled:%u\n", raw, scaled);
     return scaled;
 }
 
-void BatteryMonitor::checkBatteryState(uint32_t currentTimeMs, uint8_t alarmThreshold) {
+uint32_t BatteryMonitor::checkBatteryState(uint32_t currentTimeMs, uint8_t alarmThreshold) {
     switch (state) {
         case ALARM_OFF:
             if ((alarmThreshold > 0) && ((currentTimeMs - lastCheckTimeMs) > MONITOR_CHECK_TIME_MS)) {
@@ -68,4 +70,7 @@ void BatteryMonitor::checkBatteryState(uint32_t currentTimeMs, uint8_t alarmThre
         default:
             break;
     }
+    if (state != ALARM_OFF) return MONITOR_BEEP_TIME_MS - (currentTimeMs - lastCheckTimeMs) + 1;
+    if (alarmThreshold == 0) return SCHEDULER_IDLE;
+    return MONITOR_CHECK_TIME_MS - (currentTimeMs - lastCheckTimeMs) + 1;
 }
@@ -2,6 +2,9 @@
 
 #include "buzzer.h"
 #include "led.h"
+#include "scheduler.h"
+
+#pragma once
 
 #define MONITOR_CHECK_TIME_MS 5000
 #define MONITOR_BEEP_TIME_MS 500
@@ -17,7 +20,7 @@ class BatteryMonitor {
    public:
     void init(uint8_t pin, uint8_t batScale, uint8_t batAdd, Buzzer *buzzer, Led *l);
     uint8_t getBatteryVoltage();
-    void checkBatteryState(uint32_t currentTimeMs, uint8_t alarmThreshold);
+    uint32_t checkBatteryState(uint32_t currentTimeMs, uint8_t alarmThreshold);  // ms until the next check
 
    private:
     alarm_state_e state = ALARM_OFF;
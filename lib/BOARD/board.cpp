@@ -0,0 +1,15 @@
+#include "board.h"
+
+const board_t board = {
+    BOARD_NAME,
+    PIN_RX5808_DATA,
+    PIN_RX5808_CLOCK,
+    BOARD_RECEIVERS,
+    BOARD_RECEIVER_PINS,
+    PIN_LED,
+    PIN_BUZZER,
+    BUZZER_INVERTED,
+    PIN_VBAT,
+    VBAT_SCALE,
+    VBAT_ADD,
+};
@@ -0,0 +1,116 @@
+#include <stdint.h>
+
+#pragma once
+
+/*
+## Pinout ##
+| ESP32 | RX5880 |
+| :------------- |:-------------|
+| 33 | RSSI |
+| GND | GND |
+| 19 | CH1 |
+| 22 | CH2 |
+| 23 | CH3 |
+| 3V3 | +5V |
+
+* **Led** goes to pin 21 and GND
+* The optional **Buzzer** goes to pin 25 or 27 and GND
+
+*/
+
+//ESP32 node, four RX5808 on shared CH1/CH3 with their own CH2 and RSSI
+#if defined(BOARD_NODE4)
+
+#define BOARD_NAME "PhobosLT node4"
+#define PIN_LED 21
+#define PIN_VBAT 35
+#define VBAT_SCALE 2
+#define VBAT_ADD 2
+#define PIN_RX5808_RSSI 33
+#define PIN_RX5808_DATA 19   //CH1
+#define PIN_RX5808_SELECT 22 //CH2
+#define PIN_RX5808_CLOCK 23  //CH3
+#define PIN_BUZZER 27
+#define BUZZER_INVERTED false
+#define BOARD_RECEIVERS 4
+#define BOARD_RECEIVER_PINS {{33, 22}, {32, 18}, {34, 16}, {39, 17}}  // RSSI (ADC1), CH2
+
+//ESP23-C3
+#elif defined(ESP32C3)
+
+#define BOARD_NAME "ESP32-C3"
+#define PIN_LED 1
+#define PIN_VBAT 0
+#define VBAT_SCALE 2
+#define VBAT_ADD 2
+#define PIN_RX5808_RSSI 3
+#define PIN_RX5808_DATA 6     //CH1
+#define PIN_RX5808_SELECT 7   //CH2
+#define PIN_RX5808_CLOCK 4    //CH3
+#define PIN_BUZZER 5
+#define BUZZER_INVERTED false
+
+//ESP32-S3
+#elif defined(ESP32S3)
+
+#define BOARD_NAME "ESP32-S3"
+#define PIN_LED 2
+#define PIN_VBAT 1
+#define VBAT_SCALE 2
+#define VBAT_ADD 2
+#define PIN_RX5808_RSSI 13
+#define PIN_RX5808_DATA 11     //CH1
+#define PIN_RX5808_SELECT 10   //CH2
+#define PIN_RX5808_CLOCK 12    //CH3
+#define PIN_BUZZER 3
+#define BUZZER_INVERTED false
+
+//ESP32
+#else
+
+#define BOARD_NAME "PhobosLT"
+#define PIN_LED 21
+#define PIN_VBAT 35
+#define VBAT_SCALE 2
+#define VBAT_ADD 2
+#define PIN_RX5808_RSSI 33
+#define PIN_RX5808_DATA 19   //CH1
+#define PIN_RX5808_SELECT 22 //CH2
+#define PIN_RX5808_CLOCK 23  //CH3
+#define PIN_BUZZER 27
+#define BUZZER_INVERTED false
+
+#endif
+
+#ifndef BOARD_RECEIVERS
+#define BOARD_RECEIVERS 1
+#define BOARD_RECEIVER_PINS {{PIN_RX5808_RSSI, PIN_RX5808_SELECT}}
+#endif
+
+#define BOARD_MAX_RECEIVERS 4  // one pilot each, more pilots than receivers hop
+
+typedef struct {
+    uint8_t rssiPin;    // on ADC1
+    uint8_t selectPin;  // CH2 of the module
+} board_receiver_t;
+
+/*
+ * The pins of a board, built from the macros above for the target. RX5808
+ * modules share CH1 (DATA) and CH3 (CLK), each has its own CH2 (SELECT)
+ * and RSSI input; the first one is PIN_RX5808_SELECT and PIN_RX5808_RSSI.
+ */
+typedef struct {
+    const char *name;
+    uint8_t dataPin;
+    uint8_t clockPin;
+    uint8_t receiverCount;
+    board_receiver_t receivers[BOARD_MAX_RECEIVERS];
+    uint8_t ledPin;
+    uint8_t buzzerPin;
+    bool buzzerInverted;
+    uint8_t vbatPin;
+    uint8_t vbatScale;
+    uint8_t vbatAdd;
+} board_t;
+
+extern const board_t board;  // the one this firmware was built for
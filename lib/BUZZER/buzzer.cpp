@@ -1,34 +1,36 @@
 #include "buzzer.h"
 
 void Buzzer::init(uint8_t pin, bool inverted) {
-    pinMode(pin, OUTPUT);
-    initialState = inverted ? HIGH : LOW;
+    halPinMode(pin, HAL_OUTPUT);
+    initialState = inverted ? HAL_HIGH : HAL_LOW;
     buzzerPin = pin;
     buzzerState = BUZZER_IDLE;
-    digitalWrite(buzzerPin, initialState);
+    halDigitalWrite(buzzerPin, initialState);
 }
 
 void Buzzer::beep(uint32_t timeMs) {
     beepTimeMs = timeMs;
     buzzerState = BUZZER_BEEPING;
-    startTimeMs = millis();
-    digitalWrite(buzzerPin, !initialState);
+    startTimeMs = halMillis();
+    halDigitalWrite(buzzerPin, !initialState);
 }
 
-void Buzzer::handleBuzzer(uint32_t currentTimeMs) {
+uint32_t Buzzer::handleBuzzer(uint32_t currentTimeMs) {
     switch (buzzerState) {
         case BUZZER_IDLE:
             break;
         case BUZZER_BEEPING:
             if (currentTimeMs < startTimeMs) {
-                break;  // updated from different core
+                return 1;  // updated from different core
             }
             if ((currentTimeMs - startTimeMs) > beepTimeMs) {
-                digitalWrite(buzzerPin, initialState);
+                halDigitalWrite(buzzerPin, initialState);
                 buzzerState = BUZZER_IDLE;
+                break;
             }
-            break;
+            return beepTimeMs - (currentTimeMs - startTimeMs) + 1;
         default:
             break;
     }
+    return SCHEDULER_IDLE;
 }
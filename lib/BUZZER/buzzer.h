@@ -1,4 +1,5 @@
-#include <Arduino.h>
+#include "hal.h"
+#include "scheduler.h"
 
 #pragma once
 
@@ -10,13 +11,13 @@ typedef enum {
 class Buzzer {
    public:
     void init(uint8_t pin, bool inverted);
-    void handleBuzzer(uint32_t currentTimeMs);
+    uint32_t handleBuzzer(uint32_t currentTimeMs);  // ms until the beep ends
     void beep(uint32_t timeMs);
 
    private:
     buzzer_state_e buzzerState = BUZZER_IDLE;
     uint8_t buzzerPin;
-    uint8_t initialState = LOW;
+    uint8_t initialState = HAL_LOW;
     uint32_t beepTimeMs;
     uint32_t startTimeMs;
 };
@@ -0,0 +1,158 @@
+#include "calibrator.h"
+
+#include <string.h>
+
+void RssiCalibrator::start(uint32_t timeUs) {
+    memset(histogram, 0, sizeof(histogram));
+    histogramCount = 0;
+    startUs = timeUs;
+    floorRssi = 0;
+    noise = 0;
+    inPass = false;
+    passes = 0;
+    peakMin = 255;
+    peakMax = 0;
+    peakSum = 0;
+    state = CALIBRATOR_FLOOR;
+}
+
+void RssiCalibrator::cancel() {
+    if (state != CALIBRATOR_DONE) state = CALIBRATOR_IDLE;
+}
+
+void RssiCalibrator::setFloor(uint8_t floor) {
+    tracked = floor != 0;
+    trackQ16 = (int32_t)floor << 16;
+}
+
+void RssiCalibrator::sample(uint8_t rssi, uint32_t timeUs, uint8_t enterRssi, uint8_t exitRssi) {
+    if ((timeUs - lastUs) < CALIBRATOR_PERIOD_US) return;
+    lastUs = timeUs;
+
+    // the floor is followed between passes only
+    if (rssi >= enterRssi) {
+        tracking = false;
+    } else if (rssi < exitRssi) {
+        tracking = true;
+    }
+    if (tracking) {
+        if (!tracked) {
+            trackQ16 = (int32_t)rssi << 16;
+            tracked = true;
+        }
+        trackQ16 += (((int32_t)rssi << 16) - trackQ16) >> CALIBRATOR_TRACK_SHIFT;
+    }
+
+    switch (state) {
+        case CALIBRATOR_FLOOR:
+            count(rssi);
+            if ((timeUs - startUs) >= CALIBRATOR_FLOOR_MS * 1000) {
+                floorRssi = percentile(50);
+                noise = percentile(95) - floorRssi;
+                state = CALIBRATOR_PASSES;
+            }
+            break;
+        case CALIBRATOR_PASSES: {
+            uint16_t high = floorRssi + noise + CALIBRATOR_PASS_RISE;
+            uint16_t low = floorRssi + noise + CALIBRATOR_PASS_RISE / 2;
+            if (rssi >= high) {
+                if (!inPass) pass = 0;
+                inPass = true;
+                passEndUs = 0;
+            }
+            if (!inPass) {
+                count(rssi);  // the floor keeps getting more accurate
+                break;
+            }
+            if (rssi > pass) pass = rssi;
+            if (rssi >= low) {
+                passEndUs = 0;
+            } else if (passEndUs == 0) {
+                passEndUs = timeUs | 1;
+            } else if ((timeUs - passEndUs) >= CALIBRATOR_PASS_HOLD_MS * 1000) {
+                inPass = false;
+                addPass(pass);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void RssiCalibrator::addPass(uint8_t peak) {
+    passes++;
+    peakSum += peak;
+    if (peak < peakMin) peakMin = peak;
+    if (peak > peakMax) peakMax = peak;
+    if (passes < CALIBRATOR_PASS_COUNT) return;
+
+    floorRssi = percentile(50);
+    noise = percentile(95) - floorRssi;
+    state = CALIBRATOR_DONE;
+}
+
+void RssiCalibrator::count(uint8_t rssi) {
+    if (histogram[rssi] == UINT16_MAX) {
+        // halving keeps the shape, the floor only needs proportions
+        histogramCount = 0;
+        for (uint16_t i = 0; i < 256; i++) {
+            histogram[i] /= 2;
+            histogramCount += histogram[i];
+        }
+    }
+    histogram[rssi]++;
+    histogramCount++;
+}
+
+uint8_t RssiCalibrator::percentile(uint8_t percent) {
+    uint32_t target = (histogramCount * percent + 99) / 100;
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < 256; i++) {
+        sum += histogram[i];
+        if (sum >= target && sum > 0) return i;
+    }
+    return 0;
+}
+
+calibrator_state_e RssiCalibrator::getState() {
+    return state;
+}
+
+void RssiCalibrator::getCalibration(calibration_t *calibration) {
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->state = state;
+    calibration->floorRssi = floorRssi;
+    calibration->noise = noise;
+    calibration->passes = passes;
+    if (passes == 0) return;
+    calibration->peakMin = peakMin;
+    calibration->peakMax = peakMax;
+    calibration->peakMean = peakSum / passes;
+    if (state != CALIBRATOR_DONE) return;
+
+    int16_t span = peakMin - floorRssi;
+    int16_t enter = peakMin - (span / 4 > noise ? span / 4 : noise);
+    int16_t exit = floorRssi + (span / 4 > 2 * noise ? span / 4 : 2 * noise);
+    if (exit + CALIBRATOR_MIN_HYSTERESIS > enter) {
+        // noisy and weak, split the difference
+        int16_t mid = (floorRssi + peakMin) / 2;
+        enter = mid + CALIBRATOR_MIN_HYSTERESIS / 2;
+        exit = mid - CALIBRATOR_MIN_HYSTERESIS / 2;
+    }
+    calibration->enterRssi = enter > 255 ? 255 : enter;
+    calibration->exitRssi = exit < 0 ? 0 : exit;
+}
+
+uint8_t RssiCalibrator::getTrackedFloor() {
+    if (!tracked) return 0;
+    return (trackQ16 + 0x8000) >> 16;
+}
+
+int8_t RssiCalibrator::getDrift(uint8_t floor) {
+    if (!tracked || floor == 0) return 0;
+    int16_t drift = (int16_t)getTrackedFloor() - floor;
+    if (drift > CALIBRATOR_MAX_DRIFT) return CALIBRATOR_MAX_DRIFT;
+    if (drift < -CALIBRATOR_MAX_DRIFT) return -CALIBRATOR_MAX_DRIFT;
+    return drift;
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#pragma once
+
+#define CALIBRATOR_PERIOD_US 1000   // at most one sample per ms counted, whatever the sample rate
+#define CALIBRATOR_FLOOR_MS 2000    // noise floor recorded first, no drone near the gate
+#define CALIBRATOR_PASS_COUNT 3     // practice passes to finish
+#define CALIBRATOR_PASS_RISE 12     // a practice pass rises this far above the noise
+#define CALIBRATOR_PASS_HOLD_MS 500  // a pass coming back within this is the same pass
+#define CALIBRATOR_MIN_HYSTERESIS 6  // between proposed enter and exit
+#define CALIBRATOR_TRACK_SHIFT 12   // floor tracking time constant, 2^n periods (~4 s)
+#define CALIBRATOR_MAX_DRIFT 30     // the thresholds follow the floor this far at most
+
+typedef enum {
+    CALIBRATOR_IDLE,
+    CALIBRATOR_FLOOR,   // recording the noise floor
+    CALIBRATOR_PASSES,  // waiting for practice passes
+    CALIBRATOR_DONE     // thresholds proposed
+} calibrator_state_e;
+
+typedef struct {
+    calibrator_state_e state;
+    uint8_t floorRssi;  // median without a drone near
+    uint8_t noise;      // 95th percentile above the median
+    uint8_t passes;
+    uint8_t peakMin;
+    uint8_t peakMax;
+    uint8_t peakMean;
+    uint8_t enterRssi;  // proposed, once done
+    uint8_t exitRssi;
+} calibration_t;
+
+/*
+ * Proposes enter and exit RSSI for one pilot from what the receiver hears:
+ * first the noise floor with no drone near, then a few practice passes. The
+ * floor goes into a histogram and the passes into running peak statistics,
+ * both fixed size. Enter goes a margin below the weakest pass, exit a margin
+ * above the noise, both a quarter of the distance between them or more.
+ *
+ * Independent of calibrating it also follows the floor outside of passes
+ * during races, so thresholds calibrated on one floor can be moved along
+ * when it drifts, e.g. as other pilots power up on nearby channels.
+ */
+class RssiCalibrator {
+   public:
+    void start(uint32_t timeUs);
+    void cancel();
+    void setFloor(uint8_t floorRssi);  // tracking starts from here, 0 from the first sample
+    void sample(uint8_t rssi, uint32_t timeUs, uint8_t enterRssi, uint8_t exitRssi);  // thresholds in effect
+    calibrator_state_e getState();
+    void getCalibration(calibration_t *calibration);
+    uint8_t getTrackedFloor();
+    int8_t getDrift(uint8_t floorRssi);  // tracked floor less floorRssi, limited
+
+   private:
+    calibrator_state_e state = CALIBRATOR_IDLE;
+    uint16_t histogram[256];
+    uint32_t histogramCount = 0;
+    uint32_t startUs = 0;
+    uint32_t lastUs = 0;
+
+    uint8_t floorRssi = 0;
+    uint8_t noise = 0;
+    bool inPass = false;
+    uint8_t pass = 0;  // peak of the pass in progress
+    uint32_t passEndUs = 0;
+    uint8_t passes = 0;
+    uint8_t peakMin = 0;
+    uint8_t peakMax = 0;
+    uint16_t peakSum = 0;
+
+    bool tracking = false;  // outside of a pass
+    bool tracked = false;
+    int32_t trackQ16 = 0;
+
+    void count(uint8_t rssi);
+    uint8_t percentile(uint8_t percent);
+    void addPass(uint8_t peak);
+};
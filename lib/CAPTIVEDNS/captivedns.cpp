@@ -0,0 +1,106 @@
+#include "captivedns.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_FLAG_QR 0x80  // of the first flags byte
+#define DNS_FLAG_AA 0x04
+#define DNS_FLAG_RD 0x01
+#define DNS_FLAG_RA 0x80  // of the second
+#define DNS_OPCODE_MASK 0x78
+#define DNS_TYPE_A 1
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+void CaptiveDns::init(uint32_t address) {
+    const uint8_t record[CAPTIVEDNS_ANSWER_SIZE] = {
+        0xC0, DNS_HEADER_SIZE,  // the name of the question
+        0, DNS_TYPE_A,
+        0, DNS_CLASS_IN,
+        0, 0, CAPTIVEDNS_TTL_S >> 8, CAPTIVEDNS_TTL_S & 0xFF,
+        0, 4,
+        (uint8_t)(address >> 24), (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address};
+    memcpy(answer, record, sizeof(answer));
+    memset(clients, 0, sizeof(clients));
+    memset(&stats, 0, sizeof(stats));
+}
+
+// a token bucket per client
+bool CaptiveDns::allow(uint32_t from, uint32_t nowMs) {
+    captive_dns_client_t *client = &clients[0];
+    for (captive_dns_client_t &c : clients) {
+        if (c.address == from) {
+            client = &c;
+            break;
+        }
+        if (nowMs - c.lastMs > nowMs - client->lastMs) client = &c;
+    }
+    if (client->address != from) {
+        client->address = from;
+        client->tokens = CAPTIVEDNS_BURST * 1000;
+    } else {
+        uint32_t refill = (nowMs - client->lastMs) * CAPTIVEDNS_RATE_QPS;
+        client->tokens = refill < CAPTIVEDNS_BURST * 1000 - client->tokens ? client->tokens + refill : CAPTIVEDNS_BURST * 1000;
+    }
+    client->lastMs = nowMs;
+    if (client->tokens < 1000) return false;
+    client->tokens -= 1000;
+    return true;
+}
+
+size_t CaptiveDns::handle(const uint8_t *query, size_t len, uint32_t from, uint32_t nowMs, uint8_t *out, size_t size) {
+    stats.queries++;
+    if (!allow(from, nowMs)) {
+        stats.limited++;
+        return 0;
+    }
+    // one standard query, its question is all there is to read
+    if (len < DNS_HEADER_SIZE || (query[2] & (DNS_FLAG_QR | DNS_OPCODE_MASK)) || query[4] || query[5] != 1) {
+        stats.malformed++;
+        return 0;
+    }
+    size_t at = DNS_HEADER_SIZE;
+    while (at < len && query[at]) {
+        if (query[at] & 0xC0) break;  // no compression in a question
+        at += query[at] + 1;
+    }
+    if (at + 5 > len || query[at]) {
+        stats.malformed++;
+        return 0;
+    }
+    uint16_t type = (query[at + 1] << 8) | query[at + 2];
+    uint16_t cls = (query[at + 3] << 8) | query[at + 4];
+    size_t question = at + 5;
+    bool resolve = (type == DNS_TYPE_A || type == DNS_TYPE_ANY) && cls == DNS_CLASS_IN;
+    size_t n = question + (resolve ? sizeof(answer) : 0);
+    if (n > size) {
+        stats.malformed++;
+        return 0;
+    }
+
+    memcpy(out, query, question);
+    out[2] = DNS_FLAG_QR | DNS_FLAG_AA | (query[2] & DNS_FLAG_RD);
+    out[3] = DNS_FLAG_RA;  // no error
+    memset(&out[6], 0, 6);  // no records but the answer, EDNS options are left out
+    if (resolve) {
+        out[7] = 1;
+        memcpy(&out[question], answer, sizeof(answer));
+        stats.answered++;
+    } else {
+        stats.empty++;
+    }
+    return n;
+}
+
+void CaptiveDns::getStats(captive_dns_stats_t *s) {
+    *s = stats;
+}
+
+size_t CaptiveDns::toJson(char *buf, size_t size) {
+    captive_dns_stats_t s;
+    getStats(&s);
+    int len = snprintf(buf, size, "{\"queries\":%lu,\"answered\":%lu,\"empty\":%lu,\"malformed\":%lu,\"limited\":%lu}", (unsigned long)s.queries,
+                       (unsigned long)s.answered, (unsigned long)s.empty, (unsigned long)s.malformed, (unsigned long)s.limited);
+    return len < 0 ? 0 : (size_t)len < size ? len : size - 1;
+}
@@ -0,0 +1,57 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#define CAPTIVEDNS_PORT 53
+#define CAPTIVEDNS_TTL_S 60
+#define CAPTIVEDNS_MAX_SIZE 512     // of a query or a response, DNS over UDP
+#define CAPTIVEDNS_ANSWER_SIZE 16   // the A record, its name a pointer to the question
+#define CAPTIVEDNS_CLIENTS 16       // tracked for the rate limit, the one idle longest makes room
+#define CAPTIVEDNS_RATE_QPS 20      // queries a second a client gets answered, after the burst
+#define CAPTIVEDNS_BURST 40
+#define CAPTIVEDNS_JSON_SIZE 160
+
+typedef struct {
+    uint32_t queries;
+    uint32_t answered;   // with the address
+    uint32_t empty;      // no error and no record, AAAA and the like
+    uint32_t malformed;  // dropped
+    uint32_t limited;    // dropped, the client asked too often
+} captive_dns_stats_t;
+
+typedef struct {
+    uint32_t address;
+    uint32_t lastMs;
+    uint32_t tokens;  // in thousandths of a query
+} captive_dns_client_t;
+
+/*
+ * The captive portal's DNS: every A query resolves to the timer, anything
+ * else gets an empty answer so phones stop asking. The transport calls
+ * handle() as each datagram arrives (AsyncUDP on the ESP32) and sends back
+ * what it returns; the response is the query's header and question followed
+ * by an A record made once in init(), nothing is parsed beyond the question.
+ *
+ * A client that asks more than CAPTIVEDNS_RATE_QPS a second for longer
+ * than its burst is dropped until it slows down. The stats belong to the
+ * transport's task, others read them as they are.
+ */
+class CaptiveDns {
+   public:
+    void init(uint32_t address);  // IPv4 every name resolves to, first byte in the top bits
+    size_t handle(const uint8_t *query, size_t len, uint32_t from, uint32_t nowMs, uint8_t *out, size_t size);  // the response, 0 for none
+    void getStats(captive_dns_stats_t *stats);
+    size_t toJson(char *buf, size_t size);
+
+   private:
+    uint8_t answer[CAPTIVEDNS_ANSWER_SIZE];
+    captive_dns_client_t clients[CAPTIVEDNS_CLIENTS];
+    captive_dns_stats_t stats;
+
+    bool allow(uint32_t from, uint32_t nowMs);
+};
+
+#ifdef ARDUINO
+void captiveDnsBegin(CaptiveDns *dns);  // answers on CAPTIVEDNS_PORT from now on, once the network is up
+#endif
@@ -0,0 +1,37 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+
+#include "captivedns.h"
+#include "debug.h"
+#include "probe.h"
+
+static CaptiveDns *dns = nullptr;
+static AsyncUDP *dnsUdp = nullptr;
+
+// in the AsyncUDP task, a query is answered as it arrives
+static void onDnsPacket(void *arg, AsyncUDPPacket &packet) {
+    uint32_t startCycles = halCycles();
+    uint8_t out[CAPTIVEDNS_MAX_SIZE];
+    IPAddress ip = packet.remoteIP();
+    uint32_t from = (uint32_t)ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3];
+    size_t n = dns->handle(packet.data(), packet.length(), from, millis(), out, sizeof(out));
+    if (n) packet.write(out, n);
+    probeRecord(PROBE_DNS, halCycles() - startCycles);
+}
+
+void captiveDnsBegin(CaptiveDns *captiveDns) {
+    if (dnsUdp) return;
+    dns = captiveDns;
+    dnsUdp = new AsyncUDP();
+    if (!dnsUdp->listen(CAPTIVEDNS_PORT)) {
+        DEBUG("Error starting DNS\n");
+        delete dnsUdp;
+        dnsUdp = nullptr;
+        return;
+    }
+    dnsUdp->onPacket(onDnsPacket, NULL);
+}
+
+#endif
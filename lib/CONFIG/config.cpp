@@ -1,8 +1,56 @@
 #include "config.h"
 
-#include <EEPROM.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <type_traits>
 
 #include "debug.h"
+#include "hal.h"
+
+#define FIELD(key, kind, member, json, low, high, version)                                    \
+    {key, kind, json, offsetof(laptimer_config_t, member), sizeof(laptimer_config_t::member), \
+     sizeof(std::remove_extent<decltype(laptimer_config_t::member)>::type), low, high, version}
+
+// key 0 holds the schema
+constexpr config_field_t configFields[CONFIG_FIELDS] = {
+    FIELD(1, CONFIG_FIELD_UINT, frequency, "freq", 0, UINT16_MAX, 0),
+    FIELD(2, CONFIG_FIELD_UINT, minLap, "minLap", 0, UINT8_MAX, 0),
+    FIELD(3, CONFIG_FIELD_UINT, alarm, "alarm", 0, UINT8_MAX, 0),
+    FIELD(4, CONFIG_FIELD_UINT, announcerType, "anType", 0, UINT8_MAX, 0),
+    FIELD(5, CONFIG_FIELD_UINT, announcerRate, "anRate", 0, UINT8_MAX, 0),
+    FIELD(6, CONFIG_FIELD_UINT, enterRssi, "enterRssi", 0, UINT8_MAX, 0),
+    FIELD(7, CONFIG_FIELD_UINT, exitRssi, "exitRssi", 0, UINT8_MAX, 0),
+    FIELD(8, CONFIG_FIELD_STRING, pilotName, "name", 0, 0, 0),
+    FIELD(9, CONFIG_FIELD_STRING, ssid, "ssid", 0, 0, 0),
+    FIELD(10, CONFIG_FIELD_STRING, password, "pwd", 0, 0, 0),
+    FIELD(11, CONFIG_FIELD_UINT, pilots, "pilots", 1, CONFIG_MAX_PILOTS, 1),
+    FIELD(12, CONFIG_FIELD_ARRAY, pilotFrequency, "pilotFreq", 0, UINT16_MAX, 1),
+    FIELD(13, CONFIG_FIELD_ARRAY, pilotEnterRssi, "pilotEnter", 0, UINT8_MAX, 1),
+    FIELD(14, CONFIG_FIELD_ARRAY, pilotExitRssi, "pilotExit", 0, UINT8_MAX, 1),
+    FIELD(15, CONFIG_FIELD_UINT, detector, "detector", 0, UINT8_MAX, 2),
+    FIELD(16, CONFIG_FIELD_ARRAY, floorRssi, "floorRssi", 0, UINT8_MAX, 3),
+};
+
+static constexpr bool keyUnique(uint8_t i, uint8_t j) {
+    return j == CONFIG_FIELDS || (configFields[i].key != configFields[j].key && keyUnique(i, j + 1));
+}
+
+static constexpr bool fieldsValid(uint8_t i) {
+    return i == CONFIG_FIELDS || (configFields[i].key > 0 && configFields[i].key < CONFIGSTORE_KEYS && keyUnique(i, i + 1) &&
+                                  configFields[i].size <= CONFIGSTORE_MAX_VALUE && configFields[i].element <= 2 &&
+                                  configFields[i].size % configFields[i].element == 0 && fieldsValid(i + 1));
+}
+
+static_assert(fieldsValid(0), "config fields need unique keys and values that fit a store record");
+
+// a record of another size than the field, from an older or newer build
+static void copyField(const config_field_t& field, uint8_t* dest, const uint8_t* value, uint8_t length) {
+    if (field.type != CONFIG_FIELD_ARRAY) memset(dest, 0, field.size);
+    memcpy(dest, value, length < field.size ? length : field.size);
+    if (field.type == CONFIG_FIELD_STRING) dest[field.size - 1] = 0;
+}
 
 void Config::init(void) {
     if (sizeof(laptimer_config_t) > EEPROM_RESERVED_SIZE) {
@@ -10,113 +58,303 @@ void Config::init(void) {
         return;
     }
 
-    EEPROM.begin(EEPROM_RESERVED_SIZE);  // Size of EEPROM
-    load();                              // Override default settings from EEPROM
+    halStorageBegin(EEPROM_RESERVED_SIZE);  // Size of EEPROM
+    useStore = store.begin();              // the config partition when there is one
+    load();                                // Override default settings from EEPROM
 
-    checkTimeMs = millis();
+    checkTimeMs = halMillis();
 
     DEBUG("EEPROM Init Successful\n");
 }
 
 void Config::load(void) {
     modified = false;
-    EEPROM.get(0, conf);
+    if (useStore) {
+        if (!loadStore()) importEeprom();
+        return;
+    }
+    halStorageRead(0, &conf, sizeof(conf));
 
     uint32_t version = 0xFFFFFFFF;
     if ((conf.version & CONFIG_MAGIC_MASK) == CONFIG_MAGIC) {
         version = conf.version & ~CONFIG_MAGIC_MASK;
     }
 
-    // If version is not current, reset to defaults
-    if (version != CONFIG_VERSION) {
+    // an older layout keeps the fields it had, anything else is reset to defaults
+    if (version == CONFIG_VERSION) return;
+    if (version > CONFIG_VERSION) {
         setDefaults();
+        return;
     }
+    laptimer_config_t legacy = conf;
+    DEBUG("Upgrading EEPROM config version %lu\n", (unsigned long)version);
+    applyDefaults();
+    keepFields(legacy, version);
+    modified = true;
+    write();
 }
 
 void Config::write(void) {
     if (!modified) return;
+    if (useStore) {
+        writeStore();
+        return;
+    }
 
     DEBUG("Writing to EEPROM\n");
 
-    EEPROM.put(0, conf);
-    EEPROM.commit();
+    halStorageWrite(0, &conf, sizeof(conf));
+    halStorageCommit();
 
     DEBUG("Writing to EEPROM done\n");
 
     modified = false;
 }
 
-void Config::toJson(AsyncResponseStream& destination) {
-    // Use https://arduinojson.org/v6/assistant to estimate memory
-    DynamicJsonDocument config(256);
-    config["freq"] = conf.frequency;
-    config["minLap"] = conf.minLap;
-    config["alarm"] = conf.alarm;
-    config["anType"] = conf.announcerType;
-    config["anRate"] = conf.announcerRate;
-    config["enterRssi"] = conf.enterRssi;
-    config["exitRssi"] = conf.exitRssi;
-    config["name"] = conf.pilotName;
-    config["ssid"] = conf.ssid;
-    config["pwd"] = conf.password;
-    serializeJson(config, destination);
-}
-
-void Config::toJsonString(char* buf) {
-    DynamicJsonDocument config(256);
-    config["freq"] = conf.frequency;
-    config["minLap"] = conf.minLap;
-    config["alarm"] = conf.alarm;
-    config["anType"] = conf.announcerType;
-    config["anRate"] = conf.announcerRate;
-    config["enterRssi"] = conf.enterRssi;
-    config["exitRssi"] = conf.exitRssi;
-    config["name"] = conf.pilotName;
-    config["ssid"] = conf.ssid;
-    config["pwd"] = conf.password;
-    serializeJsonPretty(config, buf, 256);
+bool Config::loadStore(void) {
+    applyDefaults();
+    storedFields = 0;
+    storedSchema = 0;
+    if (!store.load(readField, this)) return false;
+    if (storedSchema < CONFIG_SCHEMA) migrate();
+    return true;
 }
 
-void Config::fromJson(JsonObject source) {
-    if (source["freq"] != conf.frequency) {
-        conf.frequency = source["freq"];
-        modified = true;
+void Config::readField(void* arg, uint8_t key, const uint8_t* value, uint8_t length) {
+    Config* config = (Config*)arg;
+    if (key == 0) {
+        config->storedSchema = length >= 2 ? value[0] | value[1] << 8 : 0;
+        return;
+    }
+    for (uint8_t i = 0; i < CONFIG_FIELDS; i++) {
+        const config_field_t& field = configFields[i];
+        if (field.key != key) continue;
+        copyField(field, (uint8_t*)&config->conf + field.offset, value, length);
+        memcpy((uint8_t*)&config->stored + field.offset, (uint8_t*)&config->conf + field.offset, field.size);
+        if (length == field.size) {
+            config->storedFields |= 1UL << i;
+        } else {
+            config->storedFields &= ~(1UL << i);
+            config->markModified();  // rewritten at its new size
+        }
+        return;
+    }
+}
+
+// fields that change meaning get converted here, a step per schema from storedSchema on
+void Config::migrate(void) {
+    DEBUG("Migrating config schema %u to %u\n", storedSchema, CONFIG_SCHEMA);
+    markModified();
+}
+
+// the fields the EEPROM layout of that version already had
+void Config::keepFields(const laptimer_config_t& legacy, uint32_t version) {
+    for (uint8_t i = 0; i < CONFIG_FIELDS; i++) {
+        const config_field_t& field = configFields[i];
+        if (field.version > version) continue;
+        copyField(field, (uint8_t*)&conf + field.offset, (uint8_t*)&legacy + field.offset, field.size);
+    }
+}
+
+// the whole struct from before the config partition, the fields its version had
+void Config::importEeprom(void) {
+    laptimer_config_t legacy;
+    halStorageRead(0, &legacy, sizeof(legacy));
+    applyDefaults();
+    storedFields = 0;
+    storedSchema = 0;
+    if ((legacy.version & CONFIG_MAGIC_MASK) == CONFIG_MAGIC && (legacy.version & ~CONFIG_MAGIC_MASK) <= CONFIG_VERSION) {
+        uint32_t version = legacy.version & ~CONFIG_MAGIC_MASK;
+        DEBUG("Importing EEPROM config version %lu\n", (unsigned long)version);
+        keepFields(legacy, version);
     }
-    if (source["minLap"] != conf.minLap) {
-        conf.minLap = source["minLap"];
-        modified = true;
+    modified = true;
+    write();
+}
+
+// only the fields that differ from their last record
+void Config::writeStore(void) {
+    modified = false;  // a change from now on is written next time
+    if (storedSchema < CONFIG_SCHEMA) {
+        uint16_t schema = CONFIG_SCHEMA;
+        if (!store.write(0, &schema, sizeof(schema))) {
+            DEBUG("Writing config failed\n");
+            markModified();
+            return;
+        }
+        storedSchema = schema;
+    }
+    for (uint8_t i = 0; i < CONFIG_FIELDS; i++) {
+        const config_field_t& field = configFields[i];
+        uint8_t value[CONFIGSTORE_MAX_VALUE];
+        uint8_t* old = (uint8_t*)&stored + field.offset;
+        memcpy(value, (uint8_t*)&conf + field.offset, field.size);
+        if ((storedFields & (1UL << i)) && !memcmp(value, old, field.size)) continue;
+        if (!store.write(field.key, value, field.size)) {
+            DEBUG("Writing config failed\n");
+            markModified();  // tried again once settled
+            return;
+        }
+        memcpy(old, value, field.size);
+        storedFields |= 1UL << i;
     }
-    if (source["alarm"] != conf.alarm) {
-        conf.alarm = source["alarm"];
-        modified = true;
+}
+
+void Config::markModified(void) {
+    uint32_t now = halMillis();
+    if (!modified) firstModifiedTimeMs = now;
+    modifiedTimeMs = now;
+    modified = true;
+}
+
+const laptimer_config_t* Config::getConfig() {
+    return &conf;
+}
+
+static char escape(char c) {
+    switch (c) {
+        case '"':
+            return '"';
+        case '\\':
+            return '\\';
+        case '\b':
+            return 'b';
+        case '\f':
+            return 'f';
+        case '\n':
+            return 'n';
+        case '\r':
+            return 'r';
+        case '\t':
+            return 't';
+        default:
+            return 0;
     }
-    if (source["anType"] != conf.announcerType) {
-        conf.announcerType = source["anType"];
-        modified = true;
+}
+
+// JSON text collected into chunks for the print function
+class JsonWriter {
+   public:
+    JsonWriter(config_print_fn_t print, void* arg) : print(print), arg(arg) {}
+
+    void put(char c) {
+        if (length == sizeof(text) - 1) flush();
+        text[length++] = c;
     }
-    if (source["anRate"] != conf.announcerRate) {
-        conf.announcerRate = source["anRate"];
-        modified = true;
+
+    void put(const char* s) {
+        while (*s) put(*s++);
     }
-    if (source["enterRssi"] != conf.enterRssi) {
-        conf.enterRssi = source["enterRssi"];
-        modified = true;
+
+    void putUint(uint32_t value) {
+        char digits[11];
+        snprintf(digits, sizeof(digits), "%lu", (unsigned long)value);
+        put(digits);
     }
-    if (source["exitRssi"] != conf.exitRssi) {
-        conf.exitRssi = source["exitRssi"];
-        modified = true;
+
+    // escaped like ArduinoJson does it
+    void putString(const char* s) {
+        put('"');
+        for (; *s; s++) {
+            char escaped = escape(*s);
+            if (escaped) put('\\');
+            put(escaped ? escaped : *s);
+        }
+        put('"');
     }
-    if (source["name"] != conf.pilotName) {
-        strlcpy(conf.pilotName, source["name"] | "", sizeof(conf.pilotName));
-        modified = true;
+
+    void flush() {
+        if (!length) return;
+        text[length] = 0;
+        print(arg, text);
+        length = 0;
     }
-    if (source["ssid"] != conf.ssid) {
-        strlcpy(conf.ssid, source["ssid"] | "", sizeof(conf.ssid));
-        modified = true;
+
+   private:
+    config_print_fn_t print;
+    void* arg;
+    char text[CONFIG_JSON_CHUNK];
+    uint8_t length = 0;
+};
+
+static uint32_t getElement(const uint8_t* p, uint8_t element) {
+    return element == 1 ? p[0] : p[0] | p[1] << 8;
+}
+
+void Config::toJson(bool pretty, config_print_fn_t print, void* arg) {
+    JsonWriter out(print, arg);
+    const char* newline = pretty ? "\r\n" : "";
+    const char* indent = pretty ? "  " : "";
+    out.put('{');
+    out.put(newline);
+    for (uint8_t i = 0; i < CONFIG_FIELDS; i++) {
+        const config_field_t& field = configFields[i];
+        const uint8_t* value = (const uint8_t*)&conf + field.offset;
+        out.put(indent);
+        out.putString(field.name);
+        out.put(pretty ? ": " : ":");
+        if (field.type == CONFIG_FIELD_STRING) {
+            out.putString((const char*)value);
+        } else if (field.type == CONFIG_FIELD_UINT) {
+            out.putUint(getElement(value, field.element));
+        } else {
+            out.put('[');
+            out.put(newline);
+            for (uint8_t e = 0; e < field.size / field.element; e++) {
+                if (e) {
+                    out.put(',');
+                    out.put(newline);
+                }
+                out.put(indent);
+                out.put(indent);
+                out.putUint(getElement(value + e * field.element, field.element));
+            }
+            out.put(newline);
+            out.put(indent);
+            out.put(']');
+        }
+        if (i + 1 < CONFIG_FIELDS) out.put(',');
+        out.put(newline);
     }
-    if (source["pwd"] != conf.password) {
-        strlcpy(conf.password, source["pwd"] | "", sizeof(conf.password));
-        modified = true;
+    out.put('}');
+    out.flush();
+}
+
+// missing members keep their value, as do array elements that are null
+void Config::fromJson(JsonObject source) {
+    for (uint8_t i = 0; i < CONFIG_FIELDS; i++) {
+        const config_field_t& field = configFields[i];
+        JsonVariant value = source[field.name];
+        if (value.isNull()) continue;
+        if (field.type == CONFIG_FIELD_STRING) {
+            setString(field, value.as<const char*>());
+        } else if (field.type == CONFIG_FIELD_UINT) {
+            setField(field, 0, value.as<uint32_t>());
+        } else {
+            for (uint8_t e = 0; e < field.size / field.element; e++) {
+                if (!value[e].isNull()) setField(field, e, value[e].as<uint32_t>());
+            }
+        }
+    }
+}
+
+void Config::setField(const config_field_t& field, uint8_t index, uint32_t value) {
+    if (value < field.min) value = field.min;
+    if (value > field.max) value = field.max;
+    uint8_t* p = (uint8_t*)&conf + field.offset + index * field.element;
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    if (memcmp(p, bytes, field.element)) {
+        memcpy(p, bytes, field.element);
+        markModified();
+    }
+}
+
+void Config::setString(const config_field_t& field, const char* value) {
+    char* p = (char*)&conf + field.offset;
+    if (!value) value = "";
+    if (strncmp(p, value, field.size - 1)) {
+        snprintf(p, field.size, "%s", value);
+        markModified();
     }
 }
 
@@ -140,6 +378,30 @@ uint8_t Config::getExitRssi() {
     return conf.exitRssi;
 }
 
+uint8_t Config::getPilotCount() {
+    return conf.pilots;
+}
+
+uint16_t Config::getPilotFrequency(uint8_t pilot) {
+    return pilot == 0 ? conf.frequency : conf.pilotFrequency[pilot - 1];
+}
+
+uint8_t Config::getPilotEnterRssi(uint8_t pilot) {
+    return pilot == 0 ? conf.enterRssi : conf.pilotEnterRssi[pilot - 1];
+}
+
+uint8_t Config::getPilotExitRssi(uint8_t pilot) {
+    return pilot == 0 ? conf.exitRssi : conf.pilotExitRssi[pilot - 1];
+}
+
+uint8_t Config::getDetector() {
+    return conf.detector;
+}
+
+uint8_t Config::getFloorRssi(uint8_t pilot) {
+    return pilot < CONFIG_MAX_PILOTS ? conf.floorRssi[pilot] : 0;
+}
+
 char* Config::getSsid() {
     return conf.ssid;
 }
@@ -148,8 +410,92 @@ char* Config::getPassword() {
     return conf.password;
 }
 
+void Config::setFrequency(uint16_t frequency) {
+    if (conf.frequency != frequency) {
+        conf.frequency = frequency;
+        markModified();
+    }
+}
+
+void Config::setMinLap(uint8_t minLap) {
+    if (conf.minLap != minLap) {
+        conf.minLap = minLap;
+        markModified();
+    }
+}
+
+void Config::setEnterRssi(uint8_t enterRssi) {
+    if (conf.enterRssi != enterRssi) {
+        conf.enterRssi = enterRssi;
+        markModified();
+    }
+}
+
+void Config::setExitRssi(uint8_t exitRssi) {
+    if (conf.exitRssi != exitRssi) {
+        conf.exitRssi = exitRssi;
+        markModified();
+    }
+}
+
+void Config::setPilotCount(uint8_t pilots) {
+    if (pilots < 1) pilots = 1;
+    if (pilots > CONFIG_MAX_PILOTS) pilots = CONFIG_MAX_PILOTS;
+    if (conf.pilots != pilots) {
+        conf.pilots = pilots;
+        markModified();
+    }
+}
+
+void Config::setPilotFrequency(uint8_t pilot, uint16_t frequency) {
+    if (pilot == 0) {
+        setFrequency(frequency);
+    } else if (pilot < CONFIG_MAX_PILOTS && conf.pilotFrequency[pilot - 1] != frequency) {
+        conf.pilotFrequency[pilot - 1] = frequency;
+        markModified();
+    }
+}
+
+void Config::setPilotEnterRssi(uint8_t pilot, uint8_t enterRssi) {
+    if (pilot == 0) {
+        setEnterRssi(enterRssi);
+    } else if (pilot < CONFIG_MAX_PILOTS && conf.pilotEnterRssi[pilot - 1] != enterRssi) {
+        conf.pilotEnterRssi[pilot - 1] = enterRssi;
+        markModified();
+    }
+}
+
+void Config::setPilotExitRssi(uint8_t pilot, uint8_t exitRssi) {
+    if (pilot == 0) {
+        setExitRssi(exitRssi);
+    } else if (pilot < CONFIG_MAX_PILOTS && conf.pilotExitRssi[pilot - 1] != exitRssi) {
+        conf.pilotExitRssi[pilot - 1] = exitRssi;
+        markModified();
+    }
+}
+
+void Config::setDetector(uint8_t detector) {
+    if (conf.detector != detector) {
+        conf.detector = detector;
+        markModified();
+    }
+}
+
+void Config::setFloorRssi(uint8_t pilot, uint8_t floorRssi) {
+    if (pilot < CONFIG_MAX_PILOTS && conf.floorRssi[pilot] != floorRssi) {
+        conf.floorRssi[pilot] = floorRssi;
+        markModified();
+    }
+}
+
 void Config::setDefaults(void) {
     DEBUG("Setting EEPROM defaults\n");
+    applyDefaults();
+    modified = true;
+    write();
+}
+
+void Config::applyDefaults(void) {
     // Reset everything to 0/false and then just set anything that zero is not appropriate
     memset(&conf, 0, sizeof(conf));
     conf.version = CONFIG_VERSION | CONFIG_MAGIC;
@@ -160,16 +506,34 @@ void Config::setDefaults(void) {
     conf.announcerRate = 10;
     conf.enterRssi = 120;
     conf.exitRssi = 100;
-    strlcpy(conf.ssid, "", sizeof(conf.ssid));
-    strlcpy(conf.password, "", sizeof(conf.password));
-    strlcpy(conf.pilotName, "", sizeof(conf.pilotName));
-    modified = true;
-    write();
+    snprintf(conf.ssid, sizeof(conf.ssid), "%s", "");
+    snprintf(conf.password, sizeof(conf.password), "%s", "");
+    snprintf(conf.pilotName, sizeof(conf.pilotName), "%s", "");
+    conf.pilots = 1;
+    const uint16_t pilotDefaults[CONFIG_MAX_PILOTS - 1] = {5695, 5732, 5769};  // R2-R4
+    for (uint8_t i = 0; i < CONFIG_MAX_PILOTS - 1; i++) {
+        conf.pilotFrequency[i] = pilotDefaults[i];
+        conf.pilotEnterRssi[i] = conf.enterRssi;
+        conf.pilotExitRssi[i] = conf.exitRssi;
+    }
 }
 
-void Config::handleEeprom(uint32_t currentTimeMs) {
+uint32_t Config::handleEeprom(uint32_t currentTimeMs) {
+    if (modified && useStore) {
+        uint32_t settledMs = currentTimeMs - modifiedTimeMs;
+        uint32_t delayedMs = currentTimeMs - firstModifiedTimeMs;
+        if (settledMs > CONFIG_SETTLE_MS || delayedMs > CONFIG_MAX_DELAY_MS) {
+            write();
+            return SCHEDULER_IDLE;
+        }
+        uint32_t settleDueMs = CONFIG_SETTLE_MS - settledMs + 1;
+        uint32_t delayDueMs = CONFIG_MAX_DELAY_MS - delayedMs + 1;
+        return settleDueMs < delayDueMs ? settleDueMs : delayDueMs;
+    }
     if (modified && ((currentTimeMs - checkTimeMs) > EEPROM_CHECK_TIME_MS)) {
         checkTimeMs = currentTimeMs;
         write();
+        return SCHEDULER_IDLE;
     }
+    return modified ? EEPROM_CHECK_TIME_MS - (currentTimeMs - checkTimeMs) + 1 : SCHEDULER_IDLE;
 }
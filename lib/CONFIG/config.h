@@ -1,74 +1,49 @@
 #include <ArduinoJson.h>
-#include <AsyncJson.h>
 #include <stdint.h>
 
-/*
-## Pinout ##
-| ESP32 | RX5880 |
-| :------------- |:-------------|
-| 33 | RSSI |
-| GND | GND |
-| 19 | CH1 |
-| 22 | CH2 |
-| 23 | CH3 |
-| 3V3 | +5V |
+#include "board.h"
+#include "configstore.h"
+#include "scheduler.h"
 
-* **Led** goes to pin 21 and GND
-* The optional **Buzzer** goes to pin 25 or 27 and GND
-
-*/
-
-//ESP23-C3
-#if defined(ESP32C3)
-
-#define PIN_LED 1
-#define PIN_VBAT 0
-#define VBAT_SCALE 2
-#define VBAT_ADD 2
-#define PIN_RX5808_RSSI 3
-#define PIN_RX5808_DATA 6     //CH1
-#define PIN_RX5808_SELECT 7   //CH2
-#define PIN_RX5808_CLOCK 4    //CH3
-#define PIN_BUZZER 5
-#define BUZZER_INVERTED false
-
-//ESP32-S3
-#elif defined(ESP32S3)
-
-#define PIN_LED 2
-#define PIN_VBAT 1
-#define VBAT_SCALE 2
-#define VBAT_ADD 2
-#define PIN_RX5808_RSSI 13
-#define PIN_RX5808_DATA 11     //CH1
-#define PIN_RX5808_SELECT 10   //CH2
-#define PIN_RX5808_CLOCK 12    //CH3
-#define PIN_BUZZER 3
-#define BUZZER_INVERTED false
-
-//ESP32
-#else
-
-#define PIN_LED 21
-#define PIN_VBAT 35
-#define VBAT_SCALE 2
-#define VBAT_ADD 2
-#define PIN_RX5808_RSSI 33
-#define PIN_RX5808_DATA 19   //CH1
-#define PIN_RX5808_SELECT 22 //CH2
-#define PIN_RX5808_CLOCK 23  //CH3
-#define PIN_BUZZER 27
-#define BUZZER_INVERTED false
-
-#endif
+#pragma once
 
 #define EEPROM_RESERVED_SIZE 256
 #define CONFIG_MAGIC_MASK (0b11U << 30)
 #define CONFIG_MAGIC (0b01U << 30)
-#define CONFIG_VERSION 0U
+#define CONFIG_VERSION 3U
+#define CONFIG_MAX_PILOTS 4  // more pilots than receivers are timed by frequency hopping
+#define CONFIG_JSON_CHUNK 64  // of JSON text handed to the print function at a time
 
 #define EEPROM_CHECK_TIME_MS 1000
+#define CONFIG_SCHEMA 1              // of the fields in the config store, a bump gets a step in Config::migrate
+#define CONFIG_SETTLE_MS 1000        // a burst of changes, like a dragged slider, is written once quiet this long
+#define CONFIG_MAX_DELAY_MS 10000    // or this long after its first change at the latest
+#define CONFIG_FIELDS 16
 
+typedef enum {
+    CONFIG_FIELD_UINT,    // little endian, zero extended or cut when the size changes
+    CONFIG_FIELD_STRING,  // cut and terminated when it shrinks
+    CONFIG_FIELD_ARRAY,   // elements past a stored shorter array keep their defaults
+} config_field_type_e;
+
+typedef struct {
+    uint8_t key;       // in the config store, never reused
+    uint8_t type;      // config_field_type_e
+    const char *name;  // in the /config JSON
+    uint8_t offset;    // in laptimer_config_t
+    uint8_t size;
+    uint8_t element;   // size of an array element, or of the value
+    uint16_t min;      // values from JSON are clamped to the range
+    uint16_t max;
+    uint8_t version;   // CONFIG_VERSION of the EEPROM layout that added it
+} config_field_t;
+
+// every setting, in the order of the JSON; it drives the store, toJson and fromJson
+extern const config_field_t configFields[CONFIG_FIELDS];
+
+typedef void (*config_print_fn_t)(void *arg, const char *text);
+
+// also the EEPROM layout without a config partition, fields only get appended
 typedef struct {
     uint32_t version;
     uint16_t frequency;
@@ -81,6 +56,12 @@ typedef struct {
     char pilotName[21];
     char ssid[33];
     char password[33];
+    uint8_t pilots;  // 1 = single frequency, more hop between the pilot frequencies
+    uint16_t pilotFrequency[CONFIG_MAX_PILOTS - 1];  // pilots 2.., pilot 1 uses frequency, enterRssi, exitRssi
+    uint8_t pilotEnterRssi[CONFIG_MAX_PILOTS - 1];
+    uint8_t pilotExitRssi[CONFIG_MAX_PILOTS - 1];
+    uint8_t detector;  // detector_type_e, 0 = peak
+    uint8_t floorRssi[CONFIG_MAX_PILOTS];  // noise floor the thresholds were calibrated on, they follow its drift; 0 = set by hand
 } laptimer_config_t;
 
 class Config {
@@ -88,10 +69,10 @@ class Config {
     void init();
     void load();
     void write();
-    void toJson(AsyncResponseStream& destination);
-    void toJsonString(char* buf);
+    void toJson(bool pretty, config_print_fn_t print, void* arg);  // as ArduinoJson would write it, without allocating
     void fromJson(JsonObject source);
-    void handleEeprom(uint32_t currentTimeMs);
+    uint32_t handleEeprom(uint32_t currentTimeMs);  // ms until a pending change is written
+    const laptimer_config_t* getConfig();
 
     // getters and setters
     uint16_t getFrequency();
@@ -99,12 +80,45 @@ class Config {
     uint8_t getAlarmThreshold();
     uint8_t getEnterRssi();
     uint8_t getExitRssi();
+    uint8_t getPilotCount();
+    uint16_t getPilotFrequency(uint8_t pilot);
+    uint8_t getPilotEnterRssi(uint8_t pilot);
+    uint8_t getPilotExitRssi(uint8_t pilot);
+    uint8_t getDetector();
+    uint8_t getFloorRssi(uint8_t pilot);
     char* getSsid();
     char* getPassword();
+    void setFrequency(uint16_t frequency);
+    void setMinLap(uint8_t minLap);
+    void setEnterRssi(uint8_t enterRssi);
+    void setExitRssi(uint8_t exitRssi);
+    void setPilotCount(uint8_t pilots);
+    void setPilotFrequency(uint8_t pilot, uint16_t frequency);
+    void setPilotEnterRssi(uint8_t pilot, uint8_t enterRssi);
+    void setPilotExitRssi(uint8_t pilot, uint8_t exitRssi);
+    void setDetector(uint8_t detector);
+    void setFloorRssi(uint8_t pilot, uint8_t floorRssi);
 
    private:
     laptimer_config_t conf;
     bool modified;
     volatile uint32_t checkTimeMs = 0;
+    volatile uint32_t modifiedTimeMs = 0;
+    volatile uint32_t firstModifiedTimeMs = 0;
+    ConfigStore store;
+    bool useStore = false;       // the config partition, otherwise the whole struct goes to EEPROM
+    laptimer_config_t stored;    // the fields as they are in the store
+    uint32_t storedFields = 0;   // bit per configFields entry that has a record
+    uint16_t storedSchema = 0;   // 0 = no schema record yet
+    void markModified();
     void setDefaults();
+    void applyDefaults();
+    bool loadStore();
+    void importEeprom();
+    void keepFields(const laptimer_config_t& legacy, uint32_t version);
+    void migrate();
+    void writeStore();
+    static void readField(void* arg, uint8_t key, const uint8_t* value, uint8_t length);
+    void setField(const config_field_t& field, uint8_t index, uint32_t value);
+    void setString(const config_field_t& field, const char* value);
 };
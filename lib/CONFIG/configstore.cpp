@@ -0,0 +1,140 @@
+#include "configstore.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hal.h"
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        crc ^= data[i] << 8;
+        for (uint8_t k = 0; k < 8; k++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t recordCheck(uint8_t key, const void *value, uint8_t length) {
+    uint8_t head[2] = {key, length};
+    return crc16(crc16(0xFFFF, head, 2), (const uint8_t *)value, length);
+}
+
+static uint16_t recordSize(uint8_t length) {
+    return sizeof(configstore_record_t) + ((length + 3) & ~3);
+}
+
+bool ConfigStore::begin() {
+    size_t size = halFlashBegin();
+    sectors = size / HAL_FLASH_SECTOR_SIZE;
+    if (sectors > CONFIGSTORE_MAX_SECTORS) sectors = CONFIGSTORE_MAX_SECTORS;
+    live = -1;
+    return sectors >= 2;
+}
+
+bool ConfigStore::load(configstore_reader_t reader, void *arg) {
+    live = -1;
+    memset(offsets, 0, sizeof(offsets));
+    for (uint8_t i = 0; i < sectors; i++) {
+        configstore_header_t header;
+        if (!halFlashRead(i * HAL_FLASH_SECTOR_SIZE, &header, sizeof(header)) || header.magic != CONFIGSTORE_MAGIC ||
+            header.inverse != ~header.sequence) {
+            continue;
+        }
+        if (live < 0 || (int32_t)(header.sequence - sequence) > 0) {
+            live = i;
+            sequence = header.sequence;
+        }
+    }
+    if (live < 0) return false;
+
+    // the log up to the erased space or the first broken record
+    uint32_t base = live * HAL_FLASH_SECTOR_SIZE;
+    uint16_t at = sizeof(configstore_header_t);
+    torn = false;
+    while (at + sizeof(configstore_record_t) <= HAL_FLASH_SECTOR_SIZE) {
+        configstore_record_t record;
+        uint8_t value[CONFIGSTORE_MAX_VALUE];
+        halFlashRead(base + at, &record, sizeof(record));
+        if (record.key == 0xFF && record.length == 0xFF && record.check == 0xFFFF) break;
+        torn = record.key >= CONFIGSTORE_KEYS || record.length > CONFIGSTORE_MAX_VALUE || at + recordSize(record.length) > HAL_FLASH_SECTOR_SIZE ||
+               !halFlashRead(base + at + sizeof(record), value, record.length) || recordCheck(record.key, value, record.length) != record.check;
+        if (torn) break;
+        offsets[record.key] = at;
+        reader(arg, record.key, value, record.length);
+        at += recordSize(record.length);
+    }
+    end = at;
+    DEBUG("Config store: sector %u, sequence %lu, %u bytes%s\n", live, (unsigned long)sequence, end, torn ? ", torn" : "");
+    return true;
+}
+
+bool ConfigStore::append(uint8_t sector, uint16_t *at, uint8_t key, const void *value, uint8_t length) {
+    uint8_t buf[sizeof(configstore_record_t) + CONFIGSTORE_MAX_VALUE + 3];
+    uint16_t size = recordSize(length);
+    if (*at + size > HAL_FLASH_SECTOR_SIZE) return false;
+    configstore_record_t record = {key, length, recordCheck(key, value, length)};
+    memset(buf, 0xFF, size);  // padding stays erased
+    memcpy(buf, &record, sizeof(record));
+    memcpy(buf + sizeof(record), value, length);
+    if (!halFlashWrite(sector * HAL_FLASH_SECTOR_SIZE + *at, buf, size)) return false;
+    *at += size;
+    return true;
+}
+
+bool ConfigStore::write(uint8_t key, const void *value, uint8_t length) {
+    if (!sectors || key >= CONFIGSTORE_KEYS || length > CONFIGSTORE_MAX_VALUE) return false;
+    uint16_t at = end;
+    if (live >= 0 && !torn) {
+        if (append(live, &at, key, value, length)) {
+            offsets[key] = end;
+            end = at;
+            return true;
+        }
+        torn = true;  // full, or a failed write left part of a record behind
+    }
+    return compact(key, value, length);
+}
+
+/*
+ * Copies the latest record of every key but the one being written into the
+ * next sector, adds the new one and only then the header, so until the
+ * magic is in the old sector stays live.
+ */
+bool ConfigStore::compact(uint8_t key, const void *value, uint8_t length) {
+    uint8_t target = live < 0 ? 0 : (live + 1) % sectors;
+    uint32_t base = target * HAL_FLASH_SECTOR_SIZE;
+    if (!halFlashErase(base)) return false;
+
+    uint16_t moved[CONFIGSTORE_KEYS];
+    uint16_t at = sizeof(configstore_header_t);
+    memset(moved, 0, sizeof(moved));
+    for (uint8_t k = 0; k < CONFIGSTORE_KEYS && live >= 0; k++) {
+        if (!offsets[k] || k == key) continue;
+        configstore_record_t record;
+        uint8_t old[CONFIGSTORE_MAX_VALUE];
+        uint32_t from = live * HAL_FLASH_SECTOR_SIZE + offsets[k];
+        if (!halFlashRead(from, &record, sizeof(record)) || !halFlashRead(from + sizeof(record), old, record.length)) return false;
+        moved[k] = at;
+        if (!append(target, &at, k, old, record.length)) return false;
+    }
+    moved[key] = at;
+    if (!append(target, &at, key, value, length)) return false;
+
+    configstore_header_t header = {sequence + 1, ~(sequence + 1), CONFIGSTORE_MAGIC};
+    size_t magicAt = offsetof(configstore_header_t, magic);
+    if (!halFlashWrite(base, &header, magicAt) || !halFlashWrite(base + magicAt, &header.magic, sizeof(header.magic))) return false;
+
+    live = target;
+    sequence = header.sequence;
+    end = at;
+    torn = false;
+    memcpy(offsets, moved, sizeof(offsets));
+    compactions++;
+    return true;
+}
+
+uint32_t ConfigStore::getCompactions() {
+    return compactions;
+}
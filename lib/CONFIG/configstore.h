@@ -0,0 +1,50 @@
+#include <stdint.h>
+
+#pragma once
+
+#define CONFIGSTORE_MAGIC 0x43544C50  // "PLTC"
+#define CONFIGSTORE_KEYS 64
+#define CONFIGSTORE_MAX_VALUE 64
+#define CONFIGSTORE_MAX_SECTORS 8
+
+typedef struct {
+    uint32_t sequence;  // of the compaction that wrote the sector, the highest is live
+    uint32_t inverse;   // ~sequence, an old header an erase got part way through fails it
+    uint32_t magic;     // written last, a sector without it is ignored
+} configstore_header_t;
+
+typedef struct {
+    uint8_t key;
+    uint8_t length;
+    uint16_t check;  // CRC16 of key, length and value
+} configstore_record_t;
+
+typedef void (*configstore_reader_t)(void *arg, uint8_t key, const uint8_t *value, uint8_t length);
+
+/*
+ * Key/value records appended to a log in the raw flash region, so a change
+ * costs a few bytes instead of a sector. One sector is live; when it is
+ * full the latest record of every key moves to the next sector in the ring,
+ * which is the only time anything is erased, and every sector takes its
+ * turn. A record or compaction cut short by a power loss fails its check or
+ * lacks the sector magic, so the last complete state is what loads.
+ */
+class ConfigStore {
+   public:
+    bool begin();                                          // false without a region of two sectors at least
+    bool load(configstore_reader_t reader, void *arg);     // every key's latest value, false when empty
+    bool write(uint8_t key, const void *value, uint8_t length);
+    uint32_t getCompactions();
+
+   private:
+    uint8_t sectors = 0;
+    int8_t live = -1;
+    uint32_t sequence = 0;
+    uint16_t end = 0;  // of the records in the live sector
+    bool torn = false;  // the live sector ends in a broken record, nothing can follow it
+    uint16_t offsets[CONFIGSTORE_KEYS];  // of the latest record of each key, 0 for none
+    uint32_t compactions = 0;
+
+    bool append(uint8_t sector, uint16_t *at, uint8_t key, const void *value, uint8_t length);
+    bool compact(uint8_t key, const void *value, uint8_t length);
+};
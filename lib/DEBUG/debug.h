@@ -1,7 +1,9 @@
 #pragma once
 
 #define SERIAL_BAUD 460800
+#if defined(ARDUINO) && !defined(RHNODE_SERIAL)  // the RotorHazard node has USB serial then
 #define DEBUG_OUT Serial
+#endif
 
 #ifdef DEBUG_OUT
 #define DEBUG_INIT DEBUG_OUT.begin(SERIAL_BAUD);
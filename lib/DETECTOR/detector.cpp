@@ -0,0 +1,23 @@
+#include "detector.h"
+
+#include <string.h>
+
+const char *detectorName(detector_type_e type) {
+    switch (type) {
+        case DETECTOR_PEAK:
+            return "peak";
+        case DETECTOR_SLOPE:
+            return "slope";
+        case DETECTOR_MATCHED:
+            return "matched";
+        default:
+            return "unknown";
+    }
+}
+
+detector_type_e detectorFromName(const char *name) {
+    for (uint8_t i = 0; i < DETECTOR_COUNT; i++) {
+        if (!strcmp(name, detectorName((detector_type_e)i))) return (detector_type_e)i;
+    }
+    return DETECTOR_COUNT;
+}
@@ -0,0 +1,50 @@
+#include <stdint.h>
+
+#pragma once
+
+typedef enum {
+    DETECTOR_PEAK,     // highest point above enter, confirmed below exit
+    DETECTOR_SLOPE,    // derivative zero crossing with a prominence
+    DETECTOR_MATCHED,  // correlation with a pass shaped template
+    DETECTOR_COUNT
+} detector_type_e;
+
+typedef struct {
+    uint32_t timeUs;
+    uint8_t rssi;      // filtered
+    int32_t rssiFine;  // filtered, unrounded Q16
+} detector_sample_t;
+
+/*
+ * Finds gate passes in one pilot's filtered RSSI. LapTimer keeps one per
+ * pilot and feeds it every sample; armed is false until the minimum lap time
+ * since the last pass is over, passes completing before are dropped. A pass
+ * is reported once it is over, with its time refined to where the pilot was
+ * closest, which can be well before the sample that completed it.
+ */
+class LapDetector {
+   public:
+    virtual ~LapDetector() {}
+    virtual void reset() = 0;  // forgets a pass in progress
+    virtual bool sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) = 0;
+    virtual uint32_t getPassTimeUs() = 0;  // of the pass sample() just returned true for
+};
+
+const char *detectorName(detector_type_e type);
+detector_type_e detectorFromName(const char *name);  // DETECTOR_COUNT when unknown
+
+// Slots of a fixed grid of periodUs due up to timeUs, for detectors working
+// at a fixed pace. A gap longer than maxSlots (the receiver was away) or a
+// clock going back restarts the grid, which *restarted tells.
+static inline uint16_t detectorSlotsDue(uint32_t *nextUs, uint32_t timeUs, uint32_t periodUs, uint16_t maxSlots, bool *restarted) {
+    int32_t ahead = (int32_t)(timeUs - *nextUs);
+    *restarted = ahead >= (int32_t)(periodUs * maxSlots) || ahead < -(int32_t)periodUs;
+    if (*restarted) {
+        *nextUs = timeUs;
+        ahead = 0;
+    }
+    if (ahead < 0) return 0;
+    uint16_t due = ahead / periodUs + 1;
+    *nextUs += due * periodUs;
+    return due;
+}
@@ -0,0 +1,92 @@
+#include "matcheddetector.h"
+
+#include <math.h>
+
+#define MATCHED_DETECTOR_SCALE 1024  // template taps in 1/1024
+
+static int16_t taps[MATCHED_DETECTOR_TAPS];
+static float energy = 0;  // correlation of the template with a pass of height 1
+
+MatchedDetector::MatchedDetector() {
+    if (energy > 0) return;
+    float shape[MATCHED_DETECTOR_TAPS];
+    float mean = 0;
+    for (int16_t k = 0; k < MATCHED_DETECTOR_TAPS; k++) {
+        float d = (k - MATCHED_DETECTOR_HALF) * (MATCHED_DETECTOR_PERIOD_US / 1000.0f) / MATCHED_DETECTOR_WIDTH_MS;
+        shape[k] = expf(-0.5f * d * d);
+        mean += shape[k] / MATCHED_DETECTOR_TAPS;
+    }
+    float sum = 0;
+    for (int16_t k = 0; k < MATCHED_DETECTOR_TAPS; k++) {
+        taps[k] = (int16_t)lroundf((shape[k] - mean) * MATCHED_DETECTOR_SCALE);
+        sum += taps[k] * shape[k];
+    }
+    energy = sum;
+}
+
+void MatchedDetector::reset() {
+    inPass = false;
+    best = 0;
+}
+
+bool MatchedDetector::sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) {
+    bool restarted;
+    uint16_t due = detectorSlotsDue(&nextUs, s.timeUs, MATCHED_DETECTOR_PERIOD_US, 4, &restarted);
+    if (restarted) filled = 0;
+
+    const float prominence = enterRssi > exitRssi ? enterRssi - exitRssi : 1;
+    bool passed = false;
+    for (uint16_t i = 0; i < due; i++) {
+        uint32_t slotUs = nextUs - (due - i) * MATCHED_DETECTOR_PERIOD_US;
+        passed |= step(s.rssi, slotUs, prominence, exitRssi, armed);
+    }
+    return passed;
+}
+
+bool MatchedDetector::step(uint8_t value, uint32_t slotUs, float prominence, uint8_t floor, bool armed) {
+    ring[head] = value;
+    head = (head + 1) % MATCHED_DETECTOR_TAPS;
+    if (filled < MATCHED_DETECTOR_TAPS) {
+        filled++;
+        previous[0] = previous[1] = 0;
+        return false;
+    }
+
+    // head is the oldest entry, the window is centered half of it back
+    int32_t sum = 0;
+    uint8_t n = head;
+    for (uint8_t k = 0; k < MATCHED_DETECTOR_TAPS; k++) {
+        sum += taps[k] * ring[n];
+        n = n + 1 == MATCHED_DETECTOR_TAPS ? 0 : n + 1;
+    }
+    float estimate = sum / energy;
+    uint8_t center = ring[(head + MATCHED_DETECTOR_HALF) % MATCHED_DETECTOR_TAPS];
+    uint32_t centerUs = slotUs - MATCHED_DETECTOR_HALF * MATCHED_DETECTOR_PERIOD_US;
+
+    bool passed = false;
+    if (!inPass && armed && estimate >= prominence && center >= floor) {
+        inPass = true;
+        best = 0;
+    }
+    if (inPass) {
+        // a maximum one period back, its time interpolated on the parabola through it and its neighbours
+        float a = previous[1], b = previous[0], c = estimate;
+        if (b >= a && b > c && b > best) {
+            float offset = 0.5f * (a - c) / (a - 2 * b + c);
+            best = b;
+            bestTimeUs = centerUs - MATCHED_DETECTOR_PERIOD_US + (int32_t)lroundf(offset * MATCHED_DETECTOR_PERIOD_US);
+        }
+        if (estimate < prominence / 2) {
+            passTimeUs = bestTimeUs;
+            inPass = false;
+            passed = best > 0;
+        }
+    }
+    previous[1] = previous[0];
+    previous[0] = estimate;
+    return passed;
+}
+
+uint32_t MatchedDetector::getPassTimeUs() {
+    return passTimeUs;
+}
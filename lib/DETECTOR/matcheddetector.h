@@ -0,0 +1,39 @@
+#include "detector.h"
+
+#pragma once
+
+#define MATCHED_DETECTOR_PERIOD_US 4000
+#define MATCHED_DETECTOR_WIDTH_MS 60  // standard deviation of the template pass
+#define MATCHED_DETECTOR_HALF 45      // taps either side of the center, 3 widths
+#define MATCHED_DETECTOR_TAPS (2 * MATCHED_DETECTOR_HALF + 1)
+
+/*
+ * Correlates the RSSI with a zero mean gaussian pass template, which turns
+ * a pass of that shape into its height above the surroundings whatever the
+ * noise floor is, and averages the noise over the whole window. A pass starts
+ * when the estimate reaches enter - exit with the RSSI at the center at
+ * or above exit, and ends when it drops below half that. Its time is the
+ * interpolated maximum of the correlation. Results lag by half the window;
+ * a gap in the samples (hopping) starts the window over.
+ */
+class MatchedDetector : public LapDetector {
+   public:
+    MatchedDetector();
+    void reset() override;
+    bool sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) override;
+    uint32_t getPassTimeUs() override;
+
+   private:
+    uint8_t ring[MATCHED_DETECTOR_TAPS];
+    uint8_t head = 0;
+    uint8_t filled = 0;
+    uint32_t nextUs = 0;
+    float previous[2] = {};  // estimates one and two periods back
+
+    bool inPass = false;
+    float best = 0;
+    uint32_t bestTimeUs = 0;
+    uint32_t passTimeUs = 0;
+
+    bool step(uint8_t value, uint32_t slotUs, float prominence, uint8_t floor, bool armed);
+};
@@ -0,0 +1,98 @@
+#include "peakdetector.h"
+
+#include <math.h>
+
+void PeakDetector::reset() {
+    peak = 0;
+    peakFine = 0;
+    peakFitted = true;
+}
+
+bool PeakDetector::sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) {
+    // the history is kept at a fixed pace so the fit window is the same at any sample rate
+    uint8_t last = (historyCount + PEAK_DETECTOR_HISTORY - 1) % PEAK_DETECTOR_HISTORY;
+    if ((s.timeUs - historyTimeUs[last]) >= PEAK_DETECTOR_PERIOD_US) {
+        historyFine[historyCount] = s.rssiFine;
+        historyTimeUs[historyCount] = s.timeUs;
+        historyCount = (historyCount + 1) % PEAK_DETECTOR_HISTORY;
+
+        // fit as soon as the window after the peak is in, before the history moves past it
+        if (peak && !peakFitted && (s.timeUs - peakTimeUs) >= PEAK_DETECTOR_FIT_US) {
+            fitPeak();
+        }
+    }
+
+    // unrounded so a flat top doesn't pin the peak to its start
+    if (armed && s.rssi >= enterRssi && s.rssiFine > peakFine) {
+        peak = s.rssi;
+        peakFine = s.rssiFine;
+        peakTimeUs = s.timeUs;
+        peakFitted = false;
+    }
+
+    if (s.rssi >= peak || s.rssi >= exitRssi) return false;
+    if (!peakFitted) fitPeak();
+    passTimeUs = peakTimeUs;
+    peak = 0;
+    peakFine = 0;
+    peakTimeUs = 0;
+    return true;
+}
+
+uint32_t PeakDetector::getPassTimeUs() {
+    return passTimeUs;
+}
+
+void PeakDetector::setFit(bool enabled) {
+    fit = enabled;
+}
+
+/*
+ * Moves the peak time to the vertex of a least squares parabola through the
+ * history around it. The filtered RSSI is flat within noise near the top,
+ * so the highest sample alone is off by several ms, the fit uses the whole
+ * shape of the pass. Done twice, the second time centered on the first result.
+ * When hopping the history has holes, without samples on both sides of the
+ * peak the highest sample is kept.
+ */
+void PeakDetector::fitPeak() {
+    peakFitted = true;
+    if (!fit) return;
+
+    uint32_t centerUs = peakTimeUs;
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+        float sy = 0, sxy = 0, sx2y = 0;
+        uint8_t before = 0, after = 0;
+        for (uint8_t i = 0; i < PEAK_DETECTOR_HISTORY; i++) {
+            int32_t dt = historyTimeUs[i] - centerUs;
+            if (dt < -PEAK_DETECTOR_FIT_US || dt > PEAK_DETECTOR_FIT_US) continue;
+            if (dt < 0) before++;
+            if (dt > 0) after++;
+            float x = dt * 0.001f;                                      // ms
+            float y = (historyFine[i] - peakFine) * (1.0f / 65536);  // relative to the peak, keeps float precision
+            float x2 = x * x;
+            s0 += 1;
+            s1 += x;
+            s2 += x2;
+            s3 += x2 * x;
+            s4 += x2 * x2;
+            sy += y;
+            sxy += x * y;
+            sx2y += x2 * y;
+        }
+        if (before < 2 || after < 2) return;
+
+        // y = a*x^2 + b*x + c, normal equations by Cramer's rule
+        float det = s4 * (s2 * s0 - s1 * s1) - s3 * (s3 * s0 - s1 * s2) + s2 * (s3 * s1 - s2 * s2);
+        if (det == 0) return;
+        float a = (sx2y * (s2 * s0 - s1 * s1) - s3 * (sxy * s0 - s1 * sy) + s2 * (sxy * s1 - s2 * sy)) / det;
+        float b = (s4 * (sxy * s0 - sy * s1) - sx2y * (s3 * s0 - s1 * s2) + s2 * (s3 * sy - sxy * s2)) / det;
+        if (a >= 0) return;  // not a peak
+
+        float vertexMs = -b / (2 * a);
+        if (vertexMs < -PEAK_DETECTOR_FIT_US / 1000 || vertexMs > PEAK_DETECTOR_FIT_US / 1000) return;
+        centerUs += (int32_t)lroundf(vertexMs * 1000);
+    }
+    peakTimeUs = centerUs;
+}
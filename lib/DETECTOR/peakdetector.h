@@ -0,0 +1,34 @@
+#include "detector.h"
+
+#pragma once
+
+#define PEAK_DETECTOR_HISTORY 100
+#define PEAK_DETECTOR_PERIOD_US 1000  // at most one history entry per ms, whatever the sample rate
+#define PEAK_DETECTOR_FIT_US 40000    // half width of the window the peak is fitted over
+
+/*
+ * The original detector: the highest point while RSSI is at or above enter,
+ * the pass is over once RSSI drops below both that peak and exit. The time
+ * is then refined by fitting a parabola over the history around the peak.
+ */
+class PeakDetector : public LapDetector {
+   public:
+    void reset() override;
+    bool sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) override;
+    uint32_t getPassTimeUs() override;
+    void setFit(bool enabled);
+
+   private:
+    int32_t historyFine[PEAK_DETECTOR_HISTORY] = {};
+    uint32_t historyTimeUs[PEAK_DETECTOR_HISTORY] = {};
+    uint8_t historyCount = 0;
+
+    uint8_t peak = 0;
+    int32_t peakFine = 0;
+    uint32_t peakTimeUs = 0;
+    bool peakFitted = true;
+    uint32_t passTimeUs = 0;
+    bool fit = true;
+
+    void fitPeak();
+};
@@ -0,0 +1,77 @@
+#include "slopedetector.h"
+
+void SlopeDetector::reset() {
+    candidate = false;
+    below = 0;
+    valley = INT32_MAX;
+}
+
+bool SlopeDetector::sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) {
+    bool restarted;
+    uint16_t due = detectorSlotsDue(&nextUs, s.timeUs, SLOPE_DETECTOR_PERIOD_US, SLOPE_DETECTOR_BOX, &restarted);
+    if (restarted) filled = 0;  // a pass in progress carries on, only the average and derivative start over
+
+    const int32_t prominence = (enterRssi > exitRssi ? enterRssi - exitRssi : 1) << 16;
+    const int32_t floor = (int32_t)exitRssi << 16;
+    bool passed = false;
+    for (uint16_t i = 0; i < due; i++) {
+        // slots skipped in a short gap take this sample, they are all at or before it
+        uint32_t slotUs = nextUs - (due - i) * SLOPE_DETECTOR_PERIOD_US;
+        passed |= step(s.rssiFine, slotUs, prominence, floor, armed);
+    }
+    return passed;
+}
+
+bool SlopeDetector::step(int32_t fine, uint32_t slotUs, int32_t prominence, int32_t floor, bool armed) {
+    if (filled == 0) {
+        for (uint8_t i = 0; i < SLOPE_DETECTOR_BOX; i++) box[i] = fine;
+        boxSum = (int64_t)fine * SLOPE_DETECTOR_BOX;
+    }
+    uint8_t b = slotUs / SLOPE_DETECTOR_PERIOD_US % SLOPE_DETECTOR_BOX;
+    boxSum += fine - box[b];
+    box[b] = fine;
+    int32_t value = boxSum / SLOPE_DETECTOR_BOX;
+
+    ring[head] = value;
+    head = (head + 1) % (SLOPE_DETECTOR_SPAN + 1);
+    if (filled <= SLOPE_DETECTOR_SPAN) filled++;
+
+    if (candidate && value <= candidateFine - prominence) {
+        if (++below >= SLOPE_DETECTOR_HOLD) {
+            passTimeUs = candidateTimeUs;
+            candidate = false;
+            below = 0;
+            valley = value;
+            return true;
+        }
+    } else {
+        below = 0;
+    }
+    if (value < valley) valley = value;
+    if (filled <= SLOPE_DETECTOR_SPAN) {
+        lastSlope = 0;
+        return false;
+    }
+
+    // head is the oldest entry now, the derivative is centered span / 2 periods back
+    int32_t slope = value - ring[head];
+    if (lastSlope > 0 && slope <= 0) {
+        int32_t top = ring[(head + SLOPE_DETECTOR_SPAN / 2) % (SLOPE_DETECTOR_SPAN + 1)];
+        if (armed && top >= floor && top - valley >= prominence && (!candidate || top > candidateFine)) {
+            // where the slope crossed zero between the last period and this one,
+            // back by the derivative and the average lagging half their length
+            float fraction = (float)lastSlope / ((float)lastSlope - slope);
+            float lag = SLOPE_DETECTOR_SPAN / 2.0f + (SLOPE_DETECTOR_BOX - 1) / 2.0f;
+            int32_t crossUs = (int32_t)((fraction - 1 - lag) * SLOPE_DETECTOR_PERIOD_US);
+            candidate = true;
+            candidateFine = top;
+            candidateTimeUs = slotUs + crossUs;
+        }
+    }
+    lastSlope = slope;
+    return false;
+}
+
+uint32_t SlopeDetector::getPassTimeUs() {
+    return passTimeUs;
+}
@@ -0,0 +1,42 @@
+#include "detector.h"
+
+#pragma once
+
+#define SLOPE_DETECTOR_PERIOD_US 1000
+#define SLOPE_DETECTOR_BOX 24   // periods averaged first, bridges multipath notches up to about this long
+#define SLOPE_DETECTOR_SPAN 24  // periods the derivative is taken over
+#define SLOPE_DETECTOR_HOLD 80  // periods the fall has to last, a top rising again before merges
+
+/*
+ * Finds the top of a pass where the derivative of the averaged RSSI crosses
+ * zero, interpolated between two periods. A top counts when it rose at least
+ * enter - exit above the lowest point before it and is at or above exit; the
+ * pass is over once the average stayed that much below the top for the hold.
+ * Nothing needs to reach enter, so fast passes that stay low are found, and a
+ * second top after a multipath notch is merged into the pass, the higher one
+ * wins.
+ */
+class SlopeDetector : public LapDetector {
+   public:
+    void reset() override;
+    bool sample(const detector_sample_t &s, uint8_t enterRssi, uint8_t exitRssi, bool armed) override;
+    uint32_t getPassTimeUs() override;
+
+   private:
+    int32_t box[SLOPE_DETECTOR_BOX];
+    int64_t boxSum = 0;
+    int32_t ring[SLOPE_DETECTOR_SPAN + 1];  // averages
+    uint8_t head = 0;
+    uint8_t filled = 0;
+    uint32_t nextUs = 0;
+    int32_t lastSlope = 0;
+
+    int32_t valley = INT32_MAX;  // lowest point since the last pass
+    bool candidate = false;
+    uint8_t below = 0;  // periods fallen since the top
+    int32_t candidateFine = 0;
+    uint32_t candidateTimeUs = 0;
+    uint32_t passTimeUs = 0;
+
+    bool step(int32_t fine, uint32_t slotUs, int32_t prominence, int32_t floor, bool armed);
+};
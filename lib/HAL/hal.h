@@ -0,0 +1,132 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+/*
+ * Hardware abstraction layer for everything the timing core touches: clock,
+ * periodic tickers, the timing task, ADC, GPIO, persistent storage, raw
+ * flash, firmware images and files. On the ESP32 these map straight onto the Arduino core
+ * (hal_arduino.cpp), on the host they are backed by a simulated clock and
+ * pin state that the simulator drives (hal_native.cpp).
+ */
+
+#define HAL_LOW 0
+#define HAL_HIGH 1
+#define HAL_ANALOG_READERS 2
+#define HAL_TICKERS 4
+#define HAL_FILES 6
+#define HAL_FLASH_SECTOR_SIZE 4096
+#define HAL_UDP_QUEUE 8       // datagrams received and not read yet, more are dropped
+#define HAL_UDP_MAX_SIZE 64   // of a datagram, longer ones are dropped
+#define HAL_UDP_BROADCAST 0xFFFFFFFF
+
+typedef enum {
+    HAL_INPUT,
+    HAL_OUTPUT,
+    HAL_INPUT_PULLUP
+} hal_pin_mode_e;
+
+typedef struct {
+    uint32_t address;  // IPv4, first byte in the top bits
+    uint16_t port;
+} hal_udp_peer_t;
+
+typedef enum {
+    HAL_FILE_READ,
+    HAL_FILE_WRITE,  // truncates
+    HAL_FILE_APPEND
+} hal_file_mode_e;
+
+// clock
+uint32_t halMillis();
+uint32_t halMicros();
+void halDelay(uint32_t ms);
+void halDelayMicroseconds(uint32_t us);
+// for timing code: the CPU cycle counter on the ESP32, a steady clock in ns on
+// the host where halMicros is simulated. Wraps, only differences count.
+uint32_t halCycles();
+uint32_t halCyclesPerUs();
+
+// state shared between tasks, keep it to a few instructions and never block inside
+void halCriticalEnter();
+void halCriticalExit();
+
+// orders memory accesses across cores, for lock-free handovers: a full fence on both targets
+static inline void halMemoryBarrier() {
+    __sync_synchronize();
+}
+
+// periodic callbacks in task context (esp_timer on the ESP32, 50 us minimum period)
+typedef void (*hal_ticker_fn_t)(void *arg);
+
+int8_t halTickerCreate(hal_ticker_fn_t fn, void *arg);  // -1 when all HAL_TICKERS are taken
+void halTickerStart(int8_t ticker, uint32_t periodUs);
+void halTickerStop(int8_t ticker);
+
+// the timing task: a hardware timer interrupt every periodUs wakes fn in a task of its own, on core 1 above
+// everything else there. On a single core (C3) it runs under WiFi, lwIP and esp_timer, which it would
+// starve, and above the rest. ticks counts the interrupts since the last call, more than 1 when fn
+// overran; interruptUs is the time of the latest.
+typedef void (*hal_tick_fn_t)(void *arg, uint32_t ticks, uint32_t interruptUs);
+
+bool halTickStart(hal_tick_fn_t fn, void *arg, uint32_t periodUs);  // once, false when the task or timer can't be had
+
+// ADC, raw 12 bit reading
+typedef uint16_t (*hal_analog_reader_t)(uint8_t pin);
+
+uint16_t halAnalogRead(uint8_t pin);
+// serve reads of a pin from somewhere else, e.g. a channel the continuous ADC already samples
+void halSetAnalogReader(uint8_t pin, hal_analog_reader_t reader);
+
+// GPIO
+void halPinMode(uint8_t pin, hal_pin_mode_e mode);
+void halDigitalWrite(uint8_t pin, uint8_t val);
+uint8_t halDigitalRead(uint8_t pin);
+
+// persistent storage, EEPROM semantics: read/write a RAM image, commit flushes it
+bool halStorageBegin(size_t size);
+void halStorageRead(size_t address, void *data, size_t len);
+void halStorageWrite(size_t address, const void *data, size_t len);
+bool halStorageCommit();
+
+// raw flash for log-structured storage, the "config" partition on the ESP32.
+// Erasing sets a whole sector to 0xFF, writing can only clear bits.
+size_t halFlashBegin();  // size of the region, 0 when there is none
+bool halFlashRead(uint32_t address, void *data, size_t len);
+bool halFlashWrite(uint32_t address, const void *data, size_t len);
+bool halFlashErase(uint32_t address);  // the sector starting there
+
+// firmware images: the one running and the other OTA slot, which an update is
+// written to like the raw flash above. Activating the slot checks the image
+// in it and boots it from the next reset on.
+size_t halImageSize();  // of the running image, 0 when it can't be read
+bool halImageRead(uint32_t address, void *data, size_t len);
+size_t halUpdateBegin();  // size of the slot, 0 when there is none
+bool halUpdateRead(uint32_t address, void *data, size_t len);
+bool halUpdateWrite(uint32_t address, const void *data, size_t len);
+bool halUpdateErase(uint32_t address);  // the sector starting there
+bool halUpdateActivate();
+
+// files on the data partition (LittleFS). A handle is -1 when the open failed
+// or all HAL_FILES are in use. Written data is only safe from power loss once
+// halFileSync or halFileClose returned.
+bool halFsBegin();
+int8_t halFileOpen(const char *path, hal_file_mode_e mode);
+size_t halFileRead(int8_t file, void *data, size_t len);
+size_t halFileWrite(int8_t file, const void *data, size_t len);
+bool halFileSeek(int8_t file, uint32_t position);
+uint32_t halFileSize(int8_t file);
+bool halFileSync(int8_t file);
+void halFileClose(int8_t file);
+bool halFileExists(const char *path);
+bool halFileRemove(const char *path);
+bool halFileRename(const char *from, const char *to);  // replaces to, atomically
+bool halMkdir(const char *path);
+
+// UDP on the network the node is on, one socket. Datagrams are queued with
+// their arrival time as they come in, receive hands out the oldest.
+bool halUdpBegin(uint16_t port);
+void halUdpEnd();
+bool halUdpSend(const hal_udp_peer_t *to, const void *data, size_t len);  // HAL_UDP_BROADCAST goes to every node on the port
+size_t halUdpReceive(void *data, size_t len, hal_udp_peer_t *from, uint32_t *arrivalUs);  // 0 when none is waiting
@@ -0,0 +1,384 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <esp_image_format.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_task.h>
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
+
+#include "hal.h"
+
+// The last general purpose timer. Arduino core 2 has no way to ask which are free: neither it, nor the
+// libraries here, nor this firmware start one, esp_timer runs on its own (LAC timer, systimer on the
+// C3 and S3), and other code takes timer 0 first.
+#define HAL_TICK_TIMER (SOC_TIMER_GROUP_TOTAL_TIMERS - 1)
+#define HAL_TICK_CORE (portNUM_PROCESSORS - 1)  // core 1, with loop(); the only one on the C3
+#if portNUM_PROCESSORS > 1
+#define HAL_TICK_PRIORITY (configMAX_PRIORITIES - 1)  // WiFi, lwIP and the esp_timer task are on core 0
+#else
+#define HAL_TICK_PRIORITY (ESP_TASK_TCPIP_PRIO - 1)  // under lwIP, the esp_timer task with the bus ticker and WiFi
+#endif
+
+uint32_t halMillis() {
+    return millis();
+}
+
+uint32_t halMicros() {
+    return micros();
+}
+
+uint32_t halCycles() {
+    return ESP.getCycleCount();
+}
+
+uint32_t halCyclesPerUs() {
+    return getCpuFrequencyMhz();
+}
+
+void halDelay(uint32_t ms) {
+    delay(ms);
+}
+
+void halDelayMicroseconds(uint32_t us) {
+    delayMicroseconds(us);
+}
+
+static portMUX_TYPE criticalMux = portMUX_INITIALIZER_UNLOCKED;
+
+void halCriticalEnter() {
+    portENTER_CRITICAL(&criticalMux);
+}
+
+void halCriticalExit() {
+    portEXIT_CRITICAL(&criticalMux);
+}
+
+static esp_timer_handle_t tickers[HAL_TICKERS];
+static uint8_t tickerCount = 0;
+
+int8_t halTickerCreate(hal_ticker_fn_t fn, void *arg) {
+    if (tickerCount >= HAL_TICKERS) return -1;
+    esp_timer_create_args_t args = {};
+    args.callback = fn;
+    args.arg = arg;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "hal";
+    if (esp_timer_create(&args, &tickers[tickerCount]) != ESP_OK) return -1;
+    return tickerCount++;
+}
+
+void halTickerStart(int8_t ticker, uint32_t periodUs) {
+    if (ticker < 0 || ticker >= tickerCount) return;
+    esp_timer_stop(tickers[ticker]);  // restart with the new period if already running
+    esp_timer_start_periodic(tickers[ticker], periodUs);
+}
+
+void halTickerStop(int8_t ticker) {
+    if (ticker < 0 || ticker >= tickerCount) return;
+    esp_timer_stop(tickers[ticker]);
+}
+
+static hw_timer_t *tickTimer = NULL;
+static TaskHandle_t tickTask = NULL;
+static hal_tick_fn_t tickFn;
+static void *tickArg;
+static volatile uint32_t tickInterruptUs;
+
+static void IRAM_ATTR onTickInterrupt() {
+    BaseType_t woken = pdFALSE;
+    tickInterruptUs = (uint32_t)esp_timer_get_time();
+    vTaskNotifyGiveFromISR(tickTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void tickTaskLoop(void *arg) {
+    for (;;) {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        tickFn(tickArg, ticks, tickInterruptUs);
+    }
+}
+
+// the interrupt goes to the core that attaches it, setup() runs on the core of the task
+bool halTickStart(hal_tick_fn_t fn, void *arg, uint32_t periodUs) {
+    if (tickTimer || periodUs == 0) return false;
+    tickFn = fn;
+    tickArg = arg;
+    if (xTaskCreatePinnedToCore(tickTaskLoop, "tickTask", 4096, NULL, HAL_TICK_PRIORITY, &tickTask, HAL_TICK_CORE) != pdPASS) return false;
+    tickTimer = timerBegin(HAL_TICK_TIMER, 80, true);  // 1 MHz from the 80 MHz APB clock
+    if (!tickTimer) {
+        vTaskDelete(tickTask);
+        return false;
+    }
+    timerAttachInterrupt(tickTimer, onTickInterrupt, true);
+    timerAlarmWrite(tickTimer, periodUs, true);
+    timerAlarmEnable(tickTimer);
+    return true;
+}
+
+static uint8_t readerPins[HAL_ANALOG_READERS];
+static hal_analog_reader_t readers[HAL_ANALOG_READERS];
+
+uint16_t halAnalogRead(uint8_t pin) {
+    for (uint8_t i = 0; i < HAL_ANALOG_READERS; i++) {
+        if (readers[i] && readerPins[i] == pin) return readers[i](pin);
+    }
+    return analogRead(pin);
+}
+
+void halSetAnalogReader(uint8_t pin, hal_analog_reader_t reader) {
+    for (uint8_t i = 0; i < HAL_ANALOG_READERS; i++) {
+        if (!readers[i] || readerPins[i] == pin) {
+            readerPins[i] = pin;
+            readers[i] = reader;
+            return;
+        }
+    }
+}
+
+void halPinMode(uint8_t pin, hal_pin_mode_e mode) {
+    switch (mode) {
+        case HAL_OUTPUT:
+            pinMode(pin, OUTPUT);
+            break;
+        case HAL_INPUT_PULLUP:
+            pinMode(pin, INPUT_PULLUP);
+            break;
+        case HAL_INPUT:
+        default:
+            pinMode(pin, INPUT);
+            break;
+    }
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t val) {
+    digitalWrite(pin, val);
+}
+
+uint8_t halDigitalRead(uint8_t pin) {
+    return digitalRead(pin);
+}
+
+bool halStorageBegin(size_t size) {
+    return EEPROM.begin(size);
+}
+
+void halStorageRead(size_t address, void *data, size_t len) {
+    EEPROM.readBytes(address, data, len);
+}
+
+void halStorageWrite(size_t address, const void *data, size_t len) {
+    EEPROM.writeBytes(address, data, len);
+}
+
+bool halStorageCommit() {
+    return EEPROM.commit();
+}
+
+static const esp_partition_t *flashPartition = NULL;
+
+size_t halFlashBegin() {
+    flashPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "config");
+    return flashPartition ? flashPartition->size : 0;
+}
+
+bool halFlashRead(uint32_t address, void *data, size_t len) {
+    return flashPartition && esp_partition_read(flashPartition, address, data, len) == ESP_OK;
+}
+
+bool halFlashWrite(uint32_t address, const void *data, size_t len) {
+    return flashPartition && esp_partition_write(flashPartition, address, data, len) == ESP_OK;
+}
+
+bool halFlashErase(uint32_t address) {
+    return flashPartition && esp_partition_erase_range(flashPartition, address, HAL_FLASH_SECTOR_SIZE) == ESP_OK;
+}
+
+static const esp_partition_t *updatePartition = NULL;
+static size_t imageSize = 0;
+
+// the length the bootloader checks, found by walking the image once
+size_t halImageSize() {
+    if (imageSize) return imageSize;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_partition_pos_t pos = {running->address, running->size};
+    esp_image_metadata_t meta;
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &meta) != ESP_OK) return 0;
+    imageSize = meta.image_len;
+    return imageSize;
+}
+
+bool halImageRead(uint32_t address, void *data, size_t len) {
+    return esp_partition_read(esp_ota_get_running_partition(), address, data, len) == ESP_OK;
+}
+
+size_t halUpdateBegin() {
+    updatePartition = esp_ota_get_next_update_partition(NULL);
+    return updatePartition ? updatePartition->size : 0;
+}
+
+bool halUpdateRead(uint32_t address, void *data, size_t len) {
+    return updatePartition && esp_partition_read(updatePartition, address, data, len) == ESP_OK;
+}
+
+bool halUpdateWrite(uint32_t address, const void *data, size_t len) {
+    return updatePartition && esp_partition_write(updatePartition, address, data, len) == ESP_OK;
+}
+
+bool halUpdateErase(uint32_t address) {
+    return updatePartition && esp_partition_erase_range(updatePartition, address, HAL_FLASH_SECTOR_SIZE) == ESP_OK;
+}
+
+// verifies the image in the slot before it sets it
+bool halUpdateActivate() {
+    return updatePartition && esp_ota_set_boot_partition(updatePartition) == ESP_OK;
+}
+
+static File files[HAL_FILES];
+static bool fileUsed[HAL_FILES];
+
+static bool validFile(int8_t file) {
+    return file >= 0 && file < HAL_FILES && fileUsed[file];
+}
+
+bool halFsBegin() {
+    return LittleFS.begin();  // no-op when already mounted
+}
+
+int8_t halFileOpen(const char *path, hal_file_mode_e mode) {
+    int8_t file = -1;
+    halCriticalEnter();
+    for (int8_t i = 0; i < HAL_FILES && file < 0; i++) {
+        if (!fileUsed[i]) {
+            fileUsed[i] = true;
+            file = i;
+        }
+    }
+    halCriticalExit();
+    if (file < 0) return -1;
+
+    const char *modes[] = {FILE_READ, FILE_WRITE, FILE_APPEND};
+    files[file] = LittleFS.open(path, modes[mode]);
+    if (!files[file]) {
+        fileUsed[file] = false;
+        return -1;
+    }
+    return file;
+}
+
+size_t halFileRead(int8_t file, void *data, size_t len) {
+    if (!validFile(file)) return 0;
+    return files[file].read((uint8_t *)data, len);
+}
+
+size_t halFileWrite(int8_t file, const void *data, size_t len) {
+    if (!validFile(file)) return 0;
+    return files[file].write((const uint8_t *)data, len);
+}
+
+bool halFileSeek(int8_t file, uint32_t position) {
+    if (!validFile(file)) return false;
+    return files[file].seek(position);
+}
+
+uint32_t halFileSize(int8_t file) {
+    if (!validFile(file)) return 0;
+    return files[file].size();
+}
+
+bool halFileSync(int8_t file) {
+    if (!validFile(file)) return false;
+    files[file].flush();  // fflush and fsync, which commits the LittleFS file
+    return true;
+}
+
+void halFileClose(int8_t file) {
+    if (!validFile(file)) return;
+    files[file].close();
+    fileUsed[file] = false;
+}
+
+bool halFileExists(const char *path) {
+    return LittleFS.exists(path);
+}
+
+bool halFileRemove(const char *path) {
+    return LittleFS.remove(path);
+}
+
+bool halFileRename(const char *from, const char *to) {
+    return LittleFS.rename(from, to);
+}
+
+bool halMkdir(const char *path) {
+    return LittleFS.mkdir(path);
+}
+
+typedef struct {
+    uint8_t data[HAL_UDP_MAX_SIZE];
+    uint8_t len;
+    hal_udp_peer_t from;
+    uint32_t arrivalUs;
+} udp_datagram_t;
+
+static AsyncUDP udp;
+static udp_datagram_t udpQueue[HAL_UDP_QUEUE];
+static uint8_t udpHead = 0;  // oldest waiting
+static uint8_t udpFill = 0;
+
+// in the lwIP task, the arrival time is taken before anything else
+static void onUdpPacket(AsyncUDPPacket &packet) {
+    uint32_t arrivalUs = micros();
+    size_t len = packet.length();
+    if (len > HAL_UDP_MAX_SIZE) return;
+    IPAddress ip = packet.remoteIP();
+    halCriticalEnter();
+    if (udpFill < HAL_UDP_QUEUE) {
+        udp_datagram_t &d = udpQueue[(udpHead + udpFill) % HAL_UDP_QUEUE];
+        memcpy(d.data, packet.data(), len);
+        d.len = len;
+        d.from.address = ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+        d.from.port = packet.remotePort();
+        d.arrivalUs = arrivalUs;
+        udpFill++;
+    }
+    halCriticalExit();
+}
+
+bool halUdpBegin(uint16_t port) {
+    if (!udp.listen(port)) return false;
+    udp.onPacket(onUdpPacket);
+    return true;
+}
+
+void halUdpEnd() {
+    udp.close();
+}
+
+bool halUdpSend(const hal_udp_peer_t *to, const void *data, size_t len) {
+    if (to->address == HAL_UDP_BROADCAST) return udp.broadcastTo((uint8_t *)data, len, to->port) == len;
+    IPAddress ip(to->address >> 24, (to->address >> 16) & 0xFF, (to->address >> 8) & 0xFF, to->address & 0xFF);
+    return udp.writeTo((const uint8_t *)data, len, ip, to->port) == len;
+}
+
+size_t halUdpReceive(void *data, size_t len, hal_udp_peer_t *from, uint32_t *arrivalUs) {
+    size_t n = 0;
+    halCriticalEnter();
+    if (udpFill) {
+        const udp_datagram_t &d = udpQueue[udpHead];
+        n = d.len < len ? d.len : len;
+        memcpy(data, d.data, n);
+        *from = d.from;
+        *arrivalUs = d.arrivalUs;
+        udpHead = (udpHead + 1) % HAL_UDP_QUEUE;
+        udpFill--;
+    }
+    halCriticalExit();
+    return n;
+}
+
+#endif
@@ -0,0 +1,707 @@
+#ifndef ARDUINO
+
+#include "hal_native.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <mutex>
+
+static uint64_t nowUs = 0;
+static uint16_t analogValues[HAL_NATIVE_PINS];
+static uint8_t pinLevels[HAL_NATIVE_PINS];
+static uint8_t inputLevels[HAL_NATIVE_PINS];
+static hal_pin_mode_e pinModes[HAL_NATIVE_PINS];
+static uint8_t readerPins[HAL_ANALOG_READERS];
+static hal_analog_reader_t readers[HAL_ANALOG_READERS];
+
+static hal_native_pin_hook_t pinHook = NULL;
+static void *pinHookArg = NULL;
+
+typedef struct {
+    hal_ticker_fn_t fn;
+    void *arg;
+    uint32_t periodUs;
+    uint64_t nextUs;
+    bool running;
+} native_ticker_t;
+
+static native_ticker_t tickers[HAL_TICKERS];
+static uint8_t tickerCount = 0;
+static bool inTicker = false;
+
+typedef struct {
+    hal_tick_fn_t fn;
+    void *arg;
+    uint32_t periodUs;
+    uint64_t interruptUs;  // the next one
+    uint64_t wakeUs;       // of the task, for the first interrupt it has not seen
+    bool running;
+} native_tick_t;
+
+static native_tick_t tick;
+static hal_native_tick_latency_t tickLatency = NULL;
+static void *tickLatencyArg = NULL;
+
+static uint8_t storage[HAL_NATIVE_STORAGE_SIZE];
+static size_t storageSize = 0;
+static const char *storageFile = NULL;
+static uint32_t storageCommits = 0;
+
+static uint8_t flash[HAL_NATIVE_FLASH_SECTORS * HAL_FLASH_SECTOR_SIZE];
+static size_t flashSize = HAL_NATIVE_FLASH_SECTORS * HAL_FLASH_SECTOR_SIZE;
+static uint32_t flashErases = 0;
+static uint32_t flashSectorErases[HAL_NATIVE_FLASH_SECTORS];
+static uint64_t flashBytesWritten = 0;
+static uint64_t flashCutBytes = 0;
+static bool flashCut = false;
+
+static std::mutex criticalMutex;
+
+typedef struct {
+    FILE *f;
+    char path[HAL_NATIVE_PATH_SIZE];
+    bool writable;
+    uint32_t syncedSize;
+} native_file_t;
+
+static native_file_t files[HAL_FILES];
+static const char *fsRoot = NULL;
+
+static const char *imageFile = NULL;  // the running image
+static const char *slotFile = NULL;   // the other OTA slot
+static size_t slotSize = 0;
+static FILE *imageF = NULL;
+static FILE *slotF = NULL;
+static uint32_t slotErases = 0;
+static bool slotActivated = false;
+static uint64_t powerCutBytes = 0;
+static bool powerCut = false;
+static uint64_t fsBytesWritten = 0;
+static uint32_t fsSyncs = 0;
+
+static int udpSocket = -1;
+static uint8_t udpIndex = 0;
+static uint8_t udpNodes = 1;
+static uint8_t udpLossPercent = 0;
+static uint32_t udpLossSeed = 1;
+
+void halNativeReset() {
+    nowUs = 0;
+    memset(analogValues, 0, sizeof(analogValues));
+    memset(pinLevels, 0, sizeof(pinLevels));
+    memset(inputLevels, HAL_HIGH, sizeof(inputLevels));
+    memset(pinModes, 0, sizeof(pinModes));
+    memset(readers, 0, sizeof(readers));
+    memset(tickers, 0, sizeof(tickers));
+    tickerCount = 0;
+    memset(&tick, 0, sizeof(tick));
+    pinHook = NULL;
+    memset(storage, 0xFF, sizeof(storage));  // erased flash
+    storageSize = 0;
+    storageCommits = 0;
+    memset(flash, 0xFF, sizeof(flash));
+    flashErases = 0;
+    memset(flashSectorErases, 0, sizeof(flashSectorErases));
+    flashBytesWritten = 0;
+    flashCutBytes = 0;
+    flashCut = false;
+    powerCutBytes = 0;
+    powerCut = false;
+    for (int8_t i = 0; i < HAL_FILES; i++) {
+        halFileClose(i);
+    }
+    fsBytesWritten = 0;
+    fsSyncs = 0;
+    slotErases = 0;
+    slotActivated = false;
+}
+
+static uint64_t tickWakeAfter(uint64_t interruptUs) {
+    return interruptUs + (tickLatency ? tickLatency(tickLatencyArg) : 0);
+}
+
+// the tick task, with every interrupt that came by the time it runs
+static void runTick() {
+    if (tick.wakeUs > nowUs) nowUs = tick.wakeUs;
+    uint32_t ticks = 1 + (nowUs - tick.interruptUs) / tick.periodUs;
+    tick.interruptUs += (uint64_t)ticks * tick.periodUs;
+    tick.fn(tick.arg, ticks, (uint32_t)(tick.interruptUs - tick.periodUs));
+    // an interrupt during the call is served right after it
+    tick.wakeUs = nowUs >= tick.interruptUs ? nowUs : tickWakeAfter(tick.interruptUs);
+}
+
+// moves the clock forward, firing due tickers and the tick task in time order on the way
+static void advanceTo(uint64_t targetUs) {
+    while (!inTicker) {
+        native_ticker_t *due = NULL;
+        for (uint8_t i = 0; i < tickerCount; i++) {
+            if (tickers[i].running && tickers[i].nextUs <= targetUs && (!due || tickers[i].nextUs < due->nextUs)) {
+                due = &tickers[i];
+            }
+        }
+        bool tickDue = tick.running && tick.wakeUs <= targetUs && (!due || tick.wakeUs < due->nextUs);
+        if (!due && !tickDue) break;
+        inTicker = true;  // delays inside a ticker just move the clock
+        if (tickDue) {
+            runTick();
+        } else {
+            if (due->nextUs > nowUs) nowUs = due->nextUs;
+            due->nextUs += due->periodUs;
+            due->fn(due->arg);
+        }
+        inTicker = false;
+    }
+    if (targetUs > nowUs) nowUs = targetUs;
+}
+
+void halNativeSetMicros(uint64_t us) {
+    nowUs = us;
+    for (uint8_t i = 0; i < tickerCount; i++) {
+        tickers[i].nextUs = nowUs + tickers[i].periodUs;
+    }
+    if (tick.running) {
+        tick.interruptUs = nowUs + tick.periodUs;
+        tick.wakeUs = tickWakeAfter(tick.interruptUs);
+    }
+}
+
+void halNativeSetTickLatency(hal_native_tick_latency_t latency, void *arg) {
+    tickLatency = latency;
+    tickLatencyArg = arg;
+}
+
+void halNativeAdvanceMicros(uint64_t us) {
+    advanceTo(nowUs + us);
+}
+
+uint64_t halNativeMicros64() {
+    return nowUs;
+}
+
+void halNativeSetAnalog(uint8_t pin, uint16_t value) {
+    if (pin < HAL_NATIVE_PINS) analogValues[pin] = value;
+}
+
+void halNativeSetDigitalInput(uint8_t pin, uint8_t val) {
+    if (pin < HAL_NATIVE_PINS) inputLevels[pin] = val;
+}
+
+uint8_t halNativeGetPin(uint8_t pin) {
+    return pin < HAL_NATIVE_PINS ? pinLevels[pin] : HAL_LOW;
+}
+
+hal_pin_mode_e halNativeGetPinMode(uint8_t pin) {
+    return pin < HAL_NATIVE_PINS ? pinModes[pin] : HAL_INPUT;
+}
+
+void halNativeSetPinHook(hal_native_pin_hook_t hook, void *arg) {
+    pinHook = hook;
+    pinHookArg = arg;
+}
+
+void halNativeSetStorageFile(const char *path) {
+    storageFile = path;
+}
+
+uint32_t halNativeGetStorageCommits() {
+    return storageCommits;
+}
+
+void halNativeSetFlashSectors(uint8_t sectors) {
+    if (sectors > HAL_NATIVE_FLASH_SECTORS) sectors = HAL_NATIVE_FLASH_SECTORS;
+    flashSize = sectors * HAL_FLASH_SECTOR_SIZE;
+}
+
+uint32_t halNativeGetFlashErases() {
+    return flashErases;
+}
+
+uint32_t halNativeGetFlashSectorErases(uint8_t sector) {
+    return sector < HAL_NATIVE_FLASH_SECTORS ? flashSectorErases[sector] : 0;
+}
+
+uint64_t halNativeGetFlashBytesWritten() {
+    return flashBytesWritten;
+}
+
+void halNativeSetFlashCut(uint64_t afterBytes) {
+    flashCutBytes = afterBytes;
+    flashCut = false;
+}
+
+bool halNativeFlashCutHit() {
+    return flashCut;
+}
+
+void halNativeSetImageFiles(const char *running, const char *slot, size_t size) {
+    if (imageF) fclose(imageF);
+    if (slotF) fclose(slotF);
+    imageF = slotF = NULL;
+    imageFile = running;
+    slotFile = slot;
+    slotSize = size - size % HAL_FLASH_SECTOR_SIZE;
+}
+
+uint32_t halNativeGetUpdateErases() {
+    return slotErases;
+}
+
+bool halNativeUpdateActivated() {
+    return slotActivated;
+}
+
+void halNativeSetFsRoot(const char *path) {
+    fsRoot = path;
+}
+
+void halNativeSetPowerCut(uint64_t afterBytes) {
+    powerCutBytes = afterBytes;
+}
+
+bool halNativePowerCutHit() {
+    return powerCut;
+}
+
+void halNativePowerLoss(uint32_t seed) {
+    for (int8_t i = 0; i < HAL_FILES; i++) {
+        native_file_t *file = &files[i];
+        if (!file->f) continue;
+        if (file->writable) {
+            fflush(file->f);
+            long size = ftell(file->f);
+            fclose(file->f);
+            seed = seed * 1103515245 + 12345;
+            uint32_t unsynced = size > (long)file->syncedSize ? size - file->syncedSize : 0;
+            uint32_t kept = file->syncedSize + (seed >> 8) % (unsynced + 1);
+            if (truncate(file->path, kept)) perror(file->path);
+        } else {
+            fclose(file->f);
+        }
+        file->f = NULL;
+    }
+    powerCutBytes = 0;
+    powerCut = false;
+}
+
+uint64_t halNativeGetFsBytesWritten() {
+    return fsBytesWritten;
+}
+
+uint32_t halNativeGetFsSyncs() {
+    return fsSyncs;
+}
+
+uint32_t halMillis() {
+    return (uint32_t)(nowUs / 1000);
+}
+
+uint32_t halMicros() {
+    return (uint32_t)nowUs;
+}
+
+uint32_t halCycles() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t halCyclesPerUs() {
+    return 1000;
+}
+
+void halDelay(uint32_t ms) {
+    advanceTo(nowUs + (uint64_t)ms * 1000);
+}
+
+void halDelayMicroseconds(uint32_t us) {
+    advanceTo(nowUs + us);
+}
+
+int8_t halTickerCreate(hal_ticker_fn_t fn, void *arg) {
+    if (tickerCount >= HAL_TICKERS) return -1;
+    tickers[tickerCount].fn = fn;
+    tickers[tickerCount].arg = arg;
+    tickers[tickerCount].running = false;
+    return tickerCount++;
+}
+
+void halTickerStart(int8_t ticker, uint32_t periodUs) {
+    if (ticker < 0 || ticker >= tickerCount || periodUs == 0) return;
+    tickers[ticker].periodUs = periodUs;
+    tickers[ticker].nextUs = nowUs + periodUs;
+    tickers[ticker].running = true;
+}
+
+void halTickerStop(int8_t ticker) {
+    if (ticker < 0 || ticker >= tickerCount) return;
+    tickers[ticker].running = false;
+}
+
+bool halTickStart(hal_tick_fn_t fn, void *arg, uint32_t periodUs) {
+    if (tick.running || periodUs == 0) return false;
+    tick.fn = fn;
+    tick.arg = arg;
+    tick.periodUs = periodUs;
+    tick.interruptUs = nowUs + periodUs;
+    tick.wakeUs = tickWakeAfter(tick.interruptUs);
+    tick.running = true;
+    return true;
+}
+
+uint16_t halAnalogRead(uint8_t pin) {
+    for (uint8_t i = 0; i < HAL_ANALOG_READERS; i++) {
+        if (readers[i] && readerPins[i] == pin) return readers[i](pin);
+    }
+    return pin < HAL_NATIVE_PINS ? analogValues[pin] : 0;
+}
+
+void halSetAnalogReader(uint8_t pin, hal_analog_reader_t reader) {
+    for (uint8_t i = 0; i < HAL_ANALOG_READERS; i++) {
+        if (!readers[i] || readerPins[i] == pin) {
+            readerPins[i] = pin;
+            readers[i] = reader;
+            return;
+        }
+    }
+}
+
+void halPinMode(uint8_t pin, hal_pin_mode_e mode) {
+    if (pin >= HAL_NATIVE_PINS) return;
+    pinModes[pin] = mode;
+    if (pinHook) pinHook(pinHookArg, pin);
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t val) {
+    if (pin >= HAL_NATIVE_PINS) return;
+    pinLevels[pin] = val ? HAL_HIGH : HAL_LOW;
+    if (pinHook) pinHook(pinHookArg, pin);
+}
+
+uint8_t halDigitalRead(uint8_t pin) {
+    if (pin >= HAL_NATIVE_PINS) return HAL_LOW;
+    return pinModes[pin] == HAL_OUTPUT ? pinLevels[pin] : inputLevels[pin];
+}
+
+bool halStorageBegin(size_t size) {
+    if (size > HAL_NATIVE_STORAGE_SIZE) return false;
+    storageSize = size;
+    if (storageFile) {
+        FILE *f = fopen(storageFile, "rb");
+        if (f) {
+            fread(storage, 1, storageSize, f);
+            fclose(f);
+        }
+    }
+    return true;
+}
+
+void halStorageRead(size_t address, void *data, size_t len) {
+    if (address + len > storageSize) return;
+    memcpy(data, &storage[address], len);
+}
+
+void halStorageWrite(size_t address, const void *data, size_t len) {
+    if (address + len > storageSize) return;
+    memcpy(&storage[address], data, len);
+}
+
+size_t halFlashBegin() {
+    return flashSize;
+}
+
+bool halFlashRead(uint32_t address, void *data, size_t len) {
+    if (flashCut || address + len > flashSize) return false;
+    memcpy(data, &flash[address], len);
+    return true;
+}
+
+// how much of an operation of len bytes gets done before an armed cut
+static size_t flashBudget(size_t len) {
+    if (flashCutBytes && flashBytesWritten + len >= flashCutBytes) {
+        len = flashCutBytes - flashBytesWritten;
+        flashCut = true;
+    }
+    flashBytesWritten += len;
+    return len;
+}
+
+bool halFlashWrite(uint32_t address, const void *data, size_t len) {
+    if (flashCut || address + len > flashSize) return false;
+    size_t done = flashBudget(len);
+    for (size_t i = 0; i < done; i++) {
+        flash[address + i] &= ((const uint8_t *)data)[i];
+    }
+    return !flashCut;
+}
+
+bool halFlashErase(uint32_t address) {
+    if (flashCut || address % HAL_FLASH_SECTOR_SIZE || address + HAL_FLASH_SECTOR_SIZE > flashSize) return false;
+    memset(&flash[address], 0xFF, flashBudget(HAL_FLASH_SECTOR_SIZE));
+    flashErases++;
+    flashSectorErases[address / HAL_FLASH_SECTOR_SIZE]++;
+    return !flashCut;
+}
+
+size_t halImageSize() {
+    if (!imageF && imageFile) imageF = fopen(imageFile, "rb");
+    if (!imageF || fseek(imageF, 0, SEEK_END)) return 0;
+    return ftell(imageF);
+}
+
+bool halImageRead(uint32_t address, void *data, size_t len) {
+    return halImageSize() >= address + len && !fseek(imageF, address, SEEK_SET) && fread(data, 1, len, imageF) == len;
+}
+
+// a slot file that is missing or short is made up with erased sectors
+size_t halUpdateBegin() {
+    if (slotF) return slotSize;
+    if (!slotFile || !slotSize) return 0;
+    slotF = fopen(slotFile, "r+b");
+    if (!slotF) slotF = fopen(slotFile, "w+b");
+    if (!slotF) return 0;
+    fseek(slotF, 0, SEEK_END);
+    uint8_t erased[HAL_FLASH_SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t at = ftell(slotF); at < slotSize; at += sizeof(erased)) {
+        fwrite(erased, 1, slotSize - at < sizeof(erased) ? slotSize - at : sizeof(erased), slotF);
+    }
+    fflush(slotF);
+    return slotSize;
+}
+
+bool halUpdateRead(uint32_t address, void *data, size_t len) {
+    return slotF && address + len <= slotSize && !fseek(slotF, address, SEEK_SET) && fread(data, 1, len, slotF) == len;
+}
+
+// NOR flash like the raw region, written bits only clear
+bool halUpdateWrite(uint32_t address, const void *data, size_t len) {
+    uint8_t buf[HAL_FLASH_SECTOR_SIZE];
+    for (size_t done = 0; done < len;) {
+        size_t n = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        if (!halUpdateRead(address + done, buf, n)) return false;
+        for (size_t i = 0; i < n; i++) {
+            buf[i] &= ((const uint8_t *)data)[done + i];
+        }
+        if (fseek(slotF, address + done, SEEK_SET) || fwrite(buf, 1, n, slotF) != n) return false;
+        done += n;
+    }
+    return !fflush(slotF);
+}
+
+bool halUpdateErase(uint32_t address) {
+    if (!slotF || address % HAL_FLASH_SECTOR_SIZE || address + HAL_FLASH_SECTOR_SIZE > slotSize) return false;
+    uint8_t erased[HAL_FLASH_SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    slotErases++;
+    return !fseek(slotF, address, SEEK_SET) && fwrite(erased, 1, sizeof(erased), slotF) == sizeof(erased) && !fflush(slotF);
+}
+
+// the bootloader's first check, an image starts with its magic byte
+bool halUpdateActivate() {
+    uint8_t magic;
+    slotActivated = halUpdateRead(0, &magic, 1) && magic == HAL_NATIVE_IMAGE_MAGIC;
+    return slotActivated;
+}
+
+static bool hostPath(const char *path, char *out) {
+    if (!fsRoot || powerCut) return false;
+    return snprintf(out, HAL_NATIVE_PATH_SIZE, "%s%s", fsRoot, path) < HAL_NATIVE_PATH_SIZE;
+}
+
+static native_file_t *openFile(int8_t file) {
+    if (file < 0 || file >= HAL_FILES || !files[file].f || powerCut) return NULL;
+    return &files[file];
+}
+
+void halCriticalEnter() {
+    criticalMutex.lock();
+}
+
+void halCriticalExit() {
+    criticalMutex.unlock();
+}
+
+bool halFsBegin() {
+    struct stat st;
+    return fsRoot && !powerCut && stat(fsRoot, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int8_t halFileOpen(const char *path, hal_file_mode_e mode) {
+    int8_t file = -1;
+    for (int8_t i = 0; i < HAL_FILES && file < 0; i++) {
+        if (!files[i].f) file = i;
+    }
+    if (file < 0) return -1;
+    native_file_t *f = &files[file];
+    if (!hostPath(path, f->path)) return -1;
+    const char *modes[] = {"rb", "wb", "ab"};
+    f->f = fopen(f->path, modes[mode]);
+    if (!f->f) return -1;
+    f->writable = mode != HAL_FILE_READ;
+    fseek(f->f, 0, SEEK_END);
+    f->syncedSize = ftell(f->f);
+    fseek(f->f, 0, SEEK_SET);
+    return file;
+}
+
+size_t halFileRead(int8_t file, void *data, size_t len) {
+    native_file_t *f = openFile(file);
+    return f ? fread(data, 1, len, f->f) : 0;
+}
+
+size_t halFileWrite(int8_t file, const void *data, size_t len) {
+    native_file_t *f = openFile(file);
+    if (!f || !f->writable) return 0;
+    if (powerCutBytes) {
+        if (fsBytesWritten + len >= powerCutBytes) {
+            len = powerCutBytes - fsBytesWritten;
+            powerCut = true;
+        }
+    }
+    size_t written = fwrite(data, 1, len, f->f);
+    fsBytesWritten += written;
+    return powerCut ? 0 : written;
+}
+
+bool halFileSeek(int8_t file, uint32_t position) {
+    native_file_t *f = openFile(file);
+    return f && fseek(f->f, position, SEEK_SET) == 0;
+}
+
+uint32_t halFileSize(int8_t file) {
+    native_file_t *f = openFile(file);
+    if (!f) return 0;
+    fflush(f->f);
+    struct stat st;
+    return fstat(fileno(f->f), &st) == 0 ? st.st_size : 0;
+}
+
+bool halFileSync(int8_t file) {
+    native_file_t *f = openFile(file);
+    if (!f || fflush(f->f)) return false;
+    f->syncedSize = halFileSize(file);
+    fsSyncs++;
+    return true;
+}
+
+void halFileClose(int8_t file) {
+    if (file < 0 || file >= HAL_FILES || !files[file].f) return;
+    if (powerCut) return;  // left for halNativePowerLoss
+    fclose(files[file].f);
+    files[file].f = NULL;
+    if (files[file].writable) fsSyncs++;
+}
+
+bool halFileExists(const char *path) {
+    char p[HAL_NATIVE_PATH_SIZE];
+    struct stat st;
+    return hostPath(path, p) && stat(p, &st) == 0;
+}
+
+bool halFileRemove(const char *path) {
+    char p[HAL_NATIVE_PATH_SIZE];
+    return hostPath(path, p) && unlink(p) == 0;
+}
+
+bool halFileRename(const char *from, const char *to) {
+    char a[HAL_NATIVE_PATH_SIZE], b[HAL_NATIVE_PATH_SIZE];
+    return hostPath(from, a) && hostPath(to, b) && rename(a, b) == 0;
+}
+
+bool halMkdir(const char *path) {
+    char p[HAL_NATIVE_PATH_SIZE];
+    return hostPath(path, p) && mkdir(p, 0755) == 0;
+}
+
+bool halStorageCommit() {
+    storageCommits++;
+    if (!storageFile) return true;
+    FILE *f = fopen(storageFile, "wb");
+    if (!f) return false;
+    size_t written = fwrite(storage, 1, storageSize, f);
+    fclose(f);
+    return written == storageSize;
+}
+
+void halNativeSetUdpNodes(uint8_t index, uint8_t nodes) {
+    udpIndex = index;
+    udpNodes = nodes ? nodes : 1;
+}
+
+void halNativeSetUdpLoss(uint8_t percent, uint32_t seed) {
+    udpLossPercent = percent;
+    udpLossSeed = seed ? seed : 1;
+}
+
+bool halNativeUdpWait(uint32_t timeoutUs) {
+    if (udpSocket < 0) return false;
+    struct pollfd p = {udpSocket, POLLIN, 0};
+    return poll(&p, 1, (timeoutUs + 999) / 1000) > 0;
+}
+
+bool halUdpBegin(uint16_t port) {
+    halUdpEnd();
+    udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket < 0) return false;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port + udpIndex);
+    if (bind(udpSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || fcntl(udpSocket, F_SETFL, O_NONBLOCK) < 0) {
+        halUdpEnd();
+        return false;
+    }
+    return true;
+}
+
+void halUdpEnd() {
+    if (udpSocket >= 0) close(udpSocket);
+    udpSocket = -1;
+}
+
+static bool udpSendTo(uint32_t address, uint16_t port, const void *data, size_t len) {
+    udpLossSeed = udpLossSeed * 1103515245 + 12345;
+    if ((udpLossSeed >> 8) % 100 < udpLossPercent) return true;  // lost on the way
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(address);
+    addr.sin_port = htons(port);
+    return sendto(udpSocket, data, len, 0, (struct sockaddr *)&addr, sizeof(addr)) == (ssize_t)len;
+}
+
+bool halUdpSend(const hal_udp_peer_t *to, const void *data, size_t len) {
+    if (udpSocket < 0 || len > HAL_UDP_MAX_SIZE) return false;
+    if (to->address != HAL_UDP_BROADCAST) return udpSendTo(to->address, to->port, data, len);
+    bool sent = true;
+    for (uint8_t i = 0; i < udpNodes; i++) {
+        sent = udpSendTo(INADDR_LOOPBACK, to->port + i, data, len) && sent;
+    }
+    return sent;
+}
+
+size_t halUdpReceive(void *data, size_t len, hal_udp_peer_t *from, uint32_t *arrivalUs) {
+    if (udpSocket < 0) return 0;
+    uint8_t buf[HAL_UDP_MAX_SIZE + 1];
+    struct sockaddr_in addr = {};
+    socklen_t addrLen = sizeof(addr);
+    for (;;) {
+        ssize_t n = recvfrom(udpSocket, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addrLen);
+        if (n <= 0) return 0;
+        if (n > HAL_UDP_MAX_SIZE) continue;  // dropped like on the ESP32
+        size_t copied = (size_t)n < len ? n : len;
+        memcpy(data, buf, copied);
+        from->address = ntohl(addr.sin_addr.s_addr);
+        from->port = ntohs(addr.sin_port);
+        *arrivalUs = (uint32_t)nowUs;
+        return copied;
+    }
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdint.h>
+
+#include "hal.h"
+
+#pragma once
+
+/*
+ * Host side controls for the simulated hardware. Time only moves when the
+ * simulator (or a halDelay call) advances it, which is what lets traces run
+ * much faster than real time. Tickers due on the way fire at their exact
+ * simulated time, a jump with halNativeSetMicros skips them. The tick task
+ * runs after each timer interrupt plus a latency the simulator may set, and
+ * is handed every interrupt that came meanwhile, as on the ESP32.
+ *
+ * A pin hook sees every pin write and mode change, e.g. to record a bus or
+ * to model the device on the other end of it.
+ *
+ * Files live below a host directory. A power cut can be armed to hit after
+ * a number of written bytes, the write in flight is cut short and every file
+ * operation fails from then on. halNativePowerLoss then reboots the
+ * filesystem: open files lose a random part of what was written since their
+ * last sync, which is worse than LittleFS (that drops all of it) on purpose.
+ *
+ * UDP is a socket on the loopback interface. Several node processes run on
+ * one host by each taking its own port, the base port plus its index, and a
+ * broadcast goes to the ports of all of them. A datagram arrives when
+ * halUdpReceive picks it up, so the caller polls or waits on halNativeUdpWait.
+ *
+ * The raw flash region behaves like NOR flash: writes AND into what is there
+ * and only an erase brings a sector back to 0xFF. It counts erases and
+ * written bytes, and has its own power cut: the write or erase in flight
+ * stops part way and every flash operation fails until it is disarmed.
+ *
+ * The firmware images are host files: the running one is read as it is, the
+ * OTA slot is NOR flash like the raw region. Activating the slot only checks
+ * the magic byte an ESP32 image starts with.
+ */
+
+#define HAL_NATIVE_PINS 64
+#define HAL_NATIVE_STORAGE_SIZE 4096
+#define HAL_NATIVE_PATH_SIZE 256
+#define HAL_NATIVE_FLASH_SECTORS 4  // the size of the config partition
+#define HAL_NATIVE_IMAGE_MAGIC 0xE9
+
+void halNativeReset();
+
+void halNativeSetMicros(uint64_t us);
+void halNativeAdvanceMicros(uint64_t us);
+uint64_t halNativeMicros64();
+
+typedef uint32_t (*hal_native_tick_latency_t)(void *arg);  // us from a timer interrupt to the tick task running
+void halNativeSetTickLatency(hal_native_tick_latency_t latency, void *arg);  // NULL for none, kept over halNativeReset
+
+void halNativeSetAnalog(uint8_t pin, uint16_t value);
+void halNativeSetDigitalInput(uint8_t pin, uint8_t val);
+uint8_t halNativeGetPin(uint8_t pin);
+hal_pin_mode_e halNativeGetPinMode(uint8_t pin);
+
+typedef void (*hal_native_pin_hook_t)(void *arg, uint8_t pin);
+void halNativeSetPinHook(hal_native_pin_hook_t hook, void *arg);
+
+// optional file backing for the storage image, loaded on halStorageBegin and written on commit
+void halNativeSetStorageFile(const char *path);
+uint32_t halNativeGetStorageCommits();
+
+void halNativeSetFlashSectors(uint8_t sectors);  // 0 for a device without the region, kept over halNativeReset
+uint32_t halNativeGetFlashErases();
+uint32_t halNativeGetFlashSectorErases(uint8_t sector);
+uint64_t halNativeGetFlashBytesWritten();
+void halNativeSetFlashCut(uint64_t afterBytes);  // of written bytes, an erase counts as a sector; 0 disarms
+bool halNativeFlashCutHit();
+
+void halNativeSetImageFiles(const char *running, const char *slot, size_t slotSize);  // kept over halNativeReset
+uint32_t halNativeGetUpdateErases();
+bool halNativeUpdateActivated();  // since halNativeReset
+
+void halNativeSetFsRoot(const char *path);
+void halNativeSetPowerCut(uint64_t afterBytes);  // 0 disarms
+bool halNativePowerCutHit();
+void halNativePowerLoss(uint32_t seed);
+uint64_t halNativeGetFsBytesWritten();
+uint32_t halNativeGetFsSyncs();
+
+void halNativeSetUdpNodes(uint8_t index, uint8_t nodes);  // before halUdpBegin, this process is node index of nodes
+void halNativeSetUdpLoss(uint8_t percent, uint32_t seed);  // of the datagrams sent, dropped at random
+bool halNativeUdpWait(uint32_t timeoutUs);  // until a datagram is waiting, false on timeout
@@ -0,0 +1,193 @@
+#include "hopper.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hal.h"
+
+void FrequencyHopper::init(Config *config, RX5808 *rx5808, uint8_t count) {
+    conf = config;
+    if (count < 1) count = 1;
+    if (count > BOARD_MAX_RECEIVERS) count = BOARD_MAX_RECEIVERS;
+    receiverCount = count;
+    memset(receivers, 0, sizeof(receivers));
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        receivers[i].rx = &rx5808[i];
+    }
+    pilots = 0;
+    memset(frequencies, 0, sizeof(frequencies));
+    scheduleChanged();
+    resetStats();
+}
+
+bool FrequencyHopper::scheduleChanged() {
+    uint8_t count = conf->getPilotCount();
+    if (count < 1) count = 1;
+    if (count > CONFIG_MAX_PILOTS) count = CONFIG_MAX_PILOTS;
+
+    bool changed = count != pilots;
+    pilots = count;
+    for (uint8_t i = 0; i < pilots; i++) {
+        uint16_t frequency = conf->getPilotFrequency(i);
+        if (frequency != frequencies[i]) {
+            frequencies[i] = frequency;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// pilots receiver, receiver + receiverCount, ... are timed on the receiver
+uint8_t FrequencyHopper::slotsOf(uint8_t receiver) {
+    if (receiver >= pilots) return 0;
+    return (pilots - receiver + receiverCount - 1) / receiverCount;
+}
+
+uint32_t FrequencyHopper::handleHop(uint32_t currentTimeMs) {
+    if (suspended) return SCHEDULER_IDLE;
+    if (scheduleChanged()) {
+        DEBUG("Hopping between %u frequencies on %u receivers\n", pilots, receiverCount);
+        for (uint8_t i = 0; i < receiverCount; i++) {
+            if (receivers[i].stable) closeWindow(receivers[i], halMicros());
+            receivers[i].stable = false;
+            receivers[i].slot = 0;
+        }
+        resetStats();
+    }
+
+    uint32_t dueMs = SCHEDULER_IDLE;
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        uint32_t receiverDueMs = handleReceiver(receivers[i], i, currentTimeMs);
+        if (receiverDueMs < dueMs) dueMs = receiverDueMs;
+    }
+    return dueMs;
+}
+
+uint32_t FrequencyHopper::handleReceiver(hop_receiver_t &r, uint8_t index, uint32_t currentTimeMs) {
+    uint8_t slots = slotsOf(index);
+    if (slots == 0) return r.rx->handleFrequencyChange(currentTimeMs, POWER_DOWN_FREQ_MHZ);
+
+    if (slots > 1 && r.stable && (currentTimeMs - r.stableSinceMs) >= FREQHOP_DWELL_MS) {
+        closeWindow(r, halMicros());
+        r.stable = false;
+        r.slot = (r.slot + 1) % slots;
+    }
+
+    // tuning is over if it was found over on entry, the frequency check that may follow doesn't disturb RSSI
+    uint8_t pilot = index + r.slot * receiverCount;
+    uint32_t nowUs = halMicros();
+    uint32_t dueMs = r.rx->handleFrequencyChange(currentTimeMs, frequencies[pilot]);
+    if (!r.stable && !r.rx->isTuning() && r.rx->getFrequency() == frequencies[pilot]) {
+        r.stable = true;
+        r.stableSinceMs = currentTimeMs;
+        openWindow(r, pilot, nowUs);
+    }
+    if (slots > 1 && r.stable) {
+        uint32_t hopDueMs = FREQHOP_DWELL_MS - (currentTimeMs - r.stableSinceMs);
+        if (hopDueMs < dueMs) dueMs = hopDueMs;
+    }
+    return dueMs;
+}
+
+int8_t FrequencyHopper::pilotAt(uint8_t receiver, uint32_t timeUs) {
+    if (receiver >= receiverCount) return -1;
+    // newest first, the slot after the newest may be in the middle of being rewritten
+    const hop_receiver_t &r = receivers[receiver];
+    uint8_t newest = r.latest;
+    for (uint8_t n = 0; n < FREQHOP_WINDOWS - 1; n++) {
+        const hop_window_t &w = r.windows[(newest + FREQHOP_WINDOWS - n) % FREQHOP_WINDOWS];
+        if ((int32_t)(timeUs - w.fromUs) < 0) continue;
+        if (w.open || (int32_t)(timeUs - w.toUs) < 0) return w.pilot;
+        return -1;  // between two windows, receiver was tuning
+    }
+    return -1;
+}
+
+uint8_t FrequencyHopper::getPilotCount() {
+    return pilots;
+}
+
+uint8_t FrequencyHopper::getReceiverCount() {
+    return receiverCount;
+}
+
+// frames from now on belong to no pilot, the receivers tune back on resume
+void FrequencyHopper::suspend() {
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        if (receivers[i].stable) closeWindow(receivers[i], halMicros());
+        receivers[i].stable = false;
+    }
+    suspended = true;
+}
+
+void FrequencyHopper::resume() {
+    suspended = false;
+}
+
+bool FrequencyHopper::isSuspended() {
+    return suspended;
+}
+
+void FrequencyHopper::openWindow(hop_receiver_t &r, uint8_t pilot, uint32_t timeUs) {
+    uint8_t next = (r.latest + 1) % FREQHOP_WINDOWS;
+    r.windows[next].pilot = pilot;
+    r.windows[next].fromUs = timeUs;
+    r.windows[next].toUs = 0;
+    r.windows[next].open = true;
+    r.latest = next;
+
+    hop_stats_t &s = stats[pilot];
+    if (s.windows > 0 && (timeUs - s.lastEndUs) > s.worstGapUs) {
+        s.worstGapUs = timeUs - s.lastEndUs;
+    }
+}
+
+void FrequencyHopper::closeWindow(hop_receiver_t &r, uint32_t timeUs) {
+    hop_window_t &w = r.windows[r.latest];
+    w.toUs = timeUs;
+    w.open = false;
+
+    hop_stats_t &s = stats[w.pilot];
+    s.windows++;
+    s.observedUs += timeUs - w.fromUs;
+    s.lastEndUs = timeUs;
+}
+
+void FrequencyHopper::resetStats() {
+    memset(stats, 0, sizeof(stats));
+    statsStartUs = halMicros();
+}
+
+// source rate scaled by the share of time the pilot's receiver was on it
+uint32_t FrequencyHopper::getEffectiveRateHz(uint8_t pilot, uint32_t sourceRateHz) {
+    uint32_t nowUs = halMicros();
+    uint32_t elapsedUs = nowUs - statsStartUs;
+    uint32_t observedUs = stats[pilot].observedUs;
+    const hop_receiver_t &r = receivers[pilot % receiverCount];
+    const hop_window_t &w = r.windows[r.latest];
+    if (w.open && w.pilot == pilot) {
+        observedUs += nowUs - w.fromUs;
+    }
+    if (elapsedUs == 0) return 0;
+    if (observedUs > elapsedUs) observedUs = elapsedUs;  // window opened before the reset
+    return (uint64_t)sourceRateHz * observedUs / elapsedUs;
+}
+
+uint32_t FrequencyHopper::getWorstGapUs(uint8_t pilot) {
+    return stats[pilot].worstGapUs;
+}
+
+void FrequencyHopper::toStatusString(char *buf, size_t size, uint32_t sourceRateHz) {
+    size_t len = 0;
+    buf[0] = 0;
+    for (uint8_t i = 0; i < pilots && len < size; i++) {
+        if (receiverCount > 1) {
+            len += snprintf(buf + len, size - len, "\tPilot %u:\t%u MHz, receiver %u, %u Hz, worst gap %u ms\n", i + 1, frequencies[i],
+                            i % receiverCount + 1, getEffectiveRateHz(i, sourceRateHz), getWorstGapUs(i) / 1000);
+        } else {
+            len += snprintf(buf + len, size - len, "\tPilot %u:\t%u MHz, %u Hz, worst gap %u ms\n", i + 1, frequencies[i],
+                            getEffectiveRateHz(i, sourceRateHz), getWorstGapUs(i) / 1000);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+
+#include "RX5808.h"
+#include "board.h"
+#include "config.h"
+
+#pragma once
+
+#define FREQHOP_DWELL_MS (RX5808_MIN_BUSTIME + 1)  // stable time per pilot, the bus can't be used again any earlier
+#define FREQHOP_WINDOWS 8                           // recent stable windows kept for attributing frames
+
+typedef struct {
+    uint8_t pilot;
+    bool open;
+    uint32_t fromUs;
+    uint32_t toUs;
+} hop_window_t;
+
+typedef struct {
+    uint32_t windows;
+    uint32_t observedUs;  // total stable time
+    uint32_t worstGapUs;  // longest time between two windows, nothing is seen of the pilot meanwhile
+    uint32_t lastEndUs;
+} hop_stats_t;
+
+typedef struct {
+    RX5808 *rx;
+    uint8_t slot;  // index into the pilots the receiver cycles through
+    bool stable;
+    uint32_t stableSinceMs;
+    hop_window_t windows[FREQHOP_WINDOWS];
+    volatile uint8_t latest;
+} hop_receiver_t;
+
+/*
+ * Owns the receiver frequency. With one pilot it follows the configured
+ * frequency like before; with more it cycles through the pilot frequencies,
+ * staying FREQHOP_DWELL_MS on each once the RX5808 has settled.
+ *
+ * With several receivers the pilots are dealt out round robin, receiver r
+ * takes pilots r, r + receivers, ..., so with as many receivers as pilots
+ * nothing hops. A receiver left without a pilot is parked on
+ * POWER_DOWN_FREQ_MHZ.
+ *
+ * The time a receiver was stable on each pilot is kept as a window, so RSSI
+ * frames can be attributed by their timestamp no matter how late they are
+ * processed. Windows are written by the task calling handleHop and read by
+ * pilotAt from the lap timer, a window is filled in before it is published.
+ */
+class FrequencyHopper {
+   public:
+    void init(Config *config, RX5808 *rx5808, uint8_t count = 1);  // count receivers at rx5808
+    uint32_t handleHop(uint32_t currentTimeMs);  // ms until the next hop or tuning step
+    int8_t pilotAt(uint32_t timeUs) { return pilotAt(0, timeUs); }
+    int8_t pilotAt(uint8_t receiver, uint32_t timeUs);
+    uint8_t getPilotCount();
+    uint8_t getReceiverCount();
+    void suspend();  // the receivers are left to someone else, from the task calling handleHop
+    void resume();
+    bool isSuspended();
+    void resetStats();
+    uint32_t getEffectiveRateHz(uint8_t pilot, uint32_t sourceRateHz);
+    uint32_t getWorstGapUs(uint8_t pilot);
+    void toStatusString(char *buf, size_t size, uint32_t sourceRateHz);
+
+   private:
+    Config *conf;
+    hop_receiver_t receivers[BOARD_MAX_RECEIVERS];
+    uint8_t receiverCount;
+    bool suspended = false;
+
+    uint8_t pilots;
+    uint16_t frequencies[CONFIG_MAX_PILOTS];
+
+    hop_stats_t stats[CONFIG_MAX_PILOTS];
+    uint32_t statsStartUs;
+
+    bool scheduleChanged();
+    uint8_t slotsOf(uint8_t receiver);
+    uint32_t handleReceiver(hop_receiver_t &r, uint8_t index, uint32_t currentTimeMs);
+    void openWindow(hop_receiver_t &r, uint8_t pilot, uint32_t timeUs);
+    void closeWindow(hop_receiver_t &r, uint32_t timeUs);
+};
@@ -0,0 +1,160 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma once
+
+/*
+ * Fixed point version of KalmanFilter for the 8 bit RSSI path.
+ *
+ * With A = C = 1, B = 0 and fixed noise parameters the covariance, and with it
+ * the Kalman gain, evolves the same way whatever the measurements are. So the
+ * gain sequence is computed once in floating point when the noise is set and
+ * filtering is just x += K[n] * (z - x) in integer math, with K[n] settling on
+ * the steady state gain after a few hundred samples. No divide and no FPU use
+ * per sample, which matters on the ESP32-C3.
+ *
+ * The state is kept with FRAC_BITS fractional bits (Q16 or Q15). Compared to
+ * KalmanFilter fed the same samples the unrounded output stays within 1/256,
+ * the error comes from quantizing the gain, and the rounded 8 bit output is
+ * within 1, off only for values that sit right at .5 (a few in 10000 samples).
+ * `program kalman` in the native build measures both.
+ */
+
+#define FIXED_KALMAN_SCHEDULE_MAX 512  // gain steps kept, longer transients continue on the steady state gain
+
+template <uint8_t FRAC_BITS>
+class FixedKalmanGain {
+   public:
+    static_assert(FRAC_BITS >= 8 && FRAC_BITS <= 16, "gain is stored as uint16");
+
+    // same meaning and defaults as KalmanFilter::setMeasurementNoise / setProcessNoise
+    void setNoise(float measurementNoise, float processNoise) {
+        double Q = measurementNoise;
+        double R = processNoise;
+        double one = (double)(1UL << FRAC_BITS);
+        double steady = 0;  // without process noise the gain decays to nothing
+        if (R > 0) {
+            double predCov = (R + sqrt(R * R + 4 * R * Q)) / 2;
+            steady = predCov / (predCov + Q);
+        }
+        steadyGain = lround(steady * one);
+
+        // step 0 takes the measurement as is, like the NaN start of KalmanFilter
+        double cov = Q;
+        length = 0;
+        while (length < FIXED_KALMAN_SCHEDULE_MAX) {
+            double predCov = cov + R;
+            double K = predCov / (predCov + Q);
+            cov = predCov - K * predCov;
+            gains[length] = lround(K * one);
+            if (gains[length] == steadyGain) break;
+            length++;
+        }
+    }
+
+    uint16_t gain(uint16_t step) const {
+        return step < length ? gains[step] : steadyGain;
+    }
+
+    uint16_t steadyStateGain() const {
+        return steadyGain;
+    }
+
+    uint16_t scheduleLength() const {
+        return length;
+    }
+
+   private:
+    uint16_t gains[FIXED_KALMAN_SCHEDULE_MAX];
+    uint16_t steadyGain = 1U << (FRAC_BITS - 1);
+    uint16_t length = 0;
+};
+
+/*
+ * A set of independent RSSI filters sharing one gain schedule, e.g. one per
+ * pilot or receiver.
+ */
+template <uint8_t CHANNELS, uint8_t FRAC_BITS = 16>
+class RssiFilterBank {
+   public:
+    RssiFilterBank() {
+        resetAll();
+    }
+
+    void setNoise(float measurementNoise, float processNoise) {
+        schedule.setNoise(measurementNoise, processNoise);
+        resetAll();
+    }
+
+    void reset(uint8_t channel) {
+        x[channel] = 0;
+        step[channel] = 0;
+    }
+
+    void resetAll() {
+        memset(x, 0, sizeof(x));
+        memset(step, 0, sizeof(step));
+    }
+
+    uint8_t filter(uint8_t channel, uint8_t z) {
+        const int32_t zq = (int32_t)z << FRAC_BITS;
+        if (step[channel] == 0) {
+            x[channel] = zq;
+        } else {
+            const int32_t K = schedule.gain(step[channel] - 1);
+            x[channel] += (int32_t)(((int64_t)K * (zq - x[channel]) + (1 << (FRAC_BITS - 1))) >> FRAC_BITS);
+        }
+        if (step[channel] < UINT16_MAX) step[channel]++;
+        return (x[channel] + (1 << (FRAC_BITS - 1))) >> FRAC_BITS;
+    }
+
+    // unrounded state with FRAC_BITS fractional bits
+    int32_t raw(uint8_t channel) const {
+        return x[channel];
+    }
+
+    float lastMeasurement(uint8_t channel) const {
+        return x[channel] * (1.0f / (1UL << FRAC_BITS));
+    }
+
+    const FixedKalmanGain<FRAC_BITS> &gains() const {
+        return schedule;
+    }
+
+   private:
+    FixedKalmanGain<FRAC_BITS> schedule;
+    int32_t x[CHANNELS];
+    uint16_t step[CHANNELS];
+};
+
+template <uint8_t FRAC_BITS = 16>
+class FixedKalmanFilter {
+   public:
+    void setNoise(float measurementNoise, float processNoise) {
+        bank.setNoise(measurementNoise, processNoise);
+    }
+
+    void reset() {
+        bank.reset(0);
+    }
+
+    uint8_t filter(uint8_t z) {
+        return bank.filter(0, z);
+    }
+
+    int32_t raw() const {
+        return bank.raw(0);
+    }
+
+    float lastMeasurement() const {
+        return bank.lastMeasurement(0);
+    }
+
+    const FixedKalmanGain<FRAC_BITS> &gains() const {
+        return bank.gains();
+    }
+
+   private:
+    RssiFilterBank<1, FRAC_BITS> bank;
+};
@@ -0,0 +1,24 @@
+#include "lappush.h"
+
+#include "hal.h"
+#include "probe.h"
+
+void LapPush::init(lap_push_fn_t push, void *arg) {
+    pushFn = push;
+    pushArg = arg;
+    queue.clear();
+}
+
+void LapPush::handleLapEvent(const lap_event_t &event) {
+    if (pushFn) pushFn(pushArg, event);
+    if (event.type == LAP_EVENT_LAP) probeRecordUs(PROBE_LAP_PUSH, halMicros() - event.sampleTimeUs);
+    queue.push(event);
+}
+
+bool LapPush::popLapEvent(lap_event_t *event) {
+    return queue.pop(event);
+}
+
+uint32_t LapPush::getDropped() {
+    return queue.getDropped();
+}
@@ -0,0 +1,32 @@
+#include <stdint.h>
+
+#include "lapqueue.h"
+
+#pragma once
+
+typedef void (*lap_push_fn_t)(void *arg, const lap_event_t &event);
+
+/*
+ * The fast way out for the lap events. A task of its own, above the service
+ * task, is woken by the timing loop as soon as LapTimer has an event, pushes
+ * it to the clients and hands it on to the service task for everything that
+ * can wait (session log, node sync, RotorHazard). A lap then never waits
+ * behind a bus write, a DNS answer or an EEPROM commit in the middle of a
+ * service pass.
+ *
+ * From the sample that completed a pass to the push returning, with the
+ * frames queued on the sockets, is recorded as the lap.push probe. It is one
+ * record per lap, so it is on in every build.
+ */
+class LapPush {
+   public:
+    void init(lap_push_fn_t push, void *arg);
+    void handleLapEvent(const lap_event_t &event);  // in the push task, in the order LapTimer made them
+    bool popLapEvent(lap_event_t *event);           // in the service task, pushed already
+    uint32_t getDropped();                          // not handed on, the service task fell behind
+
+   private:
+    lap_push_fn_t pushFn = nullptr;
+    void *pushArg = nullptr;
+    LapQueue queue;  // to the service task
+};
@@ -0,0 +1,39 @@
+#include "lapqueue.h"
+
+#include "hal.h"
+
+bool LapQueue::push(const lap_event_t &event) {
+    uint32_t h = head;
+    if (h - tail >= LAPQUEUE_SIZE) {
+        dropped = dropped + 1;
+        return false;
+    }
+    ring[h % LAPQUEUE_SIZE] = event;
+    halMemoryBarrier();  // the record is complete before the consumer can see it
+    head = h + 1;
+    return true;
+}
+
+bool LapQueue::pop(lap_event_t *event) {
+    uint32_t t = tail;
+    if (t == head) return false;
+    halMemoryBarrier();  // the record is read after the index that published it
+    *event = ring[t % LAPQUEUE_SIZE];
+    halMemoryBarrier();  // and before the producer may reuse the slot
+    tail = t + 1;
+    return true;
+}
+
+uint32_t LapQueue::getDropped() {
+    return dropped;
+}
+
+uint32_t LapQueue::getPushed() {
+    return head;
+}
+
+void LapQueue::clear() {
+    head = 0;
+    tail = 0;
+    dropped = 0;
+}
@@ -0,0 +1,44 @@
+#include <stdint.h>
+
+#pragma once
+
+#define LAPQUEUE_SIZE 32  // events, a power of two
+
+typedef enum {
+    LAP_EVENT_START,  // race started, timeUs is the start
+    LAP_EVENT_LAP,    // a pass, timeUs is the pass
+    LAP_EVENT_STOP    // race stopped, timeUs is the stop
+} lap_event_type_e;
+
+typedef struct {
+    uint8_t type;  // lap_event_type_e
+    uint8_t pilot;
+    uint8_t pilots;    // in the race, on start
+    uint8_t peakRssi;  // highest filtered RSSI of the pass
+    uint16_t lap;      // 0 is the time from the start to the hole shot
+    uint32_t lapTimeUs;
+    uint32_t timeUs;
+    uint32_t sampleTimeUs;  // of the sample that completed the pass or carried out the request
+} lap_event_t;
+
+/*
+ * Lap events from the timing loop to the lap push task, and from there on
+ * to the service task. Single producer and single consumer, lock-free: each
+ * side only writes its own index, and a barrier orders the record against
+ * the index that hands it over. The indexes run freely and wrap at 2^32.
+ * When the consumer falls behind new events are dropped and counted.
+ */
+class LapQueue {
+   public:
+    bool push(const lap_event_t &event);
+    bool pop(lap_event_t *event);
+    uint32_t getDropped();
+    uint32_t getPushed();
+    void clear();  // no producer or consumer may be running
+
+   private:
+    lap_event_t ring[LAPQUEUE_SIZE];
+    volatile uint32_t head = 0;  // written by the producer only
+    volatile uint32_t tail = 0;  // written by the consumer only
+    volatile uint32_t dropped = 0;
+};
@@ -1,133 +1,382 @@
 #include "laptimer.h"
 
+#include <string.h>
+
 #include "debug.h"
+#include "hal.h"
+#include "probe.h"
 
-const uint16_t rssi_filter_q = 2000;  //  0.01 - 655.36
-const uint16_t rssi_filter_r = 40;    // 0.0001 - 65.536
+const uint16_t rssi_filter_q = LAPTIMER_FILTER_Q;
+const uint16_t rssi_filter_r = LAPTIMER_FILTER_R;
 
-void LapTimer::init(Config *config, RX5808 *rx5808, Buzzer *buzzer, Led *l) {
+void LapTimer::init(Config *config, FrequencyHopper *frequencyHopper, RssiSource *rssiSource, Buzzer *buzzer, Led *l) {
     conf = config;
-    rx = rx5808;
+    hopper = frequencyHopper;
+    source = rssiSource;
     buz = buzzer;
     led = l;
 
-    filter.setMeasurementNoise(rssi_filter_q * 0.01f);
-    filter.setProcessNoise(rssi_filter_r * 0.0001f);
+    filter.setNoise(rssi_filter_q * 0.01f, rssi_filter_r * 0.0001f);
+    memset(lastPilot, -1, sizeof(lastPilot));
 
-    stop();
-    memset(rssi, 0, sizeof(rssi));
+    memset(pilots, 0, sizeof(pilots));
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        calibrators[i].setFloor(conf->getFloorRssi(i));
+    }
+    configDetector = conf->getDetector();
+    setDetector((detector_type_e)configDetector);
+    laps.clear();
+    stopRace(halMicros());
+    publishCalibration();
 }
 
 void LapTimer::start() {
+    requestAction(LAPTIMER_REQUEST_START, halMicros());
+}
+
+void LapTimer::startAt(uint32_t timeUs) {
+    requestAction(LAPTIMER_REQUEST_START, timeUs);
+}
+
+void LapTimer::stop() {
+    requestAction(LAPTIMER_REQUEST_STOP, halMicros());
+}
+
+bool LapTimer::isRunning() {
+    return state != STOPPED;
+}
+
+/*
+ * The web handlers run in other tasks, so they only leave a request with
+ * its time. The loop carries it out before the next samples, which keeps
+ * it the only writer of the race state and the only producer of lap events.
+ * A request coming before the last one was carried out replaces it, a
+ * start for later waits until its time.
+ */
+void LapTimer::requestAction(laptimer_request_e action, uint32_t timeUs) {
+    halCriticalEnter();
+    request = action;
+    requestTimeUs = timeUs;
+    requestCount = requestCount + 1;
+    halCriticalExit();
+}
+
+void LapTimer::handleRequest() {
+    if (requestCount == requestsHandled) return;
+    uint32_t nowUs = halMicros();
+    halCriticalEnter();
+    uint8_t action = request;
+    uint32_t timeUs = requestTimeUs;
+    bool due = action != LAPTIMER_REQUEST_START || (int32_t)(nowUs - timeUs) >= 0;
+    if (due) requestsHandled = requestCount;
+    halCriticalExit();
+    if (!due) return;
+
+    switch (action) {
+        case LAPTIMER_REQUEST_START:
+            startRace(timeUs);
+            break;
+        case LAPTIMER_REQUEST_STOP:
+            stopRace(timeUs);
+            break;
+        case LAPTIMER_REQUEST_CALIBRATE:
+            if (state == STOPPED) startCalibrators(timeUs);
+            break;
+        case LAPTIMER_REQUEST_APPLY_CALIBRATION:
+            applyCalibrators();
+            break;
+        default:
+            break;
+    }
+    publishCalibration();  // what the request changed, for the web page that made it
+}
+
+void LapTimer::startRace(uint32_t timeUs) {
     DEBUG("LapTimer started\n");
-    raceStartTimeMs = millis();
+    raceStartTimeUs = timeUs;
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        laptimer_pilot_t &p = pilots[i];
+        p.startTimeUs = raceStartTimeUs - conf->getMinLapMs() * 1000;  // the hole shot may come right away
+        p.lapCount = 0;
+        p.peakRssi = 0;
+        calibrators[i].cancel();
+    }
     state = RUNNING;
+    lap_event_t event = {LAP_EVENT_START, 0, getPilotCount(), 0, 0, 0, raceStartTimeUs, halMicros()};
+    laps.push(event);
     buz->beep(500);
     led->on(500);
 }
 
-void LapTimer::stop() {
+void LapTimer::stopRace(uint32_t timeUs) {
     DEBUG("LapTimer stopped\n");
+    if (state != STOPPED) {
+        lap_event_t event = {LAP_EVENT_STOP, 0, getPilotCount(), 0, 0, 0, timeUs, halMicros()};
+        laps.push(event);
+    }
     state = STOPPED;
-    lapCountWraparound = false;
-    lapCount = 0;
-    rssiCount = 0;
-    memset(lapTimes, 0, sizeof(lapTimes));
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        pilots[i].lapCount = 0;
+        detectors[i]->reset();
+    }
     buz->beep(500);
     led->on(500);
 }
 
-void LapTimer::handleLapTimerUpdate(uint32_t currentTimeMs) {
-    // always read RSSI
-    rssi[rssiCount] = round(filter.filter(rx->readRssi(), 0));
-    // DEBUG("RSSI: %u\n", rssi[rssiCount]);
+size_t LapTimer::handleLapTimerUpdate() {
+    PROBE_SCOPE(PROBE_LAPTIMER_UPDATE);
+    handleRequest();
+    if (conf->getDetector() != configDetector) {
+        configDetector = conf->getDetector();
+        setDetector((detector_type_e)configDetector);
+    }
+
+    // always read RSSI, everything acquired since the last update (up to the budget) is processed in order
+    rssi_frame_t frames[LAPTIMER_RSSI_BATCH];
+    size_t budget = frameBudget ? frameBudget : SIZE_MAX;
+    size_t handled = 0;
+    size_t wanted, count;
+    do {
+        wanted = budget - handled < LAPTIMER_RSSI_BATCH ? budget - handled : LAPTIMER_RSSI_BATCH;
+        {
+            PROBE_SCOPE(PROBE_RSSI_READ);
+            count = source->read(frames, wanted);
+        }
+        handled += count;
+        for (size_t i = 0; i < count; i++) {
+            if (scanner) scanner->push(frames[i]);
+            // which pilot the receiver was on when the frame was taken, none while it was tuning
+            uint8_t receiver = frames[i].receiver;
+            int8_t pilot = hopper->pilotAt(receiver, frames[i].timeUs);
+            if (pilot != lastPilot[receiver] && pilot >= 0) {
+                filter.reset(pilot);  // the state is stale after the receiver was away
+            }
+            lastPilot[receiver] = pilot;
+            if (pilot >= 0) {
+                handleRssiSample(pilot, frames[i].rssi, frames[i].timeUs);
+            }
+        }
+    } while (count == wanted && handled < budget);
+    if (halMillis() - publishedMs >= LAPTIMER_PUBLISH_MS) publishCalibration();
+    return handled;
+}
+
+void LapTimer::setFrameBudget(size_t frames) {
+    frameBudget = frames;
+}
+
+void LapTimer::handleRssiSample(uint8_t pilot, uint8_t value, uint32_t sampleTimeUs) {
+    laptimer_pilot_t &p = pilots[pilot];
+    {
+        PROBE_SCOPE(PROBE_RSSI_FILTER);
+        p.currentRssi = filter.filter(pilot, value);
+    }
+    // DEBUG("RSSI: %u\n", p.currentRssi);
+    if (stream) stream->push(pilot, p.currentRssi, sampleTimeUs);
+    if (history) history->push(pilot, p.currentRssi, sampleTimeUs);
+    if (rhHistory) rhHistory->push(pilot, p.currentRssi, sampleTimeUs);
+
+    // calibrated thresholds move with the noise floor
+    int16_t drift = calibrators[pilot].getDrift(conf->getFloorRssi(pilot));
+    int16_t enterRssi = conf->getPilotEnterRssi(pilot) + drift;
+    int16_t exitRssi = conf->getPilotExitRssi(pilot) + drift;
+    enterRssi = enterRssi < 1 ? 1 : (enterRssi > 255 ? 255 : enterRssi);
+    exitRssi = exitRssi < 0 ? 0 : (exitRssi > 254 ? 254 : exitRssi);
+    calibrators[pilot].sample(p.currentRssi, sampleTimeUs, enterRssi, exitRssi);
 
+    // the hole shot may come right away, later passes once the minimum lap time is over
+    bool armed = state == WAITING || (state == RUNNING && (sampleTimeUs - p.startTimeUs) > conf->getMinLapMs() * 1000);
+    detector_sample_t sample = {sampleTimeUs, p.currentRssi, filter.raw(pilot)};
+    if (p.currentRssi > p.peakRssi) p.peakRssi = p.currentRssi;
+    bool passed;
+    {
+        PROBE_SCOPE(PROBE_DETECTOR);
+        passed = detectors[pilot]->sample(sample, enterRssi, exitRssi, armed);
+    }
+    if (!passed) return;
+
+    uint32_t passTimeUs = detectors[pilot]->getPassTimeUs();
     switch (state) {
-        case STOPPED:
-            break;
         case WAITING:
-            // detect hole shot
-            lapPeakCapture();
-            if (lapPeakCaptured()) {
-                state = RUNNING;
-                startLap();
-            }
+            state = RUNNING;
+            startLap(pilot, passTimeUs);
             break;
         case RUNNING:
-            // Check if timer min has elapsed, start capturing peak
-            if ((currentTimeMs - startTimeMs) > conf->getMinLapMs()) {
-                lapPeakCapture();
-            }
-
-            if (lapPeakCaptured()) {
-                finishLap();
-                startLap();
-            }
+            finishLap(pilot, passTimeUs, sampleTimeUs);
+            startLap(pilot, passTimeUs);
             break;
         default:
             break;
     }
+    p.peakRssi = 0;
+}
+
+void LapTimer::startLap(uint8_t pilot, uint32_t passTimeUs) {
+    laptimer_pilot_t &p = pilots[pilot];
+    DEBUG("Lap started, pilot %u\n", pilot + 1);
+    p.startTimeUs = passTimeUs;
+    buz->beep(200);
+    led->on(200);
+}
+
+void LapTimer::finishLap(uint8_t pilot, uint32_t passTimeUs, uint32_t sampleTimeUs) {
+    laptimer_pilot_t &p = pilots[pilot];
+    uint32_t lapTimeUs = passTimeUs - (p.lapCount == 0 ? raceStartTimeUs : p.startTimeUs);
+    DEBUG("Lap finished, pilot %u, lap time = %u us\n", pilot + 1, lapTimeUs);
+    lap_event_t event = {LAP_EVENT_LAP, pilot, getPilotCount(), p.peakRssi, p.lapCount, lapTimeUs, passTimeUs, sampleTimeUs};
+    laps.push(event);
+    p.lapCount++;
+}
+
+uint8_t LapTimer::getRssi(uint8_t pilot) {
+    return pilots[pilot].currentRssi;
+}
 
-    rssiCount = (rssiCount + 1) % LAPTIMER_RSSI_HISTORY;
+bool LapTimer::popLapEvent(lap_event_t *event) {
+    return laps.pop(event);
+}
+
+uint32_t LapTimer::getDroppedLapEvents() {
+    return laps.getDropped();
+}
+
+uint32_t LapTimer::getPushedLapEvents() {
+    return laps.getPushed();
+}
+
+uint8_t LapTimer::getPilotCount() {
+    return hopper->getPilotCount();
+}
+
+uint32_t LapTimer::getSampleRateHz() {
+    return source->getSampleRateHz();
+}
+
+void LapTimer::setPeakFit(bool enabled) {
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        peakDetectors[i].setFit(enabled);
+    }
 }
 
-void LapTimer::lapPeakCapture() {
-    // Check if RSSI is on or post threshold, update RSSI peak
-    if (rssi[rssiCount] >= conf->getEnterRssi()) {
-        // Check if RSSI is greater than the previous detected peak
-        if (rssi[rssiCount] > rssiPeak) {
-            rssiPeak = rssi[rssiCount];
-            rssiPeakTimeMs = millis();
+void LapTimer::setDetector(detector_type_e type) {
+    if (type >= DETECTOR_COUNT) type = DETECTOR_PEAK;
+    if (type == detectorType) return;
+    DEBUG("Lap detector: %s\n", detectorName(type));
+    detectorType = type;
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        switch (type) {
+            case DETECTOR_SLOPE:
+                detectors[i] = &slopeDetectors[i];
+                break;
+            case DETECTOR_MATCHED:
+                detectors[i] = &matchedDetectors[i];
+                break;
+            default:
+                detectors[i] = &peakDetectors[i];
+                break;
         }
+        detectors[i]->reset();
     }
 }
 
-bool LapTimer::lapPeakCaptured() {
-    return (rssi[rssiCount] < rssiPeak) && (rssi[rssiCount] < conf->getExitRssi());
+detector_type_e LapTimer::getDetector() {
+    return detectorType;
 }
 
-void LapTimer::startLap() {
-    DEBUG("Lap started\n");
-    startTimeMs = rssiPeakTimeMs;
-    rssiPeak = 0;
-    rssiPeakTimeMs = 0;
+bool LapTimer::startCalibration() {
+    if (state != STOPPED) return false;
+    requestAction(LAPTIMER_REQUEST_CALIBRATE, halMicros());
+    return true;
+}
+
+void LapTimer::startCalibrators(uint32_t timeUs) {
+    DEBUG("Calibration started\n");
+    for (uint8_t i = 0; i < getPilotCount(); i++) {
+        calibrators[i].start(timeUs);
+    }
     buz->beep(200);
     led->on(200);
 }
 
-void LapTimer::finishLap() {
-    lapTimes[lapCount] = rssiPeakTimeMs - startTimeMs;
-    if (lapCount == 0 && lapCountWraparound == false)
-    {
-        lapTimes[0] = rssiPeakTimeMs - raceStartTimeMs;
+// the loop is the only one touching the calibrators, the others get a copy
+void LapTimer::publishCalibration() {
+    calibration_snapshot_t now;
+    for (uint8_t i = 0; i < LAPTIMER_MAX_PILOTS; i++) {
+        calibrators[i].getCalibration(&now.calibrations[i]);
+        now.trackedFloors[i] = calibrators[i].getTrackedFloor();
+        now.floorDrifts[i] = calibrators[i].getDrift(conf->getFloorRssi(i));
     }
-    else
-    {
-        lapTimes[lapCount] = rssiPeakTimeMs - startTimeMs;
+    halCriticalEnter();
+    shared = now;
+    halCriticalExit();
+    publishedMs = halMillis();
+}
+
+void LapTimer::getCalibration(uint8_t pilot, calibration_t *calibration) {
+    halCriticalEnter();
+    *calibration = shared.calibrations[pilot];
+    halCriticalExit();
+}
+
+bool LapTimer::applyCalibration() {
+    bool done = false;
+    halCriticalEnter();
+    for (uint8_t i = 0; i < getPilotCount(); i++) {
+        if (shared.calibrations[i].state == CALIBRATOR_DONE) done = true;
     }
-    DEBUG("Lap finished, lap time = %u\n", lapTimes[lapCount]);
-    if ((lapCount + 1) % LAPTIMER_LAP_HISTORY == 0) {
-        lapCountWraparound = true;
+    halCriticalExit();
+    if (done) requestAction(LAPTIMER_REQUEST_APPLY_CALIBRATION, halMicros());
+    return done;
+}
+
+// in the loop, the detectors read the thresholds and the calibrators track the floor there
+void LapTimer::applyCalibrators() {
+    for (uint8_t i = 0; i < getPilotCount(); i++) {
+        calibration_t c;
+        calibrators[i].getCalibration(&c);
+        if (c.state != CALIBRATOR_DONE) continue;
+        DEBUG("Calibrated pilot %u: floor %u, enter %u, exit %u\n", i + 1, c.floorRssi, c.enterRssi, c.exitRssi);
+        conf->setPilotEnterRssi(i, c.enterRssi);
+        conf->setPilotExitRssi(i, c.exitRssi);
+        conf->setFloorRssi(i, c.floorRssi);
+        calibrators[i].setFloor(c.floorRssi);
     }
-    lapCount = (lapCount + 1) % LAPTIMER_LAP_HISTORY;
-    lapAvailable = true;
 }
 
-uint8_t LapTimer::getRssi() {
-    return rssi[rssiCount];
+uint8_t LapTimer::getTrackedFloor(uint8_t pilot) {
+    halCriticalEnter();
+    uint8_t floor = shared.trackedFloors[pilot];
+    halCriticalExit();
+    return floor;
 }
 
-uint32_t LapTimer::getLapTime() {
-    uint32_t lapTime = 0;
-    lapAvailable = false;
-    if (lapCount == 0) {
-        lapTime = lapTimes[LAPTIMER_LAP_HISTORY - 1];
-    } else {
-        lapTime = lapTimes[lapCount - 1];
-    }
-    return lapTime;
+int8_t LapTimer::getFloorDrift(uint8_t pilot) {
+    halCriticalEnter();
+    int8_t drift = shared.floorDrifts[pilot];
+    halCriticalExit();
+    return drift;
+}
+
+void LapTimer::setRssiStream(RssiStream *rssiStream) {
+    stream = rssiStream;
+}
+
+RssiStream *LapTimer::getRssiStream() {
+    return stream;
+}
+
+void LapTimer::setRssiHistory(RssiHistory *rssiHistory) {
+    history = rssiHistory;
+}
+
+RssiHistory *LapTimer::getRssiHistory() {
+    return history;
+}
+
+void LapTimer::setRhHistory(RhHistory *rh) {
+    rhHistory = rh;
 }
 
-bool LapTimer::isLapAvailable() {
-    return lapAvailable;
+void LapTimer::setScanner(SpectrumScanner *spectrumScanner) {
+    scanner = spectrumScanner;
 }
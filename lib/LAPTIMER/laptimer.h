@@ -1,8 +1,21 @@
-#include "RX5808.h"
 #include "buzzer.h"
+#include "calibrator.h"
 #include "config.h"
-#include "kalman.h"
+#include "detector.h"
+#include "fixedkalman.h"
+#include "hopper.h"
+#include "lapqueue.h"
 #include "led.h"
+#include "matcheddetector.h"
+#include "peakdetector.h"
+#include "rhhistory.h"
+#include "rssihistory.h"
+#include "rssisource.h"
+#include "rssistream.h"
+#include "scanner.h"
+#include "slopedetector.h"
+
+#pragma once
 
 typedef enum {
     STOPPED,
@@ -10,43 +23,107 @@ typedef enum {
     RUNNING
 } laptimer_state_e;
 
-#define LAPTIMER_LAP_HISTORY 10
-#define LAPTIMER_RSSI_HISTORY 100
+typedef enum {
+    LAPTIMER_REQUEST_START,
+    LAPTIMER_REQUEST_STOP,
+    LAPTIMER_REQUEST_CALIBRATE,
+    LAPTIMER_REQUEST_APPLY_CALIBRATION
+} laptimer_request_e;
+
+#define LAPTIMER_MAX_PILOTS CONFIG_MAX_PILOTS
+#define LAPTIMER_RSSI_BATCH 64
+#define LAPTIMER_PUBLISH_MS 100  // the calibration copy other tasks read is this old at most
+#define LAPTIMER_FILTER_Q 2000  // 0.01 - 655.36
+#define LAPTIMER_FILTER_R 40    // 0.0001 - 65.536
+
+typedef struct {
+    calibration_t calibrations[LAPTIMER_MAX_PILOTS];
+    uint8_t trackedFloors[LAPTIMER_MAX_PILOTS];
+    int8_t floorDrifts[LAPTIMER_MAX_PILOTS];
+} calibration_snapshot_t;
+
+typedef struct {
+    uint32_t startTimeUs;
+    uint16_t lapCount;
+    uint8_t currentRssi;
+    uint8_t peakRssi;  // since the last pass
+} laptimer_pilot_t;
 
 class LapTimer {
    public:
-    void init(Config *config, RX5808 *rx5808, Buzzer *buzzer, Led *l);
-    void start();
+    void init(Config *config, FrequencyHopper *frequencyHopper, RssiSource *rssiSource, Buzzer *buzzer, Led *l);
+    void start();  // from any task, done on the next update
+    void startAt(uint32_t timeUs);  // the first update from then on, the race starts at timeUs
     void stop();
-    void handleLapTimerUpdate(uint32_t currentTimeMs);
-    uint8_t getRssi();
-    uint32_t getLapTime();
-    bool isLapAvailable();
+    bool isRunning();
+    size_t handleLapTimerUpdate();  // frames handled
+    void setFrameBudget(size_t frames);  // most frames an update takes, the rest waits in the source; 0 for all
+    uint8_t getRssi(uint8_t pilot = 0);
+    bool popLapEvent(lap_event_t *event);  // by one consumer only
+    uint32_t getDroppedLapEvents();
+    uint32_t getPushedLapEvents();  // changes when there is something to pop
+    uint8_t getPilotCount();
+    uint32_t getSampleRateHz();
+    void setPeakFit(bool enabled);
+    void setDetector(detector_type_e type);  // until the detector in Config changes
+    detector_type_e getDetector();
+    bool startCalibration();  // while stopped, a race start cancels it, done on the next update
+    void getCalibration(uint8_t pilot, calibration_t *calibration);  // from any task, LAPTIMER_PUBLISH_MS old at most
+    bool applyCalibration();  // thresholds of the pilots done into Config on the next update, false when none is done
+    uint8_t getTrackedFloor(uint8_t pilot);  // the same
+    int8_t getFloorDrift(uint8_t pilot);
+    void setRssiStream(RssiStream *rssiStream);
+    RssiStream *getRssiStream();
+    void setRssiHistory(RssiHistory *rssiHistory);
+    RssiHistory *getRssiHistory();
+    void setScanner(SpectrumScanner *spectrumScanner);  // gets every frame
+    void setRhHistory(RhHistory *rhHistory);
 
    private:
-    laptimer_state_e state = STOPPED;
-    RX5808 *rx;
+    volatile laptimer_state_e state = STOPPED;
+    FrequencyHopper *hopper;
+    RssiSource *source;
     Config *conf;
     Buzzer *buz;
     Led *led;
-    KalmanFilter filter;
-    boolean lapCountWraparound;
-    uint32_t raceStartTimeMs;
-    uint32_t startTimeMs;
-    uint8_t lapCount;
-    uint8_t rssiCount;
-    uint32_t lapTimes[LAPTIMER_LAP_HISTORY];
-    uint8_t rssi[LAPTIMER_RSSI_HISTORY];
-
-    uint8_t rssiPeak;
-    uint32_t rssiPeakTimeMs;
-
-    bool lapAvailable = false;
-
-    void lapPeakCapture();
-    bool lapPeakCaptured();
-    void lapPeakReset();
-
-    void startLap();
-    void finishLap();
+    RssiStream *stream = nullptr;
+    RssiHistory *history = nullptr;
+    SpectrumScanner *scanner = nullptr;
+    RhHistory *rhHistory = nullptr;
+    RssiFilterBank<LAPTIMER_MAX_PILOTS, 16> filter;
+    laptimer_pilot_t pilots[LAPTIMER_MAX_PILOTS];
+    int8_t lastPilot[BOARD_MAX_RECEIVERS];
+    uint32_t raceStartTimeUs;
+    size_t frameBudget = 0;
+    LapQueue laps;
+
+    // from other tasks, guarded by halCriticalEnter
+    volatile uint32_t requestCount = 0;
+    uint8_t request;
+    uint32_t requestTimeUs;
+    uint32_t requestsHandled = 0;
+
+    // the calibrators every LAPTIMER_PUBLISH_MS, for other tasks, guarded by halCriticalEnter
+    calibration_snapshot_t shared;
+    uint32_t publishedMs = 0;
+
+    PeakDetector peakDetectors[LAPTIMER_MAX_PILOTS];
+    SlopeDetector slopeDetectors[LAPTIMER_MAX_PILOTS];
+    MatchedDetector matchedDetectors[LAPTIMER_MAX_PILOTS];
+    LapDetector *detectors[LAPTIMER_MAX_PILOTS];
+    detector_type_e detectorType = DETECTOR_COUNT;
+    uint8_t configDetector;
+    RssiCalibrator calibrators[LAPTIMER_MAX_PILOTS];
+
+    void requestAction(laptimer_request_e action, uint32_t timeUs);
+    void handleRequest();
+    void startRace(uint32_t timeUs);
+    void stopRace(uint32_t timeUs);
+    void startCalibrators(uint32_t timeUs);
+    void applyCalibrators();
+    void publishCalibration();
+    void handleRssiSample(uint8_t pilot, uint8_t value, uint32_t sampleTimeUs);
+
+    void startLap(uint8_t pilot, uint32_t passTimeUs);
+    void finishLap(uint8_t pilot, uint32_t passTimeUs, uint32_t sampleTimeUs);
 };
@@ -1,28 +1,28 @@
 #include "led.h"
 
 void Led::init(uint8_t pin, bool inverted) {
-    pinMode(pin, OUTPUT);
-    initialState = inverted ? HIGH : LOW;
+    halPinMode(pin, HAL_OUTPUT);
+    initialState = inverted ? HAL_HIGH : HAL_LOW;
     currentState = initialState;
     ledPin = pin;
     ledState = LED_IDLE;
-    digitalWrite(ledPin, initialState);
+    halDigitalWrite(ledPin, initialState);
 }
 
 void Led::on(uint32_t timeMs) {
     if (timeMs > 0) {
         ledState = LED_ON;
         onTimeMs = timeMs;
-        checkTimeMs = millis();
+        checkTimeMs = halMillis();
     } else {
         ledState = LED_IDLE;
     }
-    digitalWrite(ledPin, !initialState);
+    halDigitalWrite(ledPin, !initialState);
 }
 
 void Led::off() {
     ledState = LED_IDLE;
-    digitalWrite(ledPin, initialState);
+    halDigitalWrite(ledPin, initialState);
 }
 
 void Led::blink(uint32_t onMs, uint32_t offMs) {
@@ -33,35 +33,38 @@ void Led::blink(uint32_t onMs, uint32_t offMs) {
         offTimeMs = onTimeMs;
     }
     ledState = LED_BLINKING;
-    checkTimeMs = millis();
+    checkTimeMs = halMillis();
     currentState = !initialState;
-    digitalWrite(ledPin, currentState);
+    halDigitalWrite(ledPin, currentState);
 }
 
-void Led::handleLed(uint32_t currentTimeMs) {
+uint32_t Led::handleLed(uint32_t currentTimeMs) {
     switch (ledState) {
         case LED_IDLE:
             break;
         case LED_BLINKING:
             if (currentTimeMs < checkTimeMs) {
-                break;  // updated from different core
+                return 1;  // updated from different core
             }
             if (((currentState == !initialState) && (currentTimeMs - checkTimeMs) > onTimeMs) ||  // currently led is turned on and it's time to turn it off
                 ((currentState == initialState) && (currentTimeMs - checkTimeMs) > offTimeMs)) {  // currently led is turned off and it's time to turn it on
                 currentState = !currentState;
-                digitalWrite(ledPin, currentState);
+                halDigitalWrite(ledPin, currentState);
                 checkTimeMs = currentTimeMs;
             }
-            break;
+            return (currentState == initialState ? offTimeMs : onTimeMs) - (currentTimeMs - checkTimeMs) + 1;
         case LED_ON:
             if (currentTimeMs < checkTimeMs) {
-                break;  // updated from different core
+                return 1;  // updated from different core
             }
             if ((currentTimeMs - checkTimeMs) > onTimeMs) {
-                digitalWrite(ledPin, initialState);
+                halDigitalWrite(ledPin, initialState);
                 ledState = LED_IDLE;
+                break;
             }
+            return onTimeMs - (currentTimeMs - checkTimeMs) + 1;
         default:
             break;
     }
+    return SCHEDULER_IDLE;
 }
@@ -1,4 +1,5 @@
-#include <Arduino.h>
+#include "hal.h"
+#include "scheduler.h"
 
 #pragma once
 
@@ -11,7 +12,7 @@ typedef enum {
 class Led {
    public:
     void init(uint8_t pin, bool inverted);
-    void handleLed(uint32_t currentTimeMs);
+    uint32_t handleLed(uint32_t currentTimeMs);  // ms until the next change
     void on(uint32_t timeMs = 0);
     void off();
     void blink(uint32_t onTimeMs, uint32_t offTimeMs = 0);
@@ -19,8 +20,8 @@ class Led {
    private:
     led_state_e ledState = LED_IDLE;
     uint8_t ledPin;
-    uint8_t initialState = LOW;
-    uint8_t currentState = LOW;
+    uint8_t initialState = HAL_LOW;
+    uint8_t currentState = HAL_LOW;
     uint32_t onTimeMs;
     uint32_t offTimeMs;
     uint32_t checkTimeMs;
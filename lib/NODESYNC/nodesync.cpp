@@ -0,0 +1,558 @@
+#include "nodesync.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "scheduler.h"
+
+// sizes of the messages by nodesync_msg_e, all of them start with the type and the id of the sender
+static const uint8_t messageSizes[] = {0, 6, 10, 18, 13, 9, 6, 26, 7};
+
+#define MESSAGE_TYPES (sizeof(messageSizes) / sizeof(messageSizes[0]))
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const hal_udp_peer_t broadcastPeer = {HAL_UDP_BROADCAST, NODESYNC_PORT};
+
+void NodeSync::init(uint32_t nodeId, nodesync_start_fn_t onStart, nodesync_stop_fn_t onStop, void *arg) {
+    id = nodeId;
+    startFn = onStart;
+    stopFn = onStop;
+    fnArg = arg;
+    open = false;
+    nodeCount = 0;
+    masterId = id;
+    helloMs = 0;
+    syncSeq = 0;
+    syncMs = 0;
+    resetClock();
+    raceId = 0;
+    raceStartUs = 0;
+    racing = false;
+    announceStart = false;
+    stopRepeats = 0;
+    resendMs = 0;
+    pendingCount = 0;
+    lapSeq = 0;
+    raceLapCount = 0;
+    requestsHandled = requestCount;
+    publishStatus();
+}
+
+bool NodeSync::begin() {
+    open = halUdpBegin(NODESYNC_PORT);
+    if (!open) {
+        DEBUG("Node sync: no socket on port %u\n", NODESYNC_PORT);
+        return false;
+    }
+    helloMs = 0;
+    sendHello();
+    return true;
+}
+
+void NodeSync::start() {
+    halCriticalEnter();
+    requestStart = true;
+    requestCount = requestCount + 1;
+    halCriticalExit();
+}
+
+void NodeSync::stop() {
+    halCriticalEnter();
+    requestStart = false;
+    requestCount = requestCount + 1;
+    halCriticalExit();
+}
+
+bool NodeSync::isMaster() {
+    return masterId == id;
+}
+
+void NodeSync::handleRequest(uint32_t currentTimeMs) {
+    if (requestCount == requestsHandled) return;
+    halCriticalEnter();
+    bool run = requestStart;
+    requestsHandled = requestCount;
+    halCriticalExit();
+
+    if (isMaster()) {
+        if (run) {
+            scheduleStart(currentTimeMs);
+        } else {
+            scheduleStop();
+        }
+        return;
+    }
+    uint8_t data[6];
+    data[0] = NODESYNC_MSG_REQUEST;
+    put32(&data[1], id);
+    data[5] = run;
+    send(masterPeer, data, sizeof(data));
+}
+
+uint32_t NodeSync::handleSync(uint32_t currentTimeMs) {
+    if (open) {
+        uint8_t data[HAL_UDP_MAX_SIZE];
+        hal_udp_peer_t from;
+        uint32_t arrivalUs;
+        size_t len;
+        while ((len = halUdpReceive(data, sizeof(data), &from, &arrivalUs)) > 0) {
+            handleMessage(data, len, from, arrivalUs, currentTimeMs);
+        }
+        if (currentTimeMs - helloMs >= NODESYNC_HELLO_MS) {
+            sendHello();
+            helloMs = currentTimeMs;
+        }
+        elect(currentTimeMs);
+    }
+    handleRequest(currentTimeMs);
+
+    if (open && !isMaster() && currentTimeMs - syncMs >= NODESYNC_SYNC_MS) {
+        sendSync(currentTimeMs);
+    }
+    if ((announceStart || stopRepeats > 0 || pendingCount > 0) && currentTimeMs - resendMs >= NODESYNC_RESEND_MS) {
+        resendMs = currentTimeMs;
+        if (announceStart) {
+            announceStart = (int32_t)(halMicros() - raceStartUs) < 0;
+            if (announceStart) sendRace(NODESYNC_MSG_START);
+        }
+        if (stopRepeats > 0) {
+            stopRepeats--;
+            sendRace(NODESYNC_MSG_STOP);
+        }
+        sendLaps();
+    }
+    publishStatus();
+
+    if (!open) return SCHEDULER_IDLE;  // woken by a request
+    return nodeCount > 0 ? NODESYNC_POLL_MS : NODESYNC_HELLO_MS - (currentTimeMs - helloMs);
+}
+
+void NodeSync::handleMessage(const uint8_t *data, size_t len, const hal_udp_peer_t &from, uint32_t arrivalUs, uint32_t currentTimeMs) {
+    uint8_t type = data[0];
+    if (type == 0 || type >= MESSAGE_TYPES || len != messageSizes[type]) return;
+    uint32_t sender = get32(&data[1]);
+    if (sender == id) return;  // our own broadcast
+    if (type == NODESYNC_MSG_HELLO && data[5] != NODESYNC_VERSION) return;
+    seen(sender, from, currentTimeMs);
+    bool fromMaster = sender == masterId;
+
+    switch (type) {
+        case NODESYNC_MSG_SYNC: {
+            if (!isMaster()) break;
+            uint8_t reply[18];
+            reply[0] = NODESYNC_MSG_SYNC_REPLY;
+            put32(&reply[1], id);
+            reply[5] = data[5];
+            memcpy(&reply[6], &data[6], 4);
+            put32(&reply[10], arrivalUs);
+            put32(&reply[14], halMicros());
+            send(from, reply, sizeof(reply));
+            break;
+        }
+        case NODESYNC_MSG_SYNC_REPLY:
+            if (fromMaster) handleSyncReply(data, arrivalUs);
+            break;
+        case NODESYNC_MSG_START: {
+            uint32_t startId = get32(&data[5]);
+            if (!fromMaster || startId == raceId) break;  // resent, or stopped already
+            beginRace(startId, get32(&data[9]));
+            if (!synced) {
+                DEBUG("Node sync: race %u started before the clock was synced\n", startId);
+            }
+            startFn(fnArg, synced ? toLocal(raceStartUs) : halMicros());
+            break;
+        }
+        case NODESYNC_MSG_STOP:
+            if (!fromMaster || !racing || get32(&data[5]) != raceId) break;
+            racing = false;
+            stopFn(fnArg);
+            break;
+        case NODESYNC_MSG_REQUEST:
+            if (!isMaster()) break;
+            if (data[5]) {
+                scheduleStart(currentTimeMs);
+            } else {
+                scheduleStop();
+            }
+            break;
+        case NODESYNC_MSG_LAP: {
+            if (!isMaster()) break;
+            nodesync_lap_t lap;
+            lap.node = sender;
+            lap.seq = get16(&data[9]);
+            lap.pilot = data[11];
+            lap.lap = get16(&data[12]);
+            lap.lapTimeUs = get32(&data[14]);
+            lap.passUs = get32(&data[18]);
+            lap.errorUs = get32(&data[22]);
+
+            // acknowledged even when it is from another race, the node sends it again otherwise
+            uint8_t ack[7];
+            ack[0] = NODESYNC_MSG_LAP_ACK;
+            put32(&ack[1], id);
+            put16(&ack[5], lap.seq);
+            send(from, ack, sizeof(ack));
+            if (get32(&data[5]) != raceId) break;
+            for (uint16_t i = 0; i < raceLapCount; i++) {
+                if (raceLaps[i].node == lap.node && raceLaps[i].seq == lap.seq) return;  // the ack got lost
+            }
+            addRaceLap(lap);
+            break;
+        }
+        case NODESYNC_MSG_LAP_ACK: {
+            if (!fromMaster) break;
+            uint16_t seq = get16(&data[5]);
+            for (uint8_t i = 0; i < pendingCount; i++) {
+                if (pending[i].seq != seq) continue;
+                memmove(&pending[i], &pending[i + 1], (pendingCount - i - 1) * sizeof(nodesync_lap_t));
+                pendingCount--;
+                break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*
+ * t1 sent here, t2 arrived at the master, t3 sent by the master, t4 arrived
+ * here. The offset is the mean of t2 - t1 and t3 - t4, it is off by at most
+ * half the round trip, whichever way the delay is split.
+ */
+void NodeSync::handleSyncReply(const uint8_t *data, uint32_t arrivalUs) {
+    uint32_t t1 = get32(&data[6]);
+    if (!syncPending || data[5] != syncSeq || t1 != syncT1) return;
+    syncPending = false;
+    uint32_t t2 = get32(&data[10]);
+    uint32_t t3 = get32(&data[14]);
+    int32_t roundUs = (int32_t)(arrivalUs - t1);
+    int32_t heldUs = (int32_t)(t3 - t2);
+    if (heldUs < 0 || roundUs < heldUs) return;
+
+    nodesync_sample_t &s = samples[sampleNext];
+    s.delayUs = roundUs - heldUs;
+    s.offsetUs = (t2 - t1) - s.delayUs / 2;
+    s.localUs = t1 + roundUs / 2;
+    sampleNext = (sampleNext + 1) % NODESYNC_SAMPLES;
+    if (sampleCount < NODESYNC_SAMPLES) sampleCount++;
+    fitClock();
+}
+
+void NodeSync::seen(uint32_t node, const hal_udp_peer_t &peer, uint32_t currentTimeMs) {
+    for (uint8_t i = 0; i < nodeCount; i++) {
+        if (nodes[i].id != node) continue;
+        nodes[i].peer = peer;
+        nodes[i].seenMs = currentTimeMs;
+        return;
+    }
+    if (nodeCount >= NODESYNC_MAX_NODES) return;
+    DEBUG("Node sync: node %08x joined\n", node);
+    nodes[nodeCount].id = node;
+    nodes[nodeCount].peer = peer;
+    nodes[nodeCount].seenMs = currentTimeMs;
+    nodeCount++;
+}
+
+// the lowest id of the nodes heard from recently, this one included
+void NodeSync::elect(uint32_t currentTimeMs) {
+    uint32_t lowest = id;
+    for (uint8_t i = 0; i < nodeCount;) {
+        if (currentTimeMs - nodes[i].seenMs > NODESYNC_NODE_TIMEOUT_MS) {
+            DEBUG("Node sync: node %08x gone\n", nodes[i].id);
+            nodes[i] = nodes[--nodeCount];
+            continue;
+        }
+        if (nodes[i].id < lowest) {
+            lowest = nodes[i].id;
+            masterPeer = nodes[i].peer;
+        }
+        i++;
+    }
+    if (lowest == masterId) return;
+    DEBUG("Node sync: master %08x\n", lowest);
+    masterId = lowest;
+    resetClock();
+}
+
+void NodeSync::resetClock() {
+    sampleCount = 0;
+    sampleNext = 0;
+    syncPending = false;
+    anchorLocalUs = 0;
+    anchorOffsetUs = 0;
+    anchorDelayUs = 0;
+    driftPpb = 0;
+    driftErrorPpb = NODESYNC_MAX_DRIFT_PPM * 1000;
+    synced = isMaster();
+}
+
+/*
+ * The offset is taken from the exchange with the shortest round trip, the
+ * newest of equals. The drift is a least squares line through the offsets of
+ * the exchanges not much slower than that one. Each offset is off by at most
+ * half its round trip, which bounds how far off the slope can be.
+ */
+void NodeSync::fitClock() {
+    uint8_t oldest = (sampleNext + NODESYNC_SAMPLES - sampleCount) % NODESYNC_SAMPLES;
+    const nodesync_sample_t *anchor = &samples[oldest];
+    for (uint8_t n = 1; n < sampleCount; n++) {
+        const nodesync_sample_t &s = samples[(oldest + n) % NODESYNC_SAMPLES];
+        if (s.delayUs <= anchor->delayUs) anchor = &s;
+    }
+    anchorLocalUs = anchor->localUs;
+    anchorOffsetUs = anchor->offsetUs;
+    anchorDelayUs = anchor->delayUs;
+    synced = sampleCount >= NODESYNC_MIN_SAMPLES;
+
+    uint32_t limitUs = 2 * anchorDelayUs + 100;
+    double sumX = 0, sumY = 0;
+    int32_t minX = 0, maxX = 0;
+    uint32_t maxDelayUs = 0;
+    uint8_t used = 0;
+    for (uint8_t n = 0; n < sampleCount; n++) {
+        const nodesync_sample_t &s = samples[(oldest + n) % NODESYNC_SAMPLES];
+        if (s.delayUs > limitUs) continue;
+        int32_t x = (int32_t)(s.localUs - anchorLocalUs);
+        sumX += x;
+        sumY += (int32_t)(s.offsetUs - anchorOffsetUs);
+        if (x < minX) minX = x;
+        if (x > maxX) maxX = x;
+        if (s.delayUs > maxDelayUs) maxDelayUs = s.delayUs;
+        used++;
+    }
+    driftPpb = 0;
+    driftErrorPpb = NODESYNC_MAX_DRIFT_PPM * 1000;
+    if (used < NODESYNC_MIN_SAMPLES || (uint32_t)(maxX - minX) < NODESYNC_FIT_MS * 1000) return;
+
+    double meanX = sumX / used, meanY = sumY / used;
+    double sxy = 0, sxx = 0, sabs = 0;
+    for (uint8_t n = 0; n < sampleCount; n++) {
+        const nodesync_sample_t &s = samples[(oldest + n) % NODESYNC_SAMPLES];
+        if (s.delayUs > limitUs) continue;
+        double dx = (int32_t)(s.localUs - anchorLocalUs) - meanX;
+        sxy += dx * ((int32_t)(s.offsetUs - anchorOffsetUs) - meanY);
+        sxx += dx * dx;
+        sabs += dx < 0 ? -dx : dx;
+    }
+    double drift = sxy / sxx * 1e9;
+    double errorPpb = sabs * maxDelayUs / 2 / sxx * 1e9;
+    if (errorPpb >= NODESYNC_MAX_DRIFT_PPM * 1000) return;
+    const double maxPpb = NODESYNC_MAX_DRIFT_PPM * 1000;
+    driftPpb = drift > maxPpb ? maxPpb : drift < -maxPpb ? -maxPpb : drift;
+    driftErrorPpb = errorPpb + 1;
+}
+
+bool NodeSync::toMaster(uint32_t localUs, uint32_t *masterUs, uint32_t *errorUs) {
+    if (isMaster()) {
+        *masterUs = localUs;
+        *errorUs = 0;
+        return true;
+    }
+    if (!synced) return false;
+    int32_t sinceUs = (int32_t)(localUs - anchorLocalUs);
+    uint32_t absSinceUs = sinceUs < 0 ? -sinceUs : sinceUs;
+    *masterUs = localUs + anchorOffsetUs + (int32_t)((int64_t)sinceUs * driftPpb / 1000000000);
+    *errorUs = (anchorDelayUs + 1) / 2 + (uint32_t)(((uint64_t)absSinceUs * driftErrorPpb + 999999999) / 1000000000);
+    return true;
+}
+
+// toMaster backwards, the drift is taken over the local time rather than the master time, well under a microsecond apart
+uint32_t NodeSync::toLocal(uint32_t masterUs) {
+    if (isMaster()) return masterUs;
+    uint32_t localUs = masterUs - anchorOffsetUs;
+    int32_t sinceUs = (int32_t)(localUs - anchorLocalUs);
+    return localUs - (int32_t)((int64_t)sinceUs * driftPpb / 1000000000);
+}
+
+void NodeSync::scheduleStart(uint32_t currentTimeMs) {
+    uint32_t nextId = raceId + 1 ? raceId + 1 : 1;
+    uint32_t startUs = halMicros() + (nodeCount > 0 ? NODESYNC_START_LEAD_MS * 1000 : 0);
+    DEBUG("Node sync: race %u starts in %u ms\n", nextId, nodeCount > 0 ? NODESYNC_START_LEAD_MS : 0);
+    beginRace(nextId, startUs);
+    startFn(fnArg, startUs);
+    stopRepeats = 0;
+    announceStart = nodeCount > 0;
+    if (!announceStart) return;
+    sendRace(NODESYNC_MSG_START);
+    resendMs = currentTimeMs;
+}
+
+void NodeSync::scheduleStop() {
+    racing = false;
+    announceStart = false;
+    stopFn(fnArg);
+    if (nodeCount == 0) return;
+    sendRace(NODESYNC_MSG_STOP);
+    stopRepeats = NODESYNC_STOP_REPEATS - 1;
+}
+
+// the laps of the race before are dropped, here and on the master
+void NodeSync::beginRace(uint32_t id, uint32_t startUs) {
+    raceId = id;
+    raceStartUs = startUs;
+    racing = true;
+    pendingCount = 0;
+    halCriticalEnter();
+    raceLapCount = 0;
+    halCriticalExit();
+}
+
+void NodeSync::addRaceLap(const nodesync_lap_t &lap) {
+    if (raceLapCount >= NODESYNC_RACE_LAPS) {
+        DEBUG("Node sync: lap of node %08x dropped, race full\n", lap.node);
+        return;
+    }
+    halCriticalEnter();
+    raceLaps[raceLapCount] = lap;
+    raceLapCount++;
+    halCriticalExit();
+}
+
+// pending laps keep the pass on the local clock, it is converted as they go out with the offset of then
+void NodeSync::handleLapEvent(const lap_event_t &event) {
+    if (event.type != LAP_EVENT_LAP || !racing) return;
+    nodesync_lap_t lap;
+    lap.node = id;
+    lap.seq = lapSeq++;
+    lap.pilot = event.pilot;
+    lap.lap = event.lap;
+    lap.lapTimeUs = event.lapTimeUs;
+    lap.passUs = event.timeUs;
+    lap.errorUs = 0;
+    if (isMaster()) {
+        addRaceLap(lap);
+        return;
+    }
+    if (pendingCount >= NODESYNC_LAPS) {
+        DEBUG("Node sync: lap %u not acknowledged, dropped\n", pending[0].seq);
+        memmove(&pending[0], &pending[1], (NODESYNC_LAPS - 1) * sizeof(nodesync_lap_t));
+        pendingCount--;
+    }
+    pending[pendingCount++] = lap;
+    sendLaps();
+}
+
+void NodeSync::sendHello() {
+    uint8_t data[6];
+    data[0] = NODESYNC_MSG_HELLO;
+    put32(&data[1], id);
+    data[5] = NODESYNC_VERSION;
+    send(broadcastPeer, data, sizeof(data));
+}
+
+void NodeSync::sendSync(uint32_t currentTimeMs) {
+    uint8_t data[10];
+    syncSeq++;
+    syncT1 = halMicros();
+    syncPending = true;
+    syncMs = currentTimeMs;
+    data[0] = NODESYNC_MSG_SYNC;
+    put32(&data[1], id);
+    data[5] = syncSeq;
+    put32(&data[6], syncT1);
+    send(masterPeer, data, sizeof(data));
+}
+
+void NodeSync::sendRace(uint8_t type) {
+    uint8_t data[13];
+    data[0] = type;
+    put32(&data[1], id);
+    put32(&data[5], raceId);
+    put32(&data[9], raceStartUs);
+    send(broadcastPeer, data, messageSizes[type]);
+}
+
+void NodeSync::sendLaps() {
+    if (isMaster()) return;
+    for (uint8_t i = 0; i < pendingCount; i++) {
+        uint32_t passUs, errorUs;
+        if (!toMaster(pending[i].passUs, &passUs, &errorUs)) return;  // sent once synced
+        uint8_t data[26];
+        data[0] = NODESYNC_MSG_LAP;
+        put32(&data[1], id);
+        put32(&data[5], raceId);
+        put16(&data[9], pending[i].seq);
+        data[11] = pending[i].pilot;
+        put16(&data[12], pending[i].lap);
+        put32(&data[14], pending[i].lapTimeUs);
+        put32(&data[18], passUs);
+        put32(&data[22], errorUs);
+        send(masterPeer, data, sizeof(data));
+    }
+}
+
+void NodeSync::send(const hal_udp_peer_t &to, const uint8_t *data, size_t len) {
+    if (open) halUdpSend(&to, data, len);
+}
+
+void NodeSync::publishStatus() {
+    uint32_t masterUs, errorUs = 0;
+    bool haveTime = toMaster(halMicros(), &masterUs, &errorUs);
+    halCriticalEnter();
+    status.nodeId = id;
+    status.masterId = masterId;
+    status.nodes = nodeCount + 1;
+    status.synced = haveTime;
+    status.driftPpb = driftPpb;
+    status.delayUs = anchorDelayUs;
+    status.errorUs = errorUs;
+    status.raceId = raceId;
+    status.racing = racing;
+    status.laps = raceLapCount;
+    halCriticalExit();
+}
+
+void NodeSync::getStatus(nodesync_status_t *s) {
+    halCriticalEnter();
+    *s = status;
+    halCriticalExit();
+}
+
+bool NodeSync::getLap(size_t index, nodesync_lap_t *lap) {
+    halCriticalEnter();
+    bool found = index < raceLapCount;
+    if (found) *lap = raceLaps[index];
+    halCriticalExit();
+    return found;
+}
+
+size_t NodeSync::toJson(char *buf, size_t size) {
+    nodesync_status_t s;
+    getStatus(&s);
+    int len = snprintf(buf, size,
+                       "{\"node\":\"%08lx\",\"master\":\"%08lx\",\"nodes\":%u,\"synced\":%s,\"driftPpb\":%ld,\"delayUs\":%lu,\"errorUs\":%lu,"
+                       "\"race\":%lu,\"racing\":%s,\"laps\":%u}",
+                       (unsigned long)s.nodeId, (unsigned long)s.masterId, s.nodes, s.synced ? "true" : "false", (long)s.driftPpb,
+                       (unsigned long)s.delayUs, (unsigned long)s.errorUs, (unsigned long)s.raceId, s.racing ? "true" : "false", s.laps);
+    return len < 0 ? 0 : (size_t)len < size ? len : size - 1;
+}
+
+bool NodeSyncLapsJson::nextElement(char *text, size_t size) {
+    nodesync_lap_t lap;
+    if (!nodeSync->getLap(position, &lap)) return false;
+    position++;
+    snprintf(text, size, "{\"node\":\"%08lx\",\"pilot\":%u,\"lap\":%u,\"us\":%lu,\"passUs\":%lu,\"errorUs\":%lu}", (unsigned long)lap.node,
+             lap.pilot + 1, lap.lap, (unsigned long)lap.lapTimeUs, (unsigned long)lap.passUs, (unsigned long)lap.errorUs);
+    return true;
+}
@@ -0,0 +1,196 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "lapqueue.h"
+#include "sessionjson.h"
+
+#pragma once
+
+#define NODESYNC_PORT 5811
+#define NODESYNC_VERSION 1
+#define NODESYNC_MAX_NODES 8
+#define NODESYNC_HELLO_MS 500
+#define NODESYNC_NODE_TIMEOUT_MS 2000  // a node not heard from this long is gone, the master as well
+#define NODESYNC_SYNC_MS 250           // time exchanges with the master
+#define NODESYNC_SAMPLES 32            // exchanges the offset and drift are taken from, 8 s
+#define NODESYNC_MIN_SAMPLES 4         // before the clock counts as synced
+#define NODESYNC_FIT_MS 2000           // span of exchanges before the drift is fitted
+#define NODESYNC_MAX_DRIFT_PPM 100     // between two crystals, what the bound assumes until the drift is fitted
+#define NODESYNC_START_LEAD_MS 500     // a race starts this long after the master scheduled it
+#define NODESYNC_RESEND_MS 100         // starts, stops and laps until acknowledged or due
+#define NODESYNC_POLL_MS 10            // for datagrams while there are other nodes
+#define NODESYNC_STOP_REPEATS 3        // a stop is not acknowledged, it goes out this often
+#define NODESYNC_LAPS 16               // own laps not acknowledged by the master yet
+#define NODESYNC_RACE_LAPS 128         // laps of all nodes the master keeps of the race
+#define NODESYNC_JSON_SIZE 512
+
+typedef enum {
+    NODESYNC_MSG_HELLO = 1,
+    NODESYNC_MSG_SYNC,
+    NODESYNC_MSG_SYNC_REPLY,
+    NODESYNC_MSG_START,
+    NODESYNC_MSG_STOP,
+    NODESYNC_MSG_REQUEST,
+    NODESYNC_MSG_LAP,
+    NODESYNC_MSG_LAP_ACK
+} nodesync_msg_e;
+
+typedef struct {
+    uint32_t id;
+    hal_udp_peer_t peer;
+    uint32_t seenMs;
+} nodesync_node_t;
+
+typedef struct {
+    uint32_t localUs;  // middle of the exchange
+    uint32_t offsetUs;  // master minus local, wraps like the clocks
+    uint32_t delayUs;  // round trip without the time the master held it
+} nodesync_sample_t;
+
+typedef struct {
+    uint32_t node;
+    uint16_t seq;  // per node
+    uint8_t pilot;
+    uint16_t lap;
+    uint32_t lapTimeUs;
+    uint32_t passUs;   // on the master clock
+    uint32_t errorUs;  // bound of the pass time against the master clock
+} nodesync_lap_t;
+
+typedef struct {
+    uint32_t nodeId;
+    uint32_t masterId;
+    uint8_t nodes;  // heard from, this one included
+    bool synced;    // the master itself, or enough exchanges with it
+    int32_t driftPpb;
+    uint32_t delayUs;  // round trip of the exchange the offset is taken from
+    uint32_t errorUs;  // bound of the master clock as this node sees it now
+    uint32_t raceId;   // 0 before the first race
+    bool racing;
+    uint16_t laps;  // of the race on the master
+} nodesync_status_t;
+
+typedef void (*nodesync_start_fn_t)(void *arg, uint32_t startUs);  // the local time to start at, may be in the future
+typedef void (*nodesync_stop_fn_t)(void *arg);
+
+/*
+ * Several timers on one network as one: one node per pilot, races started
+ * at the same instant on all of them and the laps of all collected on one.
+ *
+ * Nodes announce themselves by broadcast and the one with the lowest id is
+ * the master. The others keep asking it for the time, NTP style: four
+ * timestamps per exchange give the offset and the round trip, the offset is
+ * taken from the exchange with the shortest round trip of the recent ones,
+ * and a line fitted through the recent offsets gives the drift. Half of that
+ * round trip bounds the error, plus what the drift can add since. Arrival
+ * times are taken by the HAL as datagrams come in, so how long they wait to
+ * be read doesn't count.
+ *
+ * The master schedules a start NODESYNC_START_LEAD_MS ahead on its clock and
+ * broadcasts it until it is due; every node starts its LapTimer at that
+ * instant on its own clock. Laps go to the master on its clock with their
+ * error bound and are sent again until acknowledged. A node on its own starts
+ * right away.
+ *
+ * Everything runs in the service task. start and stop are requests from any
+ * task, the status and laps are copied under halCriticalEnter for the web
+ * server.
+ */
+class NodeSync {
+   public:
+    void init(uint32_t nodeId, nodesync_start_fn_t onStart, nodesync_stop_fn_t onStop, void *arg);
+    bool begin();  // once the network is up, from the service task; until then the node is on its own
+    uint32_t handleSync(uint32_t currentTimeMs);  // ms until the next message is due
+    void handleLapEvent(const lap_event_t &event);  // from the lap event consumer
+    void start();  // of a race on all nodes, from any task
+    void stop();
+    bool isMaster();
+    bool toMaster(uint32_t localUs, uint32_t *masterUs, uint32_t *errorUs);  // false while not synced
+    uint32_t toLocal(uint32_t masterUs);
+    void getStatus(nodesync_status_t *status);
+    bool getLap(size_t index, nodesync_lap_t *lap);  // of the race on the master, in the order they came in
+    size_t toJson(char *buf, size_t size);  // the status, not the laps
+
+   private:
+    uint32_t id;
+    nodesync_start_fn_t startFn;
+    nodesync_stop_fn_t stopFn;
+    void *fnArg;
+    bool open = false;
+
+    nodesync_node_t nodes[NODESYNC_MAX_NODES];
+    uint8_t nodeCount;
+    uint32_t masterId;
+    hal_udp_peer_t masterPeer;
+    uint32_t helloMs;
+
+    // time exchanges with the master
+    nodesync_sample_t samples[NODESYNC_SAMPLES];
+    uint8_t sampleCount;
+    uint8_t sampleNext;
+    uint8_t syncSeq;
+    uint32_t syncMs;
+    uint32_t syncT1;
+    bool syncPending;
+    uint32_t anchorLocalUs;  // the exchange with the shortest round trip
+    uint32_t anchorOffsetUs;
+    uint32_t anchorDelayUs;
+    int32_t driftPpb;
+    uint32_t driftErrorPpb;
+    bool synced;
+
+    // the race, on the master clock
+    uint32_t raceId;
+    uint32_t raceStartUs;
+    bool racing;
+    bool announceStart;  // until it is due
+    uint8_t stopRepeats;
+    uint32_t resendMs;
+
+    // own laps until the master acknowledged them
+    nodesync_lap_t pending[NODESYNC_LAPS];
+    uint8_t pendingCount;
+    uint16_t lapSeq;
+
+    // guarded by halCriticalEnter, read by the web server
+    nodesync_lap_t raceLaps[NODESYNC_RACE_LAPS];
+    uint16_t raceLapCount;
+    nodesync_status_t status;
+
+    // from other tasks, guarded by halCriticalEnter
+    volatile uint32_t requestCount = 0;
+    bool requestStart;
+    uint32_t requestsHandled = 0;
+
+    void handleRequest(uint32_t currentTimeMs);
+    void handleMessage(const uint8_t *data, size_t len, const hal_udp_peer_t &from, uint32_t arrivalUs, uint32_t currentTimeMs);
+    void handleSyncReply(const uint8_t *data, uint32_t arrivalUs);
+    void seen(uint32_t node, const hal_udp_peer_t &peer, uint32_t currentTimeMs);
+    void elect(uint32_t currentTimeMs);
+    void resetClock();
+    void fitClock();
+    void scheduleStart(uint32_t currentTimeMs);
+    void scheduleStop();
+    void beginRace(uint32_t id, uint32_t startUs);
+    void addRaceLap(const nodesync_lap_t &lap);
+    void sendHello();
+    void sendSync(uint32_t currentTimeMs);
+    void sendRace(uint8_t type);
+    void sendLaps();
+    void publishStatus();
+    void send(const hal_udp_peer_t &to, const uint8_t *data, size_t len);
+};
+
+// [{"node":"0a1b2c3d","pilot":1,"lap":0,"us":4012345,"passUs":91234567,"errorUs":180},...], the pass on the master clock
+class NodeSyncLapsJson : public ChunkedJson {
+   public:
+    NodeSyncLapsJson(NodeSync *sync) : nodeSync(sync) {}
+
+   protected:
+    bool nextElement(char *text, size_t size) override;
+
+   private:
+    NodeSync *nodeSync;
+    size_t position = 0;
+};
@@ -0,0 +1,260 @@
+#include "otadelta.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool OtaDelta::hashImage() {
+    if (imageHashed || imageUnreadable) return true;
+    if (!imageSize) {
+        imageSize = halImageSize();
+        if (!imageSize) {
+            imageUnreadable = true;
+            return true;
+        }
+        imageSha.init();
+        imageHashedLen = 0;
+    }
+    uint32_t end = imageSize - imageHashedLen < OTA_DELTA_HASH_CHUNK ? imageSize : imageHashedLen + OTA_DELTA_HASH_CHUNK;
+    for (; imageHashedLen < end; imageHashedLen += sizeof(source)) {
+        uint32_t n = end - imageHashedLen < sizeof(source) ? end - imageHashedLen : sizeof(source);
+        if (!halImageRead(imageHashedLen, source, n)) {
+            imageSha.final(imageHash);  // only to let go of it
+            imageUnreadable = true;
+            return true;
+        }
+        imageSha.update(source, n);
+    }
+    if (imageHashedLen < imageSize) return false;
+    imageSha.final(imageHash);
+    slotSize = halUpdateBegin();
+    imageHashed = true;
+    return true;
+}
+
+bool OtaDelta::getImage(uint8_t *hash, uint32_t *size) {
+    if (!imageHashed) return false;
+    if (hash) memcpy(hash, imageHash, SHA256_SIZE);
+    if (size) *size = imageSize;
+    return true;
+}
+
+bool OtaDelta::begin() {
+    received = written = 0;
+    sourceLen = 0;
+    error = OTA_DELTA_OK;
+    state = OTA_DELTA_HEADER;
+    if (imageUnreadable) return fail(OTA_DELTA_ERR_FLASH);
+    if (!imageHashed) return fail(OTA_DELTA_ERR_NOT_READY);
+    slotSize = halUpdateBegin();
+    if (!slotSize) return fail(OTA_DELTA_ERR_NO_SLOT);
+    return true;
+}
+
+bool OtaDelta::fail(ota_delta_error_e e) {
+    if (state != OTA_DELTA_FAILED) {
+        DEBUG("Delta update failed: %s after %lu bytes\n", errorName(e), (unsigned long)received);
+    }
+    state = OTA_DELTA_FAILED;
+    error = e;
+    return false;
+}
+
+// nothing is erased before this passes
+bool OtaDelta::checkHeader() {
+    if (memcmp(header, OTA_DELTA_MAGIC, 4) || header[4] != OTA_DELTA_VERSION) return fail(OTA_DELTA_ERR_HEADER);
+    if (get32(&header[8]) != imageSize || memcmp(&header[12], imageHash, SHA256_SIZE)) return fail(OTA_DELTA_ERR_BASE);
+    targetSize = get32(&header[44]);
+    if (targetSize == 0 || targetSize > slotSize) return fail(OTA_DELTA_ERR_TOO_BIG);
+    sourcePos = 0;
+    control = 0;
+    varint = 0;
+    varintShift = 0;
+    state = OTA_DELTA_CONTROL;
+    return true;
+}
+
+bool OtaDelta::readVarint(uint8_t b) {
+    if (varintShift > 28) return fail(OTA_DELTA_ERR_PATCH);
+    varint |= (uint32_t)(b & 0x7F) << varintShift;
+    varintShift += 7;
+    if (b & 0x80) return true;
+    bool ok = handleVarint();
+    varint = 0;
+    varintShift = 0;
+    return ok;
+}
+
+bool OtaDelta::handleVarint() {
+    switch (state) {
+        case OTA_DELTA_CONTROL:
+            if (control == 0) {
+                if (written == targetSize) return fail(OTA_DELTA_ERR_PATCH);  // more after the last op
+                addLeft = varint;
+            } else if (control == 1) {
+                extraLeft = varint;
+            } else {
+                seek = (int32_t)(varint >> 1) ^ -(int32_t)(varint & 1);
+            }
+            if (++control < 3) return true;
+            control = 0;
+            if ((uint64_t)written + addLeft + extraLeft > targetSize) return fail(OTA_DELTA_ERR_PATCH);
+            break;
+        case OTA_DELTA_ZEROS:
+            if (varint > addLeft) return fail(OTA_DELTA_ERR_PATCH);
+            addLeft -= varint;
+            for (uint32_t i = 0; i < varint; i++) {
+                uint8_t b;
+                if (!sourceByte(&b) || !emit(b)) return false;
+            }
+            state = OTA_DELTA_LITERALS;
+            return true;
+        case OTA_DELTA_LITERALS:
+            if (varint > addLeft) return fail(OTA_DELTA_ERR_PATCH);
+            runLeft = varint;
+            if (runLeft) {
+                state = OTA_DELTA_ADD;
+                return true;
+            }
+            break;
+        default:
+            return fail(OTA_DELTA_ERR_PATCH);
+    }
+
+    // what comes after a control or a run
+    if (addLeft) {
+        state = OTA_DELTA_ZEROS;
+    } else if (extraLeft) {
+        state = OTA_DELTA_EXTRA;
+    } else {
+        int64_t pos = (int64_t)sourcePos + seek;
+        if (pos < 0 || pos > imageSize) return fail(OTA_DELTA_ERR_PATCH);
+        sourcePos = pos;
+        state = OTA_DELTA_CONTROL;
+    }
+    return true;
+}
+
+bool OtaDelta::sourceByte(uint8_t *out) {
+    if (sourcePos >= imageSize) return fail(OTA_DELTA_ERR_PATCH);
+    if (sourcePos < sourceAt || sourcePos >= sourceAt + sourceLen) {
+        sourceAt = sourcePos;
+        sourceLen = imageSize - sourcePos < sizeof(source) ? imageSize - sourcePos : sizeof(source);
+        if (!halImageRead(sourceAt, source, sourceLen)) {
+            sourceLen = 0;
+            return fail(OTA_DELTA_ERR_FLASH);
+        }
+    }
+    *out = source[sourcePos++ - sourceAt];
+    return true;
+}
+
+bool OtaDelta::emit(uint8_t b) {
+    if (written >= targetSize) return fail(OTA_DELTA_ERR_PATCH);
+    sector[written++ % sizeof(sector)] = b;
+    return written % sizeof(sector) || flushSector();
+}
+
+// the sector the last byte went into, erased and written whole
+bool OtaDelta::flushSector() {
+    uint32_t address = (written - 1) / sizeof(sector) * sizeof(sector);
+    uint32_t fill = written - address;
+    memset(&sector[fill], 0xFF, sizeof(sector) - fill);
+    if (!halUpdateErase(address) || !halUpdateWrite(address, sector, sizeof(sector))) return fail(OTA_DELTA_ERR_FLASH);
+    return true;
+}
+
+bool OtaDelta::write(const uint8_t *data, size_t len) {
+    if (state == OTA_DELTA_IDLE || state == OTA_DELTA_DONE) return fail(OTA_DELTA_ERR_HEADER);  // no begin()
+    for (size_t i = 0; i < len && state != OTA_DELTA_FAILED; i++) {
+        uint8_t b = data[i];
+        received++;
+        switch (state) {
+            case OTA_DELTA_HEADER:
+                header[received - 1] = b;
+                if (received == OTA_DELTA_HEADER_SIZE) checkHeader();
+                break;
+            case OTA_DELTA_CONTROL:
+            case OTA_DELTA_ZEROS:
+            case OTA_DELTA_LITERALS:
+                readVarint(b);
+                break;
+            case OTA_DELTA_ADD: {
+                uint8_t old;
+                if (!sourceByte(&old) || !emit(old + b)) break;
+                addLeft--;
+                if (--runLeft) break;
+                state = OTA_DELTA_LITERALS;  // the run is done, what follows as after a literal count of 0
+                varint = 0;
+                handleVarint();
+                break;
+            }
+            case OTA_DELTA_EXTRA:
+                if (!emit(b)) break;
+                if (--extraLeft) break;
+                varint = 0;
+                state = OTA_DELTA_LITERALS;
+                handleVarint();
+                break;
+            default:
+                fail(OTA_DELTA_ERR_PATCH);
+        }
+    }
+    return state != OTA_DELTA_FAILED;
+}
+
+// the slot as the bootloader will read it
+bool OtaDelta::verify() {
+    Sha256 sha;
+    uint8_t hash[SHA256_SIZE];
+    sha.init();
+    for (uint32_t at = 0; at < targetSize; at += sizeof(sector)) {
+        uint32_t n = targetSize - at < sizeof(sector) ? targetSize - at : sizeof(sector);
+        if (!halUpdateRead(at, sector, n)) return fail(OTA_DELTA_ERR_FLASH);
+        sha.update(sector, n);
+    }
+    sha.final(hash);
+    if (memcmp(hash, &header[48], SHA256_SIZE)) return fail(OTA_DELTA_ERR_HASH);
+    return true;
+}
+
+bool OtaDelta::end() {
+    if (state == OTA_DELTA_FAILED) return false;
+    if (state != OTA_DELTA_CONTROL || control != 0 || varintShift != 0 || written != targetSize) return fail(OTA_DELTA_ERR_SHORT);
+    if (written % sizeof(sector) && !flushSector()) return false;
+    if (!verify()) return false;
+    if (!halUpdateActivate()) return fail(OTA_DELTA_ERR_ACTIVATE);
+    DEBUG("Delta update of %lu bytes made a %lu byte image\n", (unsigned long)received, (unsigned long)written);
+    state = OTA_DELTA_DONE;
+    return true;
+}
+
+ota_delta_state_e OtaDelta::getState() {
+    return state;
+}
+
+ota_delta_error_e OtaDelta::getError() {
+    return error;
+}
+
+const char *OtaDelta::errorName(ota_delta_error_e e) {
+    static const char *names[] = {"none", "no slot", "bad header", "other base image", "too big", "bad patch", "incomplete", "flash", "hash mismatch", "not bootable", "not hashed yet"};
+    return e < sizeof(names) / sizeof(names[0]) ? names[e] : "unknown";
+}
+
+size_t OtaDelta::toJson(char *buf, size_t size) {
+    char hex[SHA256_HEX_SIZE] = "";
+    uint8_t hash[SHA256_SIZE];
+    uint32_t image = 0;
+    if (getImage(hash, &image)) Sha256::toHex(hash, hex);
+    const char *stateName = state == OTA_DELTA_IDLE ? "idle" : state == OTA_DELTA_DONE ? "done" : state == OTA_DELTA_FAILED ? "failed" : "receiving";
+    int len = snprintf(buf, size, "{\"size\":%lu,\"sha256\":\"%s\",\"slot\":%lu,\"state\":\"%s\",\"error\":\"%s\",\"received\":%lu,\"written\":%lu}",
+                       (unsigned long)image, hex, (unsigned long)(imageHashed ? slotSize : 0), stateName, errorName(error), (unsigned long)received,
+                       (unsigned long)written);
+    return len < 0 ? 0 : (size_t)len < size ? len : size - 1;
+}
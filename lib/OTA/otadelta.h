@@ -0,0 +1,110 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "sha256.h"
+
+#pragma once
+
+#define OTA_DELTA_MAGIC "PLTD"
+#define OTA_DELTA_VERSION 1
+#define OTA_DELTA_HEADER_SIZE 80
+#define OTA_DELTA_SOURCE_CHUNK 256  // of the running image read at a time
+#define OTA_DELTA_HASH_CHUNK 16384  // of the running image hashed per hashImage() call
+#define OTA_DELTA_JSON_SIZE 256
+
+typedef enum {
+    OTA_DELTA_IDLE,
+    OTA_DELTA_HEADER,
+    OTA_DELTA_CONTROL,   // add, extra and seek of the next op
+    OTA_DELTA_ZEROS,     // bytes of the add run taken from the image as they are
+    OTA_DELTA_LITERALS,  // count of the bytes added to the image that follow
+    OTA_DELTA_ADD,
+    OTA_DELTA_EXTRA,
+    OTA_DELTA_DONE,
+    OTA_DELTA_FAILED
+} ota_delta_state_e;
+
+typedef enum {
+    OTA_DELTA_OK,
+    OTA_DELTA_ERR_NO_SLOT,
+    OTA_DELTA_ERR_HEADER,
+    OTA_DELTA_ERR_BASE,  // made against another image than the one running
+    OTA_DELTA_ERR_TOO_BIG,
+    OTA_DELTA_ERR_PATCH,
+    OTA_DELTA_ERR_SHORT,
+    OTA_DELTA_ERR_FLASH,
+    OTA_DELTA_ERR_HASH,
+    OTA_DELTA_ERR_ACTIVATE,
+    OTA_DELTA_ERR_NOT_READY  // the running image isn't hashed yet
+} ota_delta_error_e;
+
+/*
+ * Firmware updates as a binary diff against the running image, the way
+ * bsdiff makes them, so only the changes cross the WiFi link.
+ *
+ * The header (little endian) holds the magic, the version, the size and
+ * SHA-256 of the image the patch was made from and of the image it makes.
+ * Then ops, each three LEB128 varints: the add length, the extra length and
+ * the seek in the old image (zigzag). Add bytes are the old image plus a
+ * difference, sent as runs of a zero count (old bytes as they are) and a
+ * literal count followed by that many differences; extra bytes are new.
+ *
+ * The patch streams in as the body arrives and the image is built in the
+ * OTA slot a sector at a time, so RAM stays at a sector and a read chunk
+ * whatever the image size. Nothing is erased until the header matches the
+ * running image. end() reads the slot back, checks it against the hash of
+ * the header and only then makes it the boot image.
+ *
+ * The running image is hashed by hashImage() from the service task, a chunk
+ * per call, so the web server's task never reads through the whole image.
+ * The slot is looked up there too, once, before a patch can begin.
+ */
+class OtaDelta {
+   public:
+    bool hashImage();  // true once there is nothing left to hash, call until then
+    bool getImage(uint8_t *hash, uint32_t *size);  // of the running image, false until hashImage() got through it
+    bool begin();  // a patch starts, false when there is no slot to write to
+    bool write(const uint8_t *data, size_t len);  // false once the update failed, the rest can go
+    bool end();  // the patch is complete, true when the image checks out and boots next
+    ota_delta_state_e getState();
+    ota_delta_error_e getError();
+    size_t toJson(char *buf, size_t size);
+    static const char *errorName(ota_delta_error_e error);
+
+   private:
+    ota_delta_state_e state = OTA_DELTA_IDLE;
+    ota_delta_error_e error = OTA_DELTA_OK;
+    volatile bool imageHashed = false;  // set by the service task once the rest is
+    bool imageUnreadable = false;
+    Sha256 imageSha;
+    uint32_t imageHashedLen = 0;
+    uint8_t imageHash[SHA256_SIZE];
+    uint32_t imageSize = 0;
+    size_t slotSize = 0;
+
+    uint8_t header[OTA_DELTA_HEADER_SIZE];
+    uint32_t received = 0;
+    uint32_t targetSize;
+    uint32_t varint;
+    uint8_t varintShift;
+    uint8_t control;  // varints of the op read so far
+    uint32_t addLeft, extraLeft, runLeft;
+    int32_t seek;
+    uint32_t sourcePos;
+    uint32_t written = 0;  // bytes of the new image made
+
+    uint8_t sector[HAL_FLASH_SECTOR_SIZE];
+    uint8_t source[OTA_DELTA_SOURCE_CHUNK];
+    uint32_t sourceAt;  // image address of source[0]
+    uint32_t sourceLen;
+
+    bool fail(ota_delta_error_e e);
+    bool checkHeader();
+    bool readVarint(uint8_t b);
+    bool handleVarint();
+    bool sourceByte(uint8_t *out);
+    bool emit(uint8_t b);
+    bool flushSector();
+    bool verify();
+};
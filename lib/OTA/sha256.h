@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <mbedtls/sha256.h>
+#endif
+
+#pragma once
+
+#define SHA256_SIZE 32
+#define SHA256_HEX_SIZE (2 * SHA256_SIZE + 1)
+
+// FIPS 180-4, streaming. On the ESP32 mbedtls, which hands the blocks to the SHA peripheral, on the host in software.
+class Sha256 {
+   public:
+    void init();
+    void update(const void *data, size_t len);
+    void final(uint8_t *hash);  // SHA256_SIZE bytes
+    static void toHex(const uint8_t *hash, char *hex);  // SHA256_HEX_SIZE with the terminator
+
+   private:
+#ifdef ARDUINO
+    mbedtls_sha256_context context;
+#else
+    uint32_t state[8];
+    uint64_t length;  // bytes so far
+    uint8_t block[64];
+    uint8_t used;
+
+    void compress();
+#endif
+};
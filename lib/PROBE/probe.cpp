@@ -0,0 +1,163 @@
+#include "probe.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t sumCycles;
+    uint32_t lastMark;
+    bool marked;
+    volatile bool resetPending;
+    uint32_t buckets[PROBE_BUCKETS];
+} probe_t;
+
+static probe_t probes[PROBE_COUNT];
+
+static const char *names[PROBE_COUNT] = {
+    "laptimer.update",
+    "rssi.read",
+    "rssi.filter",
+    "detector",
+    "loop",
+    "lap.latency",
+    "lap.push",
+    "tick.late",
+    "tick.work",
+    "dns",
+    "task.buzzer",
+    "task.led",
+    "task.laps",
+    "task.web",
+    "task.eeprom",
+    "task.sessions",
+    "task.hopper",
+    "task.battery",
+    "task.sync",
+};
+
+// exact below 2^PROBE_SUB_BITS, above that the octave and the next bits under its top bit
+static inline uint8_t bucketOf(uint32_t cycles) {
+    const uint32_t sub = 1 << PROBE_SUB_BITS;
+    if (cycles < sub) return cycles;
+    uint8_t octave = 31 - __builtin_clz(cycles);
+    uint32_t bucket = ((octave - PROBE_SUB_BITS + 1) << PROBE_SUB_BITS) + ((cycles >> (octave - PROBE_SUB_BITS)) & (sub - 1));
+    return bucket < PROBE_BUCKETS ? bucket : PROBE_BUCKETS - 1;
+}
+
+static float bucketMidCycles(uint8_t bucket) {
+    const uint32_t sub = 1 << PROBE_SUB_BITS;
+    if (bucket < sub) return bucket;
+    uint8_t shift = (bucket >> PROBE_SUB_BITS) - 1;
+    float low = (float)((sub + (bucket & (sub - 1))) << shift);
+    return low + (float)(1 << shift) / 2;
+}
+
+void probeRecord(uint8_t probe, uint32_t cycles) {
+    probe_t &p = probes[probe];
+    if (p.resetPending) {
+        memset(p.buckets, 0, sizeof(p.buckets));
+        p.count = 0;
+        p.sumCycles = 0;
+        p.resetPending = false;
+    }
+    if (p.count == 0 || cycles < p.minCycles) p.minCycles = cycles;
+    if (p.count == 0 || cycles > p.maxCycles) p.maxCycles = cycles;
+    p.sumCycles += cycles;
+    p.buckets[bucketOf(cycles)]++;
+    p.count++;
+}
+
+void probeRecordUs(uint8_t probe, uint32_t us) {
+    uint64_t cycles = (uint64_t)us * halCyclesPerUs();
+    probeRecord(probe, cycles > UINT32_MAX ? UINT32_MAX : cycles);
+}
+
+void probeMark(uint8_t probe) {
+    probe_t &p = probes[probe];
+    uint32_t now = halCycles();
+    if (p.marked) probeRecord(probe, now - p.lastMark);
+    p.lastMark = now;
+    p.marked = true;
+}
+
+void probeReset() {
+    for (probe_t &p : probes) {
+        p.resetPending = true;
+    }
+}
+
+bool probeSummary(uint8_t probe, probe_summary_t *summary) {
+    memset(summary, 0, sizeof(*summary));
+    const probe_t &p = probes[probe];
+    if (p.resetPending || p.count == 0) return false;
+
+    float cyclesPerUs = halCyclesPerUs();
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < PROBE_BUCKETS; i++) {
+        total += p.buckets[i];
+    }
+    float *percentiles[] = {&summary->p50Us, &summary->p90Us, &summary->p99Us};
+    const float ranks[] = {0.50f, 0.90f, 0.99f};
+    uint32_t seen = 0;
+    uint8_t next = 0;
+    for (uint8_t i = 0; i < PROBE_BUCKETS && next < 3; i++) {
+        seen += p.buckets[i];
+        while (next < 3 && seen && seen >= ranks[next] * total) {
+            float cycles = bucketMidCycles(i);
+            // the bucket middle can be outside what was seen
+            if (cycles < p.minCycles) cycles = p.minCycles;
+            if (cycles > p.maxCycles) cycles = p.maxCycles;
+            *percentiles[next++] = cycles / cyclesPerUs;
+        }
+    }
+    summary->count = p.count;
+    summary->minUs = p.minCycles / cyclesPerUs;
+    summary->maxUs = p.maxCycles / cyclesPerUs;
+    summary->meanUs = (float)p.sumCycles / p.count / cyclesPerUs;
+    return true;
+}
+
+const char *probeName(uint8_t probe) {
+    return probe < PROBE_COUNT ? names[probe] : "";
+}
+
+bool probesEnabled() {
+#ifdef PROBES
+    return true;
+#else
+    return false;
+#endif
+}
+
+void probeReport(bool json, probe_print_fn_t print, void *arg) {
+    char line[192];
+    probe_summary_t loop;
+    float loopHz = probeSummary(PROBE_LOOP, &loop) && loop.meanUs > 0 ? 1000000 / loop.meanUs : 0;
+
+    if (json) {
+        snprintf(line, sizeof(line), "{\"enabled\":%s,\"cyclesPerUs\":%u,\"loopHz\":%.1f,\"probes\":{", probesEnabled() ? "true" : "false",
+                 halCyclesPerUs(), loopHz);
+    } else {
+        snprintf(line, sizeof(line), "Probes:\t%s\nCycles per us:\t%u\nLoop rate:\t%.1f Hz\n%-16s\tcount\tmin us\tp50 us\tp90 us\tp99 us\tmax us\tmean us\n",
+                 probesEnabled() ? "on" : "off, build with -DPROBES (lap.push and tick are always on)", halCyclesPerUs(), loopHz, "probe");
+    }
+    print(arg, line);
+
+    for (uint8_t i = 0; i < PROBE_COUNT; i++) {
+        probe_summary_t s;
+        probeSummary(i, &s);
+        if (json) {
+            snprintf(line, sizeof(line),
+                     "%s\"%s\":{\"count\":%u,\"minUs\":%.3f,\"p50Us\":%.3f,\"p90Us\":%.3f,\"p99Us\":%.3f,\"maxUs\":%.3f,\"meanUs\":%.3f}",
+                     i ? "," : "", names[i], s.count, s.minUs, s.p50Us, s.p90Us, s.p99Us, s.maxUs, s.meanUs);
+        } else {
+            snprintf(line, sizeof(line), "%-16s\t%u\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", names[i], s.count, s.minUs, s.p50Us, s.p90Us,
+                     s.p99Us, s.maxUs, s.meanUs);
+        }
+        print(arg, line);
+    }
+    if (json) print(arg, "}}");
+}
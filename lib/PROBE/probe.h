@@ -0,0 +1,85 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+#pragma once
+
+#define PROBE_OCTAVES 24  // cycles up to 2^25, 140 ms at 240 MHz, longer ones land in the last bucket
+#define PROBE_SUB_BITS 2  // 4 buckets per octave, a percentile is within 13% of the truth
+#define PROBE_BUCKETS (PROBE_OCTAVES << PROBE_SUB_BITS)
+
+typedef enum {
+    PROBE_LAPTIMER_UPDATE,  // timing loop
+    PROBE_RSSI_READ,
+    PROBE_RSSI_FILTER,
+    PROBE_DETECTOR,
+    PROBE_LOOP,         // between two runs of the timing loop, the loop rate follows
+    PROBE_LAP_LATENCY,  // from the sample completing a pass to its event in the service task
+    PROBE_LAP_PUSH,     // from the sample completing a pass to its frames handed to the clients, in every build
+    PROBE_TICK_LATE,    // from the timer interrupt to the tick task running, in every build
+    PROBE_TICK_WORK,    // the timing loop in the tick task, in every build
+    PROBE_DNS,          // a captive portal query from its arrival to the answer sent, in every build
+    PROBE_TASK_BUZZER,  // service task
+    PROBE_TASK_LED,
+    PROBE_TASK_LAPS,
+    PROBE_TASK_WEB,
+    PROBE_TASK_EEPROM,
+    PROBE_TASK_SESSIONS,
+    PROBE_TASK_HOPPER,
+    PROBE_TASK_BATTERY,
+    PROBE_TASK_SYNC,
+    PROBE_COUNT
+} probe_id_e;
+
+typedef struct {
+    uint32_t count;
+    float minUs;
+    float p50Us;
+    float p90Us;
+    float p99Us;
+    float maxUs;
+    float meanUs;
+} probe_summary_t;
+
+typedef void (*probe_print_fn_t)(void *arg, const char *text);
+
+/*
+ * Timing of hot paths in halCycles, with count, min, max, sum and a log
+ * histogram per probe in fixed memory. Each probe is recorded by one task
+ * only and needs no lock; readers see it as it is, a summary taken while
+ * it records can be a sample off. A reset is left for the recording task.
+ * The PROBE_ macros compile to nothing unless built with -DPROBES.
+ */
+void probeRecord(uint8_t probe, uint32_t cycles);
+void probeRecordUs(uint8_t probe, uint32_t us);
+void probeMark(uint8_t probe);  // records the cycles since the last mark
+void probeReset();
+bool probeSummary(uint8_t probe, probe_summary_t *summary);  // false when nothing was recorded
+const char *probeName(uint8_t probe);
+bool probesEnabled();
+
+// text is a table like /status, json the same numbers
+void probeReport(bool json, probe_print_fn_t print, void *arg);
+
+class ProbeScope {
+   public:
+    explicit ProbeScope(uint8_t probe) : id(probe), startCycles(halCycles()) {}
+    ~ProbeScope() { probeRecord(id, halCycles() - startCycles); }
+
+   private:
+    uint8_t id;
+    uint32_t startCycles;
+};
+
+#ifdef PROBES
+#define PROBE_JOIN_(a, b) a##b
+#define PROBE_JOIN(a, b) PROBE_JOIN_(a, b)
+#define PROBE_SCOPE(probe) ProbeScope PROBE_JOIN(probeScope, __LINE__)(probe)
+#define PROBE_MARK(probe) probeMark(probe)
+#define PROBE_RECORD_US(probe, us) probeRecordUs(probe, us)
+#else
+#define PROBE_SCOPE(probe)
+#define PROBE_MARK(probe)
+#define PROBE_RECORD_US(probe, us)
+#endif
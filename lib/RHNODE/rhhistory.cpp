@@ -0,0 +1,115 @@
+#include "rhhistory.h"
+
+#include <string.h>
+
+#include "hal.h"
+
+void RhHistory::init() {
+    memset(pilots, 0, sizeof(pilots));
+}
+
+void RhHistory::push(uint8_t pilot, uint8_t rssi, uint32_t timeUs) {
+    if (pilot >= CONFIG_MAX_PILOTS) return;
+    rh_pilot_history_t &h = pilots[pilot];
+    if (h.resetCount != h.resetsHandled) {
+        h.resetsHandled = h.resetCount;
+        h.started = false;
+    }
+    if (!h.started) {
+        h.started = true;
+        h.rising = true;
+        h.level = rssi;
+        h.firstUs = h.lastUs = timeUs;
+        h.nodePeak = rssi;
+        h.nodeNadir = rssi;
+        h.passNadir = rssi;
+        h.passesHandled = h.passCount;
+        return;
+    }
+    if (rssi > h.nodePeak) h.nodePeak = rssi;
+    if (rssi < h.nodeNadir) h.nodeNadir = rssi;
+    if (h.passCount != h.passesHandled) {
+        h.passesHandled = h.passCount;
+        h.passNadir = rssi;
+    } else if (rssi < h.passNadir) {
+        h.passNadir = rssi;
+    }
+
+    // follow the signal while it goes on the same way, turn once it left the level by the hysteresis
+    if (rssi == h.level) {
+        h.lastUs = timeUs;
+    } else if (h.rising ? rssi > h.level : rssi < h.level) {
+        h.level = rssi;
+        h.firstUs = h.lastUs = timeUs;
+    } else if (h.rising ? rssi + RHHISTORY_HYSTERESIS <= h.level : rssi >= h.level + RHHISTORY_HYSTERESIS) {
+        store(h);
+        h.rising = !h.rising;
+        h.level = rssi;
+        h.firstUs = h.lastUs = timeUs;
+    }
+}
+
+void RhHistory::store(rh_pilot_history_t &h) {
+    uint32_t head = h.head;
+    if (head - h.tail >= RHHISTORY_EXTREMUMS) {
+        h.dropped = h.dropped + 1;
+        return;
+    }
+    rh_extremum_t &e = h.ring[head % RHHISTORY_EXTREMUMS];
+    e.rssi = h.level;
+    e.peak = h.rising;
+    e.firstUs = h.firstUs;
+    e.lastUs = h.lastUs;
+    halMemoryBarrier();  // the record is complete before a consumer can see it
+    h.head = head + 1;
+}
+
+bool RhHistory::pop(uint8_t pilot, rh_extremum_t *extremum) {
+    if (pilot >= CONFIG_MAX_PILOTS) return false;
+    rh_pilot_history_t &h = pilots[pilot];
+    bool found = false;
+    halCriticalEnter();
+    uint32_t tail = h.tail;
+    if (tail != h.head) {
+        halMemoryBarrier();  // the record is read after the index that published it
+        *extremum = h.ring[tail % RHHISTORY_EXTREMUMS];
+        halMemoryBarrier();  // and before the producer may reuse the slot
+        h.tail = tail + 1;
+        found = true;
+    }
+    halCriticalExit();
+    return found;
+}
+
+uint8_t RhHistory::getNodePeak(uint8_t pilot) {
+    return pilot < CONFIG_MAX_PILOTS ? pilots[pilot].nodePeak : 0;
+}
+
+uint8_t RhHistory::getNodeNadir(uint8_t pilot) {
+    return pilot < CONFIG_MAX_PILOTS ? pilots[pilot].nodeNadir : 0;
+}
+
+uint8_t RhHistory::getPassNadir(uint8_t pilot) {
+    return pilot < CONFIG_MAX_PILOTS ? pilots[pilot].passNadir : 0;
+}
+
+uint32_t RhHistory::getDropped(uint8_t pilot) {
+    return pilot < CONFIG_MAX_PILOTS ? pilots[pilot].dropped : 0;
+}
+
+// turning points not read yet are dropped with the rest, from the last one read on
+void RhHistory::reset(uint8_t pilot) {
+    if (pilot >= CONFIG_MAX_PILOTS) return;
+    rh_pilot_history_t &h = pilots[pilot];
+    halCriticalEnter();
+    h.tail = h.head;
+    h.resetCount = h.resetCount + 1;
+    halCriticalExit();
+}
+
+void RhHistory::pass(uint8_t pilot) {
+    if (pilot >= CONFIG_MAX_PILOTS) return;
+    halCriticalEnter();
+    pilots[pilot].passCount = pilots[pilot].passCount + 1;
+    halCriticalExit();
+}
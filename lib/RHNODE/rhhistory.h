@@ -0,0 +1,70 @@
+#include <stdint.h>
+
+#include "config.h"
+
+#pragma once
+
+#define RHHISTORY_EXTREMUMS 16   // per pilot not read yet, a power of two
+#define RHHISTORY_HYSTERESIS 2   // a peak or nadir counts once RSSI left it by this much
+
+typedef struct {
+    uint8_t rssi;
+    bool peak;  // or nadir
+    uint32_t firstUs;  // first and last sample at that level
+    uint32_t lastUs;
+} rh_extremum_t;
+
+typedef struct {
+    // producer side
+    bool started;
+    bool rising;
+    uint8_t level;
+    uint32_t firstUs;
+    uint32_t lastUs;
+    uint32_t resetsHandled;
+    uint32_t passesHandled;
+
+    // read by the consumers whenever
+    volatile uint8_t nodePeak;
+    volatile uint8_t nodeNadir;
+    volatile uint8_t passNadir;  // lowest since the last pass
+    volatile uint32_t dropped;
+
+    // from the consumers
+    volatile uint32_t resetCount;
+    volatile uint32_t passCount;
+
+    rh_extremum_t ring[RHHISTORY_EXTREMUMS];
+    volatile uint32_t head;  // written by the producer only
+    volatile uint32_t tail;  // written by the consumers, one at a time under halCriticalEnter
+} rh_pilot_history_t;
+
+/*
+ * The RSSI of each pilot as RotorHazard nodes report it: the highest and
+ * lowest since the frequency was set, the lowest since the last pass, and
+ * the turning points of the signal as a queue of alternating peaks and
+ * nadirs with how long RSSI stayed there, which the server draws its RSSI
+ * graph from.
+ *
+ * push() is called by LapTimer for every filtered sample and never waits;
+ * the turning points go into a ring like LapQueue and are dropped when
+ * nobody reads them. Resets are requests the producer carries out on its
+ * next sample.
+ */
+class RhHistory {
+   public:
+    void init();
+    void push(uint8_t pilot, uint8_t rssi, uint32_t timeUs);
+    bool pop(uint8_t pilot, rh_extremum_t *extremum);  // oldest first, from any task
+    uint8_t getNodePeak(uint8_t pilot);  // 0 before the first sample
+    uint8_t getNodeNadir(uint8_t pilot);
+    uint8_t getPassNadir(uint8_t pilot);
+    uint32_t getDropped(uint8_t pilot);
+    void reset(uint8_t pilot);  // the frequency changed, starts over
+    void pass(uint8_t pilot);   // the lowest since the last pass starts over
+
+   private:
+    rh_pilot_history_t pilots[CONFIG_MAX_PILOTS];
+
+    void store(rh_pilot_history_t &h);
+};
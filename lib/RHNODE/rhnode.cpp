@@ -0,0 +1,281 @@
+#include "rhnode.h"
+
+#include <string.h>
+
+#include "bands.h"
+#include "debug.h"
+#include "hal.h"
+
+#ifdef ARDUINO
+#define RHNODE_PROCTYPE "ESP32"
+#else
+#define RHNODE_PROCTYPE "native"
+#endif
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value >> 16);
+    put16(p + 2, value);
+}
+
+// the server takes 0 for no value
+static uint8_t rssiOf(uint8_t rssi) {
+    return rssi ? rssi : 1;
+}
+
+static uint16_t msOf(uint32_t us) {
+    uint32_t ms = us / 1000;
+    return ms > 0xFFFF ? 0xFFFF : ms;
+}
+
+static size_t text(uint8_t *out, const char *s) {
+    memset(out, 0, RHNODE_TEXT_SIZE);
+    strncpy((char *)out, s, RHNODE_TEXT_SIZE);
+    return RHNODE_TEXT_SIZE;
+}
+
+void RhNode::init(Config *config, LapTimer *lapTimer) {
+    conf = config;
+    timer = lapTimer;
+    history.init();
+    memset(passes, 0, sizeof(passes));
+}
+
+RhHistory *RhNode::getHistory() {
+    return &history;
+}
+
+void RhNode::handleLapEvent(const lap_event_t &event) {
+    if (event.type != LAP_EVENT_LAP || event.pilot >= LAPTIMER_MAX_PILOTS) return;
+    uint8_t nadir = history.getPassNadir(event.pilot);
+    halCriticalEnter();
+    rh_pass_t &p = passes[event.pilot];
+    p.passes++;
+    p.passUs = event.timeUs;
+    p.peakRssi = event.peakRssi;
+    p.nadirRssi = nadir;
+    halCriticalExit();
+    history.pass(event.pilot);
+}
+
+void RhNode::attach() {
+    if (timer->isRunning()) return;
+    DEBUG("RotorHazard server attached, timer started\n");
+    timer->start();
+}
+
+uint8_t RhNode::getNodeCount() {
+    return timer->getPilotCount();
+}
+
+int8_t RhNode::writeSize(uint8_t command) {
+    switch (command) {
+        case RH_WRITE_FREQUENCY:
+        case RH_SEND_STATUS_MESSAGE:
+            return 2;
+        case RH_WRITE_ENTER_AT_LEVEL:
+        case RH_WRITE_EXIT_AT_LEVEL:
+        case RH_FORCE_END_CROSSING:
+        case RH_RESET_PAIRED_NODE:
+        case RH_WRITE_CURNODE_INDEX:
+        case RH_JUMP_TO_BOOTLOADER:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+size_t RhNode::read(uint8_t node, uint8_t command, uint8_t *out) {
+    if (node >= LAPTIMER_MAX_PILOTS) return 0;
+    size_t len;
+    switch (command) {
+        case RH_READ_FREQUENCY:
+            put16(out, conf->getPilotFrequency(node));
+            len = 2;
+            break;
+        case RH_READ_LAP_STATS:
+            len = readLapStats(node, out);
+            break;
+        case RH_READ_RHFEAT_FLAGS:
+            put16(out, 0);
+            len = 2;
+            break;
+        case RH_READ_REVISION_CODE:
+            put16(out, RHNODE_REVISION);
+            len = 2;
+            break;
+        case RH_READ_NODE_RSSI_PEAK:
+            out[0] = rssiOf(history.getNodePeak(node));
+            len = 1;
+            break;
+        case RH_READ_NODE_RSSI_NADIR:
+            out[0] = rssiOf(history.getNodeNadir(node));
+            len = 1;
+            break;
+        case RH_READ_ENTER_AT_LEVEL:
+            out[0] = conf->getPilotEnterRssi(node);
+            len = 1;
+            break;
+        case RH_READ_EXIT_AT_LEVEL:
+            out[0] = conf->getPilotExitRssi(node);
+            len = 1;
+            break;
+        case RH_READ_TIME_MILLIS:
+            put32(out, halMillis());
+            len = 4;
+            break;
+        case RH_READ_MULTINODE_COUNT:
+            out[0] = getNodeCount();
+            len = 1;
+            break;
+        case RH_READ_CURNODE_INDEX:
+        case RH_READ_NODE_SLOTIDX:
+            out[0] = node;
+            len = 1;
+            break;
+        case RH_READ_FW_VERSION:
+            len = text(out, "PhobosLT");
+            break;
+        case RH_READ_FW_BUILDDATE:
+            len = text(out, __DATE__);
+            break;
+        case RH_READ_FW_BUILDTIME:
+            len = text(out, __TIME__);
+            break;
+        case RH_READ_FW_PROCTYPE:
+            len = text(out, RHNODE_PROCTYPE);
+            break;
+        default:
+            return 0;
+    }
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += out[i];
+    }
+    out[len] = sum;
+    return len + 1;
+}
+
+/*
+ * Lap id, ms since the pass, RSSI now, node peak, pass peak, loop time,
+ * flags, pass nadir, node nadir, then the oldest turning point not read
+ * yet: its RSSI (0 when there is none), ms since it started and how long
+ * it lasted.
+ */
+size_t RhNode::readLapStats(uint8_t node, uint8_t *out) {
+    halCriticalEnter();
+    rh_pass_t p = passes[node];
+    halCriticalExit();
+    uint32_t nowUs = halMicros();
+    uint8_t rssi = timer->getRssi(node);
+    uint32_t rateHz = timer->getSampleRateHz();
+
+    out[0] = p.passes;
+    put16(&out[1], p.passes ? msOf(nowUs - p.passUs) : 0);
+    out[3] = rssiOf(rssi);
+    out[4] = rssiOf(history.getNodePeak(node));
+    out[5] = p.passes ? rssiOf(p.peakRssi) : 0;
+    put16(&out[6], rateHz ? 1000000 / rateHz : 0);  // µs per sample
+    uint8_t flags = rssi >= conf->getPilotEnterRssi(node) ? RH_LAPSTATS_FLAG_CROSSING : 0;
+    out[9] = p.passes ? rssiOf(p.nadirRssi) : 0;
+    out[10] = rssiOf(history.getNodeNadir(node));
+
+    rh_extremum_t e;
+    if (history.pop(node, &e)) {
+        if (e.peak) flags |= RH_LAPSTATS_FLAG_PEAK;
+        out[11] = rssiOf(e.rssi);
+        put16(&out[12], msOf(nowUs - e.firstUs));
+        put16(&out[14], msOf(e.lastUs - e.firstUs));
+    } else {
+        memset(&out[11], 0, 5);
+    }
+    out[8] = flags;
+    return 16;
+}
+
+bool RhNode::write(uint8_t node, uint8_t command, const uint8_t *data) {
+    if (node >= LAPTIMER_MAX_PILOTS) return false;
+    uint16_t value = (data[0] << 8) | data[1];
+    switch (command) {
+        case RH_WRITE_FREQUENCY:
+            if (value < BAND_MIN_MHZ || value > BAND_MAX_MHZ) return false;  // 0 turns a node off, the pilot count does that here
+            if (value == conf->getPilotFrequency(node)) return true;
+            conf->setPilotFrequency(node, value);
+            history.reset(node);
+            return true;
+        case RH_WRITE_ENTER_AT_LEVEL:
+            conf->setPilotEnterRssi(node, data[0]);
+            return true;
+        case RH_WRITE_EXIT_AT_LEVEL:
+            conf->setPilotExitRssi(node, data[0]);
+            return true;
+        case RH_SEND_STATUS_MESSAGE:
+        case RH_FORCE_END_CROSSING:
+        case RH_RESET_PAIRED_NODE:
+        case RH_JUMP_TO_BOOTLOADER:
+            return true;  // nothing to do on this hardware
+        default:
+            return false;
+    }
+}
+
+void RhLink::init(RhNode *rhNode) {
+    node = rhNode;
+    current = 0;
+    need = 0;
+    errors = 0;
+}
+
+uint32_t RhLink::getErrors() {
+    return errors;
+}
+
+size_t RhLink::handle(const uint8_t *in, size_t len, uint8_t *out, size_t size) {
+    size_t n = 0;
+    uint32_t nowMs = halMillis();
+    if (need > 0 && nowMs - startMs > RHNODE_WRITE_TIMEOUT_MS) {
+        need = 0;  // lost bytes, the write would swallow the commands that follow
+        errors++;
+    }
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = in[i];
+        if (need > 0) {
+            value[got++] = b;
+            if (got < need) continue;
+            need = 0;
+            uint8_t sum = 0;
+            for (uint8_t k = 0; k + 1 < got; k++) {
+                sum += value[k];
+            }
+            if (sum != value[got - 1]) {
+                errors++;
+            } else if (command == RH_WRITE_CURNODE_INDEX) {
+                if (value[0] < node->getNodeCount()) {
+                    current = value[0];
+                } else {
+                    errors++;
+                }
+            } else if (!node->write(current, command, value)) {
+                errors++;
+            }
+            continue;
+        }
+
+        int8_t valueSize = RhNode::writeSize(b);
+        if (valueSize >= 0) {
+            command = b;
+            need = valueSize + 1;
+            got = 0;
+            startMs = nowMs;
+            continue;
+        }
+        size_t answer = size - n >= RHNODE_RESPONSE_MAX ? node->read(current, b, &out[n]) : 0;
+        if (answer == 0) errors++;
+        n += answer;
+    }
+    return n;
+}
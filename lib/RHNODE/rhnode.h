@@ -0,0 +1,115 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "lapqueue.h"
+#include "laptimer.h"
+#include "rhhistory.h"
+
+#pragma once
+
+#define RHNODE_API_LEVEL 34
+#define RHNODE_REVISION ((0x25 << 8) | RHNODE_API_LEVEL)  // the server checks the high byte
+#define RHNODE_TEXT_SIZE 16       // of the firmware strings, padded with zeros
+#define RHNODE_RESPONSE_MAX 17    // READ_LAP_STATS with its checksum
+#define RHNODE_WRITE_TIMEOUT_MS 100  // a write not complete by then is dropped, the next byte is a command
+#define RHNODE_TCP_PORT 5810
+#define RHNODE_TCP_CLIENTS 2
+#define RHNODE_SERIAL_BAUD 921600
+
+// as the RotorHazard node firmware names them
+typedef enum {
+    RH_READ_ADDRESS = 0x00,
+    RH_READ_FREQUENCY = 0x03,
+    RH_READ_LAP_STATS = 0x05,
+    RH_READ_RHFEAT_FLAGS = 0x11,
+    RH_READ_REVISION_CODE = 0x22,
+    RH_READ_NODE_RSSI_PEAK = 0x23,
+    RH_READ_NODE_RSSI_NADIR = 0x24,
+    RH_READ_ENTER_AT_LEVEL = 0x31,
+    RH_READ_EXIT_AT_LEVEL = 0x32,
+    RH_READ_TIME_MILLIS = 0x33,
+    RH_READ_MULTINODE_COUNT = 0x39,
+    RH_READ_CURNODE_INDEX = 0x3A,
+    RH_READ_NODE_SLOTIDX = 0x3C,
+    RH_READ_FW_VERSION = 0x3D,
+    RH_READ_FW_BUILDDATE = 0x3E,
+    RH_READ_FW_BUILDTIME = 0x3F,
+    RH_READ_FW_PROCTYPE = 0x40,
+
+    RH_WRITE_FREQUENCY = 0x51,
+    RH_WRITE_ENTER_AT_LEVEL = 0x71,
+    RH_WRITE_EXIT_AT_LEVEL = 0x72,
+    RH_SEND_STATUS_MESSAGE = 0x75,
+    RH_FORCE_END_CROSSING = 0x78,
+    RH_RESET_PAIRED_NODE = 0x79,
+    RH_WRITE_CURNODE_INDEX = 0x7A,
+    RH_JUMP_TO_BOOTLOADER = 0x7E
+} rh_command_e;
+
+#define RH_LAPSTATS_FLAG_CROSSING 0x01
+#define RH_LAPSTATS_FLAG_PEAK 0x02  // the turning point in the lap stats is a peak, a nadir otherwise
+
+typedef struct {
+    uint8_t passes;  // the lap id the server watches, every pass counts it up
+    uint32_t passUs;
+    uint8_t peakRssi;
+    uint8_t nadirRssi;
+} rh_pass_t;
+
+/*
+ * The pilots of the timer as RotorHazard timing nodes, one node per pilot.
+ * The server sends a command byte; reads are answered with the value, big
+ * endian, and a checksum byte (the sum of the value bytes), writes carry
+ * their value and checksum and are not answered.
+ *
+ * RhNode builds the answers from what LapTimer publishes, the last pass of
+ * each pilot it keeps from the lap events and the RSSI history RhHistory
+ * gets from the sample loop, so no answer waits on the loop. Each
+ * connection has an RhLink of its own with the node it talks to and the
+ * write in progress; links run in whatever task their transport calls them
+ * from.
+ */
+class RhNode {
+   public:
+    void init(Config *config, LapTimer *lapTimer);
+    RhHistory *getHistory();  // for LapTimer::setRhHistory
+    void handleLapEvent(const lap_event_t &event);  // from the lap event consumer
+    void attach();  // a server connected; it expects every pass, so the timer runs from now on
+    uint8_t getNodeCount();
+    size_t read(uint8_t node, uint8_t command, uint8_t *out);  // the answer with its checksum, 0 for no such read
+    bool write(uint8_t node, uint8_t command, const uint8_t *data);
+    static int8_t writeSize(uint8_t command);  // of the value, -1 if it is not a write
+
+   private:
+    Config *conf;
+    LapTimer *timer;
+    RhHistory history;
+
+    // written by the lap event consumer, guarded by halCriticalEnter
+    rh_pass_t passes[LAPTIMER_MAX_PILOTS];
+
+    size_t readLapStats(uint8_t node, uint8_t *out);
+};
+
+class RhLink {
+   public:
+    void init(RhNode *rhNode);
+    size_t handle(const uint8_t *in, size_t len, uint8_t *out, size_t size);  // answers to the bytes in, as many as fit
+    uint32_t getErrors();  // unknown commands, bad checksums, answers that did not fit
+
+   private:
+    RhNode *node;
+    uint8_t current = 0;  // node the commands go to
+    uint8_t command;
+    int8_t need = 0;  // value and checksum bytes of the write still to come
+    uint8_t got = 0;
+    uint8_t value[4];
+    uint32_t startMs;
+    uint32_t errors = 0;
+};
+
+#ifdef ARDUINO
+void rhNodeBeginSerial(RhNode *node);  // USB serial is the node's, built with RHNODE_SERIAL only
+void rhNodeBeginTcp(RhNode *node);     // once the network is up
+#endif
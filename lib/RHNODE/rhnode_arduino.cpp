@@ -0,0 +1,84 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+
+#include "debug.h"
+#include "rhnode.h"
+
+#define RHNODE_CHUNK 8  // bytes handled at a time, each may be a read
+
+typedef struct {
+    AsyncClient *client;  // NULL for a free slot
+    RhLink link;
+} rh_tcp_client_t;
+
+static RhNode *serialNode = nullptr;
+static RhLink serialLink;
+static RhNode *tcpNode = nullptr;
+static AsyncServer *tcpServer = nullptr;
+static rh_tcp_client_t tcpClients[RHNODE_TCP_CLIENTS];
+
+// in the UART event task, a command is answered as soon as it is in
+static void onSerialReceive() {
+    uint8_t in[RHNODE_CHUNK];
+    uint8_t out[RHNODE_CHUNK * RHNODE_RESPONSE_MAX];
+    serialNode->attach();
+    while (Serial.available() > 0) {
+        size_t len = Serial.read(in, sizeof(in));
+        size_t n = serialLink.handle(in, len, out, sizeof(out));
+        if (n) Serial.write(out, n);
+    }
+}
+
+void rhNodeBeginSerial(RhNode *node) {
+    serialNode = node;
+    serialLink.init(node);
+    Serial.begin(RHNODE_SERIAL_BAUD);
+    Serial.onReceive(onSerialReceive);
+}
+
+// in the AsyncTCP task, like the web server
+static void onTcpData(void *arg, AsyncClient *client, void *data, size_t len) {
+    rh_tcp_client_t *c = (rh_tcp_client_t *)arg;
+    const uint8_t *in = (const uint8_t *)data;
+    uint8_t out[RHNODE_CHUNK * RHNODE_RESPONSE_MAX];
+    tcpNode->attach();
+    for (size_t done = 0; done < len; done += RHNODE_CHUNK) {
+        size_t chunk = len - done < RHNODE_CHUNK ? len - done : RHNODE_CHUNK;
+        size_t n = c->link.handle(&in[done], chunk, out, sizeof(out));
+        if (n) client->write((const char *)out, n);
+    }
+}
+
+static void onTcpDisconnect(void *arg, AsyncClient *client) {
+    rh_tcp_client_t *c = (rh_tcp_client_t *)arg;
+    DEBUG("RotorHazard server disconnected\n");
+    c->client = NULL;
+    delete client;
+}
+
+static void onTcpClient(void *arg, AsyncClient *client) {
+    for (rh_tcp_client_t &c : tcpClients) {
+        if (c.client) continue;
+        DEBUG("RotorHazard server connected\n");
+        c.client = client;
+        c.link.init(tcpNode);
+        client->setNoDelay(true);  // answers are a few bytes, each one waited for
+        client->onData(onTcpData, &c);
+        client->onDisconnect(onTcpDisconnect, &c);
+        return;
+    }
+    client->close(true);
+    delete client;
+}
+
+void rhNodeBeginTcp(RhNode *node) {
+    if (tcpServer) return;
+    tcpNode = node;
+    tcpServer = new AsyncServer(RHNODE_TCP_PORT);
+    tcpServer->onClient(onTcpClient, NULL);
+    tcpServer->begin();
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifdef ARDUINO
+
+#include <driver/adc.h>
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
+
+#include "debug.h"
+#include "hal.h"
+#include "rssisource.h"
+
+#if CONFIG_IDF_TARGET_ESP32
+#define RSSI_DMA_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define RSSI_DMA_CONV_LIMIT true
+#define RESULT_CHANNEL(p) ((p)->type1.channel)
+#define RESULT_DATA(p) ((p)->type1.data)
+#else
+#define RSSI_DMA_FORMAT ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define RSSI_DMA_CONV_LIMIT false
+#define RESULT_CHANNEL(p) ((p)->type2.channel)
+#define RESULT_DATA(p) ((p)->type2.data)
+#endif
+
+// ADC1 only, ADC2 is shared with WiFi
+static int8_t pinToAdc1Channel(uint8_t pin) {
+    for (int ch = 0; ch < ADC1_CHANNEL_MAX; ch++) {
+        gpio_num_t io;
+        if (adc1_pad_get_io_num((adc1_channel_t)ch, &io) == ESP_OK && io == pin) {
+            return ch;
+        }
+    }
+    return -1;
+}
+
+DmaRssiSource::DmaRssiSource(const board_t *board) {
+    receivers = board->receiverCount;
+    for (uint8_t i = 0; i < receivers; i++) {
+        rssiPins[i] = board->receivers[i].rssiPin;
+    }
+    auxPin = board->vbatPin;
+}
+
+bool DmaRssiSource::begin(uint32_t sampleRateHz) {
+    for (uint8_t i = 0; i < receivers; i++) {
+        rssiChannels[i] = pinToAdc1Channel(rssiPins[i]);
+        if (rssiChannels[i] < 0) {
+            DEBUG("RSSI pin %u is not on ADC1, continuous sampling not available\n", rssiPins[i]);
+            return false;
+        }
+    }
+    auxChannel = pinToAdc1Channel(auxPin);
+
+    if (auxChannel >= 0) {
+        auxRaw = halAnalogRead(auxPin);  // valid until the first DMA batch arrives
+    }
+
+    uint8_t channels = receivers + (auxChannel < 0 ? 0 : 1);
+    rateHz = sampleRateHz;
+    if (rateHz * channels < SOC_ADC_SAMPLE_FREQ_THRES_LOW) rateHz = (SOC_ADC_SAMPLE_FREQ_THRES_LOW + channels - 1) / channels;
+    if (rateHz * channels > SOC_ADC_SAMPLE_FREQ_THRES_HIGH) rateHz = SOC_ADC_SAMPLE_FREQ_THRES_HIGH / channels;
+
+    adc_digi_init_config_t initConfig = {};
+    initConfig.max_store_buf_size = RSSI_DMA_BUFFER_FRAMES * channels * SOC_ADC_DIGI_RESULT_BYTES;
+    initConfig.conv_num_each_intr = RSSI_DMA_FRAMES_PER_INTR * channels * SOC_ADC_DIGI_RESULT_BYTES;
+    initConfig.adc1_chan_mask = auxChannel < 0 ? 0 : BIT(auxChannel);
+    for (uint8_t i = 0; i < receivers; i++) {
+        initConfig.adc1_chan_mask |= BIT(rssiChannels[i]);
+    }
+    initConfig.adc2_chan_mask = 0;
+    if (adc_digi_initialize(&initConfig) != ESP_OK) {
+        DEBUG("ADC DMA init failed\n");
+        return false;
+    }
+
+    // the receivers in board order, then aux
+    adc_digi_pattern_config_t pattern[BOARD_MAX_RECEIVERS + 1] = {};
+    for (uint8_t i = 0; i < channels; i++) {
+        pattern[i].atten = ADC_ATTEN_DB_11;
+        pattern[i].channel = i < receivers ? rssiChannels[i] : auxChannel;
+        pattern[i].unit = 0;  // ADC1
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_digi_configuration_t digiConfig = {};
+    digiConfig.conv_limit_en = RSSI_DMA_CONV_LIMIT;
+    digiConfig.conv_limit_num = 250;
+    digiConfig.pattern_num = channels;
+    digiConfig.adc_pattern = pattern;
+    digiConfig.sample_freq_hz = rateHz * channels;
+    digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    digiConfig.format = RSSI_DMA_FORMAT;
+    if (adc_digi_controller_configure(&digiConfig) != ESP_OK || adc_digi_start() != ESP_OK) {
+        DEBUG("ADC DMA start failed\n");
+        adc_digi_deinitialize();
+        return false;
+    }
+
+    clock.begin(rateHz);
+    lastReceiver = BOARD_MAX_RECEIVERS;
+    dropped = 0;
+    DEBUG("ADC DMA sampling RSSI of %u receivers at %u Hz\n", receivers, rateHz);
+    return true;
+}
+
+int8_t DmaRssiSource::receiverOf(uint8_t channel) {
+    for (uint8_t i = 0; i < receivers; i++) {
+        if (rssiChannels[i] == channel) return i;
+    }
+    return -1;
+}
+
+size_t DmaRssiSource::read(rssi_frame_t *frames, size_t maxFrames) {
+    static uint8_t buf[RSSI_DMA_FRAMES_PER_INTR * (BOARD_MAX_RECEIVERS + 1) * SOC_ADC_DIGI_RESULT_BYTES];
+    uint8_t channels = receivers + (auxChannel < 0 ? 0 : 1);
+    size_t scansFit = maxFrames / receivers;
+    if (scansFit == 0) return 0;
+    uint32_t maxBytes = scansFit * channels * SOC_ADC_DIGI_RESULT_BYTES;
+    if (maxBytes > sizeof(buf)) maxBytes = sizeof(buf);
+
+    uint32_t length = 0;
+    esp_err_t ret = adc_digi_read_bytes(buf, maxBytes, &length, 0);
+    if (ret == ESP_ERR_TIMEOUT || length == 0) return 0;
+
+    // a receiver that isn't after the previous one in the pattern begins a scan, frames
+    // before the first such one in the batch finish the scan the last batch ended in
+    size_t count = 0;
+    uint32_t scans = 0;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&buf[i];
+        int8_t receiver = receiverOf(RESULT_CHANNEL(p));
+        if (receiver >= 0 && count < maxFrames) {
+            if (receiver <= lastReceiver) scans++;
+            lastReceiver = receiver;
+            frames[count].rssi = scaleRaw(RESULT_DATA(p));
+            frames[count].receiver = receiver;
+            frames[count++].timeUs = scans;  // scans begun up to it, turned into the time below
+        } else if (RESULT_CHANNEL(p) == auxChannel) {
+            auxRaw = RESULT_DATA(p);
+        }
+    }
+
+    dropped += clock.addBatch(scans, (uint32_t)esp_timer_get_time(), ret == ESP_ERR_INVALID_STATE) * receivers;
+    for (size_t i = 0; i < count; i++) {
+        frames[i].timeUs = clock.scanTimeUs((int32_t)frames[i].timeUs - 1);
+    }
+    return count;
+}
+
+uint32_t DmaRssiSource::getSampleRateHz() {
+    return rateHz;
+}
+
+uint32_t DmaRssiSource::getDroppedFrames() {
+    return dropped;
+}
+
+uint16_t DmaRssiSource::getAuxRaw() {
+    return auxRaw;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#include "rssisource.h"
+
+#include "hal.h"
+
+PolledRssiSource::PolledRssiSource(RX5808 *rx5808, uint8_t count) {
+    rx = rx5808;
+    receivers = count;
+}
+
+bool PolledRssiSource::begin(uint32_t sampleRateHz) {
+    return true;
+}
+
+size_t PolledRssiSource::read(rssi_frame_t *frames, size_t maxFrames) {
+    size_t count = 0;
+    for (uint8_t i = 0; i < receivers && count < maxFrames; i++, count++) {
+        frames[count].rssi = rx[i].readRssi();
+        frames[count].timeUs = halMicros();
+        frames[count].receiver = i;
+    }
+    return count;
+}
+
+uint32_t PolledRssiSource::getSampleRateHz() {
+    return 0;  // unknown, depends on the loop
+}
+
+uint32_t PolledRssiSource::getDroppedFrames() {
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RX5808.h"
+#include "board.h"
+#include "scanclock.h"
+
+#pragma once
+
+#ifndef RSSI_SAMPLE_RATE_HZ
+#define RSSI_SAMPLE_RATE_HZ 10000  // requested continuous ADC rate, clamped to what the chip supports
+#endif
+#define RSSI_DMA_BUFFER_FRAMES 1024  // frames the DMA ring can hold before new conversions are dropped
+#define RSSI_DMA_FRAMES_PER_INTR 64
+
+typedef struct {
+    uint32_t timeUs;   // acquisition time
+    uint8_t rssi;
+    uint8_t receiver;  // index on the board, 0 with a single module
+} rssi_frame_t;
+
+/*
+ * Where LapTimer gets its RSSI from. Sources are non-blocking: read() hands
+ * out whatever frames were acquired since the last call, oldest first.
+ */
+class RssiSource {
+   public:
+    virtual ~RssiSource() {}
+    virtual bool begin(uint32_t sampleRateHz) = 0;
+    virtual size_t read(rssi_frame_t *frames, size_t maxFrames) = 0;
+    virtual uint32_t getSampleRateHz() = 0;
+    virtual uint32_t getDroppedFrames() = 0;
+
+    // same 0-255 scale RX5808::readRssi produces
+    static uint8_t scaleRaw(uint16_t raw) {
+        if (raw > 2047) raw = 2047;
+        return raw >> 3;
+    }
+};
+
+// One blocking RX5808::readRssi per receiver and read() call, the rate is whatever the caller's loop achieves
+class PolledRssiSource : public RssiSource {
+   public:
+    explicit PolledRssiSource(RX5808 *rx5808, uint8_t count = 1);  // count receivers at rx5808
+    bool begin(uint32_t sampleRateHz) override;
+    size_t read(rssi_frame_t *frames, size_t maxFrames) override;
+    uint32_t getSampleRateHz() override;
+    uint32_t getDroppedFrames() override;
+
+   private:
+    RX5808 *rx;
+    uint8_t receivers;
+};
+
+#ifdef ARDUINO
+/*
+ * Continuous ADC driven by DMA. Conversions are collected by the driver in a
+ * ring buffer at a fixed rate, timestamps are derived from the sample index so
+ * they are as regular as the ADC clock, at the rate a ScanClock measures it
+ * against the system clock. The RSSI pins of all receivers on the board are
+ * converted in one pattern, a scan, and the frames of a scan share its
+ * timestamp. An optional auxiliary pin (battery) is converted in the same
+ * pattern, as ADC1 can't do one-shot reads meanwhile.
+ */
+class DmaRssiSource : public RssiSource {
+   public:
+    explicit DmaRssiSource(const board_t *board);
+    bool begin(uint32_t sampleRateHz) override;
+    size_t read(rssi_frame_t *frames, size_t maxFrames) override;
+    uint32_t getSampleRateHz() override;
+    uint32_t getDroppedFrames() override;
+    uint16_t getAuxRaw();
+
+   private:
+    uint8_t rssiPins[BOARD_MAX_RECEIVERS];
+    uint8_t receivers;
+    uint8_t auxPin;
+    int8_t rssiChannels[BOARD_MAX_RECEIVERS];
+    int8_t auxChannel = -1;
+    uint32_t rateHz = 0;  // scans per second
+    uint32_t dropped = 0;
+    ScanClock clock;
+    uint8_t lastReceiver = BOARD_MAX_RECEIVERS;
+    volatile uint16_t auxRaw = 0;
+
+    int8_t receiverOf(uint8_t channel);
+};
+#endif
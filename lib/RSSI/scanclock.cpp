@@ -0,0 +1,109 @@
+#include "scanclock.h"
+
+void ScanClock::begin(uint32_t rateHz) {
+    nominalHz = rateHz ? rateHz : 1;
+    nominalQ32 = (1000000ULL << 32) / nominalHz;
+    rateQ32 = periodQ32 = nominalQ32;
+    nextIndex = batchIndex = 0;
+    pointCount = 0;
+    anchored = false;
+}
+
+int64_t ScanClock::timeOf(uint64_t index) {
+    int64_t d = (int64_t)(index - baseIndex);
+    return (int64_t)baseUs + ((d * (int64_t)periodQ32) >> 32);
+}
+
+uint32_t ScanClock::addBatch(uint32_t scans, uint32_t timeUs, bool overflowed) {
+    uint32_t lost = 0;
+    batchIndex = nextIndex;
+    if (!anchored) {
+        if (!scans) return 0;
+        // the newest scan of the first batch was just converted
+        nowUs = windowUs = baseUs = timeUs;
+        lastUs = timeUs;
+        baseIndex = nextIndex + scans - 1;
+        bestDelayUs = INT64_MAX;
+        anchored = true;
+    } else {
+        nowUs += (uint32_t)(timeUs - lastUs);
+        lastUs = timeUs;
+    }
+
+    if (overflowed) {
+        // the driver ring overflowed, conversions got lost: skip ahead to where the clock says we are
+        int64_t sinceUs = (int64_t)nowUs - (int64_t)baseUs;
+        uint64_t newest = sinceUs > 0 ? baseIndex + ((uint64_t)sinceUs << 32) / periodQ32 : baseIndex;
+        if (newest + 1 > nextIndex + scans) {
+            lost = newest + 1 - nextIndex - scans;
+            nextIndex += lost;
+            batchIndex = nextIndex;
+        }
+    }
+
+    if (scans) {
+        uint64_t newest = nextIndex + scans - 1;
+        int64_t delayUs = (int64_t)nowUs - timeOf(newest);
+        if (delayUs < bestDelayUs) {
+            bestDelayUs = delayUs;
+            best = {newest, nowUs};
+        }
+    }
+    nextIndex += scans;
+    if (nowUs - windowUs >= SCAN_CLOCK_WINDOW_US) closeWindow();
+    return lost;
+}
+
+// against a line of the given period through the first point
+uint8_t ScanClock::leastDelayed(uint8_t from, uint8_t to, uint64_t period) {
+    uint8_t least = from;
+    int64_t leastUs = INT64_MAX;
+    for (uint8_t i = from; i < to; i++) {
+        int64_t d = (int64_t)(points[i].index - points[0].index);
+        int64_t delayUs = (int64_t)(points[i].timeUs - points[0].timeUs) - ((d * (int64_t)period) >> 32);
+        if (delayUs < leastUs) {
+            leastUs = delayUs;
+            least = i;
+        }
+    }
+    return least;
+}
+
+void ScanClock::closeWindow() {
+    if (pointCount == SCAN_CLOCK_POINTS) {
+        for (uint8_t i = 1; i < SCAN_CLOCK_POINTS; i++) points[i - 1] = points[i];
+        pointCount--;
+    }
+    points[pointCount++] = best;
+    if (pointCount > 1) {
+        uint8_t older = leastDelayed(0, pointCount / 2, rateQ32);
+        uint8_t newer = leastDelayed(pointCount / 2, pointCount, rateQ32);
+        uint64_t q = ((points[newer].timeUs - points[older].timeUs) << 32) / (points[newer].index - points[older].index);
+        uint64_t limit = nominalQ32 / 1000000 * SCAN_CLOCK_MAX_PPM;
+        if (q > nominalQ32 - limit && q < nominalQ32 + limit) rateQ32 = q;
+    }
+    const scan_clock_point_t &phase = points[leastDelayed(0, pointCount, rateQ32)];
+
+    // the batch's first scan stays where it is, the next window ends on the line through the phase point
+    int64_t startUs = timeOf(batchIndex);
+    int64_t d = (int64_t)(batchIndex - phase.index);
+    int64_t offsetUs = (int64_t)phase.timeUs + ((d * (int64_t)rateQ32) >> 32) - startUs;
+    int64_t windowScans = (int64_t)nominalHz * SCAN_CLOCK_WINDOW_US / 1000000;
+    int64_t slewQ32 = (int64_t)((uint64_t)offsetUs << 32) / windowScans;
+    int64_t maxSlewQ32 = (int64_t)(rateQ32 / 1000000 * SCAN_CLOCK_SLEW_PPM);
+    if (slewQ32 > maxSlewQ32) slewQ32 = maxSlewQ32;
+    if (slewQ32 < -maxSlewQ32) slewQ32 = -maxSlewQ32;
+    baseUs = startUs;
+    baseIndex = batchIndex;
+    periodQ32 = rateQ32 + slewQ32;
+    windowUs = nowUs;
+    bestDelayUs = INT64_MAX;
+}
+
+uint32_t ScanClock::scanTimeUs(int32_t scan) {
+    return (uint32_t)timeOf(batchIndex + scan);
+}
+
+int32_t ScanClock::getErrorPpm() {
+    return (int32_t)(((int64_t)nominalQ32 - (int64_t)rateQ32) * 1000000 / (int64_t)rateQ32);
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+
+#pragma once
+
+#define SCAN_CLOCK_WINDOW_US 1000000  // the earliest batch of each window corrects the clock
+#define SCAN_CLOCK_POINTS 32          // windows kept, the rate is measured across them
+#define SCAN_CLOCK_MAX_PPM 2000       // rate error believed, more is a bad measurement
+#define SCAN_CLOCK_SLEW_PPM 500       // fastest the time of a scan is pulled onto the measured one
+
+/*
+ * Time of each ADC scan from its index. The ADC runs from clock dividers, its
+ * real rate is off the one asked for by some hundred ppm, so the period is
+ * measured against the system clock instead of taken from the nominal rate.
+ *
+ * Every batch read says its newest scan was converted by nowUs, a bound that
+ * is close only for a batch read right after the DMA interrupt. The batch
+ * with the least delay in each window is kept for the last SCAN_CLOCK_POINTS
+ * windows. The period comes from the least delayed of the older half to the
+ * least delayed of the newer half, the phase from the least delayed of all
+ * at that period. It is slewed onto over the next window, so times never
+ * step and a lap is scaled by at most SCAN_CLOCK_SLEW_PPM.
+ */
+class ScanClock {
+   public:
+    void begin(uint32_t rateHz);  // nominal scans per second
+    uint32_t addBatch(uint32_t scans, uint32_t nowUs, bool overflowed);  // scans begun in a batch just read, the scans lost before it
+    uint32_t scanTimeUs(int32_t scan);  // of the batch's scan from 0, -1 for the last one of the batch before
+    int32_t getErrorPpm();  // measured rate against the nominal one
+
+   private:
+    typedef struct {
+        uint64_t index;
+        uint64_t timeUs;
+    } scan_clock_point_t;
+
+    uint32_t nominalHz = 0;
+    uint64_t nominalQ32 = 0;  // period in us << 32
+    uint64_t rateQ32 = 0;     // measured
+    uint64_t periodQ32 = 0;   // used, the measured one plus the slew
+    uint64_t baseIndex = 0;   // the scan at baseUs
+    uint64_t baseUs = 0;
+    uint64_t batchIndex = 0;  // of the batch's first scan
+    uint64_t nextIndex = 0;
+    uint64_t nowUs = 0;  // the system clock without its wrap
+    uint32_t lastUs = 0;
+    uint64_t windowUs = 0;
+    bool anchored = false;
+    scan_clock_point_t best;  // least delay of the window
+    int64_t bestDelayUs;
+    scan_clock_point_t points[SCAN_CLOCK_POINTS];  // the best of each window, oldest first
+    uint8_t pointCount = 0;
+
+    int64_t timeOf(uint64_t index);
+    uint8_t leastDelayed(uint8_t from, uint8_t to, uint64_t periodQ32);
+    void closeWindow();
+};
@@ -1,5 +1,10 @@
 #include <stdint.h>
 
+#include "rx5808bus.h"
+#include "scheduler.h"
+
+#pragma once
+
 #define RX5808_MIN_TUNETIME 35    // after set freq need to wait this long before read RSSI
 #define RX5808_MIN_BUSTIME 30     // after set freq need to wait this long before setting again
 #define POWER_DOWN_FREQ_MHZ 1111  // signal to power down the module
@@ -7,11 +12,17 @@
 
 class RX5808 {
    public:
+    RX5808() {}
     RX5808(uint8_t _rssiInputPin, uint8_t _rx5808DataPin, uint8_t _rx5808SelPin, uint8_t _rx5808ClkPin);
+    RX5808(uint8_t _rssiInputPin, uint8_t _rx5808SelPin, RX5808Bus *sharedBus);  // DATA and CLK shared with other modules, the bus is set up by the owner
     void init();
     void setFrequency(uint16_t frequency);
+    void sweepTo(uint16_t frequency);  // no bus time kept, no read back, RSSI reads right away
     uint8_t readRssi();
-    void handleFrequencyChange(uint32_t currentTimeMs, uint16_t potentiallyNewFreq);
+    bool isTuning();
+    uint16_t getFrequency();
+    uint32_t handleFrequencyChange(uint32_t currentTimeMs, uint16_t potentiallyNewFreq);  // ms until it needs to be called again
+    bool isBusIdle();
 
    private:
     uint8_t rx5808DataPin = 0;  // DATA (CH1) output line to RX5808 module
@@ -23,18 +34,20 @@ class RX5808 {
 
     bool rxPoweredDown = false;
     bool recentSetFreqFlag = false;
+    bool verifyPending = false;
+    uint16_t verifyFrequencyMhz = 0;
     uint32_t lastSetFreqTimeMs = 0;
 
-    void rx5808SerialSendBit1();
-    void rx5808SerialSendBit0();
-    void rx5808SerialEnableLow();
-    void rx5808SerialEnableHigh();
+    RX5808Bus bus;                 // of its own
+    RX5808Bus *shared = nullptr;  // or this one
 
+    RX5808Bus &activeBus();
     void setRxModulePower(uint32_t options);
     void resetRxModule();
     void setupRxModule();
     void powerDownRxModule();
-    bool verifyFrequency();
+    void verifyFrequency();
+    bool checkFrequency();
 
     static uint16_t freqMhzToRegVal(uint16_t freqInMhz);
 };
@@ -0,0 +1,41 @@
+#include "bands.h"
+
+#include <stdio.h>
+
+const band_t bands[BAND_COUNT] = {
+    {'A', {5865, 5845, 5825, 5805, 5785, 5765, 5745, 5725}},
+    {'B', {5733, 5752, 5771, 5790, 5809, 5828, 5847, 5866}},
+    {'E', {5705, 5685, 5665, 5645, 5885, 5905, 5925, 5945}},
+    {'F', {5740, 5760, 5780, 5800, 5820, 5840, 5860, 5880}},
+    {'R', {5658, 5695, 5732, 5769, 5806, 5843, 5880, 5917}},
+    {'L', {5362, 5399, 5436, 5473, 5510, 5547, 5584, 5621}},
+};
+
+// the first band with the frequency, F8 and R7 share one
+bool bandLookup(uint16_t frequency, uint8_t *band, uint8_t *channel) {
+    for (uint8_t b = 0; b < BAND_COUNT; b++) {
+        for (uint8_t c = 0; c < BAND_CHANNELS; c++) {
+            if (bands[b].frequency[c] != frequency) continue;
+            *band = b;
+            *channel = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+// {"names":"ABEFRL","freq":[[5865,...],...]}, buf has BANDS_JSON_SIZE bytes
+size_t bandsToJson(char *buf) {
+    size_t len = snprintf(buf, BANDS_JSON_SIZE, "{\"names\":\"");
+    for (uint8_t b = 0; b < BAND_COUNT; b++) {
+        buf[len++] = bands[b].name;
+    }
+    len += snprintf(buf + len, BANDS_JSON_SIZE - len, "\",\"freq\":[");
+    for (uint8_t b = 0; b < BAND_COUNT; b++) {
+        for (uint8_t c = 0; c < BAND_CHANNELS; c++) {
+            len += snprintf(buf + len, BANDS_JSON_SIZE - len, "%s%u", c ? "," : b ? "],[" : "[", bands[b].frequency[c]);
+        }
+    }
+    len += snprintf(buf + len, BANDS_JSON_SIZE - len, "]]}");
+    return len;
+}
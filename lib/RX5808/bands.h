@@ -0,0 +1,21 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#define BAND_COUNT 6
+#define BAND_CHANNELS 8
+#define BAND_MIN_MHZ 5300  // what a scan may cover, the RX5808 tunes a little past the channels
+#define BAND_MAX_MHZ 5950
+#define BANDS_JSON_SIZE 384
+
+typedef struct {
+    char name;
+    uint16_t frequency[BAND_CHANNELS];
+} band_t;
+
+// the channels the web UI offers, in the order of its band list
+extern const band_t bands[BAND_COUNT];
+
+bool bandLookup(uint16_t frequency, uint8_t *band, uint8_t *channel);  // false when no channel has it
+size_t bandsToJson(char *buf);
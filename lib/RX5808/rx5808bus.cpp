@@ -0,0 +1,141 @@
+#include "rx5808bus.h"
+
+#include "hal.h"
+
+typedef enum {
+    BUS_SELECT_HIGH,
+    BUS_SELECT_LOW,
+    BUS_DATA,
+    BUS_CLOCK_HIGH,
+    BUS_CLOCK_LOW,
+    BUS_DESELECT,
+    BUS_RELEASE
+} rx5808_bus_phase_e;
+
+#define TRANSFER_BITS (4 + 1 + RX5808_BUS_DATA_BITS)
+
+static void busTicker(void *arg) {
+    ((RX5808Bus *)arg)->step();
+}
+
+void RX5808Bus::init(uint8_t rx5808DataPin, uint8_t rx5808ClkPin) {
+    dataPin = rx5808DataPin;
+    clkPin = rx5808ClkPin;
+    halPinMode(dataPin, HAL_OUTPUT);
+    halPinMode(clkPin, HAL_OUTPUT);
+    halDigitalWrite(clkPin, HAL_LOW);
+    halDigitalWrite(dataPin, HAL_LOW);
+    head = tail = 0;
+    phase = BUS_SELECT_HIGH;
+    tickerRunning = false;
+    ticker = halTickerCreate(busTicker, this);
+}
+
+bool RX5808Bus::enqueue(uint8_t selPin, uint8_t reg, bool write, uint32_t data) {
+    uint8_t next = (head + 1) % RX5808_BUS_QUEUE;
+    if (next == tail) return false;  // full
+    queue[head].selPin = selPin;
+    queue[head].reg = reg;
+    queue[head].write = write;
+    queue[head].data = data;
+    head = next;
+    if (!tickerRunning) {
+        tickerRunning = true;
+        halTickerStart(ticker, RX5808_BUS_STEP_US);
+    }
+    return true;
+}
+
+bool RX5808Bus::write(uint8_t selPin, uint8_t reg, uint32_t data) {
+    return enqueue(selPin, reg, true, data);
+}
+
+bool RX5808Bus::read(uint8_t selPin, uint8_t reg) {
+    return enqueue(selPin, reg, false, 0);
+}
+
+bool RX5808Bus::isIdle() {
+    return head == tail;
+}
+
+bool RX5808Bus::isRunning() {
+    return tickerRunning;
+}
+
+uint32_t RX5808Bus::getReadData() {
+    return readData;
+}
+
+uint8_t RX5808Bus::getReadSelect() {
+    return readSelect;
+}
+
+uint32_t RX5808Bus::getCompletedTransfers() {
+    return completed;
+}
+
+// the ticker is stopped from the producer side, only it can add work
+void RX5808Bus::handleBus() {
+    if (tickerRunning && isIdle()) {
+        halTickerStop(ticker);
+        tickerRunning = false;
+    }
+}
+
+// one line change per call, same sequence as the old bit-banged driver
+void RX5808Bus::step() {
+    if (head == tail) return;
+    const rx5808_transfer_t &t = queue[tail];
+
+    switch (phase) {
+        case BUS_SELECT_HIGH:
+            halDigitalWrite(t.selPin, HAL_HIGH);
+            phase = BUS_SELECT_LOW;
+            break;
+        case BUS_SELECT_LOW:
+            halDigitalWrite(t.selPin, HAL_LOW);
+            bit = 0;
+            shift = 0;
+            phase = BUS_DATA;
+            break;
+        case BUS_DATA:
+            if (bit < 4) {
+                halDigitalWrite(dataPin, (t.reg >> bit) & 1);
+            } else if (bit == 4) {
+                halDigitalWrite(dataPin, t.write ? HAL_HIGH : HAL_LOW);
+            } else if (t.write) {
+                halDigitalWrite(dataPin, (t.data >> (bit - 5)) & 1);
+            } else {
+                // module drives DATA, sampled before the rising edge
+                if (bit == 5) halPinMode(dataPin, HAL_INPUT_PULLUP);
+                if (halDigitalRead(dataPin)) shift |= 1UL << (bit - 5);
+            }
+            phase = BUS_CLOCK_HIGH;
+            break;
+        case BUS_CLOCK_HIGH:
+            halDigitalWrite(clkPin, HAL_HIGH);
+            phase = BUS_CLOCK_LOW;
+            break;
+        case BUS_CLOCK_LOW:
+            halDigitalWrite(clkPin, HAL_LOW);
+            phase = (++bit < TRANSFER_BITS) ? BUS_DATA : BUS_DESELECT;
+            break;
+        case BUS_DESELECT:
+            if (!t.write) {
+                halPinMode(dataPin, HAL_OUTPUT);
+                readData = shift;
+                readSelect = t.selPin;
+            }
+            halDigitalWrite(t.selPin, HAL_HIGH);  // finished clocking data in
+            phase = BUS_RELEASE;
+            break;
+        case BUS_RELEASE:
+        default:
+            halDigitalWrite(clkPin, HAL_LOW);
+            halDigitalWrite(dataPin, HAL_LOW);
+            phase = BUS_SELECT_HIGH;
+            completed++;
+            tail = (tail + 1) % RX5808_BUS_QUEUE;
+            break;
+    }
+}
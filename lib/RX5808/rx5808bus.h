@@ -0,0 +1,65 @@
+#include <stdint.h>
+
+#pragma once
+
+#define RX5808_BUS_STEP_US 50   // one line change per step, the shortest esp_timer period
+#define RX5808_BUS_QUEUE 16     // slots, one stays free: wake up + setup + frequency of four modules with a read still pending fits
+#define RX5808_BUS_DATA_BITS 20
+
+#define RX5808_REG_FREQUENCY 0x1
+#define RX5808_REG_POWER 0xA
+#define RX5808_REG_RESET 0xF
+
+typedef struct {
+    uint8_t selPin;  // of the module addressed
+    uint8_t reg;
+    bool write;
+    uint32_t data;
+} rx5808_transfer_t;
+
+/*
+ * The RX5808 3-wire register protocol driven step by step from a HAL ticker
+ * instead of bit-banged with delays. A transfer is SEL low, 4 address bits,
+ * the R/W bit and 20 data bits, all LSB first and latched on the rising
+ * clock edge, then SEL high. On a read the module drives DATA for the 20 data
+ * bits. write() and read() only queue the transfer and return right away,
+ * isIdle() turns true once everything queued is on the wire. Several
+ * modules can share DATA and CLK, a transfer goes to the one whose SEL line
+ * it names and they take turns on the wire.
+ *
+ * The queue has one producer (the caller of write/read/handleBus) and one
+ * consumer (the ticker).
+ */
+class RX5808Bus {
+   public:
+    void init(uint8_t dataPin, uint8_t clkPin);
+    bool write(uint8_t selPin, uint8_t reg, uint32_t data);
+    bool read(uint8_t selPin, uint8_t reg);
+    bool isIdle();
+    bool isRunning();  // the ticker, until handleBus finds the queue empty
+    uint32_t getReadData();  // of the last read
+    uint8_t getReadSelect();  // the module it was from
+    uint32_t getCompletedTransfers();
+    void handleBus();
+    void step();
+
+   private:
+    uint8_t dataPin;
+    uint8_t clkPin;
+    int8_t ticker = -1;
+    bool tickerRunning = false;
+
+    rx5808_transfer_t queue[RX5808_BUS_QUEUE];
+    volatile uint8_t head = 0;  // next free slot
+    volatile uint8_t tail = 0;  // transfer on the wire
+    volatile uint32_t completed = 0;
+    volatile uint32_t readData = 0;
+    volatile uint8_t readSelect = 0;
+
+    // position within the current transfer
+    uint8_t phase = 0;
+    uint8_t bit = 0;
+    uint32_t shift = 0;
+
+    bool enqueue(uint8_t selPin, uint8_t reg, bool write, uint32_t data);
+};
@@ -0,0 +1,249 @@
+#include "scanner.h"
+
+#include <string.h>
+
+#include "debug.h"
+#include "hal.h"
+
+typedef enum {
+    SCAN_IDLE,  // more receivers than bins
+    SCAN_TUNE,
+    SCAN_WRITE,
+    SCAN_SETTLE,
+    SCAN_SAMPLE
+} scan_state_e;
+
+void scannerDefaults(scanner_params_t *params) {
+    params->fromMhz = BAND_MIN_MHZ;
+    params->toMhz = BAND_MAX_MHZ;
+    params->stepMhz = SCANNER_STEP_MHZ;
+    params->hold = SCANNER_HOLD_OFF;
+    params->settleMs = SCANNER_SETTLE_MS;
+}
+
+void SpectrumScanner::init(FrequencyHopper *frequencyHopper, RX5808 *rx5808, uint8_t count) {
+    hopper = frequencyHopper;
+    if (count < 1) count = 1;
+    if (count > BOARD_MAX_RECEIVERS) count = BOARD_MAX_RECEIVERS;
+    receiverCount = count;
+    memset(receivers, 0, sizeof(receivers));
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        receivers[i].rx = &rx5808[i];
+        receivers[i].window = -1;
+    }
+    scannerDefaults(&params);
+    running = false;
+    bins = 0;
+    requestsHandled = requestCount;
+}
+
+void SpectrumScanner::start(const scanner_params_t &scan) {
+    halCriticalEnter();
+    request = scan;
+    requestRun = true;
+    requestCount = requestCount + 1;
+    halCriticalExit();
+}
+
+void SpectrumScanner::stop() {
+    halCriticalEnter();
+    requestRun = false;
+    requestCount = requestCount + 1;
+    halCriticalExit();
+}
+
+bool SpectrumScanner::isRunning() {
+    return running;
+}
+
+// 0 until push has seen a new scan and cleared the spectrum
+uint32_t SpectrumScanner::getSweeps() {
+    return pushGeneration == generation ? sweeps : 0;
+}
+
+uint16_t SpectrumScanner::frequencyOf(uint16_t bin) {
+    return params.fromMhz + bin * params.stepMhz;
+}
+
+void SpectrumScanner::handleRequest() {
+    if (requestCount == requestsHandled) return;
+    halCriticalEnter();
+    bool run = requestRun;
+    scanner_params_t scan = request;
+    requestsHandled = requestCount;
+    halCriticalExit();
+
+    for (uint8_t i = 0; i < receiverCount && running; i++) {
+        if (receivers[i].state == SCAN_SAMPLE) closeWindow(receivers[i], halMicros());
+    }
+    if (!run) {
+        if (running) {
+            DEBUG("Spectrum scan stopped\n");
+        }
+        running = false;
+        hopper->resume();
+        return;
+    }
+
+    if (scan.fromMhz < BAND_MIN_MHZ) scan.fromMhz = BAND_MIN_MHZ;
+    if (scan.toMhz > BAND_MAX_MHZ) scan.toMhz = BAND_MAX_MHZ;
+    if (scan.toMhz < scan.fromMhz) scan.toMhz = scan.fromMhz;
+    if (scan.stepMhz < 1) scan.stepMhz = 1;
+    if (scan.hold >= SCANNER_HOLD_COUNT) scan.hold = SCANNER_HOLD_OFF;
+    uint32_t count = (scan.toMhz - scan.fromMhz) / scan.stepMhz + 1;
+    params = scan;
+    bins = count > SCANNER_MAX_BINS ? SCANNER_MAX_BINS : count;
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        receivers[i].bin = i;
+        receivers[i].state = i < bins ? SCAN_TUNE : SCAN_IDLE;
+    }
+    DEBUG("Spectrum scan %u-%u MHz in %u bins\n", params.fromMhz, frequencyOf(bins - 1), bins);
+
+    hopper->suspend();
+    startUs = halMicros();
+    generation = generation + 1;
+    halMemoryBarrier();  // the scan is set up before push sees it running
+    running = true;
+}
+
+uint32_t SpectrumScanner::handleScan(uint32_t currentTimeMs) {
+    handleRequest();
+    if (!running) return SCHEDULER_IDLE;
+
+    uint32_t dueMs = SCHEDULER_IDLE;
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        uint32_t receiverDueMs = handleReceiver(receivers[i], i, currentTimeMs);
+        if (receiverDueMs < dueMs) dueMs = receiverDueMs;
+    }
+    return dueMs;
+}
+
+// tune, wait for the write to be on the wire, let RSSI settle, sample, next bin
+uint32_t SpectrumScanner::handleReceiver(scan_receiver_t &r, uint8_t index, uint32_t currentTimeMs) {
+    uint32_t elapsedMs = currentTimeMs - r.sinceMs;
+    switch (r.state) {
+        case SCAN_TUNE:
+            r.rx->sweepTo(frequencyOf(r.bin));
+            r.state = SCAN_WRITE;
+            // fall through
+        case SCAN_WRITE:
+            r.rx->handleFrequencyChange(currentTimeMs, r.rx->getFrequency());  // keeps the bus going
+            if (!r.rx->isBusIdle()) return 1;
+            r.state = SCAN_SETTLE;
+            r.sinceMs = currentTimeMs;
+            elapsedMs = 0;
+            // fall through
+        case SCAN_SETTLE:
+            if (elapsedMs < params.settleMs) return params.settleMs - elapsedMs;
+            openWindow(r, halMicros());
+            r.state = SCAN_SAMPLE;
+            r.sinceMs = currentTimeMs;
+            return SCANNER_DWELL_MS;
+        case SCAN_SAMPLE:
+            if (elapsedMs < SCANNER_DWELL_MS) return SCANNER_DWELL_MS - elapsedMs;
+            closeWindow(r, halMicros());
+            r.bin += receiverCount;
+            if (r.bin >= bins) r.bin = index;
+            r.state = SCAN_TUNE;
+            return handleReceiver(r, index, currentTimeMs);
+        default:
+            return SCHEDULER_IDLE;
+    }
+}
+
+void SpectrumScanner::openWindow(scan_receiver_t &r, uint32_t timeUs) {
+    uint8_t next = (r.latest + 1) % SCANNER_WINDOWS;
+    r.windows[next].bin = r.bin;
+    r.windows[next].fromUs = timeUs;
+    r.windows[next].toUs = 0;
+    r.windows[next].open = true;
+    r.latest = next;
+}
+
+void SpectrumScanner::closeWindow(scan_receiver_t &r, uint32_t timeUs) {
+    scan_window_t &w = r.windows[r.latest];
+    w.toUs = timeUs;
+    w.open = false;
+}
+
+// same as FrequencyHopper::pilotAt, the slot of the window or -1
+int8_t SpectrumScanner::windowAt(const scan_receiver_t &r, uint32_t timeUs) {
+    uint8_t newest = r.latest;
+    for (uint8_t n = 0; n < SCANNER_WINDOWS - 1; n++) {
+        uint8_t slot = (newest + SCANNER_WINDOWS - n) % SCANNER_WINDOWS;
+        const scan_window_t &w = r.windows[slot];
+        if ((int32_t)(timeUs - w.fromUs) < 0) continue;
+        if (w.open || (int32_t)(timeUs - w.toUs) < 0) return slot;
+        return -1;
+    }
+    return -1;
+}
+
+void SpectrumScanner::push(const rssi_frame_t &frame) {
+    if (!running || frame.receiver >= receiverCount) return;
+    if (pushGeneration != generation) {
+        pushGeneration = generation;
+        memset(peak, 0, sizeof(peak));
+        memset(mean, 0, sizeof(mean));
+        binsDone = 0;
+        sweepStartUs = startUs;
+        sweeps = 0;
+        sweepTimeUs = 0;
+        for (uint8_t i = 0; i < receiverCount; i++) {
+            receivers[i].window = -1;
+        }
+    }
+    if ((int32_t)(frame.timeUs - startUs) < 0) return;  // taken before the scan
+
+    // a window is told apart from a later one in the same slot by its start
+    scan_receiver_t &r = receivers[frame.receiver];
+    int8_t window = windowAt(r, frame.timeUs);
+    uint32_t fromUs = window >= 0 ? r.windows[window].fromUs : 0;
+    if (window != r.window || fromUs != r.windowFromUs) {
+        finishWindow(r, frame.timeUs);
+        r.window = window;
+        r.windowFromUs = fromUs;
+        r.windowBin = window >= 0 ? r.windows[window].bin : 0;
+        r.sum = 0;
+        r.count = 0;
+        r.peak = 0;
+    }
+    if (window < 0) return;
+    r.sum += frame.rssi;
+    r.count++;
+    if (frame.rssi > r.peak) r.peak = frame.rssi;
+}
+
+void SpectrumScanner::finishWindow(scan_receiver_t &r, uint32_t timeUs) {
+    if (r.window < 0 || r.count == 0 || r.windowBin >= bins) return;
+    uint8_t held = peak[r.windowBin];
+    switch (params.hold) {
+        case SCANNER_HOLD_MAX:
+            break;
+        case SCANNER_HOLD_DECAY:
+            held = held > SCANNER_DECAY ? held - SCANNER_DECAY : 0;
+            break;
+        default:
+            held = 0;
+            break;
+    }
+    peak[r.windowBin] = r.peak > held ? r.peak : held;
+    mean[r.windowBin] = r.sum / r.count;
+
+    if (++binsDone < bins) return;
+    binsDone = 0;
+    sweepTimeUs = timeUs - sweepStartUs;
+    sweepStartUs = timeUs;
+    sweeps = sweeps + 1;
+}
+
+void SpectrumScanner::getSpectrum(scanner_spectrum_t *spectrum) {
+    spectrum->fromMhz = params.fromMhz;
+    spectrum->stepMhz = params.stepMhz;
+    spectrum->hold = params.hold;
+    spectrum->bins = bins;
+    spectrum->sweeps = getSweeps();
+    spectrum->sweepTimeUs = sweepTimeUs;
+    memcpy(spectrum->peak, peak, sizeof(peak));
+    memcpy(spectrum->mean, mean, sizeof(mean));
+}
@@ -0,0 +1,124 @@
+#include <stdint.h>
+
+#include "RX5808.h"
+#include "bands.h"
+#include "board.h"
+#include "hopper.h"
+#include "rssisource.h"
+
+#pragma once
+
+#define SCANNER_MAX_BINS 256
+#define SCANNER_STEP_MHZ 5    // default step
+#define SCANNER_SETTLE_MS 10  // default wait once the frequency write is on the wire, RSSI still moves before
+#define SCANNER_DWELL_MS 2    // RSSI taken per bin once settled
+#define SCANNER_DECAY 4       // a held peak falls this much per sweep with SCANNER_HOLD_DECAY
+#define SCANNER_WINDOWS 8     // recent sampling windows kept for attributing frames
+
+typedef enum {
+    SCANNER_HOLD_OFF,    // the peak of the last sweep
+    SCANNER_HOLD_MAX,    // the highest peak since the start
+    SCANNER_HOLD_DECAY,  // the highest, falling by SCANNER_DECAY per sweep
+    SCANNER_HOLD_COUNT
+} scanner_hold_e;
+
+typedef struct {
+    uint16_t fromMhz;
+    uint16_t toMhz;
+    uint8_t stepMhz;
+    uint8_t hold;  // scanner_hold_e
+    uint8_t settleMs;
+} scanner_params_t;
+
+typedef struct {
+    uint16_t bin;
+    bool open;
+    uint32_t fromUs;
+    uint32_t toUs;
+} scan_window_t;
+
+typedef struct {
+    RX5808 *rx;
+    uint8_t state;
+    uint16_t bin;
+    uint32_t sinceMs;
+    scan_window_t windows[SCANNER_WINDOWS];
+    volatile uint8_t latest;
+
+    // what push has of the window it is in
+    int8_t window;
+    uint16_t windowBin;
+    uint32_t windowFromUs;
+    uint32_t sum;
+    uint16_t count;
+    uint8_t peak;
+} scan_receiver_t;
+
+typedef struct {
+    uint16_t fromMhz;
+    uint8_t stepMhz;
+    uint8_t hold;
+    uint16_t bins;
+    uint32_t sweeps;
+    uint32_t sweepTimeUs;  // of the last full sweep
+    uint8_t peak[SCANNER_MAX_BINS];
+    uint8_t mean[SCANNER_MAX_BINS];
+} scanner_spectrum_t;
+
+void scannerDefaults(scanner_params_t *params);
+
+/*
+ * Sweeps the receivers across a frequency range, taking the peak and mean
+ * RSSI of each step. The receivers are taken from the hopper while it runs,
+ * so no laps are timed meanwhile. With several receivers the bins are dealt
+ * out round robin like the pilots and swept in parallel.
+ *
+ * Each bin is a write on the bus, a settle time and a short dwell; like the
+ * hopper the dwell is published as a window, and push attributes the frames
+ * LapTimer reads by their timestamp. The spectrum is written by push only,
+ * and read by the web server whenever, one bin may be from the sweep before.
+ */
+class SpectrumScanner {
+   public:
+    void init(FrequencyHopper *frequencyHopper, RX5808 *rx5808, uint8_t count);  // count receivers at rx5808
+    void start(const scanner_params_t &params);  // from any task, done on the next handleScan
+    void stop();
+    uint32_t handleScan(uint32_t currentTimeMs);  // from the task calling handleHop, ms until the next step
+    void push(const rssi_frame_t &frame);  // every frame, by the task running the lap timer
+    bool isRunning();
+    uint32_t getSweeps();
+    void getSpectrum(scanner_spectrum_t *spectrum);
+
+   private:
+    FrequencyHopper *hopper;
+    scan_receiver_t receivers[BOARD_MAX_RECEIVERS];
+    uint8_t receiverCount;
+    scanner_params_t params;
+    volatile bool running = false;
+    volatile uint16_t bins = 0;
+    volatile uint32_t startUs;
+    volatile uint32_t generation = 0;  // of the scan, a new one clears the spectrum
+
+    // from other tasks, guarded by halCriticalEnter
+    volatile uint32_t requestCount = 0;
+    bool requestRun;
+    scanner_params_t request;
+    uint32_t requestsHandled = 0;
+
+    // written by push
+    volatile uint32_t pushGeneration = 0;
+    uint16_t binsDone;
+    uint32_t sweepStartUs;
+    volatile uint32_t sweeps = 0;
+    volatile uint32_t sweepTimeUs = 0;
+    uint8_t peak[SCANNER_MAX_BINS];
+    uint8_t mean[SCANNER_MAX_BINS];
+
+    void handleRequest();
+    uint32_t handleReceiver(scan_receiver_t &r, uint8_t index, uint32_t currentTimeMs);
+    uint16_t frequencyOf(uint16_t bin);
+    void openWindow(scan_receiver_t &r, uint32_t timeUs);
+    void closeWindow(scan_receiver_t &r, uint32_t timeUs);
+    int8_t windowAt(const scan_receiver_t &r, uint32_t timeUs);
+    void finishWindow(scan_receiver_t &r, uint32_t timeUs);
+};
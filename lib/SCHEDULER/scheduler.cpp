@@ -0,0 +1,39 @@
+#include "scheduler.h"
+
+#include "probe.h"
+
+bool Scheduler::add(service_fn_t run, void *arg, uint8_t probe) {
+    if (count == SCHEDULER_SERVICES) return false;
+    services[count].run = run;
+    services[count].arg = arg;
+    services[count].probe = probe;
+    count++;
+    return true;
+}
+
+void Scheduler::setNotify(scheduler_notify_fn_t fn, void *arg) {
+    notify = fn;
+    notifyArg = arg;
+}
+
+uint32_t Scheduler::run(uint32_t currentTimeMs) {
+    uint32_t waitMs = SCHEDULER_MAX_WAIT_MS;
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t dueMs;
+        {
+            PROBE_SCOPE(services[i].probe);
+            dueMs = services[i].run(services[i].arg, currentTimeMs);
+        }
+        if (dueMs < waitMs) waitMs = dueMs;
+    }
+    passes++;
+    return waitMs;
+}
+
+void Scheduler::wake() {
+    if (notify) notify(notifyArg);
+}
+
+uint32_t Scheduler::getPasses() {
+    return passes;
+}
@@ -0,0 +1,45 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#define SCHEDULER_SERVICES 10
+#define SCHEDULER_IDLE UINT32_MAX  // from a service with nothing planned
+#define SCHEDULER_MAX_WAIT_MS 50   // longest sleep, a change made without a wake is seen this late at most
+
+typedef uint32_t (*service_fn_t)(void *arg, uint32_t currentTimeMs);  // ms until it has something to do again
+typedef void (*scheduler_notify_fn_t)(void *arg);
+
+typedef struct {
+    service_fn_t run;
+    void *arg;
+    uint8_t probe;  // probe_id_e
+} service_t;
+
+/*
+ * The service task's loop without the busy spinning. A pass runs every
+ * service in the order they were added, each returns how long until it
+ * next has work (a beep to end, a write to settle, a batch to send), and
+ * the task sleeps until the nearest of those. A service that changes the
+ * state of another one, like the battery monitor starting a beep, has to
+ * be added before it so the pass sees the new deadline.
+ *
+ * Other tasks call wake() when they hand work over, the notify function
+ * gets the sleeping task going. Whatever changes without a wake, like the
+ * LED turned on from a web handler, is picked up after SCHEDULER_MAX_WAIT_MS.
+ */
+class Scheduler {
+   public:
+    bool add(service_fn_t run, void *arg, uint8_t probe);
+    void setNotify(scheduler_notify_fn_t notify, void *arg);
+    uint32_t run(uint32_t currentTimeMs);  // one pass, returns the ms to sleep
+    void wake();                           // from any task
+    uint32_t getPasses();
+
+   private:
+    service_t services[SCHEDULER_SERVICES];
+    uint8_t count = 0;
+    scheduler_notify_fn_t notify = NULL;
+    void *notifyArg = NULL;
+    uint32_t passes = 0;
+};
@@ -0,0 +1,71 @@
+#include "sessionjson.h"
+
+#include <stdio.h>
+#include <string.h>
+
+size_t ChunkedJson::read(uint8_t *buf, size_t maxLen) {
+    size_t len = 0;
+    while (len < maxLen) {
+        if (pendingPos < pendingLen) {
+            size_t n = pendingLen - pendingPos;
+            if (n > maxLen - len) n = maxLen - len;
+            memcpy(&buf[len], &pending[pendingPos], n);
+            pendingPos += n;
+            len += n;
+            continue;
+        }
+        if (closed) break;
+
+        // the next piece: opening bracket, element with its separator or the closing bracket
+        pendingPos = 0;
+        if (!opened) {
+            pending[0] = '[';
+            pendingLen = 1;
+            opened = true;
+        } else if (nextElement(&pending[1], sizeof(pending) - 1)) {
+            pending[0] = ',';
+            pendingLen = strlen(&pending[1]) + 1;
+            if (elements++ == 0) pendingPos = 1;
+        } else {
+            pending[0] = ']';
+            pendingLen = 1;
+            closed = true;
+        }
+    }
+    return len;
+}
+
+SessionListJson::SessionListJson(SessionLog *log, size_t offset, size_t limit) {
+    count = log->getSessions(sessions, limit < SESSIONLOG_MAX_SESSIONS ? limit : SESSIONLOG_MAX_SESSIONS, offset);
+}
+
+bool SessionListJson::nextElement(char *text, size_t size) {
+    if (position >= count) return false;
+    const session_info_t &s = sessions[position++];
+    snprintf(text, size, "{\"id\":%lu,\"uptime\":%lu,\"pilots\":%u,\"laps\":%u,\"closed\":%s,\"recovered\":%s}", (unsigned long)s.id,
+             (unsigned long)s.startMs, s.pilots, s.laps, (s.flags & SESSION_CLOSED) ? "true" : "false",
+             (s.flags & SESSION_RECOVERED) ? "true" : "false");
+    return true;
+}
+
+bool SessionLapsJson::open(uint32_t id, size_t offset, size_t limit) {
+    if (!reader.open(id)) return false;
+    session_record_t record;
+    while (offset > 0 && reader.next(&record)) {
+        offset--;
+    }
+    remaining = limit;
+    return true;
+}
+
+bool SessionLapsJson::nextElement(char *text, size_t size) {
+    session_record_t record;
+    if (remaining == 0 || !reader.next(&record)) {
+        reader.close();  // don't hold a file handle until the response is freed
+        return false;
+    }
+    remaining--;
+    snprintf(text, size, "{\"pilot\":%u,\"lap\":%u,\"us\":%lu,\"ms\":%lu}", record.pilot, record.lap, (unsigned long)record.value,
+             (unsigned long)record.timeMs);
+    return true;
+}
@@ -0,0 +1,59 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sessionlog.h"
+
+#pragma once
+
+#define SESSIONJSON_ELEMENT_SIZE 96
+#define SESSIONJSON_DEFAULT_LIMIT 1000
+
+/*
+ * JSON arrays produced a piece at a time for chunked HTTP responses, so a
+ * session of thousands of laps is sent without building it in RAM. read()
+ * fills up to maxLen bytes and returns 0 once the array is complete.
+ */
+class ChunkedJson {
+   public:
+    virtual ~ChunkedJson() {}
+    size_t read(uint8_t *buf, size_t maxLen);
+
+   protected:
+    // writes the next element, returns false when there are no more
+    virtual bool nextElement(char *text, size_t size) = 0;
+
+   private:
+    char pending[SESSIONJSON_ELEMENT_SIZE];
+    size_t pendingLen = 0;
+    size_t pendingPos = 0;
+    uint32_t elements = 0;
+    bool opened = false;
+    bool closed = false;
+};
+
+// [{"id":1,"uptime":1234,"pilots":1,"laps":12,"closed":true,"recovered":false},...]
+class SessionListJson : public ChunkedJson {
+   public:
+    SessionListJson(SessionLog *log, size_t offset = 0, size_t limit = SESSIONJSON_DEFAULT_LIMIT);
+
+   protected:
+    bool nextElement(char *text, size_t size) override;
+
+   private:
+    session_info_t sessions[SESSIONLOG_MAX_SESSIONS];
+    size_t count;
+    size_t position = 0;
+};
+
+// [{"pilot":0,"lap":0,"us":4012345,"ms":4012},...], ms since the session started
+class SessionLapsJson : public ChunkedJson {
+   public:
+    bool open(uint32_t id, size_t offset = 0, size_t limit = SESSIONJSON_DEFAULT_LIMIT);
+
+   protected:
+    bool nextElement(char *text, size_t size) override;
+
+   private:
+    SessionReader reader;
+    size_t remaining = 0;
+};
@@ -0,0 +1,367 @@
+#include "sessionlog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "hal.h"
+
+static_assert(sizeof(session_record_t) == 16, "records are read back as 16 byte blocks");
+static_assert(sizeof(session_info_t) == 16, "index entries are read back as 16 byte blocks");
+
+// CRC-32 (IEEE), a nibble at a time, a record is only 12 bytes
+uint32_t sessionCrc(const void *data, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (p[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+void sessionLogPath(uint32_t id, char *path) {
+    snprintf(path, SESSIONLOG_PATH_SIZE, SESSIONLOG_DIR "/%lu.log", (unsigned long)id);
+}
+
+static bool validRecord(const session_record_t &record) {
+    return record.crc == sessionCrc(&record, offsetof(session_record_t, crc));
+}
+
+static bool validInfo(const session_info_t &info) {
+    return info.id != 0 && info.crc == sessionCrc(&info, offsetof(session_info_t, crc));
+}
+
+bool SessionLog::init() {
+    ready = false;
+    file = -1;
+    queueHead = queueTail = 0;
+    sessionCount = 0;
+    openId = 0;
+    if (!halFsBegin()) {
+        DEBUG("Session log: no filesystem\n");
+        return false;
+    }
+    if (!halFileExists(SESSIONLOG_DIR) && !halMkdir(SESSIONLOG_DIR)) return false;
+    halFileRemove(SESSIONLOG_INDEX_TMP);  // a compaction a power cut interrupted
+
+    bool dirty = loadIndex();
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        if (!(sessions[i].flags & SESSION_CLOSED)) {
+            recover(&sessions[i]);
+            dirty = true;
+        }
+    }
+    // recover() drops sessions without a usable header
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        if (sessions[i].id != 0) sessions[kept++] = sessions[i];
+    }
+    sessionCount = kept;
+    if (dirty && !writeIndex()) return false;
+
+    nextId = sessionCount ? sessions[sessionCount - 1].id + 1 : 1;
+    DEBUG("Session log: %u sessions, next %lu\n", sessionCount, (unsigned long)nextId);
+    ready = true;
+    return true;
+}
+
+bool SessionLog::isReady() {
+    return ready;
+}
+
+// newest entry per session wins, returns true when the index needs rewriting
+bool SessionLog::loadIndex() {
+    indexEntries = 0;
+    int8_t f = halFileOpen(SESSIONLOG_INDEX, HAL_FILE_READ);
+    if (f < 0) return halFileExists(SESSIONLOG_INDEX);
+
+    bool dirty = false;
+    session_info_t info;
+    size_t n;
+    while ((n = halFileRead(f, &info, sizeof(info))) > 0) {
+        indexEntries++;
+        if (n != sizeof(info) || !validInfo(info)) {
+            dirty = true;
+            continue;
+        }
+        session_info_t *known = findSession(info.id);
+        if (known) {
+            *known = info;
+            continue;
+        }
+        if (sessionCount == SESSIONLOG_MAX_SESSIONS) {
+            memmove(&sessions[0], &sessions[1], sizeof(sessions[0]) * (sessionCount - 1));
+            sessionCount--;
+            dirty = true;
+        }
+        sessions[sessionCount++] = info;
+    }
+    halFileClose(f);
+
+    // a retention delete the index didn't see any more
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        char path[SESSIONLOG_PATH_SIZE];
+        sessionLogPath(sessions[i].id, path);
+        if (!halFileExists(path)) {
+            sessions[i].id = 0;
+            dirty = true;
+        }
+    }
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        if (sessions[i].id != 0) sessions[kept++] = sessions[i];
+    }
+    sessionCount = kept;
+    return dirty;
+}
+
+// counts the laps that made it to flash, a torn record at the end is ignored
+void SessionLog::recover(session_info_t *info) {
+    char path[SESSIONLOG_PATH_SIZE];
+    sessionLogPath(info->id, path);
+    int8_t f = halFileOpen(path, HAL_FILE_READ);
+    session_record_t record;
+    if (f < 0 || halFileRead(f, &record, sizeof(record)) != sizeof(record) || !validRecord(record) ||
+        record.type != SESSION_RECORD_HEADER || record.value != info->id) {
+        halFileClose(f);
+        halFileRemove(path);
+        info->id = 0;
+        return;
+    }
+    uint16_t count = 0;
+    bool ended = false;
+    while (halFileRead(f, &record, sizeof(record)) == sizeof(record)) {
+        if (!validRecord(record)) continue;
+        if (record.type == SESSION_RECORD_LAP) count++;
+        if (record.type == SESSION_RECORD_END) ended = true;
+    }
+    halFileClose(f);
+    info->laps = count;
+    info->flags |= SESSION_CLOSED;
+    if (!ended) info->flags |= SESSION_RECOVERED;
+    DEBUG("Session log: recovered session %lu with %u laps\n", (unsigned long)info->id, count);
+}
+
+bool SessionLog::appendIndex(const session_info_t &info) {
+    if (indexEntries >= SESSIONLOG_INDEX_COMPACT) return writeIndex();  // has info already
+    session_info_t entry = info;
+    entry.crc = sessionCrc(&entry, offsetof(session_info_t, crc));
+    int8_t f = halFileOpen(SESSIONLOG_INDEX, HAL_FILE_APPEND);
+    if (f < 0) return false;
+    bool ok = halFileWrite(f, &entry, sizeof(entry)) == sizeof(entry);
+    halFileClose(f);
+    indexEntries++;
+    return ok;
+}
+
+// one entry per session into a new file, which then replaces the index
+bool SessionLog::writeIndex() {
+    int8_t f = halFileOpen(SESSIONLOG_INDEX_TMP, HAL_FILE_WRITE);
+    if (f < 0) return false;
+    bool ok = true;
+    for (uint8_t i = 0; i < sessionCount && ok; i++) {
+        session_info_t entry = sessions[i];
+        entry.crc = sessionCrc(&entry, offsetof(session_info_t, crc));
+        ok = halFileWrite(f, &entry, sizeof(entry)) == sizeof(entry);
+    }
+    halFileClose(f);
+    ok = ok && halFileRename(SESSIONLOG_INDEX_TMP, SESSIONLOG_INDEX);
+    if (ok) indexEntries = sessionCount;
+    return ok;
+}
+
+session_info_t *SessionLog::findSession(uint32_t id) {
+    for (uint8_t i = 0; i < sessionCount; i++) {
+        if (sessions[i].id == id) return &sessions[i];
+    }
+    return nullptr;
+}
+
+bool SessionLog::push(const session_event_t &event) {
+    if (!ready) return false;
+    bool queued = false;
+    halCriticalEnter();
+    uint8_t next = (queueHead + 1) % SESSIONLOG_QUEUE;
+    if (next != queueTail) {
+        queue[queueHead] = event;
+        queueHead = next;
+        queued = true;
+    } else {
+        dropped++;
+    }
+    halCriticalExit();
+    return queued;
+}
+
+bool SessionLog::pop(session_event_t *event) {
+    bool popped = false;
+    halCriticalEnter();
+    if (queueTail != queueHead) {
+        *event = queue[queueTail];
+        queueTail = (queueTail + 1) % SESSIONLOG_QUEUE;
+        popped = true;
+    }
+    halCriticalExit();
+    return popped;
+}
+
+void SessionLog::beginSession(uint8_t pilots, uint32_t startTimeUs) {
+    push({SESSION_EVENT_BEGIN, pilots, 0, startTimeUs});
+}
+
+void SessionLog::addLap(uint8_t pilot, uint32_t lapTimeUs, uint32_t timeUs) {
+    push({SESSION_EVENT_LAP, pilot, lapTimeUs, timeUs});
+}
+
+void SessionLog::endSession(uint32_t timeUs) {
+    push({SESSION_EVENT_END, 0, 0, timeUs});
+}
+
+uint32_t SessionLog::getDroppedEvents() {
+    return dropped;
+}
+
+void SessionLog::handleSessionLog(uint32_t currentTimeMs) {
+    if (!ready) return;
+    session_event_t event;
+    bool written = false;
+    while (pop(&event)) {
+        switch (event.type) {
+            case SESSION_EVENT_BEGIN:
+                if (file >= 0) closeSession(event.timeUs);
+                openSession(event, currentTimeMs);
+                break;
+            case SESSION_EVENT_LAP:
+                written |= writeLap(event);
+                break;
+            case SESSION_EVENT_END:
+                if (file >= 0) closeSession(event.timeUs);
+                break;
+        }
+    }
+    if (written && file >= 0) halFileSync(file);
+}
+
+void SessionLog::openSession(const session_event_t &event, uint32_t currentTimeMs) {
+    // oldest file first, an index entry without its file is dropped on the next boot
+    if (sessionCount == SESSIONLOG_MAX_SESSIONS) {
+        char path[SESSIONLOG_PATH_SIZE];
+        sessionLogPath(sessions[0].id, path);
+        halFileRemove(path);
+        halCriticalEnter();
+        memmove(&sessions[0], &sessions[1], sizeof(sessions[0]) * (sessionCount - 1));
+        sessionCount--;
+        halCriticalExit();
+        writeIndex();
+    }
+
+    char path[SESSIONLOG_PATH_SIZE];
+    uint32_t id = nextId++;
+    sessionLogPath(id, path);
+    file = halFileOpen(path, HAL_FILE_WRITE);
+    session_record_t header = {SESSION_RECORD_HEADER, event.pilot, SESSIONLOG_VERSION, id, currentTimeMs, 0};
+    if (file < 0 || !writeRecord(&header) || !halFileSync(file)) {
+        DEBUG("Session log: can't start %s\n", path);
+        halFileClose(file);
+        file = -1;
+        return;
+    }
+    startUs = event.timeUs;
+    laps = 0;
+    memset(pilotLaps, 0, sizeof(pilotLaps));
+
+    session_info_t info = {id, currentTimeMs, 0, event.pilot, 0, 0};
+    halCriticalEnter();
+    sessions[sessionCount++] = info;
+    openId = id;
+    halCriticalExit();
+    appendIndex(info);
+}
+
+bool SessionLog::writeLap(const session_event_t &event) {
+    if (file < 0 || event.pilot >= CONFIG_MAX_PILOTS) return false;
+    if (laps >= SESSIONLOG_MAX_LAPS) {
+        dropped++;
+        return false;
+    }
+    session_record_t record = {SESSION_RECORD_LAP, event.pilot, pilotLaps[event.pilot], event.lapTimeUs, (event.timeUs - startUs) / 1000, 0};
+    if (!writeRecord(&record)) return false;
+    pilotLaps[event.pilot]++;
+    laps++;
+    halCriticalEnter();
+    sessions[sessionCount - 1].laps = laps;
+    halCriticalExit();
+    return true;
+}
+
+void SessionLog::closeSession(uint32_t timeUs) {
+    session_record_t end = {SESSION_RECORD_END, 0, laps, 0, (timeUs - startUs) / 1000, 0};
+    writeRecord(&end);
+    halFileClose(file);
+    file = -1;
+
+    halCriticalEnter();
+    session_info_t &info = sessions[sessionCount - 1];
+    info.laps = laps;
+    info.flags |= SESSION_CLOSED;
+    openId = 0;
+    halCriticalExit();
+    appendIndex(sessions[sessionCount - 1]);
+}
+
+bool SessionLog::writeRecord(session_record_t *record) {
+    record->crc = sessionCrc(record, offsetof(session_record_t, crc));
+    return halFileWrite(file, record, sizeof(*record)) == sizeof(*record);
+}
+
+size_t SessionLog::getSessions(session_info_t *list, size_t maxSessions, size_t first) {
+    size_t count = 0;
+    halCriticalEnter();
+    for (size_t i = first; i < sessionCount && count < maxSessions; i++) {
+        list[count++] = sessions[i];
+    }
+    halCriticalExit();
+    return count;
+}
+
+bool SessionLog::getSession(uint32_t id, session_info_t *info) {
+    halCriticalEnter();
+    session_info_t *known = findSession(id);
+    if (known) *info = *known;
+    halCriticalExit();
+    return known != nullptr;
+}
+
+uint32_t SessionLog::getOpenSessionId() {
+    return openId;
+}
+
+SessionReader::~SessionReader() {
+    close();
+}
+
+bool SessionReader::open(uint32_t id) {
+    char path[SESSIONLOG_PATH_SIZE];
+    close();
+    sessionLogPath(id, path);
+    file = halFileOpen(path, HAL_FILE_READ);
+    return file >= 0;
+}
+
+bool SessionReader::next(session_record_t *record) {
+    if (file < 0) return false;
+    while (halFileRead(file, record, sizeof(*record)) == sizeof(*record)) {
+        if (record->type == SESSION_RECORD_LAP && validRecord(*record)) return true;
+    }
+    close();
+    return false;
+}
+
+void SessionReader::close() {
+    halFileClose(file);
+    file = -1;
+}
@@ -0,0 +1,144 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#pragma once
+
+#define SESSIONLOG_DIR "/sessions"
+#define SESSIONLOG_INDEX "/sessions/index"
+#define SESSIONLOG_INDEX_TMP "/sessions/index.tmp"
+#define SESSIONLOG_PATH_SIZE 32
+#define SESSIONLOG_VERSION 1
+#define SESSIONLOG_MAX_SESSIONS 32   // oldest sessions are deleted beyond this
+#define SESSIONLOG_MAX_LAPS 4000     // per session, 64kB of records
+#define SESSIONLOG_QUEUE 32          // events between two handleSessionLog calls
+#define SESSIONLOG_INDEX_COMPACT 96  // index entries before it is rewritten
+
+/*
+ * Race sessions on the data partition, one append-only file of fixed size
+ * records per session and an index file with an entry per session.
+ *
+ * Every record and index entry carries a CRC, so whatever a power cut leaves
+ * behind is recognized: a torn record at the end is ignored and the index
+ * entry of a session that was still open is rebuilt from its file on the
+ * next boot. A lap is on flash once the handleSessionLog call after it
+ * returned.
+ *
+ * beginSession, addLap and endSession are called from the lap events in the
+ * service task (handleLapEvents in main.cpp) and only queue the event. The
+ * flash writes happen in handleSessionLog, a later service of the same task
+ * on core 0, so the timing loop never gets near the filesystem. The readers
+ * copy what they need under the same lock, so the web server never waits for
+ * a write either.
+ */
+
+typedef enum {
+    SESSION_RECORD_HEADER = 1,
+    SESSION_RECORD_LAP,
+    SESSION_RECORD_END
+} session_record_e;
+
+typedef struct {
+    uint8_t type;
+    uint8_t pilot;    // pilot count in the header
+    uint16_t lap;     // format version in the header, lap count in the end record
+    uint32_t value;   // lap time in us, session id in the header
+    uint32_t timeMs;  // since the session started, uptime in the header
+    uint32_t crc;
+} session_record_t;
+
+#define SESSION_CLOSED 0x01
+#define SESSION_RECOVERED 0x02  // closed on the next boot, laps counted from the log
+
+typedef struct {
+    uint32_t id;
+    uint32_t startMs;  // uptime when it started
+    uint16_t laps;
+    uint8_t pilots;
+    uint8_t flags;
+    uint32_t crc;
+} session_info_t;
+
+typedef enum {
+    SESSION_EVENT_BEGIN,
+    SESSION_EVENT_LAP,
+    SESSION_EVENT_END
+} session_event_e;
+
+typedef struct {
+    uint8_t type;
+    uint8_t pilot;  // pilot count for BEGIN
+    uint32_t lapTimeUs;
+    uint32_t timeUs;
+} session_event_t;
+
+uint32_t sessionCrc(const void *data, size_t len);
+void sessionLogPath(uint32_t id, char *path);
+
+class SessionLog {
+   public:
+    bool init();  // mounts, recovers what a power cut left open
+    bool isReady();
+    void handleSessionLog(uint32_t currentTimeMs);
+
+    // timing side, never touch flash
+    void beginSession(uint8_t pilots, uint32_t startTimeUs);
+    void addLap(uint8_t pilot, uint32_t lapTimeUs, uint32_t timeUs);
+    void endSession(uint32_t timeUs);
+    uint32_t getDroppedEvents();
+
+    // web side, oldest first
+    size_t getSessions(session_info_t *sessions, size_t maxSessions, size_t first = 0);
+    bool getSession(uint32_t id, session_info_t *info);
+    uint32_t getOpenSessionId();  // 0 when none
+
+   private:
+    volatile bool ready = false;
+
+    session_event_t queue[SESSIONLOG_QUEUE];
+    volatile uint8_t queueHead = 0;
+    volatile uint8_t queueTail = 0;
+    volatile uint32_t dropped = 0;
+
+    // guarded by halCriticalEnter, written by the writer only
+    session_info_t sessions[SESSIONLOG_MAX_SESSIONS];
+    uint8_t sessionCount = 0;
+    uint32_t openId = 0;
+
+    // writer side
+    int8_t file = -1;
+    uint32_t nextId = 1;
+    uint32_t startUs;
+    uint16_t laps;
+    uint16_t pilotLaps[CONFIG_MAX_PILOTS];
+    uint16_t indexEntries = 0;
+
+    bool push(const session_event_t &event);
+    bool pop(session_event_t *event);
+    void openSession(const session_event_t &event, uint32_t currentTimeMs);
+    bool writeLap(const session_event_t &event);
+    void closeSession(uint32_t timeUs);
+    bool writeRecord(session_record_t *record);
+
+    bool loadIndex();
+    void recover(session_info_t *info);
+    bool appendIndex(const session_info_t &info);
+    bool writeIndex();
+    session_info_t *findSession(uint32_t id);
+};
+
+/*
+ * Lap records of one session in the order they were written, skipping
+ * anything that doesn't check out.
+ */
+class SessionReader {
+   public:
+    ~SessionReader();
+    bool open(uint32_t id);
+    bool next(session_record_t *record);
+    void close();
+
+   private:
+    int8_t file = -1;
+};
@@ -0,0 +1,74 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <thread>
+
+uint32_t percentile(std::vector<uint32_t> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1))];
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1))];
+}
+
+void WallClock::start() {
+    origin = std::chrono::steady_clock::now();
+}
+
+uint32_t WallClock::micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+uint32_t WallClock::millis() {
+    return micros() / 1000;
+}
+
+std::chrono::steady_clock::time_point WallClock::at(uint32_t ms) {
+    return origin + std::chrono::milliseconds(ms);
+}
+
+void Waker::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    woken = false;
+}
+
+void Waker::wake(void *waker) {
+    Waker *w = (Waker *)waker;
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->woken = true;
+    }
+    w->cv.notify_one();
+}
+
+bool Waker::wait(uint32_t waitMs, volatile bool *done) {
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait_for(guard, std::chrono::milliseconds(waitMs), [&]() { return woken || *done; });
+    woken = false;
+    return !*done;
+}
+
+void PeriodicService::init(uint32_t period, uint32_t block, uint32_t random, uint32_t seed) {
+    periodMs = period;
+    blockUs = block;
+    randomUs = random;
+    rnd = SimRandom(seed);
+    lastMs = 0;
+}
+
+void PeriodicService::reset(uint32_t currentTimeMs) {
+    lastMs = currentTimeMs;
+}
+
+uint32_t PeriodicService::run(void *service, uint32_t currentTimeMs) {
+    PeriodicService *s = (PeriodicService *)service;
+    if (currentTimeMs - s->lastMs < s->periodMs) return s->periodMs - (currentTimeMs - s->lastMs);
+    s->lastMs = currentTimeMs;
+    uint32_t us = s->blockUs + (s->randomUs ? s->rnd.next() % (s->randomUs + 1) : 0);
+    if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+    return s->periodMs;
+}
@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+#pragma once
+
+// Pieces the real time benches of the host program share.
+
+uint32_t percentile(std::vector<uint32_t> values, double p);  // the value below which p of them are, 0 for none
+double percentile(std::vector<double> values, double p);
+
+// real time since start(), the benches' own clock next to the simulated one
+class WallClock {
+   public:
+    void start();
+    uint32_t micros();
+    uint32_t millis();
+    std::chrono::steady_clock::time_point at(uint32_t ms);  // ms after start()
+
+   private:
+    std::chrono::steady_clock::time_point origin;
+};
+
+// a thread sleeping until a deadline or a wake, what a task notification is on the ESP32
+class Waker {
+   public:
+    void reset();
+    static void wake(void *waker);  // a scheduler_notify_fn_t
+    bool wait(uint32_t waitMs, volatile bool *done);  // woken or after waitMs, false once done
+
+   private:
+    std::mutex lock;
+    std::condition_variable cv;
+    bool woken = false;
+};
+
+// stands in for a service with work every periodMs that blocks in its driver meanwhile
+class PeriodicService {
+   public:
+    void init(uint32_t periodMs, uint32_t blockUs, uint32_t randomUs, uint32_t seed = 1);  // blocks blockUs plus up to randomUs
+    void reset(uint32_t currentTimeMs);  // the next period starts now
+    static uint32_t run(void *service, uint32_t currentTimeMs);  // a service_fn_t
+
+   private:
+    uint32_t periodMs = 0;
+    uint32_t blockUs = 0;
+    uint32_t randomUs = 0;
+    uint32_t lastMs = 0;
+    SimRandom rnd = SimRandom(1);
+};
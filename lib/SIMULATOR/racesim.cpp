@@ -0,0 +1,226 @@
+#include "racesim.h"
+
+#include <math.h>
+
+#include "hal_native.h"
+#include "probe.h"
+#include "scheduler.h"
+
+// as on BOARD_NODE4, the first receiver is the one of the target
+static const board_receiver_t simReceivers[BOARD_MAX_RECEIVERS] = {{PIN_RX5808_RSSI, PIN_RX5808_SELECT}, {32, 18}, {34, 16}, {39, 17}};
+
+void raceDefaults(race_params_t *params) {
+    const uint16_t frequencies[CONFIG_MAX_PILOTS] = {5800, 5695, 5732, 5769};
+    params->pilots = 1;
+    for (uint8_t i = 0; i < CONFIG_MAX_PILOTS; i++) {
+        params->frequency[i] = frequencies[i];
+    }
+    params->enterRssi = 120;
+    params->exitRssi = 100;
+    params->minLap = 50;
+    params->peakFit = true;
+    params->detector = DETECTOR_PEAK;
+    params->floorRssi = 0;
+    params->calibrate = false;
+    params->receivers = 1;
+    params->tickHz = 0;
+    params->frameBudget = 0;
+    params->adcPpm = 0;
+    params->scanClock = false;
+}
+
+RaceSimulator::RaceSimulator()
+    : module(PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK) {
+}
+
+void RaceSimulator::service() {
+    // same duties as parallelTask in main.cpp, minus the network, and asleep until the nearest deadline like it
+    uint32_t currentTimeMs = halMillis();
+    if (currentTimeMs == lastServiceMs) return;
+    if (!serviceHook && currentTimeMs - lastServiceMs < serviceWaitMs) return;
+    lastServiceMs = currentTimeMs;
+    source.pump();  // what was received before a possible retune
+    uint32_t waitMs = SCHEDULER_MAX_WAIT_MS;
+    uint32_t dueMs;
+    {
+        PROBE_SCOPE(PROBE_TASK_BUZZER);
+        dueMs = buzzer.handleBuzzer(currentTimeMs);
+    }
+    if (dueMs < waitMs) waitMs = dueMs;
+    {
+        PROBE_SCOPE(PROBE_TASK_LED);
+        dueMs = led.handleLed(currentTimeMs);
+    }
+    if (dueMs < waitMs) waitMs = dueMs;
+    if (serviceHook) {
+        PROBE_SCOPE(PROBE_TASK_WEB);
+        serviceHook(serviceHookArg, currentTimeMs);
+    }
+    {
+        PROBE_SCOPE(PROBE_TASK_EEPROM);
+        dueMs = config.handleEeprom(currentTimeMs);
+    }
+    if (dueMs < waitMs) waitMs = dueMs;
+    {
+        PROBE_SCOPE(PROBE_TASK_HOPPER);
+        dueMs = hopper.handleHop(currentTimeMs);
+    }
+    if (dueMs < waitMs) waitMs = dueMs;
+    {
+        PROBE_SCOPE(PROBE_TASK_BATTERY);
+        dueMs = monitor.checkBatteryState(currentTimeMs, config.getAlarmThreshold());
+    }
+    if (dueMs < waitMs) waitMs = dueMs;
+    serviceWaitMs = waitMs;
+}
+
+void RaceSimulator::timingTick(void *arg, uint32_t currentTimeMs) {
+    RaceSimulator *sim = (RaceSimulator *)arg;
+    size_t frames = sim->timer.handleLapTimerUpdate();
+    if (frames > sim->maxTickFrames) sim->maxTickFrames = frames;
+}
+
+void RaceSimulator::getTickStats(tick_stats_t *stats) {
+    tickDriver.getStats(stats);
+}
+
+size_t RaceSimulator::getMaxTickFrames() {
+    return maxTickFrames;
+}
+
+void RaceSimulator::setRssiStream(RssiStream *rssiStream) {
+    stream = rssiStream;
+}
+
+void RaceSimulator::setRssiHistory(RssiHistory *rssiHistory) {
+    history = rssiHistory;
+}
+
+void RaceSimulator::setRhNode(RhNode *node) {
+    rhNode = node;
+}
+
+void RaceSimulator::setServiceHook(race_service_hook_t hook, void *arg) {
+    serviceHook = hook;
+    serviceHookArg = arg;
+}
+
+void RaceSimulator::run(const RssiTrace *traces, const race_params_t &params, race_result_t *results) {
+    halNativeReset();
+    halNativeSetAnalog(PIN_VBAT, SIM_VBAT_RAW);
+    module.clear();
+    module.attach();  // answers the frequency read back
+
+    // fresh hardware for every race, as after a power cycle
+    uint8_t count = params.receivers < 1 ? 1 : params.receivers > BOARD_MAX_RECEIVERS ? BOARD_MAX_RECEIVERS : params.receivers;
+    for (uint8_t i = 0; i < count; i++) {
+        receivers[i] = RX5808(simReceivers[i].rssiPin, simReceivers[i].selectPin, &bus);
+    }
+    source = ReplayRssiSource();
+    source.setAdcClock(params.adcPpm, params.scanClock);
+    timer = LapTimer();
+    monitor = BatteryMonitor();
+
+    config.init();
+    config.setPilotCount(params.pilots);
+    for (uint8_t i = 0; i < params.pilots; i++) {
+        config.setPilotFrequency(i, params.frequency[i]);
+        config.setPilotEnterRssi(i, params.enterRssi);
+        config.setPilotExitRssi(i, params.exitRssi);
+        config.setFloorRssi(i, params.floorRssi);
+        source.addTrace(&traces[i], params.frequency[i]);
+    }
+    config.setMinLap(params.minLap);
+    config.setDetector(params.detector);
+    bus.init(PIN_RX5808_DATA, PIN_RX5808_CLOCK);
+    for (uint8_t i = 0; i < count; i++) {
+        receivers[i].init();
+    }
+    hopper.init(&config, receivers, count);
+    buzzer.init(PIN_BUZZER, BUZZER_INVERTED);
+    led.init(PIN_LED, false);
+    source.setReceivers(receivers, count);
+    timer.init(&config, &hopper, &source, &buzzer, &led);
+    timer.setPeakFit(params.peakFit);
+    timer.setFrameBudget(params.frameBudget);
+    timer.setRssiStream(stream);
+    timer.setRssiHistory(history);
+    if (rhNode) {
+        rhNode->init(&config, &timer);
+        timer.setRhHistory(rhNode->getHistory());
+    }
+    monitor.init(PIN_VBAT, VBAT_SCALE, VBAT_ADD, &buzzer, &led);
+
+    // let the receiver tune and settle before the race starts
+    lastServiceMs = 0xFFFFFFFF;
+    serviceWaitMs = 0;
+    while (halMillis() < SIM_SETTLE_TIME_MS) {
+        service();
+        halNativeAdvanceMicros(1000);
+    }
+    halNativeSetMicros((uint64_t)SIM_RACE_START_MS * 1000);
+
+    for (uint8_t i = 0; i < params.pilots; i++) {
+        race_result_t *result = &results[i];
+        result->lapsExpected = traces[i].passTimesUs.size();
+        result->lapsDetected = 0;
+        result->samples = traces[i].samples.size();
+        result->meanAbsErrorMs = 0;
+        result->maxAbsErrorMs = 0;
+        result->expectedUs.clear();
+        result->detectedUs.clear();
+
+        uint32_t previousPassUs = 0;
+        for (uint32_t passUs : traces[i].passTimesUs) {
+            result->expectedUs.push_back((uint64_t)(passUs - previousPassUs) * 1000000 / (1000000 + params.adcPpm));
+            previousPassUs = passUs;
+        }
+    }
+
+    source.begin(0);
+    hopper.resetStats();
+    if (params.calibrate) {
+        timer.startCalibration();
+    } else {
+        timer.start();
+    }
+    maxTickFrames = 0;
+    tickDriver.init(params.tickHz, timingTick, this);
+    if (params.tickHz) tickDriver.start();  // the first interrupt a period from now
+
+    while (!source.finished()) {
+        PROBE_SCOPE(PROBE_LOOP);  // the iteration, a mark would span the setup between races
+        halNativeAdvanceMicros(SIM_LOOP_PERIOD_US);
+        service();
+        if (!params.tickHz) timingTick(this, halMillis());
+        PROBE_SCOPE(PROBE_TASK_LAPS);
+        lap_event_t event;
+        while (timer.popLapEvent(&event)) {
+            if (event.type == LAP_EVENT_LAP && event.pilot < params.pilots) {
+                PROBE_RECORD_US(PROBE_LAP_LATENCY, halMicros() - event.sampleTimeUs);
+                results[event.pilot].detectedUs.push_back(event.lapTimeUs);
+            }
+            if (rhNode) rhNode->handleLapEvent(event);
+            serviceWaitMs = 0;  // lapPushTask wakes the scheduler
+        }
+    }
+
+    for (uint8_t i = 0; i < params.pilots; i++) {
+        race_result_t *result = &results[i];
+        result->lapsDetected = result->detectedUs.size();
+        result->effectiveRateHz = hopper.getEffectiveRateHz(i, source.getSampleRateHz());
+        result->worstGapUs = hopper.getWorstGapUs(i);
+        result->maxTimeErrorUs = source.getMaxTimeErrorUs();
+        result->endTimeErrorUs = source.getTimeErrorUs();
+        result->measuredPpm = source.getMeasuredPpm();
+        timer.getCalibration(i, &result->calibration);
+
+        size_t compared = result->detectedUs.size() < result->expectedUs.size() ? result->detectedUs.size() : result->expectedUs.size();
+        for (size_t n = 0; n < compared; n++) {
+            double error = fabs((double)result->detectedUs[n] - (double)result->expectedUs[n]) / 1000;
+            result->meanAbsErrorMs += error;
+            if (error > result->maxAbsErrorMs) result->maxAbsErrorMs = error;
+        }
+        if (compared) result->meanAbsErrorMs /= compared;
+    }
+}
@@ -0,0 +1,115 @@
+#include <stdint.h>
+
+#include <vector>
+
+#include "battery.h"
+#include "buzzer.h"
+#include "config.h"
+#include "hopper.h"
+#include "laptimer.h"
+#include "led.h"
+#include "RX5808.h"
+#include "replaysource.h"
+#include "rhnode.h"
+#include "rx5808model.h"
+#include "tickdriver.h"
+#include "trace.h"
+
+#pragma once
+
+#define SIM_SETTLE_TIME_MS 200
+#define SIM_RACE_START_MS 30000  // device uptime when the race is started, after tuning and client connect
+#define SIM_LOOP_PERIOD_US 1000  // how often loop() gets to drain the RSSI source
+#define SIM_VBAT_RAW 2296  // ~3.9V through the 1/2 divider
+
+typedef struct {
+    uint8_t pilots;
+    uint16_t frequency[CONFIG_MAX_PILOTS];
+    uint8_t enterRssi;
+    uint8_t exitRssi;
+    uint8_t minLap;  // in 0.1s, same as Config
+    bool peakFit;
+    detector_type_e detector;
+    uint8_t floorRssi;  // the thresholds follow the drift from, 0 = they stay put
+    bool calibrate;     // a calibration run instead of a race
+    uint8_t receivers;  // RX5808 modules on the shared bus, pilots are dealt out to them
+    uint32_t tickHz;    // the timing loop in the tick task at this rate, 0 = from loop() every SIM_LOOP_PERIOD_US
+    uint16_t frameBudget;  // LapTimer::setFrameBudget, 0 for all there are
+    int32_t adcPpm;        // ReplayRssiSource::setAdcClock, the expected laps are in real time
+    bool scanClock;
+} race_params_t;
+
+typedef struct {
+    uint32_t lapsExpected;
+    uint32_t lapsDetected;
+    uint32_t samples;
+    double meanAbsErrorMs;
+    double maxAbsErrorMs;
+    uint32_t effectiveRateHz;
+    uint32_t worstGapUs;
+    uint32_t maxTimeErrorUs;  // of a frame against when it was converted
+    int32_t endTimeErrorUs;   // of the last one
+    int32_t measuredPpm;
+    std::vector<uint32_t> expectedUs;
+    std::vector<uint32_t> detectedUs;
+    calibration_t calibration;
+} race_result_t;
+
+typedef void (*race_service_hook_t)(void *arg, uint32_t currentTimeMs);
+
+void raceDefaults(race_params_t *params);
+
+/*
+ * Runs one race on the simulated hardware. The trace is fed through a
+ * ReplayRssiSource the way the continuous ADC delivers frames, and
+ * LapTimer::handleLapTimerUpdate drains it every SIM_LOOP_PERIOD_US like
+ * loop() does, interleaved with the service calls parallelTask makes.
+ * Those are all millisecond based; like parallelTask they run again when
+ * the nearest one says it is due, at most SCHEDULER_MAX_WAIT_MS later, after a
+ * lap event, or every simulated millisecond with a service hook.
+ *
+ * With more than one pilot there is a trace and a result per pilot, the
+ * receiver hops between the pilot frequencies and only hears the trace of the
+ * one it is tuned to. With more receivers they sit on the pins of a
+ * BOARD_NODE4 board; the module model answers on the first one only.
+ *
+ * With tickHz the timing loop runs from a TickDriver on the simulated tick
+ * task instead, late by whatever halNativeSetTickLatency says.
+ */
+class RaceSimulator {
+   public:
+    RaceSimulator();
+    void run(const RssiTrace *traces, const race_params_t &params, race_result_t *results);
+    void setRssiStream(RssiStream *rssiStream);
+    void setRssiHistory(RssiHistory *rssiHistory);
+    void setRhNode(RhNode *node);  // initialised on the race timer, gets its lap events
+    void setServiceHook(race_service_hook_t hook, void *arg);  // called where parallelTask serves the network
+    void getTickStats(tick_stats_t *stats);  // of the last race run with tickHz
+    size_t getMaxTickFrames();  // most frames one update took in the last race
+
+   private:
+    RX5808Bus bus;
+    RX5808 receivers[BOARD_MAX_RECEIVERS];
+    Rx5808Model module;
+    Config config;
+    Buzzer buzzer;
+    Led led;
+    FrequencyHopper hopper;
+    ReplayRssiSource source;
+    LapTimer timer;
+    BatteryMonitor monitor;
+    TickDriver tickDriver;
+
+    RssiStream *stream = nullptr;
+    RssiHistory *history = nullptr;
+    RhNode *rhNode = nullptr;
+    race_service_hook_t serviceHook = nullptr;
+    void *serviceHookArg = nullptr;
+
+    uint32_t lastServiceMs;
+    uint32_t serviceWaitMs;  // the scheduler's, ms after lastServiceMs
+    size_t maxTickFrames;
+
+    void service();
+    static void timingTick(void *arg, uint32_t currentTimeMs);
+};
@@ -0,0 +1,163 @@
+#include "replaysource.h"
+
+#include "hal.h"
+
+ReplayRssiSource::ReplayRssiSource(size_t capacityFrames) : capacity(capacityFrames), ring(capacityFrames) {
+}
+
+void ReplayRssiSource::setTrace(const RssiTrace *rssiTrace) {
+    channels.clear();
+    setReceivers(NULL, 1);
+    trace = NULL;
+    addTrace(rssiTrace, 0);
+}
+
+void ReplayRssiSource::addTrace(const RssiTrace *rssiTrace, uint16_t frequency) {
+    channels.push_back({rssiTrace, frequency});
+    if (!trace || rssiTrace->samples.size() > trace->samples.size()) {
+        trace = rssiTrace;
+    }
+}
+
+void ReplayRssiSource::setReceiver(RX5808 *rx5808) {
+    setReceivers(rx5808, 1);
+}
+
+void ReplayRssiSource::setReceivers(RX5808 *rx5808, uint8_t count) {
+    rx = rx5808;
+    receivers = count;
+    ring.resize(capacity * count);
+    head = 0;
+    fill = 0;
+}
+
+const RssiTrace *ReplayRssiSource::tunedTrace(uint8_t receiver) {
+    if (!rx) return channels[0].trace;
+    const RssiTrace *tuned = NULL;
+    for (const replay_channel_t &channel : channels) {
+        if (channel.frequency == rx[receiver].getFrequency()) tuned = channel.trace;
+    }
+    return tuned;
+}
+
+// trace time 0 maps to the moment begin() is called, the rate is the one the trace was recorded at
+bool ReplayRssiSource::begin(uint32_t sampleRateHz) {
+    head = 0;
+    fill = 0;
+    next = 0;
+    dropped = 0;
+    droppedSeen = 0;
+    lastReceiver = BOARD_MAX_RECEIVERS;
+    maxTimeErrorUs = 0;
+    timeErrorUs = 0;
+    clock.begin(getSampleRateHz());
+    startUs = halMicros();
+    running = trace != NULL;
+    return running;
+}
+
+void ReplayRssiSource::setAdcClock(int32_t ppm, bool scanClock) {
+    adcPpm = ppm;
+    clocked = scanClock;
+}
+
+// since begin(), on an ADC adcPpm fast
+uint32_t ReplayRssiSource::convertedUs(size_t sample) {
+    if (!adcPpm) return trace->samples[sample].timeUs;
+    return (uint64_t)trace->samples[sample].timeUs * 1000000 / (1000000 + adcPpm);
+}
+
+void ReplayRssiSource::checkTime(uint32_t timeUs, uint32_t convertedAtUs) {
+    int32_t error = (int32_t)(timeUs - convertedAtUs);
+    uint32_t magnitude = error < 0 ? -error : error;
+    timeErrorUs = error;
+    if (magnitude > maxTimeErrorUs) maxTimeErrorUs = magnitude;
+}
+
+uint32_t ReplayRssiSource::getMaxTimeErrorUs() {
+    return maxTimeErrorUs;
+}
+
+int32_t ReplayRssiSource::getTimeErrorUs() {
+    return timeErrorUs;
+}
+
+int32_t ReplayRssiSource::getMeasuredPpm() {
+    return clocked ? clock.getErrorPpm() : 0;
+}
+
+// convert everything the clock has passed since the last call
+void ReplayRssiSource::pump() {
+    if (!running) return;
+
+    uint32_t elapsedUs = halMicros() - startUs;
+    size_t due = next;
+    while (due < trace->samples.size() && convertedUs(due) <= elapsedUs) due++;
+    if (clocked && due < trace->samples.size()) due -= due % RSSI_DMA_FRAMES_PER_INTR;  // whole interrupts only
+    if (due <= next) return;
+
+    const RssiTrace *tuned[BOARD_MAX_RECEIVERS];
+    for (uint8_t r = 0; r < receivers; r++) {
+        tuned[r] = tunedTrace(r);
+    }
+    size_t tail = head + fill < ring.size() ? head + fill : head + fill - ring.size();
+    while (next < due) {
+        for (uint8_t r = 0; r < receivers; r++) {
+            if (fill < ring.size()) {
+                rssi_frame_t &frame = ring[tail];
+                if (++tail == ring.size()) tail = 0;
+                frame.timeUs = startUs + (clocked ? convertedUs(next) : trace->samples[next].timeUs);  // timed when read with the clock
+                if (adcPpm && !clocked && r == 0) checkTime(frame.timeUs, startUs + convertedUs(next));
+                frame.rssi = (tuned[r] && next < tuned[r]->samples.size()) ? tuned[r]->samples[next].rssi : 0;
+                frame.receiver = r;
+                fill++;
+            } else {
+                dropped++;
+            }
+        }
+        next++;
+    }
+}
+
+size_t ReplayRssiSource::read(rssi_frame_t *frames, size_t maxFrames) {
+    if (!running) return 0;
+    pump();
+
+    size_t count = 0;
+    uint32_t scans = 0;
+    while (count < maxFrames && fill > 0) {
+        frames[count] = ring[head];
+        if (++head == ring.size()) head = 0;
+        fill--;
+        if (clocked) {
+            // as DmaRssiSource counts them
+            if (frames[count].receiver <= lastReceiver) scans++;
+            lastReceiver = frames[count].receiver;
+        }
+        count++;
+    }
+    if (!clocked || !count) return count;
+
+    clock.addBatch(scans, halMicros(), dropped != droppedSeen);
+    droppedSeen = dropped;
+    for (size_t i = 0, scan = 0; i < count; i++) {
+        if (i > 0 && frames[i].receiver <= frames[i - 1].receiver) scan++;
+        uint32_t convertedAtUs = frames[i].timeUs;
+        frames[i].timeUs = clock.scanTimeUs((int32_t)scan - (frames[0].receiver == 0 ? 0 : 1));
+        checkTime(frames[i].timeUs, convertedAtUs);
+    }
+    return count;
+}
+
+uint32_t ReplayRssiSource::getSampleRateHz() {
+    if (!trace || trace->samples.size() < 2 || trace->durationUs() == 0) return 0;
+    return (uint64_t)(trace->samples.size() - 1) * 1000000 / trace->durationUs();
+}
+
+uint32_t ReplayRssiSource::getDroppedFrames() {
+    return dropped;
+}
+
+bool ReplayRssiSource::finished() {
+    return trace && next >= trace->samples.size() && fill == 0;
+}
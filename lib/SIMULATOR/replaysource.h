@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+#include <vector>
+
+#include "RX5808.h"
+#include "rssisource.h"
+#include "trace.h"
+
+#pragma once
+
+/*
+ * Host stand-in for DmaRssiSource. Frames of a trace become available once the
+ * simulated clock passes their timestamp and wait in a bounded ring, like
+ * conversions in the DMA driver buffer; when the reader falls behind and the
+ * ring is full, new frames are dropped and counted.
+ *
+ * With a trace per frequency and a receiver attached, frames come from the
+ * trace of the frequency the receiver is tuned to when they are converted, and
+ * read 0 on any other frequency. With several receivers every trace sample
+ * is converted once per receiver, as one scan of the DMA pattern, and the
+ * ring holds capacityFrames scans. pump() converts what is due without
+ * reading, it has to be called before a receiver is retuned.
+ *
+ * setAdcClock() runs the ADC ppm off the trace's rate. Frames are then
+ * timed from the nominal rate as if anchored at begin(), or with scanClock
+ * like DmaRssiSource: they arrive a DMA interrupt's worth at a time and a
+ * ScanClock times them from when they are read.
+ */
+class ReplayRssiSource : public RssiSource {
+   public:
+    explicit ReplayRssiSource(size_t capacityFrames = RSSI_DMA_BUFFER_FRAMES);
+    void setTrace(const RssiTrace *rssiTrace);
+    void addTrace(const RssiTrace *rssiTrace, uint16_t frequency);
+    void setReceiver(RX5808 *rx5808);
+    void setReceivers(RX5808 *rx5808, uint8_t count);  // count receivers at rx5808
+    void pump();
+    void setAdcClock(int32_t ppm, bool scanClock);
+    uint32_t getMaxTimeErrorUs();  // a frame's time against when it was converted
+    int32_t getTimeErrorUs();      // of the last frame
+    int32_t getMeasuredPpm();      // by the scan clock
+    bool begin(uint32_t sampleRateHz) override;
+    size_t read(rssi_frame_t *frames, size_t maxFrames) override;
+    uint32_t getSampleRateHz() override;
+    uint32_t getDroppedFrames() override;
+    bool finished();
+
+   private:
+    typedef struct {
+        const RssiTrace *trace;
+        uint16_t frequency;
+    } replay_channel_t;
+
+    std::vector<replay_channel_t> channels;
+    const RssiTrace *trace = NULL;  // the longest, sets the pace
+    RX5808 *rx = NULL;
+    uint8_t receivers = 1;
+    size_t capacity;  // scans
+    std::vector<rssi_frame_t> ring;
+    size_t head = 0;  // next frame to hand out
+    size_t fill = 0;  // frames waiting in the ring
+    size_t next = 0;  // next trace sample to convert
+    uint32_t startUs = 0;
+    uint32_t dropped = 0;
+    bool running = false;
+    int32_t adcPpm = 0;
+    bool clocked = false;
+    ScanClock clock;
+    uint32_t droppedSeen = 0;  // by the clock
+    uint8_t lastReceiver = BOARD_MAX_RECEIVERS;
+    uint32_t maxTimeErrorUs = 0;
+    int32_t timeErrorUs = 0;
+
+    const RssiTrace *tunedTrace(uint8_t receiver);
+    uint32_t convertedUs(size_t sample);
+    void checkTime(uint32_t timeUs, uint32_t convertedAtUs);
+};
@@ -0,0 +1,77 @@
+#include "rx5808model.h"
+
+#include <string.h>
+
+#include "hal_native.h"
+
+#define FRAME_BITS 25  // address, R/W, 20 data bits
+
+Rx5808Model::Rx5808Model(uint8_t rx5808DataPin, uint8_t rx5808SelPin, uint8_t rx5808ClkPin) {
+    dataPin = rx5808DataPin;
+    selPin = rx5808SelPin;
+    clkPin = rx5808ClkPin;
+    clear();
+}
+
+void Rx5808Model::attach() {
+    for (Rx5808Model *m = this; m; m = m->next) {
+        m->selLevel = halNativeGetPin(m->selPin);
+        m->clkLevel = halNativeGetPin(m->clkPin);
+    }
+    halNativeSetPinHook(pinHook, this);
+}
+
+void Rx5808Model::setNext(Rx5808Model *module) {
+    next = module;
+}
+
+void Rx5808Model::detach() {
+    halNativeSetPinHook(NULL, NULL);
+}
+
+void Rx5808Model::clear() {
+    frames.clear();
+    memset(registers, 0, sizeof(registers));
+    selected = false;
+}
+
+void Rx5808Model::pinHook(void *arg, uint8_t pin) {
+    for (Rx5808Model *m = (Rx5808Model *)arg; m; m = m->next) {
+        m->onPin(pin);
+    }
+}
+
+void Rx5808Model::onPin(uint8_t pin) {
+    if (pin == selPin) {
+        uint8_t level = halNativeGetPin(selPin);
+        if (selLevel == HAL_HIGH && level == HAL_LOW) {
+            selected = true;
+            memset(&current, 0, sizeof(current));
+            current.startUs = halNativeMicros64();
+        } else if (selLevel == HAL_LOW && level == HAL_HIGH && selected) {
+            selected = false;
+            current.endUs = halNativeMicros64();
+            bool write = (current.value >> 4) & 1;
+            if (current.bits == FRAME_BITS && write) {
+                registers[current.value & 0xF] = current.value >> 5;
+            }
+            frames.push_back(current);
+        }
+        selLevel = level;
+    } else if (pin == clkPin) {
+        uint8_t level = halNativeGetPin(clkPin);
+        if (selected && clkLevel == HAL_LOW && level == HAL_HIGH && current.bits < 32) {
+            if (halDigitalRead(dataPin)) current.value |= 1UL << current.bits;
+            if (halNativeGetPinMode(dataPin) == HAL_OUTPUT) current.drivenBits++;
+            current.bits++;
+        } else if (selected && clkLevel == HAL_HIGH && level == HAL_LOW) {
+            // on a read the module shifts the register out after the falling edge
+            bool write = (current.value >> 4) & 1;
+            if (current.bits >= 5 && current.bits < FRAME_BITS && !write) {
+                uint32_t reg = registers[current.value & 0xF];
+                halNativeSetDigitalInput(dataPin, (reg >> (current.bits - 5)) & 1);
+            }
+        }
+        clkLevel = level;
+    }
+}
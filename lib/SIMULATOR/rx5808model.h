@@ -0,0 +1,46 @@
+#include <stdint.h>
+
+#include <vector>
+
+#pragma once
+
+typedef struct {
+    uint8_t bits;        // clocked while SEL was low
+    uint8_t drivenBits;  // of those, driven by the MCU, the rest by the module
+    uint32_t value;      // DATA at each rising clock edge, LSB first
+    uint64_t startUs;
+    uint64_t endUs;
+} bus_frame_t;
+
+/*
+ * The module end of the RX5808 bus on the simulated pins. Records every
+ * SEL framed transfer as it was clocked, keeps the register file written
+ * through it and answers register reads, so driver output can be compared
+ * bit for bit and frequency verification works in the simulator. Modules
+ * sharing DATA and CLK are chained behind the attached one, each listens to
+ * its own SEL.
+ */
+class Rx5808Model {
+   public:
+    Rx5808Model(uint8_t dataPin, uint8_t selPin, uint8_t clkPin);
+    void attach();  // replaces any other pin hook, after halNativeReset
+    void setNext(Rx5808Model *module);  // another module on the same bus, answered by the same hook
+    void detach();
+    void clear();
+
+    std::vector<bus_frame_t> frames;
+    uint32_t registers[16];
+
+   private:
+    uint8_t dataPin;
+    uint8_t selPin;
+    uint8_t clkPin;
+    uint8_t selLevel;
+    uint8_t clkLevel;
+    bool selected;
+    bus_frame_t current;
+    Rx5808Model *next = nullptr;
+
+    static void pinHook(void *arg, uint8_t pin);
+    void onPin(uint8_t pin);
+};
@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#include <math.h>
+#include <stdio.h>
+
+void synthDefaults(synth_params_t *params) {
+    params->sampleRateHz = 1000;
+    params->noiseFloor = 60;
+    params->peakRssi = 170;
+    params->noiseStdDev = 3.0f;
+    params->passWidthMs = 120;
+    params->firstPassMs = 3000;
+    params->lapTimeMs = 12000;
+    params->lapJitterMs = 2000;
+    params->laps = 5;
+    params->tailMs = 2000;
+    params->fadeDepth = 0;
+    params->fadeWidthMs = 10;
+    params->fadeOffsetMs = 0;
+    params->floorDrift = 0;
+}
+
+SimRandom::SimRandom(uint32_t seed) {
+    state = seed ? seed : 0x9E3779B9;
+}
+
+uint32_t SimRandom::next() {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+float SimRandom::uniform() {
+    return (next() >> 8) * (1.0f / 16777216.0f);
+}
+
+float SimRandom::gaussian() {
+    // Box-Muller, the second value is simply dropped
+    float u1 = uniform();
+    float u2 = uniform();
+    if (u1 < 1e-7f) u1 = 1e-7f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+void RssiTrace::clear() {
+    samples.clear();
+    passTimesUs.clear();
+}
+
+void RssiTrace::synthesize(const synth_params_t &params, uint32_t seed) {
+    SimRandom rnd(seed);
+    clear();
+
+    uint32_t passMs = params.firstPassMs;
+    for (uint8_t i = 0; i <= params.laps; i++) {
+        passTimesUs.push_back(passMs * 1000);
+        int32_t jitter = params.lapJitterMs ? (int32_t)(rnd.next() % (2 * params.lapJitterMs + 1)) - (int32_t)params.lapJitterMs : 0;
+        passMs += params.lapTimeMs + jitter;
+    }
+
+    const uint32_t endUs = passTimesUs.back() + params.tailMs * 1000;
+    const uint32_t periodUs = 1000000 / params.sampleRateHz;
+    const float sigmaUs = params.passWidthMs * 1000.0f;
+    const float amplitude = (float)params.peakRssi - params.noiseFloor;
+    const float fadeSigmaUs = params.fadeWidthMs * 1000.0f;
+    samples.reserve(endUs / periodUs + 1);
+
+    size_t nextPass = 0;
+    for (uint32_t t = 0; t <= endUs; t += periodUs) {
+        // only the closest pass contributes, passes are seconds apart
+        while (nextPass + 1 < passTimesUs.size() && passTimesUs[nextPass + 1] < t) {
+            nextPass++;
+        }
+        float signal = params.noiseFloor + (float)params.floorDrift * t / endUs;
+        for (size_t p = nextPass; p < nextPass + 2 && p < passTimesUs.size(); p++) {
+            float d = ((float)t - passTimesUs[p]) / sigmaUs;
+            if (d < -6.0f || d > 6.0f) continue;
+            float fade = 1.0f;
+            if (params.fadeDepth > 0) {
+                float f = ((float)t - passTimesUs[p] - params.fadeOffsetMs * 1000.0f) / fadeSigmaUs;
+                fade -= params.fadeDepth * expf(-0.5f * f * f);
+            }
+            signal += amplitude * fade * expf(-0.5f * d * d);
+        }
+        signal += params.noiseStdDev * rnd.gaussian();
+        if (signal < 0) signal = 0;
+        if (signal > 255) signal = 255;
+        samples.push_back({t, (uint8_t)lroundf(signal)});
+    }
+}
+
+bool RssiTrace::load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    clear();
+
+    char line[128];
+    unsigned long t, v;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "pass,%lu", &t) == 1) {
+            passTimesUs.push_back(t);
+        } else if (sscanf(line, "%lu,%lu", &t, &v) == 2) {
+            samples.push_back({(uint32_t)t, (uint8_t)(v > 255 ? 255 : v)});
+        }
+    }
+    fclose(f);
+    return !samples.empty();
+}
+
+bool RssiTrace::save(const char *path) const {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "# PhobosLT RSSI trace, %zu samples\n", samples.size());
+    for (uint32_t p : passTimesUs) {
+        fprintf(f, "pass,%u\n", p);
+    }
+    for (const trace_sample_t &s : samples) {
+        fprintf(f, "%u,%u\n", s.timeUs, s.rssi);
+    }
+    fclose(f);
+    return true;
+}
+
+uint32_t RssiTrace::durationUs() const {
+    return samples.empty() ? 0 : samples.back().timeUs;
+}
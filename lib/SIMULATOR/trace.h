@@ -0,0 +1,64 @@
+#include <stdint.h>
+
+#include <vector>
+
+#pragma once
+
+/*
+ * RSSI trace used by the host simulator. A trace is a list of timestamped
+ * 8 bit RSSI samples (the same scale RX5808::readRssi returns) plus the true
+ * pass times, either loaded from a recording or synthesized.
+ *
+ * File format, one entry per line:
+ *   # comment
+ *   pass,<timeUs>        ground truth gate pass (peak) time
+ *   <timeUs>,<rssi>      sample
+ */
+
+typedef struct {
+    uint32_t timeUs;
+    uint8_t rssi;
+} trace_sample_t;
+
+typedef struct {
+    uint32_t sampleRateHz;
+    uint8_t noiseFloor;
+    uint8_t peakRssi;
+    float noiseStdDev;
+    uint32_t passWidthMs;  // standard deviation of the gaussian pass shape
+    uint32_t firstPassMs;  // hole shot, measured from race start
+    uint32_t lapTimeMs;
+    uint32_t lapJitterMs;
+    uint8_t laps;
+    uint32_t tailMs;  // recording time after the last pass
+    float fadeDepth;       // multipath, a notch taking this part of every pass away, 0 for none
+    uint32_t fadeWidthMs;  // standard deviation of the notch
+    int32_t fadeOffsetMs;  // of the notch from the pass
+    int16_t floorDrift;    // the noise floor moves this much over the trace, evenly
+} synth_params_t;
+
+void synthDefaults(synth_params_t *params);
+
+class RssiTrace {
+   public:
+    void clear();
+    void synthesize(const synth_params_t &params, uint32_t seed);
+    bool load(const char *path);
+    bool save(const char *path) const;
+    uint32_t durationUs() const;
+
+    std::vector<trace_sample_t> samples;
+    std::vector<uint32_t> passTimesUs;
+};
+
+// small deterministic PRNG so synthetic races are reproducible from a seed
+class SimRandom {
+   public:
+    explicit SimRandom(uint32_t seed);
+    uint32_t next();
+    float uniform();  // [0, 1)
+    float gaussian();  // mean 0, standard deviation 1
+
+   private:
+    uint32_t state;
+};
@@ -0,0 +1,94 @@
+#include "rssihistory.h"
+
+void RssiHistory::setPilot(uint8_t pilot) {
+    selected = pilot;
+}
+
+uint8_t RssiHistory::getPilot() {
+    return selected;
+}
+
+void RssiHistory::store(const rssi_bucket_t &bucket, uint32_t bucketEndUs) {
+    ring[head] = bucket;
+    endUs = bucketEndUs;
+    head = (head + 1) % RSSI_HISTORY_BUCKETS;
+    if (filled < RSSI_HISTORY_BUCKETS) filled++;
+}
+
+void RssiHistory::push(uint8_t pilot, uint8_t rssi, uint32_t timeUs) {
+    uint8_t pilotSelected = selected;  // once, setPilot() may change it in between
+    if (pilot != pilotSelected) return;
+    if (current != pilotSelected) {
+        filled = 0;
+        synced = false;
+        current = pilotSelected;  // last, query() trusts the ring again from here
+    }
+
+    if (synced) {
+        int32_t ahead = timeUs - acc.startUs;
+        if (ahead >= 0 && ahead < RSSI_HISTORY_BUCKET_US) {
+            rssiAccumulatorAdd(&acc, rssi);
+            return;
+        }
+        if (ahead >= RSSI_HISTORY_BUCKET_US) {
+            uint32_t startUs = acc.startUs + RSSI_HISTORY_BUCKET_US;
+            store(rssiAccumulatorBucket(&acc), startUs);
+            uint32_t missing = ahead / RSSI_HISTORY_BUCKET_US - 1;  // whole buckets without a sample
+            if (missing < RSSI_HISTORY_BUCKETS) {
+                for (uint32_t i = 0; i < missing; i++) {
+                    startUs += RSSI_HISTORY_BUCKET_US;
+                    store(RSSI_BUCKET_EMPTY, startUs);
+                }
+                rssiAccumulatorStart(&acc, startUs, rssi);
+                return;
+            }
+        }
+    }
+    // first sample, the clock went back or nothing for longer than the history
+    filled = 0;
+    rssiAccumulatorStart(&acc, timeUs, rssi);
+    synced = true;
+}
+
+/*
+ * The newest spanUs as at most maxBuckets buckets, oldest first. Each one
+ * covers a whole number of stored buckets, so the span may come out a bit
+ * shorter. Returns how many were written.
+ */
+size_t RssiHistory::query(uint32_t spanUs, size_t maxBuckets, rssi_bucket_t *buckets, uint32_t *firstUs, uint32_t *bucketUs) {
+    if (current != selected) return 0;  // the ring is still the previous pilot's
+    uint16_t h, n;
+    uint32_t end;
+    do {
+        h = head;
+        n = filled;
+        end = endUs;
+    } while (h != head);
+
+    uint32_t span = spanUs / RSSI_HISTORY_BUCKET_US;
+    if (span > n) span = n;
+    if (span == 0 || maxBuckets == 0) return 0;
+    uint32_t group = (span + maxBuckets - 1) / maxBuckets;
+    size_t count = span / group;
+
+    uint16_t index = (h + RSSI_HISTORY_BUCKETS - count * group) % RSSI_HISTORY_BUCKETS;
+    for (size_t i = 0; i < count; i++) {
+        rssi_bucket_t out = RSSI_BUCKET_EMPTY;
+        uint32_t sum = 0;
+        uint32_t used = 0;
+        for (uint32_t g = 0; g < group; g++) {
+            const rssi_bucket_t &b = ring[index];
+            index = (index + 1) % RSSI_HISTORY_BUCKETS;
+            if (rssiBucketEmpty(b)) continue;
+            if (b.min < out.min) out.min = b.min;
+            if (b.max > out.max) out.max = b.max;
+            sum += b.mean;
+            used++;
+        }
+        if (used) out.mean = (sum + used / 2) / used;
+        buckets[i] = out;
+    }
+    *bucketUs = group * RSSI_HISTORY_BUCKET_US;
+    *firstUs = end - count * group * RSSI_HISTORY_BUCKET_US;
+    return count;
+}
@@ -0,0 +1,44 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rssistream.h"
+
+#pragma once
+
+#define RSSI_HISTORY_BUCKET_US 10000
+#define RSSI_HISTORY_BUCKETS 6000  // one minute, 18kB
+
+/*
+ * The last minute of one pilot's filtered RSSI as min/max/mean buckets,
+ * read back at whatever resolution the client asks for. Coarser buckets
+ * take the min and max of the ones they cover, so peaks survive any zoom
+ * level. Buckets the receiver was away for (hopping) stay empty.
+ *
+ * push() is called from LapTimer, query() and setPilot() from the web
+ * server. A query racing a push is off by at most the bucket being written.
+ * selected is the only handover for a pilot change: push() reads it once
+ * and starts over when it differs from current, which it sets last, and
+ * query() answers nothing until the two match again.
+ */
+class RssiHistory {
+   public:
+    void setPilot(uint8_t pilot);  // starts over when it changes
+    uint8_t getPilot();
+    void push(uint8_t pilot, uint8_t rssi, uint32_t timeUs);
+    size_t query(uint32_t spanUs, size_t maxBuckets, rssi_bucket_t *buckets, uint32_t *firstUs, uint32_t *bucketUs);
+
+   private:
+    rssi_bucket_t ring[RSSI_HISTORY_BUCKETS];
+    volatile uint16_t head = 0;    // next bucket to store
+    volatile uint16_t filled = 0;
+    volatile uint32_t endUs = 0;   // end of the newest stored bucket
+    volatile uint8_t selected = 0;
+
+    volatile uint8_t current = 0xFF;  // the pilot in the ring, written by push() only
+
+    // producer side
+    bool synced = false;
+    rssi_accumulator_t acc;
+
+    void store(const rssi_bucket_t &bucket, uint32_t bucketEndUs);
+};
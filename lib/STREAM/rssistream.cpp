@@ -0,0 +1,73 @@
+#include "rssistream.h"
+
+#include <string.h>
+
+void RssiStream::setRateHz(uint16_t rateHz) {
+    if (rateHz != 0 && rateHz < RSSI_STREAM_MIN_HZ) rateHz = RSSI_STREAM_MIN_HZ;
+    if (rateHz > RSSI_STREAM_MAX_HZ) rateHz = RSSI_STREAM_MAX_HZ;
+    rate = rateHz;
+    periodUs = rateHz ? 1000000 / rateHz : 0;
+}
+
+uint16_t RssiStream::getRateHz() {
+    return rate;
+}
+
+uint16_t RssiStream::getPeriodUs() {
+    return periodUs;
+}
+
+void RssiStream::push(uint8_t pilot, uint8_t rssi, uint32_t timeUs) {
+    uint16_t period = periodUs;
+    if (period == 0 || pilot >= CONFIG_MAX_PILOTS) return;
+    if (period != gridPeriodUs) {
+        gridPeriodUs = period;
+        memset(synced, 0, sizeof(synced));
+    }
+
+    rssi_accumulator_t &acc = buckets[pilot];
+    if (synced[pilot]) {
+        int32_t ahead = timeUs - acc.startUs;
+        if (ahead >= 0 && ahead < period) {
+            rssiAccumulatorAdd(&acc, rssi);
+            return;
+        }
+        if (ahead >= period) {
+            emit(pilot);
+            uint32_t nextUs = acc.startUs + period;
+            if (timeUs - nextUs >= period) nextUs = timeUs;  // gap, restart the grid here
+            rssiAccumulatorStart(&acc, nextUs, rssi);
+            return;
+        }
+    }
+    // first sample or the clock went back
+    rssiAccumulatorStart(&acc, timeUs, rssi);
+    synced[pilot] = true;
+}
+
+void RssiStream::emit(uint8_t pilot) {
+    uint16_t next = (head + 1) % RSSI_STREAM_SIZE;
+    if (next == tail) {
+        dropped++;
+        return;
+    }
+    ring[head].timeUs = buckets[pilot].startUs;
+    ring[head].pilot = pilot;
+    ring[head].rssi = rssiAccumulatorBucket(&buckets[pilot]);
+    head = next;
+}
+
+size_t RssiStream::pop(rssi_sample_t *samples, size_t maxSamples) {
+    size_t count = 0;
+    uint16_t t = tail;
+    while (count < maxSamples && t != head) {
+        samples[count++] = ring[t];
+        t = (t + 1) % RSSI_STREAM_SIZE;
+    }
+    tail = t;
+    return count;
+}
+
+uint32_t RssiStream::getDropped() {
+    return dropped;
+}
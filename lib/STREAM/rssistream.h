@@ -0,0 +1,92 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#pragma once
+
+#define RSSI_STREAM_SIZE 256      // slots, one stays free, 250 ms at the highest rate
+#define RSSI_STREAM_MIN_HZ 16     // the period has to fit the 16 bit field of a frame
+#define RSSI_STREAM_MAX_HZ 1000
+
+// the filtered RSSI over a stretch of time, min > max when there were no samples
+typedef struct {
+    uint8_t min;
+    uint8_t max;
+    uint8_t mean;
+} rssi_bucket_t;
+
+typedef struct {
+    uint32_t timeUs;  // start of the bucket
+    uint8_t pilot;
+    rssi_bucket_t rssi;
+} rssi_sample_t;
+
+typedef struct {
+    uint32_t startUs;
+    uint32_t sum;
+    uint16_t count;
+    uint8_t min;
+    uint8_t max;
+} rssi_accumulator_t;
+
+static const rssi_bucket_t RSSI_BUCKET_EMPTY = {255, 0, 0};
+
+static inline bool rssiBucketEmpty(const rssi_bucket_t &bucket) {
+    return bucket.min > bucket.max;
+}
+
+static inline void rssiAccumulatorStart(rssi_accumulator_t *acc, uint32_t startUs, uint8_t rssi) {
+    acc->startUs = startUs;
+    acc->sum = acc->min = acc->max = rssi;
+    acc->count = 1;
+}
+
+static inline void rssiAccumulatorAdd(rssi_accumulator_t *acc, uint8_t rssi) {
+    acc->sum += rssi;
+    if (acc->count < UINT16_MAX) acc->count++;
+    if (rssi < acc->min) acc->min = rssi;
+    if (rssi > acc->max) acc->max = rssi;
+}
+
+static inline rssi_bucket_t rssiAccumulatorBucket(const rssi_accumulator_t *acc) {
+    rssi_bucket_t bucket = {acc->min, acc->max, (uint8_t)((acc->sum + acc->count / 2) / acc->count)};
+    return bucket;
+}
+
+/*
+ * Filtered RSSI handed from LapTimer to the network side at a fixed rate per
+ * pilot. Every sample in a period goes into a min/max/mean bucket, so a pass
+ * shorter than the period still shows with its full height. Buckets sit on a
+ * grid of the period, a run of them is fully described by its first time and
+ * the period. The grid restarts after a gap, e.g. while the receiver was on
+ * another pilot.
+ *
+ * One producer (LapTimer in the timing loop) and one consumer (Webserver in
+ * parallelTask). When the consumer falls behind new buckets are dropped and
+ * counted.
+ */
+class RssiStream {
+   public:
+    void setRateHz(uint16_t rateHz);  // 0 stops the stream
+    uint16_t getRateHz();
+    uint16_t getPeriodUs();
+    void push(uint8_t pilot, uint8_t rssi, uint32_t timeUs);
+    size_t pop(rssi_sample_t *samples, size_t maxSamples);
+    uint32_t getDropped();
+
+   private:
+    rssi_sample_t ring[RSSI_STREAM_SIZE];
+    volatile uint16_t head = 0;  // next free slot
+    volatile uint16_t tail = 0;  // oldest bucket
+    volatile uint16_t rate = 0;
+    volatile uint16_t periodUs = 0;
+    volatile uint32_t dropped = 0;
+
+    // producer side
+    uint16_t gridPeriodUs = 0;
+    bool synced[CONFIG_MAX_PILOTS];
+    rssi_accumulator_t buckets[CONFIG_MAX_PILOTS];
+
+    void emit(uint8_t pilot);
+};
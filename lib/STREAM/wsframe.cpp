@@ -0,0 +1,298 @@
+#include "wsframe.h"
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static void putNibble(uint8_t *codes, size_t n, uint8_t v) {
+    if (n % 2 == 0) {
+        codes[n / 2] = v << 4;
+    } else {
+        codes[n / 2] |= v & 0xF;
+    }
+}
+
+static uint8_t getNibble(const uint8_t *codes, size_t n) {
+    return n % 2 == 0 ? codes[n / 2] >> 4 : codes[n / 2] & 0xF;
+}
+
+bool wsParseCommand(const uint8_t *data, size_t length, ws_command_t *command) {
+    if (length == 0) return false;
+    command->command = data[0];
+    command->pilot = 0;
+    command->rateHz = 0;
+    command->spanMs = 0;
+    command->buckets = 0;
+    scannerDefaults(&command->scan);
+    switch (data[0]) {
+        case WS_CMD_START:
+        case WS_CMD_STOP:
+            return length == 1;
+        case WS_CMD_RSSI:
+            if (length != 3) return false;
+            command->rateHz = get16(data + 1);
+            return true;
+        case WS_CMD_HISTORY:
+            if (length != 6) return false;
+            command->pilot = data[1];
+            command->spanMs = get16(data + 2);
+            command->buckets = get16(data + 4);
+            return command->pilot < CONFIG_MAX_PILOTS;
+        case WS_CMD_SCAN:
+            if (length != 8) return false;
+            command->scan.fromMhz = get16(data + 1);
+            command->scan.toMhz = get16(data + 3);
+            command->scan.stepMhz = data[5];
+            command->scan.hold = data[6];
+            command->scan.settleMs = data[7];
+            return true;
+        default:
+            return false;
+    }
+}
+
+WsFrameWriter::WsFrameWriter(uint8_t *buffer, size_t bufferSize) {
+    buf = buffer;
+    size = bufferSize;
+}
+
+// Adds frames for the samples, a new one for every gap or change of pilot.
+// Returns how many samples fit.
+size_t WsFrameWriter::addRssi(const rssi_sample_t *samples, size_t count, uint16_t periodUs) {
+    size_t added = 0;
+    while (added < count) {
+        size_t n = addRssiFrame(samples + added, count - added, periodUs);
+        if (n == 0) break;
+        added += n;
+    }
+    return added;
+}
+
+static void putValue(uint8_t *codes, size_t *nibbles, uint8_t value, uint8_t last) {
+    int16_t delta = value - last;
+    if (delta >= -WS_RSSI_MAX_DELTA && delta <= WS_RSSI_MAX_DELTA) {
+        putNibble(codes, (*nibbles)++, delta & 0xF);
+    } else {
+        putNibble(codes, (*nibbles)++, WS_RSSI_ESCAPE);
+        putNibble(codes, (*nibbles)++, value >> 4);
+        putNibble(codes, (*nibbles)++, value);
+    }
+}
+
+// false when the code runs past the end
+static bool getValue(const uint8_t *codes, size_t end, size_t *nibbles, uint8_t last, uint8_t *value) {
+    if (*nibbles >= end) return false;
+    uint8_t code = getNibble(codes, (*nibbles)++);
+    if (code != WS_RSSI_ESCAPE) {
+        *value = last + (code & 0x8 ? (int8_t)code - 16 : code);
+        return true;
+    }
+    if (*nibbles + 2 > end) return false;
+    *value = getNibble(codes, *nibbles) << 4 | getNibble(codes, *nibbles + 1);
+    *nibbles += 2;
+    return true;
+}
+
+// one frame with as many of the buckets as continue on the grid of the first
+size_t WsFrameWriter::addRssiFrame(const rssi_sample_t *samples, size_t count, uint16_t periodUs) {
+    if (count == 0 || len + WS_RSSI_HEADER_SIZE > size) return 0;
+    uint8_t *frame = buf + len;
+    uint8_t *codes = frame + WS_RSSI_HEADER_SIZE;
+    const size_t room = size - len - WS_RSSI_HEADER_SIZE;
+    const rssi_sample_t &first = samples[0];
+
+    size_t n = 1;
+    size_t nibbles = 0;
+    while (n < count && n < WS_RSSI_FRAME_SAMPLES) {
+        const rssi_sample_t &s = samples[n];
+        int32_t offsetUs = s.timeUs - (first.timeUs + (uint32_t)n * periodUs);
+        if (s.pilot != first.pilot || offsetUs > periodUs / 2 || offsetUs < -(periodUs / 2)) break;
+        if ((nibbles + 9 + 1) / 2 > room) break;  // worst case, all three escaped
+        const rssi_bucket_t &last = samples[n - 1].rssi;
+        putValue(codes, &nibbles, s.rssi.min, last.min);
+        putValue(codes, &nibbles, s.rssi.max, last.max);
+        putValue(codes, &nibbles, s.rssi.mean, last.mean);
+        n++;
+    }
+
+    frame[0] = WS_FRAME_RSSI;
+    frame[1] = first.pilot;
+    frame[2] = n;
+    put16(frame + 3, (nibbles + 1) / 2);
+    put32(frame + 5, first.timeUs);
+    put16(frame + 9, periodUs);
+    frame[11] = first.rssi.min;
+    frame[12] = first.rssi.max;
+    frame[13] = first.rssi.mean;
+    len += WS_RSSI_HEADER_SIZE + (nibbles + 1) / 2;
+    return n;
+}
+
+bool WsFrameWriter::addLap(uint8_t pilot, uint32_t lapTimeUs) {
+    if (len + WS_LAP_FRAME_SIZE > size) return false;
+    buf[len] = WS_FRAME_LAP;
+    buf[len + 1] = pilot;
+    put32(buf + len + 2, lapTimeUs);
+    len += WS_LAP_FRAME_SIZE;
+    return true;
+}
+
+bool WsFrameWriter::addBattery(uint8_t voltage) {
+    if (len + WS_BATTERY_FRAME_SIZE > size) return false;
+    buf[len] = WS_FRAME_BATTERY;
+    buf[len + 1] = voltage;
+    len += WS_BATTERY_FRAME_SIZE;
+    return true;
+}
+
+bool WsFrameWriter::addHistory(uint8_t pilot, const rssi_bucket_t *buckets, size_t count, uint32_t firstUs, uint32_t bucketUs) {
+    if (count > WS_HISTORY_BUCKETS || len + WS_HISTORY_HEADER_SIZE + count * 3 > size) return false;
+    uint8_t *frame = buf + len;
+    frame[0] = WS_FRAME_HISTORY;
+    frame[1] = pilot;
+    put16(frame + 2, count);
+    put32(frame + 4, firstUs);
+    put32(frame + 8, bucketUs);
+    uint8_t *p = frame + WS_HISTORY_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        *p++ = buckets[i].min;
+        *p++ = buckets[i].max;
+        *p++ = buckets[i].mean;
+    }
+    len += WS_HISTORY_HEADER_SIZE + count * 3;
+    return true;
+}
+
+bool WsFrameWriter::addSpectrum(const scanner_spectrum_t &spectrum) {
+    if (len + WS_SPECTRUM_HEADER_SIZE + spectrum.bins * 2 > size) return false;
+    uint8_t *frame = buf + len;
+    frame[0] = WS_FRAME_SPECTRUM;
+    frame[1] = spectrum.hold;
+    put16(frame + 2, spectrum.fromMhz);
+    frame[4] = spectrum.stepMhz;
+    put16(frame + 5, spectrum.bins);
+    put32(frame + 7, spectrum.sweepTimeUs);
+    put32(frame + 11, spectrum.sweeps);
+    uint8_t *p = frame + WS_SPECTRUM_HEADER_SIZE;
+    for (uint16_t i = 0; i < spectrum.bins; i++) {
+        *p++ = spectrum.peak[i];
+        *p++ = spectrum.mean[i];
+    }
+    len += WS_SPECTRUM_HEADER_SIZE + spectrum.bins * 2;
+    return true;
+}
+
+size_t WsFrameWriter::length() {
+    return len;
+}
+
+void WsFrameWriter::clear() {
+    len = 0;
+}
+
+WsFrameReader::WsFrameReader(const uint8_t *data, size_t length) {
+    buf = data;
+    size = length;
+}
+
+bool WsFrameReader::next(ws_frame_t *frame) {
+    if (malformed || pos >= size) return false;
+    const uint8_t *p = buf + pos;
+    const size_t left = size - pos;
+    frame->type = p[0];
+
+    switch (p[0]) {
+        case WS_FRAME_RSSI: {
+            if (left < WS_RSSI_HEADER_SIZE) break;
+            const size_t codeBytes = get16(p + 3);
+            if (left < WS_RSSI_HEADER_SIZE + codeBytes || p[2] == 0) break;
+            const uint8_t *codes = p + WS_RSSI_HEADER_SIZE;
+            frame->pilot = p[1];
+            frame->count = p[2];
+            frame->timeUs = get32(p + 5);
+            frame->periodUs = get16(p + 9);
+            frame->rssi[0].min = p[11];
+            frame->rssi[0].max = p[12];
+            frame->rssi[0].mean = p[13];
+            size_t n = 0;
+            for (uint16_t i = 1; i < frame->count; i++) {
+                const rssi_bucket_t &last = frame->rssi[i - 1];
+                rssi_bucket_t &b = frame->rssi[i];
+                if (!getValue(codes, codeBytes * 2, &n, last.min, &b.min) || !getValue(codes, codeBytes * 2, &n, last.max, &b.max) ||
+                    !getValue(codes, codeBytes * 2, &n, last.mean, &b.mean)) {
+                    malformed = true;
+                    return false;
+                }
+            }
+            pos += WS_RSSI_HEADER_SIZE + codeBytes;
+            return true;
+        }
+        case WS_FRAME_LAP:
+            if (left < WS_LAP_FRAME_SIZE) break;
+            frame->pilot = p[1];
+            frame->timeUs = get32(p + 2);
+            pos += WS_LAP_FRAME_SIZE;
+            return true;
+        case WS_FRAME_BATTERY:
+            if (left < WS_BATTERY_FRAME_SIZE) break;
+            frame->voltage = p[1];
+            pos += WS_BATTERY_FRAME_SIZE;
+            return true;
+        case WS_FRAME_HISTORY: {
+            if (left < WS_HISTORY_HEADER_SIZE) break;
+            frame->pilot = p[1];
+            frame->count = get16(p + 2);
+            frame->timeUs = get32(p + 4);
+            frame->periodUs = get32(p + 8);
+            if (frame->count > WS_HISTORY_BUCKETS || left < WS_HISTORY_HEADER_SIZE + frame->count * 3U) break;
+            const uint8_t *b = p + WS_HISTORY_HEADER_SIZE;
+            for (uint16_t i = 0; i < frame->count; i++, b += 3) {
+                frame->rssi[i].min = b[0];
+                frame->rssi[i].max = b[1];
+                frame->rssi[i].mean = b[2];
+            }
+            pos += WS_HISTORY_HEADER_SIZE + frame->count * 3;
+            return true;
+        }
+        case WS_FRAME_SPECTRUM: {
+            if (left < WS_SPECTRUM_HEADER_SIZE) break;
+            frame->hold = p[1];
+            frame->fromMhz = get16(p + 2);
+            frame->stepMhz = p[4];
+            frame->count = get16(p + 5);
+            frame->periodUs = get32(p + 7);
+            frame->sweeps = get32(p + 11);
+            if (frame->count > SCANNER_MAX_BINS || left < WS_SPECTRUM_HEADER_SIZE + frame->count * 2U) break;
+            const uint8_t *b = p + WS_SPECTRUM_HEADER_SIZE;
+            for (uint16_t i = 0; i < frame->count; i++, b += 2) {
+                frame->rssi[i].max = b[0];
+                frame->rssi[i].min = b[1];
+                frame->rssi[i].mean = b[1];
+            }
+            pos += WS_SPECTRUM_HEADER_SIZE + frame->count * 2;
+            return true;
+        }
+        default:
+            break;
+    }
+    malformed = true;
+    return false;
+}
+
+bool WsFrameReader::isMalformed() {
+    return malformed;
+}
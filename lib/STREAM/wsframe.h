@@ -0,0 +1,132 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rssihistory.h"
+#include "rssistream.h"
+#include "scanner.h"
+
+#pragma once
+
+/*
+ * Binary frames of the /ws WebSocket. A message is one or more frames back
+ * to back, all little endian, each starting with its type:
+ *
+ *   RSSI     u8 type, u8 pilot, u8 count, u16 code bytes, u32 start of the
+ *            first bucket in us, u16 period in us, u8 min, u8 max, u8 mean
+ *            of the first bucket, codes
+ *   LAP      u8 type, u8 pilot, u32 lap time in us
+ *   BATTERY  u8 type, u8 voltage in 0.1V
+ *   HISTORY  u8 type, u8 pilot, u16 count, u32 start of the first bucket in
+ *            us, u32 bucket width in us, count times u8 min, u8 max, u8 mean
+ *   SPECTRUM u8 type, u8 hold, u16 first MHz, u8 step MHz, u16 count, u32
+ *            time of the last full sweep in us, u32 sweeps, count times u8
+ *            peak, u8 mean
+ *
+ * Bucket n of an RSSI frame starts at time + n * period. After the first one
+ * min, max and mean of each bucket are 4 bit codes, high nibble first: the
+ * signed difference to the same value of the previous bucket (-7..7), or 0x8
+ * followed by two more nibbles with the value itself, 12 bits in all.
+ * Filtered RSSI mostly moves by a few counts between buckets, so a bucket
+ * costs about one and a half bytes. History buckets are not coded, an empty
+ * one (min > max) had no samples.
+ *
+ * Commands from the client are single frames:
+ *
+ *   START, STOP  u8 command
+ *   RSSI         u8 command, u16 stream rate in Hz, 0 unsubscribes
+ *   HISTORY      u8 command, u8 pilot, u16 span in ms, u16 buckets
+ *   SCAN         u8 command, u16 first MHz, u16 last MHz, u8 step MHz, u8
+ *                hold, u8 settle ms; a first MHz of 0 stops the scan
+ */
+
+#define WS_RSSI_HEADER_SIZE 14
+#define WS_RSSI_FRAME_SAMPLES 255
+#define WS_LAP_FRAME_SIZE 6
+#define WS_BATTERY_FRAME_SIZE 2
+#define WS_HISTORY_HEADER_SIZE 12
+#define WS_HISTORY_BUCKETS 1000
+#define WS_SPECTRUM_HEADER_SIZE 15
+#define WS_SPECTRUM_FRAME_SIZE (WS_SPECTRUM_HEADER_SIZE + SCANNER_MAX_BINS * 2)
+
+#define WS_RSSI_ESCAPE 0x8
+#define WS_RSSI_MAX_DELTA 7
+
+#define WS_RSSI_DEFAULT_HZ 100
+#define WS_BATCH_MS 100        // RSSI goes out in one message per batch, laps right away
+#define WS_BATCH_SAMPLES 128   // per message, more waiting are sent in another one
+#define WS_BATTERY_MS 2000
+#define WS_BUFFER_SIZE (WS_BATCH_SAMPLES * WS_RSSI_HEADER_SIZE)  // a batch of single bucket frames
+
+typedef enum {
+    WS_FRAME_RSSI = 1,
+    WS_FRAME_LAP = 2,
+    WS_FRAME_BATTERY = 3,
+    WS_FRAME_HISTORY = 4,
+    WS_FRAME_SPECTRUM = 5
+} ws_frame_e;
+
+typedef enum {
+    WS_CMD_START = 1,
+    WS_CMD_STOP = 2,
+    WS_CMD_RSSI = 3,
+    WS_CMD_HISTORY = 4,
+    WS_CMD_SCAN = 5
+} ws_command_e;
+
+typedef struct {
+    uint8_t type;
+    uint8_t pilot;
+    uint16_t count;
+    uint32_t periodUs;  // RSSI period, history bucket width or sweep time
+    uint32_t timeUs;    // first bucket or lap time
+    rssi_bucket_t rssi[WS_HISTORY_BUCKETS];  // a spectrum has the peak in max, the mean in min and mean
+    uint8_t voltage;
+    uint16_t fromMhz;
+    uint8_t stepMhz;
+    uint8_t hold;
+    uint32_t sweeps;
+} ws_frame_t;
+
+typedef struct {
+    uint8_t command;
+    uint8_t pilot;
+    uint16_t rateHz;
+    uint16_t spanMs;
+    uint16_t buckets;
+    scanner_params_t scan;
+} ws_command_t;
+
+bool wsParseCommand(const uint8_t *data, size_t length, ws_command_t *command);
+
+class WsFrameWriter {
+   public:
+    WsFrameWriter(uint8_t *buffer, size_t bufferSize);
+    size_t addRssi(const rssi_sample_t *samples, size_t count, uint16_t periodUs);
+    bool addLap(uint8_t pilot, uint32_t lapTimeUs);
+    bool addBattery(uint8_t voltage);
+    bool addHistory(uint8_t pilot, const rssi_bucket_t *buckets, size_t count, uint32_t firstUs, uint32_t bucketUs);
+    bool addSpectrum(const scanner_spectrum_t &spectrum);
+    size_t length();
+    void clear();
+
+   private:
+    uint8_t *buf;
+    size_t size;
+    size_t len = 0;
+
+    size_t addRssiFrame(const rssi_sample_t *samples, size_t count, uint16_t periodUs);
+};
+
+// the host side counterpart of the decoder in script.js
+class WsFrameReader {
+   public:
+    WsFrameReader(const uint8_t *data, size_t length);
+    bool next(ws_frame_t *frame);
+    bool isMalformed();
+
+   private:
+    const uint8_t *buf;
+    size_t size;
+    size_t pos = 0;
+    bool malformed = false;
+};
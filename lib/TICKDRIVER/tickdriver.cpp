@@ -0,0 +1,70 @@
+#include "tickdriver.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "probe.h"
+
+static void tickThunk(void *arg, uint32_t ticks, uint32_t interruptUs) {
+    ((TickDriver *)arg)->handleTick(ticks, interruptUs);
+}
+
+void TickDriver::init(uint32_t rateHz, tick_work_fn_t work, void *arg) {
+    workFn = work;
+    workArg = arg;
+    memset(&stats, 0, sizeof(stats));
+    stats.periodUs = 1000000 / (rateHz ? rateHz : TICK_RATE_HZ);
+    stats.budgetUs = stats.periodUs * TICK_BUDGET_PERCENT / 100;
+}
+
+bool TickDriver::start() {
+    running = halTickStart(tickThunk, this, stats.periodUs);
+    return running;
+}
+
+bool TickDriver::isRunning() {
+    return running;
+}
+
+void TickDriver::handleTick(uint32_t ticks, uint32_t interruptUs) {
+    uint32_t nowUs = halMicros();
+    if (resetCount != resetsHandled) {
+        resetsHandled = resetCount;
+        stats.ticks = stats.missed = stats.overBudget = stats.lateMaxUs = stats.workMaxUs = 0;
+    }
+    // late from the first interrupt not served yet
+    uint32_t lateUs = nowUs - (interruptUs - (ticks - 1) * stats.periodUs);
+    if ((int32_t)lateUs < 0) lateUs = 0;  // the timer and the clock run off different dividers
+    stats.ticks++;
+    stats.missed += ticks - 1;
+    if (lateUs > stats.lateMaxUs) stats.lateMaxUs = lateUs;
+    probeRecordUs(PROBE_TICK_LATE, lateUs);
+
+    uint32_t startCycles = halCycles();
+    workFn(workArg, halMillis());
+    uint32_t workCycles = halCycles() - startCycles;
+    probeRecord(PROBE_TICK_WORK, workCycles);
+    uint32_t workUs = workCycles / halCyclesPerUs();
+    if (workUs > stats.workMaxUs) stats.workMaxUs = workUs;
+    if (workUs > stats.budgetUs) stats.overBudget++;
+}
+
+void TickDriver::getStats(tick_stats_t *s) {
+    *s = stats;
+}
+
+void TickDriver::resetStats() {
+    resetCount = resetCount + 1;
+}
+
+size_t TickDriver::toJson(char *buf, size_t size) {
+    tick_stats_t s;
+    getStats(&s);
+    int len = snprintf(buf, size,
+                       "{\"running\":%s,\"periodUs\":%lu,\"budgetUs\":%lu,\"ticks\":%lu,\"missed\":%lu,\"overBudget\":%lu,\"lateMaxUs\":%lu,"
+                       "\"workMaxUs\":%lu}",
+                       running ? "true" : "false", (unsigned long)s.periodUs, (unsigned long)s.budgetUs, (unsigned long)s.ticks,
+                       (unsigned long)s.missed, (unsigned long)s.overBudget, (unsigned long)s.lateMaxUs, (unsigned long)s.workMaxUs);
+    return len < 0 ? 0 : (size_t)len < size ? len : size - 1;
+}
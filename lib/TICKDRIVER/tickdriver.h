@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+#ifndef TICK_RATE_HZ
+#define TICK_RATE_HZ 1000  // timing loop runs a second
+#endif
+#define TICK_BUDGET_PERCENT 50  // of the period the timing loop may take, loop() and the idle task get the rest
+#define TICK_JSON_SIZE 160
+
+typedef void (*tick_work_fn_t)(void *arg, uint32_t currentTimeMs);
+
+typedef struct {
+    uint32_t periodUs;
+    uint32_t budgetUs;
+    uint32_t ticks;       // runs of the work
+    uint32_t missed;      // interrupts that came while the work still ran, served by one run
+    uint32_t overBudget;  // runs that took longer than the budget
+    uint32_t lateMaxUs;   // from the interrupt to the run
+    uint32_t workMaxUs;
+} tick_stats_t;
+
+/*
+ * Runs the timing loop at a fixed rate in the tick task (halTickStart), off
+ * loop() and whatever else runs there. Every run is timed against the
+ * interrupt that was due and against the budget; how late and how long go
+ * into the tick.late and tick.work probes in every build, missed interrupts
+ * and runs over budget are counted.
+ *
+ * The work has to keep within the budget by itself, LapTimer does by taking
+ * a bounded number of frames a run (setFrameBudget).
+ *
+ * The stats belong to the tick task; other tasks read them as they are and
+ * ask for a reset, which the next run carries out.
+ */
+class TickDriver {
+   public:
+    void init(uint32_t rateHz, tick_work_fn_t work, void *arg);
+    bool start();  // false when there is no tick task, the work then has to run from loop()
+    bool isRunning();
+    void handleTick(uint32_t ticks, uint32_t interruptUs);  // in the tick task
+    void getStats(tick_stats_t *stats);
+    void resetStats();  // from any task
+    size_t toJson(char *buf, size_t size);
+
+   private:
+    tick_work_fn_t workFn = nullptr;
+    void *workArg = nullptr;
+    bool running = false;
+    tick_stats_t stats;
+    volatile uint32_t resetCount = 0;
+    uint32_t resetsHandled = 0;
+};
@@ -1,19 +1,27 @@
 #include "webserver.h"
+#include <AsyncJson.h>
 #include <ElegantOTA.h>
 
-#include <DNSServer.h>
 #include <ESPmDNS.h>
 #include <LittleFS.h>
 #include <esp_wifi.h>
 
+#include <memory>
+
+#include "assets.h"
+#include "captivedns.h"
 #include "debug.h"
+#include "probe.h"
+#include "scheduler.h"
 
-static const uint8_t DNS_PORT = 53;
 static IPAddress netMsk(255, 255, 255, 0);
-static DNSServer dnsServer;
+static CaptiveDns captiveDns;
 static IPAddress ipAddress;
 static AsyncWebServer server(80);
 static AsyncEventSource events("/events");
+static AsyncWebSocket webSocket("/ws");
+static AssetManifest assets;
+static OtaDelta otaDelta;
 
 static const char *wifi_hostname = "plt";
 static const char *wifi_ap_ssid_prefix = "PhobosLT";
@@ -21,12 +29,13 @@ static const char *wifi_ap_password = "phoboslt";
 static const char *wifi_ap_address = "20.0.0.1";
 String wifi_ap_ssid;
 
-void Webserver::init(Config *config, LapTimer *lapTimer, BatteryMonitor *batMonitor, Buzzer *buzzer, Led *l) {
+void Webserver::init(Config *config, LapTimer *lapTimer, FrequencyHopper *frequencyHopper, BatteryMonitor *batMonitor, Buzzer *buzzer, Led *l) {
 
     ipAddress.fromString(wifi_ap_address);
 
     conf = config;
     timer = lapTimer;
+    hopper = frequencyHopper;
     monitor = batMonitor;
     buz = buzzer;
     led = l;
@@ -56,23 +65,293 @@ void Webserver::sendRssiEvent(uint8_t rssi) {
     events.send(buf, "rssi");
 }
 
-void Webserver::sendLaptimeEvent(uint32_t lapTime) {
+void Webserver::sendLaptimeEvent(uint32_t lapTimeUs) {
     if (!servicesStarted) return;
     char buf[16];
-    snprintf(buf, sizeof(buf), "%u", lapTime);
+    snprintf(buf, sizeof(buf), "%u", lapTimeUs);
     events.send(buf, "lap");
 }
 
-void Webserver::handleWebUpdate(uint32_t currentTimeMs) {
-    if (timer->isLapAvailable()) {
-        sendLaptimeEvent(timer->getLapTime());
+// every pilot's laps, for clients that know about hopping
+void Webserver::sendPilotLaptimeEvent(uint8_t pilot, uint32_t lapTimeUs) {
+    if (!servicesStarted) return;
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%u,%u", pilot + 1, lapTimeUs);
+    events.send(buf, "pilotlap");
+}
+
+void Webserver::handleWsEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    switch (type) {
+        case WS_EVT_CONNECT:
+            DEBUG("WebSocket client %u connected\n", client->id());
+            wsBatteryMs = 0;  // battery state goes out with the next update
+            led->on(200);
+            break;
+        case WS_EVT_DISCONNECT:
+            setRssiSubscription(client->id(), 0);
+            break;
+        case WS_EVT_DATA: {
+            // commands are a few bytes, anything not in a single binary frame is ignored
+            AwsFrameInfo *info = (AwsFrameInfo *)arg;
+            ws_command_t command;
+            if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_BINARY) break;
+            if (!wsParseCommand(data, len, &command)) {
+                DEBUG("Unknown WebSocket command\n");
+                break;
+            }
+            switch (command.command) {
+                case WS_CMD_START:
+                    startRace();
+                    break;
+                case WS_CMD_STOP:
+                    stopRace();
+                    break;
+                case WS_CMD_RSSI:
+                    setRssiSubscription(client->id(), command.rateHz);
+                    break;
+                case WS_CMD_HISTORY:
+                    sendWsHistory(client, command);
+                    break;
+                case WS_CMD_SCAN:
+                    if (!scanner) break;
+                    if (command.scan.fromMhz) {
+                        scanner->start(command.scan);
+                    } else {
+                        scanner->stop();
+                    }
+                    break;
+                default:
+                    break;
+            }
+            led->on(200);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// the stream is shared, the last subscription sets its rate, it stops with the last client
+void Webserver::setRssiSubscription(uint32_t clientId, uint16_t rateHz) {
+    RssiStream *stream = timer->getRssiStream();
+    if (!stream) return;
+    uint8_t subscribed = 0;
+    bool found = false;
+    for (uint8_t i = 0; i < WEB_WS_CLIENTS; i++) {
+        if (rssiClients[i] == clientId) {
+            rssiClients[i] = rateHz ? clientId : 0;
+            found = true;
+        }
+    }
+    for (uint8_t i = 0; i < WEB_WS_CLIENTS; i++) {
+        if (rateHz && !found && rssiClients[i] == 0) {
+            rssiClients[i] = clientId;
+            found = true;
+        }
+        if (rssiClients[i]) subscribed++;
+    }
+    if (rateHz && found) {
+        stream->setRateHz(rateHz);
+    } else if (subscribed == 0) {
+        stream->setRateHz(0);
+    }
+}
+
+void Webserver::sendWsRssi() {
+    static rssi_sample_t samples[WS_BATCH_SAMPLES];
+    static uint8_t buf[WS_BUFFER_SIZE];
+    RssiStream *stream = timer->getRssiStream();
+    if (!stream) return;
+    size_t count;
+    do {
+        count = stream->pop(samples, WS_BATCH_SAMPLES);
+        if (count == 0) break;
+        WsFrameWriter writer(buf, sizeof(buf));
+        writer.addRssi(samples, count, stream->getPeriodUs());
+        for (uint8_t i = 0; i < WEB_WS_CLIENTS; i++) {
+            uint32_t id = rssiClients[i];
+            if (id) webSocket.binary(id, buf, writer.length());
+        }
+    } while (count == WS_BATCH_SAMPLES);
+}
+
+// answered right away from the async_tcp task, the buffers are only used there
+void Webserver::sendWsHistory(AsyncWebSocketClient *client, const ws_command_t &command) {
+    static rssi_bucket_t buckets[WS_HISTORY_BUCKETS];
+    static uint8_t buf[WS_HISTORY_HEADER_SIZE + sizeof(buckets)];
+    RssiHistory *history = timer->getRssiHistory();
+    if (!history) return;
+    if (command.pilot != history->getPilot()) {
+        history->setPilot(command.pilot);  // starts over, this answer is empty
     }
+    uint32_t firstUs, bucketUs;
+    size_t count = command.buckets < WS_HISTORY_BUCKETS ? command.buckets : WS_HISTORY_BUCKETS;
+    count = history->query((uint32_t)command.spanMs * 1000, count, buckets, &firstUs, &bucketUs);
+    WsFrameWriter writer(buf, sizeof(buf));
+    writer.addHistory(command.pilot, buckets, count, firstUs, bucketUs);
+    client->binary(buf, writer.length());
+}
+
+void Webserver::sendWsLap(uint8_t pilot, uint32_t lapTimeUs) {
+    if (!servicesStarted) return;
+    uint8_t buf[WS_LAP_FRAME_SIZE];
+    WsFrameWriter writer(buf, sizeof(buf));
+    writer.addLap(pilot, lapTimeUs);
+    webSocket.binaryAll(buf, writer.length());
+}
+
+void Webserver::sendWsBattery() {
+    uint8_t buf[WS_BATTERY_FRAME_SIZE];
+    WsFrameWriter writer(buf, sizeof(buf));
+    writer.addBattery(monitor->getBatteryVoltage());
+    webSocket.binaryAll(buf, writer.length());
+}
+
+// every full sweep, to all clients
+void Webserver::sendWsSpectrum() {
+    static scanner_spectrum_t spectrum;
+    static uint8_t buf[WS_SPECTRUM_FRAME_SIZE];
+    if (!scanner || !scanner->isRunning() || scanner->getSweeps() == spectrumSweeps) return;
+    scanner->getSpectrum(&spectrum);
+    spectrumSweeps = spectrum.sweeps;
+    WsFrameWriter writer(buf, sizeof(buf));
+    writer.addSpectrum(spectrum);
+    webSocket.binaryAll(buf, writer.length());
+}
+
+static size_t getSizeParam(AsyncWebServerRequest *request, const char *name, size_t fallback) {
+    if (!request->hasParam(name)) return fallback;
+    long value = request->getParam(name)->value().toInt();
+    return value > 0 ? value : 0;
+}
+
+// /api/sessions and /api/sessions/<id>/laps, both paged with ?offset=&limit=
+void Webserver::handleSessionsRequest(AsyncWebServerRequest *request) {
+    SessionLog *log = sessions;
+    if (!log || !log->isReady()) {
+        request->send(503, "application/json", "{\"status\": \"no session log\"}");
+        return;
+    }
+    size_t offset = getSizeParam(request, "offset", 0);
+    size_t limit = getSizeParam(request, "limit", SESSIONJSON_DEFAULT_LIMIT);
+
+    std::shared_ptr<ChunkedJson> json;
+    const String &url = request->url();
+    if (url == "/api/sessions" || url == "/api/sessions/") {
+        json = std::make_shared<SessionListJson>(log, offset, limit);
+    } else {
+        char *end;
+        unsigned long id = strtoul(url.c_str() + strlen("/api/sessions/"), &end, 10);
+        std::shared_ptr<SessionLapsJson> laps = std::make_shared<SessionLapsJson>();
+        if (id == 0 || strcmp(end, "/laps") != 0 || !laps->open(id, offset, limit)) {
+            request->send(404, "application/json", "{\"status\": \"no such session\"}");
+            return;
+        }
+        json = laps;
+    }
+    request->send(request->beginChunkedResponse("application/json", [json](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        return json->read(buffer, maxLen);
+    }));
+    led->on(200);
+}
+
+// per pilot, the proposal once done and the floor followed since
+void Webserver::sendCalibration(AsyncWebServerRequest *request) {
+    static const char *states[] = {"idle", "floor", "passes", "done"};
+    char buf[192 * LAPTIMER_MAX_PILOTS + 8];
+    size_t len = snprintf(buf, sizeof(buf), "[");
+    for (uint8_t i = 0; i < timer->getPilotCount(); i++) {
+        calibration_t c;
+        timer->getCalibration(i, &c);
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        "%s{\"pilot\":%u,\"state\":\"%s\",\"floor\":%u,\"noise\":%u,\"passes\":%u,\"peakMin\":%u,\"peakMax\":%u,"
+                        "\"enterRssi\":%u,\"exitRssi\":%u,\"trackedFloor\":%u,\"drift\":%d}",
+                        i ? "," : "", i + 1, states[c.state], c.floorRssi, c.noise, c.passes, c.peakMin, c.peakMax, c.enterRssi, c.exitRssi,
+                        timer->getTrackedFloor(i), timer->getFloorDrift(i));
+    }
+    snprintf(buf + len, sizeof(buf) - len, "]");
+    request->send(200, "application/json", buf);
+}
+
+void Webserver::handleLapEvent(const lap_event_t &event) {
+    if (event.type != LAP_EVENT_LAP) return;
+    if (event.pilot == 0) sendLaptimeEvent(event.lapTimeUs);  // the app times pilot 1
+    sendPilotLaptimeEvent(event.pilot, event.lapTimeUs);
+    sendWsLap(event.pilot, event.lapTimeUs);
+}
+
+void Webserver::setSessionLog(SessionLog *sessionLog) {
+    sessions = sessionLog;
+}
+
+void Webserver::setScanner(SpectrumScanner *spectrumScanner) {
+    scanner = spectrumScanner;
+}
+
+void Webserver::setNodeSync(NodeSync *sync) {
+    nodeSync = sync;
+}
+
+void Webserver::setRhNode(RhNode *node) {
+    rhNode = node;
+}
+
+void Webserver::setTickDriver(TickDriver *driver) {
+    tickDriver = driver;
+}
+
+// in the web server task, the body in the pieces TCP hands over
+void Webserver::handleOtaDelta(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        DEBUG("Delta update of %u bytes\n", (unsigned)total);
+        led->blink(100);
+        if (!otaDelta.begin()) return;
+    }
+    if (!otaDelta.write(data, len)) return;
+    if (index + len == total) otaDelta.end();
+}
+
+// on all nodes when they are synced, the node sync starts the timer here
+void Webserver::startRace() {
+    if (nodeSync) {
+        nodeSync->start();
+    } else {
+        timer->start();
+    }
+}
+
+void Webserver::stopRace() {
+    if (nodeSync) {
+        nodeSync->stop();
+    } else {
+        timer->stop();
+    }
+}
+
+// ms until periodMs have passed since sinceMs, 1 when they have
+static uint32_t msUntil(uint32_t currentTimeMs, uint32_t sinceMs, uint32_t periodMs) {
+    uint32_t elapsedMs = currentTimeMs - sinceMs;
+    return elapsedMs < periodMs ? periodMs - elapsedMs : 1;
+}
 
+uint32_t Webserver::handleWebUpdate(uint32_t currentTimeMs) {
     if (sendRssi && ((currentTimeMs - rssiSentMs) > WEB_RSSI_SEND_TIMEOUT_MS)) {
         sendRssiEvent(timer->getRssi());
         rssiSentMs = currentTimeMs;
     }
 
+    if (servicesStarted && (currentTimeMs - wsBatchMs) >= WS_BATCH_MS) {
+        sendWsRssi();
+        sendWsSpectrum();
+        wsBatchMs = currentTimeMs;
+    }
+
+    if (servicesStarted && (currentTimeMs - wsBatteryMs) >= WS_BATTERY_MS) {
+        sendWsBattery();
+        webSocket.cleanupClients();
+        wsBatteryMs = currentTimeMs;
+    }
+
     wl_status_t status = WiFi.status();
 
     if (status != lastStatus && wifiMode == WIFI_STA) {
@@ -141,47 +420,87 @@ void Webserver::handleWebUpdate(uint32_t currentTimeMs) {
         changeMode = WIFI_OFF;
     }
 
+    // the running image for GET /ota/delta, hashed here rather than in the web server's task
+    bool imageHashed = otaDelta.hashImage();
+
+    if (rebootRequested && !rebooting) {
+        rebooting = true;
+        rebootTimeMs = currentTimeMs;
+    }
+    if (rebooting && currentTimeMs - rebootTimeMs >= WEB_OTA_REBOOT_DELAY_MS) {
+        DEBUG("Rebooting into the delta update\n");
+        ESP.restart();
+    }
+
+    // WiFi status changes are polled, at the longest scheduler wait
+    uint32_t dueMs = SCHEDULER_IDLE;
+    if (sendRssi) dueMs = min(dueMs, msUntil(currentTimeMs, rssiSentMs, WEB_RSSI_SEND_TIMEOUT_MS + 1));
     if (servicesStarted) {
-        dnsServer.processNextRequest();
+        dueMs = min(dueMs, msUntil(currentTimeMs, wsBatchMs, WS_BATCH_MS));
+        dueMs = min(dueMs, msUntil(currentTimeMs, wsBatteryMs, WS_BATTERY_MS));
     }
+    if (status != WL_CONNECTED && wifiMode == WIFI_STA) dueMs = min(dueMs, msUntil(currentTimeMs, changeTimeMs, WIFI_CONNECTION_TIMEOUT_MS + 1));
+    if (changeMode != wifiMode && changeMode != WIFI_OFF) dueMs = min(dueMs, msUntil(currentTimeMs, changeTimeMs, WIFI_RECONNECT_TIMEOUT_MS + 1));
+    if (rebooting) dueMs = min(dueMs, msUntil(currentTimeMs, rebootTimeMs, WEB_OTA_REBOOT_DELAY_MS));
+    if (!imageHashed) dueMs = min(dueMs, (uint32_t)1);  // a chunk a pass, the idle task and WiFi get a tick between
+    return dueMs;
 }
 
 /** Is this an IP? */
-static boolean isIp(String str) {
-    for (size_t i = 0; i < str.length(); i++) {
-        int c = str.charAt(i);
-        if (c != '.' && (c < '0' || c > '9')) {
+static bool isIp(const char *str) {
+    for (; *str; str++) {
+        if (*str != '.' && (*str < '0' || *str > '9')) {
             return false;
         }
     }
     return true;
 }
 
-/** IP to String? */
-static String toStringIp(IPAddress ip) {
-    String res = "";
-    for (int i = 0; i < 3; i++) {
-        res += String((ip >> (8 * i)) & 0xFF) + ".";
-    }
-    res += String(((ip >> 8 * 3)) & 0xFF);
-    return res;
-}
-
 static bool captivePortal(AsyncWebServerRequest *request) {
     extern const char *wifi_hostname;
 
-    if (!isIp(request->host()) && request->host() != (String(wifi_hostname) + ".local")) {
+    char local[40];
+    const char *host = request->host().c_str();
+    snprintf(local, sizeof(local), "%s.local", wifi_hostname);
+    if (!isIp(host) && strcmp(host, local)) {
         DEBUG("Request redirected to captive portal\n");
-        request->redirect(String("http://") + toStringIp(request->client()->localIP()));
+        IPAddress ip = request->client()->localIP();
+        char url[24];
+        snprintf(url, sizeof(url), "http://%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        request->redirect(url);
         return true;
     }
     return false;
 }
 
+// the gzipped file as it is, or a 304 when the client has it already
+static bool sendAsset(AsyncWebServerRequest *request, const char *url) {
+    asset_response_t asset;
+    const AsyncWebHeader *header = request->getHeader("If-None-Match");
+    const char *ifNoneMatch = header ? header->value().c_str() : NULL;
+    AsyncWebServerResponse *response;
+    switch (assets.resolve(url, ifNoneMatch, &asset)) {
+        case ASSET_SEND:
+            response = request->beginResponse(LittleFS, asset.asset->file, asset.asset->type);
+            response->addHeader("Content-Encoding", "gzip");
+            break;
+        case ASSET_NOT_MODIFIED:
+            response = request->beginResponse(304);
+            break;
+        default:
+            return false;
+    }
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Cache-Control", asset.cacheControl);
+    request->send(response);
+    return true;
+}
+
 static void handleRoot(AsyncWebServerRequest *request) {
     if (captivePortal(request)) {  // If captive portal redirect instead of displaying the page.
         return;
     }
+    if (sendAsset(request, ASSETS_ENTRY)) return;
     request->send(LittleFS, "/index.html", "text/html");
 }
 
@@ -189,22 +508,34 @@ static void handleNotFound(AsyncWebServerRequest *request) {
     if (captivePortal(request)) {  // If captive portal redirect instead of displaying the error page.
         return;
     }
-    String message = F("File Not Found\n\n");
-    message += F("URI: ");
-    message += request->url();
-    message += F("\nMethod: ");
-    message += (request->method() == HTTP_GET) ? "GET" : "POST";
-    message += F("\nArguments: ");
-    message += request->args();
-    message += F("\n");
-
-    for (uint8_t i = 0; i < request->args(); i++) {
-        message += String(F(" ")) + request->argName(i) + F(": ") + request->arg(i) + F("\n");
-    }
-    AsyncWebServerResponse *response = request->beginResponse(404, "text/plain", message);
+    if (request->method() == HTTP_GET && sendAsset(request, request->url().c_str())) return;
+    AsyncResponseStream *response = request->beginResponseStream("text/plain");
+    response->setCode(404);
     response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
     response->addHeader("Pragma", "no-cache");
     response->addHeader("Expires", "-1");
+    response->print("File Not Found\n\nURI: ");
+    response->print(request->url().c_str());
+    response->printf("\nMethod: %s\nArguments: %u\n", request->method() == HTTP_GET ? "GET" : "POST", (unsigned)request->args());
+    for (uint8_t i = 0; i < request->args(); i++) {
+        response->print(" ");
+        response->print(request->argName(i).c_str());
+        response->print(": ");
+        response->print(request->arg(i).c_str());
+        response->print("\n");
+    }
+    request->send(response);
+}
+
+static void printToStream(void *arg, const char *text) {
+    ((AsyncResponseStream *)arg)->print(text);
+}
+
+static void handleMetrics(AsyncWebServerRequest *request) {
+    bool json = request->hasParam("format") && request->getParam("format")->value() == "json";
+    AsyncResponseStream *response = request->beginResponseStream(json ? "application/json" : "text/plain");
+    response->addHeader("Cache-Control", "no-cache");
+    probeReport(json, printToStream, response);
     request->send(response);
 }
 
@@ -230,6 +561,7 @@ static void startMDNS() {
 }
 
 void Webserver::startServices() {
+    if (nodeSync) nodeSync->begin();  // the socket goes with the network
     if (servicesStarted) {
         MDNS.end();
         startMDNS();
@@ -237,6 +569,7 @@ void Webserver::startServices() {
     }
 
     startLittleFS();
+    if (rhNode) rhNodeBeginTcp(rhNode);
 
     server.on("/", handleRoot);
     server.on("/generate_204", handleRoot);  // handle Andriod phones doing shit to detect if there is 'real' internet and possibly dropping conn.
@@ -249,10 +582,14 @@ void Webserver::startServices() {
     server.on("/fwlink", handleRoot);
 
     server.on("/status", [this](AsyncWebServerRequest *request) {
-        char buf[1024];
-        char configBuf[256];
-        conf->toJsonString(configBuf);
+        char buf[640];
+        char pilotsBuf[256];
+        hopper->toStatusString(pilotsBuf, sizeof(pilotsBuf), timer->getSampleRateHz());
         float voltage = (float)monitor->getBatteryVoltage() / 10;
+        IPAddress ip = WiFi.localIP();
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
         const char *format =
             "\
 Heap:\n\
@@ -269,27 +606,75 @@ Chip:\n\
 \tFlashSpeed:\t%iMHz\n\
 \tCPU Speed:\t%iMHz\n\
 Network:\n\
-\tIP:\t%s\n\
-\tMAC:\t%s\n\
-EEPROM:\n\
-%s\n\
-Battery Voltage:\t%0.1fv";
+\tIP:\t%u.%u.%u.%u\n\
+\tMAC:\t%02X:%02X:%02X:%02X:%02X:%02X\n\
+EEPROM:\n";
 
+        // the config goes into the response as it is written, between the two halves
         snprintf(buf, sizeof(buf), format,
                  ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getHeapSize(), ESP.getMaxAllocHeap(), LittleFS.usedBytes(), LittleFS.totalBytes(),
                  ESP.getChipModel(), ESP.getChipRevision(), ESP.getChipCores(), ESP.getSdkVersion(), ESP.getFlashChipSize(), ESP.getFlashChipSpeed() / 1000000, getCpuFrequencyMhz(),
-                 WiFi.localIP().toString().c_str(), WiFi.macAddress().c_str(), configBuf, voltage);
-        request->send(200, "text/plain", buf);
+                 ip[0], ip[1], ip[2], ip[3], mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        response->print(buf);
+        conf->toJson(true, printToStream, response);
+        snprintf(buf, sizeof(buf), "\nPilots:\n%sLap events dropped:\t%u\nBattery Voltage:\t%0.1fv", pilotsBuf, timer->getDroppedLapEvents(), voltage);
+        response->print(buf);
+        request->send(response);
         led->on(200);
     });
 
+    server.on("/metrics", HTTP_GET, handleMetrics);
+
+    server.on("/metrics/reset", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        probeReset();
+        if (tickDriver) tickDriver->resetStats();
+        request->send(200, "application/json", "{\"status\": \"OK\"}");
+    });
+
+    server.on("/tick", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!tickDriver) {
+            request->send(404, "application/json", "{\"status\": \"no tick driver\"}");
+            return;
+        }
+        char buf[TICK_JSON_SIZE];
+        tickDriver->toJson(buf, sizeof(buf));
+        request->send(200, "application/json", buf);
+    });
+
+    server.on("/dns", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char buf[CAPTIVEDNS_JSON_SIZE];
+        captiveDns.toJson(buf, sizeof(buf));
+        request->send(200, "application/json", buf);
+    });
+
+    server.on("/ota/delta", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char buf[OTA_DELTA_JSON_SIZE];
+        otaDelta.toJson(buf, sizeof(buf));
+        request->send(200, "application/json", buf);
+    });
+
+    // the patch as the raw body, applied as it arrives
+    server.on(
+        "/ota/delta", HTTP_POST,
+        [this](AsyncWebServerRequest *request) {
+            char buf[OTA_DELTA_JSON_SIZE];
+            bool ok = otaDelta.getState() == OTA_DELTA_DONE;
+            otaDelta.toJson(buf, sizeof(buf));
+            request->send(ok ? 200 : 400, "application/json", buf);
+            if (ok) rebootRequested = true;
+        },
+        NULL,
+        [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            handleOtaDelta(request, data, len, index, total);
+        });
+
     server.on("/timer/start", HTTP_POST, [this](AsyncWebServerRequest *request) {
-        timer->start();
+        startRace();
         request->send(200, "application/json", "{\"status\": \"OK\"}");
     });
 
     server.on("/timer/stop", HTTP_POST, [this](AsyncWebServerRequest *request) {
-        timer->stop();
+        stopRace();
         request->send(200, "application/json", "{\"status\": \"OK\"}");
     });
 
@@ -305,13 +690,66 @@ Battery Voltage:\t%0.1fv";
         led->on(200);
     });
 
+    server.on("/bands", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char buf[BANDS_JSON_SIZE];
+        bandsToJson(buf);
+        request->send(200, "application/json", buf);
+    });
+
+    server.on("/sync", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!nodeSync) {
+            request->send(404, "application/json", "{\"status\": \"no node sync\"}");
+            return;
+        }
+        char buf[NODESYNC_JSON_SIZE];
+        nodeSync->toJson(buf, sizeof(buf));
+        request->send(200, "application/json", buf);
+    });
+
+    server.on("/sync/laps", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!nodeSync) {
+            request->send(404, "application/json", "{\"status\": \"no node sync\"}");
+            return;
+        }
+        std::shared_ptr<ChunkedJson> json = std::make_shared<NodeSyncLapsJson>(nodeSync);
+        request->send(request->beginChunkedResponse("application/json", [json](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return json->read(buffer, maxLen);
+        }));
+    });
+
     server.on("/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
         AsyncResponseStream *response = request->beginResponseStream("application/json");
-        conf->toJson(*response);
+        conf->toJson(false, printToStream, response);
         request->send(response);
         led->on(200);
     });
 
+    server.on("/api/sessions", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        handleSessionsRequest(request);
+    });
+
+    server.on("/calibration", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        sendCalibration(request);
+    });
+
+    server.on("/calibration/start", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (!timer->startCalibration()) {
+            request->send(409, "application/json", "{\"status\": \"race running\"}");
+            return;
+        }
+        request->send(200, "application/json", "{\"status\": \"OK\"}");
+        led->on(200);
+    });
+
+    server.on("/calibration/apply", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (!timer->applyCalibration()) {
+            request->send(409, "application/json", "{\"status\": \"not calibrated\"}");
+            return;
+        }
+        sendCalibration(request);
+        led->on(200);
+    });
+
     AsyncCallbackJsonWebHandler *configJsonHandler = new AsyncCallbackJsonWebHandler("/config", [this](AsyncWebServerRequest *request, JsonVariant &json) {
         JsonObject jsonObj = json.as<JsonObject>();
 #ifdef DEBUG_OUT
@@ -323,7 +761,10 @@ Battery Voltage:\t%0.1fv";
         led->on(200);
     });
 
-    server.serveStatic("/", LittleFS, "/").setCacheControl("max-age=600");
+    // a data partition built without scripts/assets.py has the files as they are
+    if (!assets.load()) {
+        server.serveStatic("/", LittleFS, "/").setCacheControl("max-age=600");
+    }
 
     events.onConnect([this](AsyncEventSourceClient *client) {
         if (client->lastId()) {
@@ -333,6 +774,10 @@ Battery Voltage:\t%0.1fv";
         led->on(200);
     });
 
+    webSocket.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+        handleWsEvent(client, type, arg, data, len);
+    });
+
     DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
     DefaultHeaders::Instance().addHeader("Access-Control-Max-Age", "600");
     DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "POST,GET,OPTIONS");
@@ -341,6 +786,7 @@ Battery Voltage:\t%0.1fv";
     server.onNotFound(handleNotFound);
 
     server.addHandler(&events);
+    server.addHandler(&webSocket);
     server.addHandler(configJsonHandler);
 
     ElegantOTA.setAutoReboot(true);
@@ -348,8 +794,8 @@ Battery Voltage:\t%0.1fv";
 
     server.begin();
 
-    dnsServer.start(DNS_PORT, "*", ipAddress);
-    dnsServer.setErrorReplyCode(DNSReplyCode::NoError);
+    captiveDns.init((uint32_t)ipAddress[0] << 24 | ipAddress[1] << 16 | ipAddress[2] << 8 | ipAddress[3]);
+    captiveDnsBegin(&captiveDns);
 
     startMDNS();
 
@@ -1,35 +1,77 @@
 #include <ESPAsyncWebServer.h>
 
 #include "battery.h"
+#include "hopper.h"
 #include "laptimer.h"
+#include "nodesync.h"
+#include "otadelta.h"
+#include "rhnode.h"
+#include "sessionjson.h"
+#include "tickdriver.h"
+#include "wsframe.h"
 
 #define WIFI_CONNECTION_TIMEOUT_MS 30000
 #define WIFI_RECONNECT_TIMEOUT_MS 500
 #define WEB_RSSI_SEND_TIMEOUT_MS 200
+#define WEB_WS_CLIENTS 4  // clients getting RSSI on /ws
+#define WEB_OTA_REBOOT_DELAY_MS 1000  // after a delta update, for the response to get out
 
 class Webserver {
    public:
-    void init(Config *config, LapTimer *lapTimer, BatteryMonitor *batMonitor, Buzzer *buzzer, Led *l);
-    void handleWebUpdate(uint32_t currentTimeMs);
+    void init(Config *config, LapTimer *lapTimer, FrequencyHopper *frequencyHopper, BatteryMonitor *batMonitor, Buzzer *buzzer, Led *l);
+    uint32_t handleWebUpdate(uint32_t currentTimeMs);  // ms until the next send or WiFi timeout
+    void handleLapEvent(const lap_event_t &event);
+    void setSessionLog(SessionLog *sessionLog);
+    void setScanner(SpectrumScanner *spectrumScanner);
+    void setNodeSync(NodeSync *sync);  // races are then started and stopped through it
+    void setRhNode(RhNode *node);  // served over TCP once the network is up
+    void setTickDriver(TickDriver *driver);  // its stats on /tick, reset with the probes
 
    private:
     void startServices();
     void sendRssiEvent(uint8_t rssi);
-    void sendLaptimeEvent(uint32_t lapTime);
+    void sendLaptimeEvent(uint32_t lapTimeUs);
+    void sendPilotLaptimeEvent(uint8_t pilot, uint32_t lapTimeUs);
+    void handleWsEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
+    void setRssiSubscription(uint32_t clientId, uint16_t rateHz);
+    void sendWsRssi();
+    void sendWsHistory(AsyncWebSocketClient *client, const ws_command_t &command);
+    void sendWsLap(uint8_t pilot, uint32_t lapTimeUs);
+    void sendWsBattery();
+    void sendWsSpectrum();
+    void handleSessionsRequest(AsyncWebServerRequest *request);
+    void sendCalibration(AsyncWebServerRequest *request);
+    void handleOtaDelta(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    void startRace();
+    void stopRace();
 
     Config *conf;
     LapTimer *timer;
+    FrequencyHopper *hopper;
     BatteryMonitor *monitor;
     Buzzer *buz;
     Led *led;
+    SessionLog *sessions = nullptr;
+    SpectrumScanner *scanner = nullptr;
+    NodeSync *nodeSync = nullptr;
+    RhNode *rhNode = nullptr;
+    TickDriver *tickDriver = nullptr;
 
     wifi_mode_t wifiMode = WIFI_OFF;
     wl_status_t lastStatus = WL_IDLE_STATUS;
     volatile wifi_mode_t changeMode = WIFI_OFF;
     volatile uint32_t changeTimeMs = 0;
+    volatile bool rebootRequested = false;  // set by the web server task once an update is in the slot
+    bool rebooting = false;
+    uint32_t rebootTimeMs = 0;
     bool servicesStarted = false;
     bool wifiConnected = false;
 
     bool sendRssi = false;
     uint32_t rssiSentMs = 0;
+
+    volatile uint32_t rssiClients[WEB_WS_CLIENTS] = {};  // WebSocket client ids, 0 is a free slot
+    uint32_t wsBatchMs = 0;
+    volatile uint32_t wsBatteryMs = 0;
+    uint32_t spectrumSweeps = 0;  // sent to the clients
 };
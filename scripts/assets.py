@@ -0,0 +1,132 @@
+"""
+Builds the web UI for the data partition: minifies the files in data/,
+gzips them, puts the CRC32 of the content into their names and writes the
+manifest the Webserver serves them by (lib/ASSETS). The output goes to the
+PlatformIO data_dir, which buildfs/uploadfs pack. Runs before every
+PlatformIO build, or alone:
+
+    python3 scripts/assets.py [source dir] [output dir]
+"""
+
+import gzip
+import os
+import re
+import sys
+import zlib
+
+ENTRY = "index.html"  # what the browser asks for first, keeps its name
+MANIFEST = "assets.txt"
+TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+}
+
+
+def minify_js(text):
+    """Line based and conservative: drops indentation, blank lines and
+    comments on lines of their own, keeps license blocks. Gives up on the
+    rest of a file at a template literal spanning lines."""
+    out = []
+    lines = text.splitlines()
+    i = 0
+    while i < len(lines):
+        line = lines[i].strip()
+        if line.count("`") % 2:
+            out.extend(lines[i:])
+            break
+        if line.startswith("/*"):
+            end = i
+            while end < len(lines) and "*/" not in lines[end]:
+                end += 1
+            if end < len(lines) and lines[end].rstrip().endswith("*/") and lines[end].count("*/") == 1:
+                block = lines[i : end + 1]
+                if "@license" in "\n".join(block):
+                    out.extend(block)
+                i = end + 1
+                continue
+        if line and not line.startswith("//"):
+            out.append(line)
+        i += 1
+    return "\n".join(out) + "\n"
+
+
+def minify_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"\s+", " ", text)
+    text = re.sub(r"\s*([{};,>])\s*", r"\1", text)
+    return text.replace(";}", "}").strip() + "\n"
+
+
+def minify_html(text, names):
+    lines = [line.strip() for line in text.splitlines()]
+    text = "\n".join(line for line in lines if line) + "\n"
+    # local references to the fingerprinted names
+    for name, hashed in names.items():
+        text = re.sub(r'((?:src|href)=")/?' + re.escape(name) + '"', r"\g<1>" + hashed + '"', text)
+    return text
+
+
+def minify(name, data, names):
+    if name.endswith(".min.js"):
+        return data
+    if name.endswith(".js"):
+        return minify_js(data.decode()).encode()
+    if name.endswith(".css"):
+        return minify_css(data.decode()).encode()
+    if name.endswith(".html"):
+        return minify_html(data.decode(), names).encode()
+    return data
+
+
+def fingerprinted(name, crc):
+    stem, ext = os.path.splitext(name)
+    return "%s.%08x%s" % (stem, crc, ext)
+
+
+def build(source, output):
+    os.makedirs(output, exist_ok=True)
+    for stale in os.listdir(output):
+        path = os.path.join(output, stale)
+        if os.path.isfile(path):
+            os.remove(path)
+
+    files = sorted(f for f in os.listdir(source) if os.path.isfile(os.path.join(source, f)))
+    # the entry last, it refers to the others by their new names
+    files.sort(key=lambda f: f == ENTRY)
+    names = {}
+    rows = []
+    before = after = 0
+    for name in files:
+        with open(os.path.join(source, name), "rb") as f:
+            data = f.read()
+        content = minify(name, data, names)
+        crc = zlib.crc32(content) & 0xFFFFFFFF
+        hashed = "-" if name == ENTRY else fingerprinted(name, crc)
+        stored = (name if name == ENTRY else hashed) + ".gz"
+        packed = gzip.compress(content, compresslevel=9, mtime=0)
+        with open(os.path.join(output, stored), "wb") as f:
+            f.write(packed)
+        if name != ENTRY:
+            names[name] = hashed
+        kind = TYPES.get(os.path.splitext(name)[1], "application/octet-stream")
+        rows.append("/%s\t%s\t/%s\t%s\t%08x\t%u\t%u" % (name, hashed if hashed == "-" else "/" + hashed, stored, kind, crc, len(content), len(packed)))
+        before += len(data)
+        after += len(packed)
+
+    with open(os.path.join(output, MANIFEST), "w") as f:
+        f.write("# url\tfingerprinted url\tfile\ttype\tcrc32\tlength\tsize\n")
+        f.write("\n".join(rows) + "\n")
+    print("Web assets: %u files, %u bytes, %u gzipped, into %s" % (len(files), before, after, output))
+
+
+if __name__ == "__main__":
+    here = os.path.dirname(os.path.dirname(os.path.abspath(sys.argv[0])))
+    build(sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "data"), sys.argv[2] if len(sys.argv) > 2 else os.path.join(here, ".pio", "assets"))
+else:
+    Import("env")  # noqa: F821, defined by PlatformIO
+    build(os.path.join(env.subst("$PROJECT_DIR"), "data"), env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
@@ -1,53 +1,238 @@
 #include "debug.h"
+#include "lappush.h"
 #include "led.h"
+#include "probe.h"
+#include "scheduler.h"
+#include "tickdriver.h"
 #include "webserver.h"
 #include <ElegantOTA.h>
+#include <esp_task_wdt.h>
 
-static RX5808 rx(PIN_RX5808_RSSI, PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+static RX5808Bus rxBus;  // DATA and CLK, shared by the receivers of the board
+static RX5808 receivers[BOARD_MAX_RECEIVERS];
+static DmaRssiSource dmaRssi(&board);
+static PolledRssiSource polledRssi(receivers, board.receiverCount);
 static Config config;
+static FrequencyHopper hopper;
+static SpectrumScanner scanner;
 static Webserver ws;
 static Buzzer buzzer;
 static Led led;
 static LapTimer timer;
+static RssiStream rssiStream;
+static RssiHistory rssiHistory;
+static SessionLog sessionLog;
 static BatteryMonitor monitor;
+static NodeSync nodeSync;
+static RhNode rhNode;
+static LapPush lapPush;
+static TickDriver tickDriver;
+
+static Scheduler scheduler;
 
 static TaskHandle_t xTimerTask = NULL;
+static TaskHandle_t xLapPushTask = NULL;
+static uint32_t lapEventsSeen = 0;
+
+// the lap events after the push, everything that can wait gets them from here
+static void handleLapEvents() {
+    lap_event_t event;
+    while (lapPush.popLapEvent(&event)) {
+        switch (event.type) {
+            case LAP_EVENT_START:
+                sessionLog.beginSession(event.pilots, event.timeUs);
+                break;
+            case LAP_EVENT_LAP:
+                PROBE_RECORD_US(PROBE_LAP_LATENCY, halMicros() - event.sampleTimeUs);
+                sessionLog.addLap(event.pilot, event.lapTimeUs, event.timeUs);
+                break;
+            case LAP_EVENT_STOP:
+                sessionLog.endSession(event.timeUs);
+                break;
+            default:
+                break;
+        }
+        nodeSync.handleLapEvent(event);
+        rhNode.handleLapEvent(event);
+    }
+}
+
+static uint32_t serviceLaps(void *arg, uint32_t currentTimeMs) {
+    handleLapEvents();
+    return SCHEDULER_IDLE;  // woken by lapPushTask
+}
+
+static uint32_t serviceWeb(void *arg, uint32_t currentTimeMs) {
+    return ws.handleWebUpdate(currentTimeMs);
+}
+
+static uint32_t serviceEeprom(void *arg, uint32_t currentTimeMs) {
+    return config.handleEeprom(currentTimeMs);
+}
+
+static uint32_t serviceSessions(void *arg, uint32_t currentTimeMs) {
+    sessionLog.handleSessionLog(currentTimeMs);
+    return SCHEDULER_IDLE;  // fed by the lap events
+}
+
+// the scanner takes the receivers from the hopper while it runs
+static uint32_t serviceHopper(void *arg, uint32_t currentTimeMs) {
+    uint32_t dueMs = hopper.handleHop(currentTimeMs);
+    uint32_t scanDueMs = scanner.handleScan(currentTimeMs);
+    return scanDueMs < dueMs ? scanDueMs : dueMs;
+}
+
+static uint32_t serviceBattery(void *arg, uint32_t currentTimeMs) {
+    return monitor.checkBatteryState(currentTimeMs, config.getAlarmThreshold());
+}
+
+static uint32_t serviceSync(void *arg, uint32_t currentTimeMs) {
+    return nodeSync.handleSync(currentTimeMs);
+}
+
+static uint32_t serviceBuzzer(void *arg, uint32_t currentTimeMs) {
+    return buzzer.handleBuzzer(currentTimeMs);
+}
+
+static uint32_t serviceLed(void *arg, uint32_t currentTimeMs) {
+    return led.handleLed(currentTimeMs);
+}
+
+// races are started and stopped by the node sync, on every node at the same instant
+static void startRace(void *arg, uint32_t startUs) {
+    timer.startAt(startUs);
+}
 
+static void stopRace(void *arg) {
+    timer.stop();
+}
+
+static void pushLap(void *arg, const lap_event_t &event) {
+    ws.handleLapEvent(event);
+}
+
+// the only consumer of the lap events, woken by the timing loop; above parallelTask, so it runs in the middle of a service
+static void lapPushTask(void *pvArgs) {
+    lap_event_t event;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (timer.popLapEvent(&event)) {
+            lapPush.handleLapEvent(event);
+        }
+        scheduler.wake();
+    }
+}
+
+// the timing loop, in the tick task on core 1 or from loop() when there is none
+static void timingTick(void *arg, uint32_t currentTimeMs) {
+    PROBE_MARK(PROBE_LOOP);
+    timer.handleLapTimerUpdate();
+    uint32_t lapEvents = timer.getPushedLapEvents();
+    if (lapEvents != lapEventsSeen) {
+        lapEventsSeen = lapEvents;
+        if (xLapPushTask) xTaskNotifyGive(xLapPushTask);
+    }
+}
+
+// a tick takes what twice the sample rate brings in a period, a late one catches up over the next few
+static size_t tickFrameBudget() {
+    size_t frames = 2 * timer.getSampleRateHz() * board.receiverCount / TICK_RATE_HZ;
+    return frames > board.receiverCount ? frames : board.receiverCount;
+}
+
+static void notifyParallelTask(void *arg) {
+    if (xTimerTask) xTaskNotifyGive(xTimerTask);
+}
+
+// sleeps until the nearest deadline or a wake, the idle task and WiFi get core 0 meanwhile
 static void parallelTask(void *pvArgs) {
+    esp_task_wdt_add(NULL);
     for (;;) {
-        uint32_t currentTimeMs = millis();
-        buzzer.handleBuzzer(currentTimeMs);
-        led.handleLed(currentTimeMs);
-        ws.handleWebUpdate(currentTimeMs);
-        config.handleEeprom(currentTimeMs);
-        rx.handleFrequencyChange(currentTimeMs, config.getFrequency());
-        monitor.checkBatteryState(currentTimeMs, config.getAlarmThreshold());
-        buzzer.handleBuzzer(currentTimeMs);
-        led.handleLed(currentTimeMs);
+        uint32_t waitMs = scheduler.run(millis());
+        esp_task_wdt_reset();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
     }
 }
 
+static uint16_t readVbatFromDma(uint8_t pin) {
+    return dmaRssi.getAuxRaw();
+}
+
+static RssiSource *initRssiSource() {
+    if (dmaRssi.begin(RSSI_SAMPLE_RATE_HZ)) {
+        halSetAnalogReader(board.vbatPin, readVbatFromDma);  // VBAT is converted by the DMA pattern too
+        return &dmaRssi;
+    }
+    DEBUG("Falling back to polled RSSI reads\n");
+    return &polledRssi;
+}
+
 static void initParallelTask() {
-    disableCore0WDT();
-    xTaskCreatePinnedToCore(parallelTask, "parallelTask", 3000, NULL, 0, &xTimerTask, 0);
+    // buzzer and LED last, the services before them start beeps and blinks
+    scheduler.add(serviceLaps, NULL, PROBE_TASK_LAPS);
+    scheduler.add(serviceWeb, NULL, PROBE_TASK_WEB);
+    scheduler.add(serviceEeprom, NULL, PROBE_TASK_EEPROM);
+    scheduler.add(serviceSessions, NULL, PROBE_TASK_SESSIONS);
+    scheduler.add(serviceHopper, NULL, PROBE_TASK_HOPPER);
+    scheduler.add(serviceBattery, NULL, PROBE_TASK_BATTERY);
+    scheduler.add(serviceSync, NULL, PROBE_TASK_SYNC);
+    scheduler.add(serviceBuzzer, NULL, PROBE_TASK_BUZZER);
+    scheduler.add(serviceLed, NULL, PROBE_TASK_LED);
+    scheduler.setNotify(notifyParallelTask, NULL);
+    xTaskCreatePinnedToCore(parallelTask, "parallelTask", 4096, NULL, 1, &xTimerTask, 0);
+    xTaskCreatePinnedToCore(lapPushTask, "lapPushTask", 4096, NULL, 2, &xLapPushTask, 0);
 }
 
 void setup() {
     DEBUG_INIT;
     config.init();
-    rx.init();
-    buzzer.init(PIN_BUZZER, BUZZER_INVERTED);
-    led.init(PIN_LED, false);
-    timer.init(&config, &rx, &buzzer, &led);
-    monitor.init(PIN_VBAT, VBAT_SCALE, VBAT_ADD, &buzzer, &led);
-    ws.init(&config, &timer, &monitor, &buzzer, &led);
+    DEBUG("Board %s, %u receivers\n", board.name, board.receiverCount);
+    rxBus.init(board.dataPin, board.clockPin);
+    for (uint8_t i = 0; i < board.receiverCount; i++) {
+        receivers[i] = RX5808(board.receivers[i].rssiPin, board.receivers[i].selectPin, &rxBus);
+        receivers[i].init();
+    }
+    hopper.init(&config, receivers, board.receiverCount);
+    scanner.init(&hopper, receivers, board.receiverCount);
+    buzzer.init(board.buzzerPin, board.buzzerInverted);
+    led.init(board.ledPin, false);
+    timer.init(&config, &hopper, initRssiSource(), &buzzer, &led);
+    timer.setRssiStream(&rssiStream);
+    timer.setRssiHistory(&rssiHistory);
+    timer.setScanner(&scanner);
+    lapPush.init(pushLap, NULL);
+    rhNode.init(&config, &timer);
+    timer.setRhHistory(rhNode.getHistory());
+#ifdef RHNODE_SERIAL
+    rhNodeBeginSerial(&rhNode);
+#endif
+    sessionLog.init();
+    monitor.init(board.vbatPin, board.vbatScale, board.vbatAdd, &buzzer, &led);
+    ws.setSessionLog(&sessionLog);
+    ws.setScanner(&scanner);
+    nodeSync.init((uint32_t)(ESP.getEfuseMac() >> 16), startRace, stopRace, NULL);  // the last four bytes of the MAC
+    ws.setNodeSync(&nodeSync);
+    ws.setRhNode(&rhNode);
+    ws.setTickDriver(&tickDriver);
+    ws.init(&config, &timer, &hopper, &monitor, &buzzer, &led);
     led.on(400);
     buzzer.beep(200);
     initParallelTask();
+    timer.setFrameBudget(tickFrameBudget());
+    tickDriver.init(TICK_RATE_HZ, timingTick, NULL);
+    if (!tickDriver.start()) {
+        DEBUG("No tick task, the timing loop runs from loop()\n");
+        timer.setFrameBudget(0);
+    }
 }
 
+// OTA only once the tick task has the timing loop; a flash write may block here, not there
 void loop() {
-    uint32_t currentTimeMs = millis();
-    timer.handleLapTimerUpdate(currentTimeMs);
+    if (!tickDriver.isRunning()) {
+        timingTick(NULL, millis());
+        ElegantOTA.loop();
+        return;
+    }
     ElegantOTA.loop();
+    delay(1);
 }
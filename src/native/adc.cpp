@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "laptimer.h"
+#include "replaysource.h"
+#include "trace.h"
+
+// Reader side of the continuous ADC: batches are drained like LapTimer does,
+// with loop() stalls of up to maxStall, and the frames are checked for gaps.
+int runAdc(int argc, char **argv) {
+    uint32_t rateHz = RSSI_SAMPLE_RATE_HZ;
+    uint32_t seconds = 10;
+    uint32_t maxStallMs = 5;
+    uint32_t bufferFrames = RSSI_DMA_BUFFER_FRAMES;
+    uint32_t seed = 1;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--rate")) {
+            rateHz = val;
+        } else if (!strcmp(argv[i], "--seconds")) {
+            seconds = val;
+        } else if (!strcmp(argv[i], "--max-stall")) {
+            maxStallMs = val;
+        } else if (!strcmp(argv[i], "--buffer")) {
+            bufferFrames = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || rateHz == 0 || bufferFrames == 0) return CMD_USAGE;
+
+    // counter pattern, every frame is identifiable by its value and timestamp
+    static RssiTrace trace;
+    trace.clear();
+    uint64_t total = (uint64_t)rateHz * seconds;
+    for (uint64_t n = 0; n < total; n++) {
+        trace.samples.push_back({(uint32_t)(n * 1000000 / rateHz), (uint8_t)n});
+    }
+
+    halNativeReset();
+    ReplayRssiSource source(bufferFrames);
+    source.setTrace(&trace);
+    source.begin(rateHz);
+
+    SimRandom rnd(seed);
+    rssi_frame_t frames[LAPTIMER_RSSI_BATCH];
+    uint64_t received = 0;
+    uint64_t gapFrames = 0;
+    uint64_t reads = 0;
+    uint32_t firstUs = 0;
+    uint32_t lastUs = 0;
+    uint8_t lastValue = 0;
+    int32_t maxJitterUs = 0;
+    const double periodUs = 1e6 / rateHz;
+
+    while (!source.finished()) {
+        halNativeAdvanceMicros(rnd.next() % (maxStallMs * 1000 + 1));
+        size_t count;
+        do {
+            count = source.read(frames, LAPTIMER_RSSI_BATCH);
+            reads++;
+            for (size_t i = 0; i < count; i++) {
+                if (received > 0) {
+                    uint32_t dt = frames[i].timeUs - lastUs;
+                    uint64_t missing = (uint64_t)(dt / periodUs + 0.5) - 1;
+                    if (missing == 0 && frames[i].rssi != (uint8_t)(lastValue + 1)) missing = 1;  // value says otherwise
+                    gapFrames += missing;
+                    if (missing == 0) {
+                        int32_t jitter = abs((int32_t)(dt - periodUs + 0.5));
+                        if (jitter > maxJitterUs) maxJitterUs = jitter;
+                    }
+                } else {
+                    firstUs = frames[i].timeUs;
+                }
+                lastUs = frames[i].timeUs;
+                lastValue = frames[i].rssi;
+                received++;
+            }
+        } while (count == LAPTIMER_RSSI_BATCH);
+    }
+
+    double measuredHz = received > 1 ? (received + gapFrames - 1) * 1e6 / (lastUs - firstUs) : 0;
+    bool consistent = (gapFrames == source.getDroppedFrames()) && (received + gapFrames == total);
+    printf("configured:\t%u Hz, %u frame buffer, reader stalls up to %u ms\n", rateHz, bufferFrames, maxStallMs);
+    printf("frames:\t\t%llu produced, %llu received in %llu reads\n", (unsigned long long)total, (unsigned long long)received, (unsigned long long)reads);
+    printf("rate:\t\t%.1f Hz measured from timestamps, max interval jitter %d us\n", measuredHz, maxJitterUs);
+    printf("drops:\t\t%llu seen by reader, %u reported by source\n", (unsigned long long)gapFrames, source.getDroppedFrames());
+    printf("result:\t\t%s\n", consistent ? (gapFrames ? "consistent, with drops" : "drop free") : "INCONSISTENT");
+    return consistent ? 0 : 1;
+}
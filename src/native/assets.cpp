@@ -0,0 +1,355 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "assets.h"
+#include "commands.h"
+#include "hal.h"
+#include "hal_native.h"
+
+// a small inflate after zlib's puff.c, enough to read back what the browser gets
+
+#define INFLATE_MAX_BITS 15
+
+typedef struct {
+    uint16_t counts[INFLATE_MAX_BITS + 1];
+    uint16_t symbols[288];
+} huffman_t;
+
+typedef struct {
+    const std::vector<uint8_t> *in;
+    size_t pos;
+    uint32_t bitBuf;
+    uint8_t bitCount;
+    bool error;
+    std::vector<uint8_t> out;
+} inflate_t;
+
+static uint32_t bits(inflate_t *s, uint8_t need) {
+    uint32_t val = s->bitBuf;
+    while (s->bitCount < need) {
+        if (s->pos >= s->in->size()) {
+            s->error = true;
+            return 0;
+        }
+        val |= (uint32_t)(*s->in)[s->pos++] << s->bitCount;
+        s->bitCount += 8;
+    }
+    s->bitBuf = val >> need;
+    s->bitCount -= need;
+    return val & ((1UL << need) - 1);
+}
+
+static void build(huffman_t *h, const uint8_t *lengths, uint16_t n) {
+    uint16_t offsets[INFLATE_MAX_BITS + 1];
+    memset(h->counts, 0, sizeof(h->counts));
+    for (uint16_t i = 0; i < n; i++) h->counts[lengths[i]]++;
+    offsets[1] = 0;
+    for (uint8_t len = 1; len < INFLATE_MAX_BITS; len++) offsets[len + 1] = offsets[len] + h->counts[len];
+    for (uint16_t i = 0; i < n; i++) {
+        if (lengths[i]) h->symbols[offsets[lengths[i]]++] = i;
+    }
+}
+
+static int decode(inflate_t *s, const huffman_t *h) {
+    int code = 0, first = 0, index = 0;
+    for (uint8_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= bits(s, 1);
+        int count = h->counts[len];
+        if (code - count < first) return h->symbols[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    s->error = true;
+    return 0;
+}
+
+static void codes(inflate_t *s, const huffman_t *lencode, const huffman_t *distcode) {
+    static const uint16_t lenBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lenExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t distExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    for (;;) {
+        int symbol = decode(s, lencode);
+        if (s->error || symbol == 256) return;
+        if (symbol < 256) {
+            s->out.push_back(symbol);
+            continue;
+        }
+        symbol -= 257;
+        if (symbol >= 29) break;
+        uint32_t len = lenBase[symbol] + bits(s, lenExtra[symbol]);
+        symbol = decode(s, distcode);
+        if (s->error || symbol >= 30) break;
+        uint32_t dist = distBase[symbol] + bits(s, distExtra[symbol]);
+        if (dist > s->out.size()) break;
+        while (len--) s->out.push_back(s->out[s->out.size() - dist]);
+    }
+    s->error = true;
+}
+
+static void dynamic(inflate_t *s) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lengths[320];
+    huffman_t lencode, distcode;
+    uint16_t nlen = bits(s, 5) + 257;
+    uint16_t ndist = bits(s, 5) + 1;
+    uint16_t ncode = bits(s, 4) + 4;
+    if (nlen > 286 || ndist > 30) {
+        s->error = true;
+        return;
+    }
+    memset(lengths, 0, sizeof(lengths));
+    for (uint16_t i = 0; i < ncode; i++) lengths[order[i]] = bits(s, 3);
+    build(&lencode, lengths, 19);
+
+    uint16_t index = 0;
+    while (index < nlen + ndist && !s->error) {
+        int symbol = decode(s, &lencode);
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+        uint8_t len = 0;
+        uint32_t repeat;
+        if (symbol == 16) {
+            if (index == 0) break;
+            len = lengths[index - 1];
+            repeat = 3 + bits(s, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + bits(s, 3);
+        } else {
+            repeat = 11 + bits(s, 7);
+        }
+        if (index + repeat > nlen + ndist) break;
+        while (repeat--) lengths[index++] = len;
+    }
+    if (index != nlen + ndist) {
+        s->error = true;
+        return;
+    }
+    build(&lencode, lengths, nlen);
+    build(&distcode, lengths + nlen, ndist);
+    codes(s, &lencode, &distcode);
+}
+
+static void fixed(inflate_t *s) {
+    static huffman_t lencode, distcode;
+    static bool built = false;
+    if (!built) {
+        uint8_t lengths[288];
+        for (uint16_t i = 0; i < 288; i++) lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+        build(&lencode, lengths, 288);
+        memset(lengths, 5, 30);
+        build(&distcode, lengths, 30);
+        built = true;
+    }
+    codes(s, &lencode, &distcode);
+}
+
+static void stored(inflate_t *s) {
+    s->bitBuf = 0;
+    s->bitCount = 0;
+    const std::vector<uint8_t> &in = *s->in;
+    if (s->pos + 4 > in.size()) {
+        s->error = true;
+        return;
+    }
+    uint16_t len = in[s->pos] | (in[s->pos + 1] << 8);
+    uint16_t nlen = in[s->pos + 2] | (in[s->pos + 3] << 8);
+    s->pos += 4;
+    if ((uint16_t)~nlen != len || s->pos + len > in.size()) {
+        s->error = true;
+        return;
+    }
+    s->out.insert(s->out.end(), in.begin() + s->pos, in.begin() + s->pos + len);
+    s->pos += len;
+}
+
+static uint32_t crc32(const std::vector<uint8_t> &data) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint8_t b : data) {
+        crc ^= b;
+        for (uint8_t k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// the content of a gzip member, false when it is broken or its trailer doesn't match
+static bool gunzip(const std::vector<uint8_t> &in, std::vector<uint8_t> *out) {
+    if (in.size() < 18 || in[0] != 0x1F || in[1] != 0x8B || in[2] != 8) return false;
+    uint8_t flags = in[3];
+    size_t pos = 10;
+    if (flags & 4) pos += 2 + (in[pos] | (in[pos + 1] << 8));
+    if (flags & 8) pos = std::find(in.begin() + pos, in.end(), 0) - in.begin() + 1;
+    if (flags & 16) pos = std::find(in.begin() + pos, in.end(), 0) - in.begin() + 1;
+    if (flags & 2) pos += 2;
+
+    inflate_t s = {&in, pos, 0, 0, false, {}};
+    bool last;
+    do {
+        last = bits(&s, 1);
+        switch (bits(&s, 2)) {
+            case 0:
+                stored(&s);
+                break;
+            case 1:
+                fixed(&s);
+                break;
+            case 2:
+                dynamic(&s);
+                break;
+            default:
+                s.error = true;
+        }
+    } while (!last && !s.error);
+    if (s.error || s.pos + 8 > in.size()) return false;
+
+    size_t t = s.pos;
+    uint32_t crc = in[t] | (in[t + 1] << 8) | (in[t + 2] << 16) | ((uint32_t)in[t + 3] << 24);
+    uint32_t size = in[t + 4] | (in[t + 5] << 8) | (in[t + 6] << 16) | ((uint32_t)in[t + 7] << 24);
+    *out = s.out;
+    return crc == crc32(s.out) && size == s.out.size();
+}
+
+static bool readHalFile(const char *path, std::vector<uint8_t> *data) {
+    int8_t file = halFileOpen(path, HAL_FILE_READ);
+    if (file < 0) return false;
+    data->resize(halFileSize(file));
+    bool ok = halFileRead(file, data->data(), data->size()) == data->size();
+    halFileClose(file);
+    return ok;
+}
+
+static bool readHostFile(const std::string &path, std::vector<uint8_t> *data) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    data->clear();
+    uint8_t buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) data->insert(data->end(), buf, buf + got);
+    fclose(f);
+    return true;
+}
+
+static bool endsWith(const std::string &s, const char *suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && !s.compare(s.size() - n, n, suffix);
+}
+
+// local src="" and href="" of a page, each has to be a fingerprinted asset
+static uint32_t checkReferences(AssetManifest *manifest, const std::vector<uint8_t> &page, uint32_t *refs) {
+    std::string html(page.begin(), page.end());
+    uint32_t failed = 0;
+    for (const char *attr : {"src=\"", "href=\""}) {
+        size_t at = 0;
+        while ((at = html.find(attr, at)) != std::string::npos) {
+            at += strlen(attr);
+            std::string ref = html.substr(at, html.find('"', at) - at);
+            if (ref.empty() || ref.find("://") != std::string::npos || ref[0] == '#') continue;
+            std::string url = ref[0] == '/' ? ref : "/" + ref;
+            asset_response_t r;
+            (*refs)++;
+            if (manifest->resolve(url.c_str(), NULL, &r) != ASSET_SEND || strcmp(r.cacheControl, ASSETS_IMMUTABLE)) {
+                printf("\t%s refers to %s, not a fingerprinted asset\n", ASSETS_ENTRY, ref.c_str());
+                failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+/*
+ * The data partition as scripts/assets.py builds it, through the same
+ * lookup the Webserver does: every file of the source dir has to resolve,
+ * its gzip has to inflate to what the manifest says, unminified files byte
+ * for byte, and the ETag has to turn a request into a 304.
+ */
+int runAssets(int argc, char **argv) {
+    std::string dir = ".pio/assets";
+    std::string source = "data";
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--dir")) {
+            dir = val;
+        } else if (!strcmp(argv[i], "--source")) {
+            source = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if (argc % 2) return CMD_USAGE;
+
+    halNativeSetFsRoot(dir.c_str());
+    static AssetManifest manifest;
+    if (!halFsBegin() || !manifest.load()) {
+        printf("No asset manifest in %s, run scripts/assets.py first\n", dir.c_str());
+        return 1;
+    }
+
+    bool ok = true;
+    printf("%u assets in %s from %s\n", manifest.getCount(), dir.c_str(), source.c_str());
+    printf("url\t\t\tsource\tcontent\tgzip\tinflates\tsame\t304\n");
+    uint32_t sourceBytes = 0, servedBytes = 0, refs = 0;
+    DIR *d = opendir(source.c_str());
+    if (!d) {
+        printf("Cannot read %s\n", source.c_str());
+        return 1;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *e = readdir(d)) {
+        if (e->d_name[0] != '.') names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &name : names) {
+        std::string url = "/" + name;
+        asset_response_t r;
+        std::vector<uint8_t> original, served, content;
+        readHostFile(source + "/" + name, &original);
+        if (manifest.resolve(url.c_str(), NULL, &r) != ASSET_SEND) {
+            printf("%-20s\tnot in the manifest\n", url.c_str());
+            ok = false;
+            continue;
+        }
+        const asset_t *a = r.asset;
+        bool read = readHalFile(a->file, &served) && served.size() == a->size;
+        bool inflates = read && gunzip(served, &content) && crc32(content) == a->crc && content.size() == a->length;
+        // minified files only have to be smaller, the rest has to come back as it was
+        bool minified = !endsWith(name, ".min.js") && (endsWith(name, ".js") || endsWith(name, ".css") || endsWith(name, ".html"));
+        bool same = minified ? content.size() <= original.size() : content == original;
+
+        // the fingerprinted name, cached for good, then revalidation by ETag
+        char fingerprint[10];
+        snprintf(fingerprint, sizeof(fingerprint), ".%08x", (unsigned)a->crc);
+        asset_response_t h;
+        bool hashed = !strcmp(url.c_str(), ASSETS_ENTRY) ||
+                      (strstr(a->hashed, fingerprint) && manifest.resolve(a->hashed, NULL, &h) == ASSET_SEND && h.asset == a && !strcmp(h.cacheControl, ASSETS_IMMUTABLE));
+        std::string weak = "W/" + std::string(r.etag);
+        bool revalidates = !strcmp(r.cacheControl, ASSETS_REVALIDATE) && manifest.resolve(url.c_str(), r.etag, &h) == ASSET_NOT_MODIFIED &&
+                           manifest.resolve(url.c_str(), weak.c_str(), &h) == ASSET_NOT_MODIFIED &&
+                           manifest.resolve(url.c_str(), "\"00000000\"", &h) == ASSET_SEND;
+
+        printf("%-20s\t%zu\t%u\t%u\t%s\t\t%s\t%s\n", url.c_str(), original.size(), a->length, a->size, inflates ? "yes" : "NO",
+               same ? (minified ? "smaller" : "yes") : "NO", revalidates && hashed ? "yes" : "NO");
+        if (!inflates || !same || !revalidates || !hashed) ok = false;
+        if (inflates && !strcmp(url.c_str(), ASSETS_ENTRY) && checkReferences(&manifest, content, &refs)) ok = false;
+        sourceBytes += original.size();
+        servedBytes += served.size();
+    }
+
+    asset_response_t r;
+    bool entry = manifest.resolve("/", NULL, &r) == ASSET_SEND && !strcmp(r.asset->url, ASSETS_ENTRY);
+    bool missing = manifest.resolve("/missing.js", NULL, &r) == ASSET_NOT_FOUND;
+    if (names.size() != manifest.getCount() || !entry || !missing) ok = false;
+    printf("%u bytes served for %u, %u references in %s checked, / is %s\n", servedBytes, sourceBytes, refs, ASSETS_ENTRY, entry ? "it" : "NOT");
+    printf("result:\t\t%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
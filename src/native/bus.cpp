@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RX5808.h"
+#include "commands.h"
+#include "config.h"
+#include "debug.h"
+#include "hal_native.h"
+#include "rx5808model.h"
+
+/*
+ * The RX5808 driver as it was before the bus went non-blocking, bit-banged
+ * with delays. Kept as the reference the new driver's bus traffic is
+ * compared against.
+ */
+class LegacyRX5808 {
+   public:
+    LegacyRX5808(uint8_t _rssiInputPin, uint8_t _rx5808DataPin, uint8_t _rx5808SelPin, uint8_t _rx5808ClkPin);
+    void init();
+    void setFrequency(uint16_t frequency);
+    void handleFrequencyChange(uint32_t currentTimeMs, uint16_t potentiallyNewFreq);
+
+   private:
+    uint8_t rx5808DataPin = 0;
+    uint8_t rx5808ClkPin = 0;
+    uint8_t rx5808SelPin = 0;
+    uint8_t rssiInputPin = 0;
+
+    uint16_t currentFrequency = 0;
+
+    bool rxPoweredDown = false;
+    bool recentSetFreqFlag = false;
+    uint32_t lastSetFreqTimeMs = 0;
+
+    void rx5808SerialSendBit1();
+    void rx5808SerialSendBit0();
+    void rx5808SerialEnableLow();
+    void rx5808SerialEnableHigh();
+
+    void setRxModulePower(uint32_t options);
+    void resetRxModule();
+    void setupRxModule();
+    void powerDownRxModule();
+    bool verifyFrequency();
+
+    static uint16_t freqMhzToRegVal(uint16_t freqInMhz);
+};
+
+LegacyRX5808::LegacyRX5808(uint8_t _rssiInputPin, uint8_t _rx5808DataPin, uint8_t _rx5808SelPin, uint8_t _rx5808ClkPin) {
+    rssiInputPin = _rssiInputPin;
+    rx5808DataPin = _rx5808DataPin;
+    rx5808SelPin = _rx5808SelPin;
+    rx5808ClkPin = _rx5808ClkPin;
+    lastSetFreqTimeMs = halMillis();
+}
+
+void LegacyRX5808::init() {
+    halPinMode(rssiInputPin, HAL_INPUT);
+    halPinMode(rx5808DataPin, HAL_OUTPUT);
+    halPinMode(rx5808SelPin, HAL_OUTPUT);
+    halPinMode(rx5808ClkPin, HAL_OUTPUT);
+    halDigitalWrite(rx5808SelPin, HAL_HIGH);
+    halDigitalWrite(rx5808ClkPin, HAL_LOW);
+    halDigitalWrite(rx5808DataPin, HAL_LOW);
+    resetRxModule();
+    setFrequency(POWER_DOWN_FREQ_MHZ);
+}
+
+void LegacyRX5808::handleFrequencyChange(uint32_t currentTimeMs, uint16_t potentiallyNewFreq) {
+    if ((currentFrequency != potentiallyNewFreq) && ((currentTimeMs - lastSetFreqTimeMs) > RX5808_MIN_BUSTIME)) {
+        lastSetFreqTimeMs = currentTimeMs;
+        setFrequency(potentiallyNewFreq);
+    }
+
+    if (recentSetFreqFlag && (currentTimeMs - lastSetFreqTimeMs) > RX5808_MIN_TUNETIME) {
+        lastSetFreqTimeMs = currentTimeMs;
+        DEBUG("RX5808 Tune done\n");
+        verifyFrequency();
+        recentSetFreqFlag = false;  // don't need to check again until next freq change
+    }
+}
+
+bool LegacyRX5808::verifyFrequency() {
+    // Start of Read Reg code :
+    // Verify read HEX value in RX5808 module Frequency Register 0x01
+    uint16_t vtxRegisterHex = 0;
+    //  Modified copy of packet code in setRxModuleToFreq(), to read Register 0x01
+    //  20 bytes of register data are read, but the
+    //  MSB 4 bits are zeros
+    //  Data Packet is: register address (4-bits) = 0x1, read/write bit = 1 for read, data D0-D15 stored in vtxHexVerify, data15-19=0x0
+
+    rx5808SerialEnableHigh();
+    rx5808SerialEnableLow();
+
+    rx5808SerialSendBit1();  // Register 0x1
+    rx5808SerialSendBit0();
+    rx5808SerialSendBit0();
+    rx5808SerialSendBit0();
+
+    rx5808SerialSendBit0();  // Read register r/w
+
+    // receive data D0-D15, and ignore D16-D19
+    halPinMode(rx5808DataPin, HAL_INPUT_PULLUP);
+    for (uint8_t i = 0; i < 20; i++) {
+        halDelayMicroseconds(10);
+        // only use D0-D15, ignore D16-D19
+        if (i < 16) {
+            if (halDigitalRead(rx5808DataPin)) {
+                vtxRegisterHex |= (1U << i);
+            } else {
+                vtxRegisterHex &= ~(1U << i);
+            }
+        }
+        if (i >= 16) {
+            halDigitalRead(rx5808DataPin);
+        }
+        halDigitalWrite(rx5808ClkPin, HAL_HIGH);
+        halDelayMicroseconds(10);
+        halDigitalWrite(rx5808ClkPin, HAL_LOW);
+        halDelayMicroseconds(10);
+    }
+
+    halPinMode(rx5808DataPin, HAL_OUTPUT);  // return status of Data pin after INPUT_PULLUP above
+    rx5808SerialEnableHigh();        // Finished clocking data in
+    halDelay(2);
+
+    halDigitalWrite(rx5808ClkPin, HAL_LOW);
+    halDigitalWrite(rx5808DataPin, HAL_LOW);
+
+    if (vtxRegisterHex != freqMhzToRegVal(currentFrequency)) {
+        DEBUG("RX5808 frequency not matching, register = %u, currentFreq = %u\n", vtxRegisterHex, currentFrequency);
+        return false;
+    }
+    DEBUG("RX5808 frequency verified properly\n");
+    return true;
+}
+
+// Set frequency on RX5808 module to given value
+void LegacyRX5808::setFrequency(uint16_t vtxFreq) {
+    DEBUG("Setting frequency to %u\n", vtxFreq);
+
+    currentFrequency = vtxFreq;
+
+    if (vtxFreq == POWER_DOWN_FREQ_MHZ)  // frequency value to power down rx module
+    {
+        powerDownRxModule();
+        rxPoweredDown = true;
+        return;
+    }
+    if (rxPoweredDown) {
+        resetRxModule();
+        rxPoweredDown = false;
+    }
+
+    // Get the hex value to send to the rx module
+    uint16_t vtxHex = freqMhzToRegVal(vtxFreq);
+
+    // Channel data from the lookup table, 20 bytes of register data are sent, but the
+    // MSB 4 bits are zeros register address = 0x1, write, data0-15=vtxHex data15-19=0x0
+    rx5808SerialEnableHigh();
+    rx5808SerialEnableLow();
+
+    rx5808SerialSendBit1();  // Register 0x1
+    rx5808SerialSendBit0();
+    rx5808SerialSendBit0();
+    rx5808SerialSendBit0();
+
+    rx5808SerialSendBit1();  // Write to register
+
+    // D0-D15, note: loop runs backwards as more efficent on AVR
+    uint8_t i;
+    for (i = 16; i > 0; i--) {
+        if (vtxHex & 0x1) {  // Is bit high or low?
+            rx5808SerialSendBit1();
+        } else {
+            rx5808SerialSendBit0();
+        }
+        vtxHex >>= 1;  // Shift bits along to check the next one
+    }
+
+    for (i = 4; i > 0; i--)  // Remaining D16-D19
+        rx5808SerialSendBit0();
+
+    rx5808SerialEnableHigh();  // Finished clocking data in
+    halDelay(2);
+
+    halDigitalWrite(rx5808ClkPin, HAL_LOW);
+    halDigitalWrite(rx5808DataPin, HAL_LOW);
+
+    recentSetFreqFlag = true;  // indicate need to wait RX5808_MIN_TUNETIME before reading RSSI
+}
+
+void LegacyRX5808::rx5808SerialSendBit1() {
+    halDigitalWrite(rx5808DataPin, HAL_HIGH);
+    halDelayMicroseconds(300);
+    halDigitalWrite(rx5808ClkPin, HAL_HIGH);
+    halDelayMicroseconds(300);
+    halDigitalWrite(rx5808ClkPin, HAL_LOW);
+    halDelayMicroseconds(300);
+}
+
+void LegacyRX5808::rx5808SerialSendBit0() {
+    halDigitalWrite(rx5808DataPin, HAL_LOW);
+    halDelayMicroseconds(300);
+    halDigitalWrite(rx5808ClkPin, HAL_HIGH);
+    halDelayMicroseconds(300);
+    halDigitalWrite(rx5808ClkPin, HAL_LOW);
+    halDelayMicroseconds(300);
+}
+
+void LegacyRX5808::rx5808SerialEnableLow() {
+    halDigitalWrite(rx5808SelPin, HAL_LOW);
+    halDelayMicroseconds(200);
+}
+
+void LegacyRX5808::rx5808SerialEnableHigh() {
+    halDigitalWrite(rx5808SelPin, HAL_HIGH);
+    halDelayMicroseconds(200);
+}
+
+// Reset rx5808 module to wake up from power down
+void LegacyRX5808::resetRxModule() {
+    rx5808SerialEnableHigh();
+    rx5808SerialEnableLow();
+
+    rx5808SerialSendBit1();  // Register 0xF
+    rx5808SerialSendBit1();
+    rx5808SerialSendBit1();
+    rx5808SerialSendBit1();
+
+    rx5808SerialSendBit1();  // Write to register
+
+    for (uint8_t i = 20; i > 0; i--)
+        rx5808SerialSendBit0();
+
+    rx5808SerialEnableHigh();  // Finished clocking data in
+
+    setupRxModule();
+}
+
+// Set power options on the rx5808 module
+void LegacyRX5808::setRxModulePower(uint32_t options) {
+    rx5808SerialEnableHigh();
+    rx5808SerialEnableLow();
+
+    rx5808SerialSendBit0();  // Register 0xA
+    rx5808SerialSendBit1();
+    rx5808SerialSendBit0();
+    rx5808SerialSendBit1();
+
+    rx5808SerialSendBit1();  // Write to register
+
+    for (uint8_t i = 20; i > 0; i--) {
+        if (options & 0x1) {  // Is bit high or low?
+            rx5808SerialSendBit1();
+        } else {
+            rx5808SerialSendBit0();
+        }
+        options >>= 1;  // Shift bits along to check the next one
+    }
+
+    rx5808SerialEnableHigh();  // Finished clocking data in
+
+    halDigitalWrite(rx5808DataPin, HAL_LOW);
+}
+
+// Power down rx5808 module
+void LegacyRX5808::powerDownRxModule() {
+    setRxModulePower(0b11111111111111111111);
+}
+
+// Set up rx5808 module (disabling unused features to save some power)
+void LegacyRX5808::setupRxModule() {
+    setRxModulePower(0b11010000110111110011);
+}
+
+// Calculate rx5808 register hex value for given frequency in MHz
+uint16_t LegacyRX5808::freqMhzToRegVal(uint16_t freqInMhz) {
+    uint16_t tf, N, A;
+    tf = (freqInMhz - 479) / 2;
+    N = tf / 32;
+    A = tf % 32;
+    return (N << (uint16_t)7) + A;
+}
+
+#define BUS_STEP_MS 150  // per frequency, covers bus guard, tune time and the read back
+
+static const uint16_t busFrequencies[] = {5658, 5695, 5732, 5769, 5806, 5843, 5880, 5917, POWER_DOWN_FREQ_MHZ, 5800};
+
+typedef struct {
+    uint32_t calls;
+    uint64_t blockedUs;  // time spent inside driver calls
+    uint32_t maxBlockedUs;
+} bus_run_t;
+
+static void noteCall(bus_run_t *run, uint64_t startUs) {
+    uint32_t blockedUs = halNativeMicros64() - startUs;
+    run->calls++;
+    run->blockedUs += blockedUs;
+    if (blockedUs > run->maxBlockedUs) run->maxBlockedUs = blockedUs;
+}
+
+// power up, go through raceband, power down and wake up again, the way parallelTask drives the receiver
+template <class RX>
+static void runScenario(Rx5808Model &model, bus_run_t *run) {
+    halNativeReset();
+    model.clear();
+    model.attach();
+    memset(run, 0, sizeof(*run));
+
+    RX rx(PIN_RX5808_RSSI, PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+    uint64_t startUs = halNativeMicros64();
+    rx.init();
+    noteCall(run, startUs);
+    for (uint16_t frequency : busFrequencies) {
+        for (uint32_t ms = 0; ms < BUS_STEP_MS; ms++) {
+            startUs = halNativeMicros64();
+            rx.handleFrequencyChange(halMillis(), frequency);
+            noteCall(run, startUs);
+            halNativeAdvanceMicros(1000);
+        }
+    }
+    model.detach();
+}
+
+static void printFrame(const bus_frame_t &frame) {
+    bool write = (frame.value >> 4) & 1;
+    printf("\t%s reg 0x%X %s 0x%05X\t%u bits, %u driven, %llu us\n", write ? "write" : "read", frame.value & 0xF, write ? "<-" : "->",
+           frame.value >> 5, frame.bits, frame.drivenBits, (unsigned long long)(frame.endUs - frame.startUs));
+}
+
+// Records the bus traffic of the bit-banged and the ticker driven driver for
+// the same sequence of frequency changes and compares it frame by frame.
+int runBus(int argc, char **argv) {
+    bool verbose = false;
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+
+    Rx5808Model legacyModel(PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+    Rx5808Model model(PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+    bus_run_t legacyRun;
+    bus_run_t run;
+    runScenario<LegacyRX5808>(legacyModel, &legacyRun);
+    runScenario<RX5808>(model, &run);
+
+    size_t mismatch = SIZE_MAX;
+    size_t frames = legacyModel.frames.size() > model.frames.size() ? legacyModel.frames.size() : model.frames.size();
+    for (size_t i = 0; i < frames && mismatch == SIZE_MAX; i++) {
+        if (i >= legacyModel.frames.size() || i >= model.frames.size()) {
+            mismatch = i;
+        } else {
+            const bus_frame_t &a = legacyModel.frames[i];
+            const bus_frame_t &b = model.frames[i];
+            if (a.bits != b.bits || a.drivenBits != b.drivenBits || a.value != b.value) mismatch = i;
+        }
+    }
+    bool registersMatch = !memcmp(legacyModel.registers, model.registers, sizeof(model.registers));
+
+    uint64_t busUs = 0;
+    for (const bus_frame_t &frame : model.frames) busUs += frame.endUs - frame.startUs;
+
+    if (verbose) {
+        printf("ticker driven frames:\n");
+        for (const bus_frame_t &frame : model.frames) printFrame(frame);
+    }
+    printf("bit-banged:\t%zu frames, caller blocked %.1f ms max, %.1f ms in total\n", legacyModel.frames.size(), legacyRun.maxBlockedUs / 1000.0,
+           legacyRun.blockedUs / 1000.0);
+    printf("ticker:\t\t%zu frames, caller blocked %u us max, %.1f ms per frame on the bus\n", model.frames.size(), run.maxBlockedUs,
+           model.frames.empty() ? 0.0 : busUs / 1000.0 / model.frames.size());
+    if (mismatch != SIZE_MAX) {
+        printf("result:\t\tDIFFERENT from frame %zu\n", mismatch);
+        if (mismatch < legacyModel.frames.size()) printFrame(legacyModel.frames[mismatch]);
+        if (mismatch < model.frames.size()) printFrame(model.frames[mismatch]);
+        return 1;
+    }
+    printf("result:\t\tidentical bit sequence%s\n", registersMatch ? ", same register contents" : ", REGISTERS DIFFER");
+    return registersMatch ? 0 : 1;
+}
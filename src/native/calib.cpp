@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "racesim.h"
+#include "trace.h"
+
+#define CALIB_GOOD_ERROR_MS 50  // a race is timed right with every lap and none off by more
+
+typedef struct {
+    const char *name;
+    uint8_t noiseFloor;
+    uint8_t peakRssi;  // closer gates are higher
+    float noiseStdDev;
+    int16_t floorDrift;  // during the race, after calibrating
+} calib_gate_t;
+
+static const calib_gate_t gates[] = {
+    {"near", 60, 210, 3.0f, 0},
+    {"far", 60, 115, 3.0f, 0},
+    {"high floor", 110, 190, 3.0f, 0},
+    {"noisy", 80, 150, 8.0f, 0},
+    {"drifting", 60, 160, 3.0f, 35},
+};
+
+static bool timedRight(const race_result_t &result) {
+    return result.lapsDetected == result.lapsExpected && result.maxAbsErrorMs < CALIB_GOOD_ERROR_MS;
+}
+
+// Calibrates on practice passes at gates of different distance and floor,
+// then races with the proposal and with the default thresholds.
+int runCalib(int argc, char **argv) {
+    uint32_t races = 20;
+    uint32_t seed = 1;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || synth.sampleRateHz == 0) return CMD_USAGE;
+
+    static RaceSimulator sim;
+    race_result_t result;
+    SimRandom rnd(seed);
+    bool ok = true;
+    printf("%u races per gate at %u Hz, defaults enter %u exit %u, timed right: all laps within %u ms\n", races, synth.sampleRateHz,
+           params.enterRssi, params.exitRssi, CALIB_GOOD_ERROR_MS);
+    printf("gate\t\tcalibrated\tfloor err\tenter\texit\tdefaults ok\tcalibrated ok\tno tracking ok\n");
+    for (const calib_gate_t &gate : gates) {
+        uint32_t calibrated = 0, defaultsOk = 0, calibratedOk = 0, fixedOk = 0;
+        double floorError = 0, enterSum = 0, exitSum = 0;
+        for (uint32_t r = 0; r < races; r++) {
+            synth_params_t p = synth;
+            p.noiseFloor = gate.noiseFloor - 5 + rnd.next() % 11;
+            p.peakRssi = gate.peakRssi - 5 + rnd.next() % 11;
+            p.noiseStdDev = gate.noiseStdDev;
+
+            // a few practice passes, with the floor clear before the first
+            RssiTrace practice;
+            synth_params_t pp = p;
+            pp.laps = CALIBRATOR_PASS_COUNT - 1;
+            pp.lapTimeMs = 5000;
+            pp.lapJitterMs = 1000;
+            pp.tailMs = 1000;
+            practice.synthesize(pp, seed + r);
+            race_params_t cp = params;
+            cp.calibrate = true;
+            sim.run(&practice, cp, &result);
+            calibration_t c = result.calibration;
+            if (c.state != CALIBRATOR_DONE) continue;
+            calibrated++;
+            floorError += abs((int)c.floorRssi - p.noiseFloor);
+            enterSum += c.enterRssi;
+            exitSum += c.exitRssi;
+
+            RssiTrace race;
+            p.floorDrift = gate.floorDrift;
+            race.synthesize(p, seed + r + 1000);
+            sim.run(&race, params, &result);
+            defaultsOk += timedRight(result);
+
+            race_params_t rp = params;
+            rp.enterRssi = c.enterRssi;
+            rp.exitRssi = c.exitRssi;
+            rp.floorRssi = c.floorRssi;
+            sim.run(&race, rp, &result);
+            calibratedOk += timedRight(result);
+
+            rp.floorRssi = 0;
+            sim.run(&race, rp, &result);
+            fixedOk += timedRight(result);
+        }
+        printf("%-10s\t%u/%u\t\t%.1f\t\t%.0f\t%.0f\t%u\t\t%u\t\t%u\n", gate.name, calibrated, races, calibrated ? floorError / calibrated : 0,
+               calibrated ? enterSum / calibrated : 0, calibrated ? exitSum / calibrated : 0, defaultsOk, calibratedOk, fixedOk);
+        if (calibrated != races || calibratedOk != calibrated) ok = false;
+    }
+    printf("result:\t\t%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
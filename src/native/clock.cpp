@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "racesim.h"
+#include "trace.h"
+
+#define CLOCK_LAPS 20
+#define CLOCK_MAX_EXTRA_ERROR_MS 0.1  // mean, over the lap error on the trace's own time
+#define CLOCK_MAX_END_ERROR_US 200  // of the frame time at the end of a race, nothing left of the startup
+#define CLOCK_MAX_PPM_ERROR 5
+
+typedef struct {
+    const char *name;
+    int32_t ppm;
+    bool scanClock;
+} clock_case_t;
+
+// Races on an ADC off its nominal rate: frames timed from the nominal rate
+// drift and scale the laps, the scan clock keeps them to the truth.
+int runClock(int argc, char **argv) {
+    int32_t ppm = 300;
+    uint32_t races = 3;
+    uint32_t seed = 1;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--ppm")) {
+            ppm = strtol(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "--races")) {
+            races = strtoul(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(argv[i + 1], NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || ppm <= -SCAN_CLOCK_MAX_PPM || ppm >= SCAN_CLOCK_MAX_PPM) return CMD_USAGE;
+
+    const clock_case_t cases[] = {
+        {"trace time", 0, false},
+        {"nominal", -ppm, false},
+        {"nominal", ppm, false},
+        {"scan clock", 0, true},
+        {"scan clock", -ppm, true},
+        {"scan clock", ppm, true},
+    };
+
+    static RssiTrace trace;
+    static RaceSimulator sim;
+    synth_params_t synth;
+    race_params_t params;
+    race_result_t result;
+    synthDefaults(&synth);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+    synth.laps = CLOCK_LAPS;
+    raceDefaults(&params);
+
+    printf("%u races of %u laps at %u Hz, the ADC up to %d ppm off\n", races, CLOCK_LAPS, synth.sampleRateHz, ppm);
+    printf("timing\t\tppm\tlaps\t\tmean error\tmax error\tframe time max\tat the end\tmeasured\n");
+    bool ok = true;
+    double referenceMs = 0;
+    for (const clock_case_t &c : cases) {
+        params.adcPpm = c.ppm;
+        params.scanClock = c.scanClock;
+        uint32_t expected = 0, detected = 0, timeErrorUs = 0, endErrorUs = 0;
+        int32_t worstPpmError = 0;
+        double errorSum = 0, errorMax = 0;
+        for (uint32_t r = 0; r < races; r++) {
+            trace.synthesize(synth, seed + r);
+            sim.run(&trace, params, &result);
+            expected += result.lapsExpected;
+            detected += result.lapsDetected;
+            errorSum += result.meanAbsErrorMs * result.lapsExpected;
+            if (result.maxAbsErrorMs > errorMax) errorMax = result.maxAbsErrorMs;
+            if (result.maxTimeErrorUs > timeErrorUs) timeErrorUs = result.maxTimeErrorUs;
+            if ((uint32_t)abs(result.endTimeErrorUs) > endErrorUs) endErrorUs = abs(result.endTimeErrorUs);
+            int32_t ppmError = abs(result.measuredPpm - c.ppm);
+            if (c.scanClock && ppmError > worstPpmError) worstPpmError = ppmError;
+        }
+        printf("%s\t%+d\t%u of %u\t%.3f ms\t%.3f ms\t%u us\t\t%u us\t\t", c.name, c.ppm, detected, expected, expected ? errorSum / expected : 0.0,
+               errorMax, timeErrorUs, endErrorUs);
+        if (c.scanClock) {
+            printf("within %d ppm\n", worstPpmError);
+        } else {
+            printf("-\n");
+        }
+
+        double meanMs = expected ? errorSum / expected : 0.0;
+        if (!c.scanClock && !c.ppm) referenceMs = meanMs;
+        if (!c.scanClock) continue;
+        ok = ok && detected == expected && meanMs <= referenceMs + CLOCK_MAX_EXTRA_ERROR_MS && endErrorUs <= CLOCK_MAX_END_ERROR_US &&
+             worstPpmError <= CLOCK_MAX_PPM_ERROR;
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#define CMD_USAGE -1  // returned by a command on bad arguments
+
+int runSim(int argc, char **argv);
+int runAdc(int argc, char **argv);
+int runClock(int argc, char **argv);
+int runKalman(int argc, char **argv);
+int runPeak(int argc, char **argv);
+int runHop(int argc, char **argv);
+int runBus(int argc, char **argv);
+int runWs(int argc, char **argv);
+int runSessions(int argc, char **argv);
+int runDetect(int argc, char **argv);
+int runCalib(int argc, char **argv);
+int runLaps(int argc, char **argv);
+int runProbes(int argc, char **argv);
+int runAssets(int argc, char **argv);
+int runConfig(int argc, char **argv);
+int runJson(int argc, char **argv);
+int runSched(int argc, char **argv);
+int runScan(int argc, char **argv);
+int runSync(int argc, char **argv);
+int runRhNode(int argc, char **argv);
+int runPush(int argc, char **argv);
+int runTick(int argc, char **argv);
+int runOta(int argc, char **argv);
+int runOtaDiff(int argc, char **argv);
+int runDns(int argc, char **argv);
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "commands.h"
+#include "config.h"
+#include "configstore.h"
+#include "hal_native.h"
+#include "trace.h"
+
+#define CONFIG_DRAG_MIN_MS 500
+#define CONFIG_DRAG_MAX_MS 5000
+#define CONFIG_IDLE_MIN_MS 2000
+#define CONFIG_IDLE_MAX_MS 60000
+#define CONFIG_SETTLED_MS 15000  // after the traffic, for the last change to reach flash
+
+typedef struct {
+    uint32_t commits;  // whole struct EEPROM commits
+    uint32_t erases;
+    uint64_t bytes;
+    uint32_t minSectorErases;
+    uint32_t maxSectorErases;
+    uint32_t changes;  // setter calls that changed a value
+    uint64_t loadNs;   // of Config::init on the final state
+    bool reloaded;     // a reboot loads what was set
+} config_wear_t;
+
+static uint32_t between(SimRandom &rnd, uint32_t min, uint32_t max) {
+    return min + rnd.next() % (max - min + 1);
+}
+
+static uint8_t step(uint8_t value, int delta, uint8_t min, uint8_t max) {
+    int v = value + delta;
+    return v < min ? min : v > max ? max : v;
+}
+
+// One POST from the UI: a threshold or min lap slider moving a few steps,
+// now and then a channel, pilot count or detector picked.
+static void uiChange(Config &config, SimRandom &rnd, uint8_t control) {
+    int delta = (int)between(rnd, 0, 6) - 3;
+    uint8_t pilot = rnd.next() % config.getPilotCount();
+    switch (control) {
+        case 0:
+            config.setPilotEnterRssi(pilot, step(config.getPilotEnterRssi(pilot), delta, 50, 250));
+            break;
+        case 1:
+            config.setPilotExitRssi(pilot, step(config.getPilotExitRssi(pilot), delta, 40, 240));
+            break;
+        case 2:
+            config.setMinLap(step(config.getMinLapMs() / 100, delta, 10, 200));
+            break;
+        case 3:
+            config.setPilotFrequency(pilot, 5658 + 37 * (rnd.next() % 8));
+            break;
+        default:
+            config.setPilotCount(between(rnd, 1, CONFIG_MAX_PILOTS));
+            config.setDetector(rnd.next() % 3);
+            break;
+    }
+}
+
+static void countWear(config_wear_t *wear) {
+    wear->erases = halNativeGetFlashErases();
+    wear->bytes = halNativeGetFlashBytesWritten() - (uint64_t)wear->erases * HAL_FLASH_SECTOR_SIZE;  // an erase counts as a sector
+    wear->commits = halNativeGetStorageCommits();
+    wear->minSectorErases = UINT32_MAX;
+    wear->maxSectorErases = 0;
+    for (uint8_t i = 0; i < HAL_NATIVE_FLASH_SECTORS; i++) {
+        uint32_t erases = halNativeGetFlashSectorErases(i);
+        if (erases < wear->minSectorErases) wear->minSectorErases = erases;
+        if (erases > wear->maxSectorErases) wear->maxSectorErases = erases;
+    }
+}
+
+// Someone tuning the timer from the web UI for a while: pauses, then a
+// slider dragged with a POST every 50-150 ms or a single setting changed.
+// The service task looks at the config every millisecond.
+static void runTraffic(bool useStore, uint32_t seed, uint32_t minutes, config_wear_t *wear) {
+    static Config config;
+    static Config rebooted;
+    SimRandom rnd(seed);
+    memset(wear, 0, sizeof(*wear));
+    halNativeSetFlashSectors(useStore ? HAL_NATIVE_FLASH_SECTORS : 0);
+    halNativeReset();
+    config.init();
+
+    uint32_t endMs = halMillis() + minutes * 60000;
+    uint32_t nextMs = halMillis() + between(rnd, CONFIG_IDLE_MIN_MS, CONFIG_IDLE_MAX_MS);
+    uint32_t dragEndMs = 0;
+    uint8_t control = 0;
+    while (halMillis() < endMs + CONFIG_SETTLED_MS) {
+        uint32_t nowMs = halMillis();
+        if (nowMs < endMs && nowMs >= nextMs) {
+            if (nowMs >= dragEndMs) {
+                uint32_t r = rnd.next() % 10;
+                control = r < 6 ? r % 2 : r < 8 ? 2 : r < 9 ? 3 : 4;
+                dragEndMs = nowMs + (control <= 2 ? between(rnd, CONFIG_DRAG_MIN_MS, CONFIG_DRAG_MAX_MS) : 1);
+            }
+            laptimer_config_t before = *config.getConfig();
+            uiChange(config, rnd, control);
+            if (memcmp(&before, config.getConfig(), sizeof(before))) wear->changes++;
+            nextMs = nowMs + between(rnd, 50, 150);
+            if (nextMs >= dragEndMs) nextMs = dragEndMs + between(rnd, CONFIG_IDLE_MIN_MS, CONFIG_IDLE_MAX_MS);
+        }
+        config.handleEeprom(nowMs);
+        halNativeAdvanceMicros(1000);
+    }
+    countWear(wear);
+
+    auto start = std::chrono::steady_clock::now();
+    rebooted.init();
+    wear->loadNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    wear->reloaded = !memcmp(rebooted.getConfig(), config.getConfig(), sizeof(laptimer_config_t));
+}
+
+static bool fieldIs(const config_field_t &field, const laptimer_config_t *a, const laptimer_config_t *b) {
+    return !memcmp((const uint8_t *)a + field.offset, (const uint8_t *)b + field.offset, field.size);
+}
+
+// Power cuts while changes are written, at a random byte of the records or
+// of a compaction. Every field has to come back either as it was or as it
+// was set, and all of them as set when the cut missed.
+static bool runCuts(uint32_t seed, uint32_t cuts, uint32_t *hits) {
+    static Config config;
+    SimRandom rnd(seed);
+    bool ok = true;
+    *hits = 0;
+    halNativeSetFlashSectors(HAL_NATIVE_FLASH_SECTORS);
+    halNativeReset();
+    config.init();
+    laptimer_config_t before = *config.getConfig();
+    for (uint32_t i = 0; i < cuts && ok; i++) {
+        for (uint32_t n = between(rnd, 1, 4); n; n--) uiChange(config, rnd, rnd.next() % 5);
+        laptimer_config_t after = *config.getConfig();
+        uint32_t span = rnd.next() % 4 ? 64 : 2 * HAL_FLASH_SECTOR_SIZE;
+        halNativeSetFlashCut(halNativeGetFlashBytesWritten() + between(rnd, 1, span));
+        config.write();
+        bool hit = halNativeFlashCutHit();
+        halNativeSetFlashCut(0);
+        if (hit) (*hits)++;
+
+        config.init();
+        const laptimer_config_t *loaded = config.getConfig();
+        for (uint8_t f = 0; f < CONFIG_FIELDS && ok; f++) {
+            const config_field_t &field = configFields[f];
+            if (fieldIs(field, loaded, &after) || (hit && fieldIs(field, loaded, &before))) continue;
+            printf("  cut %u%s: field %u is neither old nor new\n", i, hit ? " (hit)" : "", field.key);
+            ok = false;
+        }
+        before = *loaded;
+    }
+    return ok;
+}
+
+// The EEPROM blob of a timer from before the config partition, of the
+// current layout and of the first one, imported or kept in EEPROM.
+static bool runImport() {
+    static Config legacy;
+    static Config config;
+    bool ok = true;
+    halNativeSetFlashSectors(0);
+    halNativeReset();
+    legacy.init();
+    legacy.setFrequency(5800);
+    legacy.setMinLap(55);
+    legacy.setPilotCount(3);
+    legacy.setPilotEnterRssi(2, 140);
+    legacy.setDetector(1);
+    legacy.setFloorRssi(1, 70);
+    legacy.write();
+    halNativeSetFlashSectors(HAL_NATIVE_FLASH_SECTORS);
+    config.init();
+    bool same = !memcmp(config.getConfig(), legacy.getConfig(), sizeof(laptimer_config_t));
+    printf("  version %u blob: %s\n", CONFIG_VERSION, same ? "imported" : "FAILED");
+    ok = ok && same;
+
+    // version 0 ended at the password, what follows it is not taken
+    halNativeSetFlashSectors(0);
+    halNativeReset();
+    legacy.init();
+    legacy.setFrequency(5800);
+    legacy.setPilotCount(3);
+    legacy.write();
+    uint32_t version = CONFIG_MAGIC | 0;
+    halStorageWrite(0, &version, sizeof(version));
+    halStorageCommit();
+    halNativeSetFlashSectors(HAL_NATIVE_FLASH_SECTORS);
+    config.init();
+    same = config.getFrequency() == 5800 && config.getPilotCount() == 1;
+    printf("  version 0 blob: %s\n", same ? "imported, later fields defaulted" : "FAILED");
+    ok = ok && same;
+
+    // and upgraded in place by a timer without a config partition
+    halNativeSetFlashSectors(0);
+    halNativeReset();
+    legacy.init();
+    legacy.setFrequency(5800);
+    legacy.setPilotCount(3);
+    legacy.write();
+    halStorageWrite(0, &version, sizeof(version));
+    halStorageCommit();
+    config.init();
+    config.init();
+    same = config.getFrequency() == 5800 && config.getPilotCount() == 1 &&
+           config.getConfig()->version == (CONFIG_VERSION | CONFIG_MAGIC);
+    printf("  version 0 EEPROM: %s\n", same ? "upgraded, later fields defaulted" : "FAILED");
+    return ok && same;
+}
+
+static void noRecords(void *arg, uint8_t key, const uint8_t *value, uint8_t length) {
+}
+
+// Records of another size than the field, as a build with a wider or
+// narrower field would have left them.
+static bool runResize() {
+    static Config config;
+    ConfigStore store;
+    halNativeSetFlashSectors(HAL_NATIVE_FLASH_SECTORS);
+    halNativeReset();
+    config.init();
+    config.write();
+    store.begin();
+    store.load(noRecords, NULL);
+    const config_field_t *frequency = &configFields[0];
+    const config_field_t *name = &configFields[7];
+    uint8_t narrow = 200;
+    char wide[CONFIGSTORE_MAX_VALUE];
+    memset(wide, 'x', sizeof(wide));
+    store.write(frequency->key, &narrow, sizeof(narrow));
+    store.write(name->key, wide, sizeof(wide));
+    config.init();
+    bool ok = config.getFrequency() == 200 && strlen(config.getConfig()->pilotName) == (size_t)name->size - 1;
+
+    // rewritten at the field size once settled, and loaded as such
+    uint64_t bytes = halNativeGetFlashBytesWritten();
+    config.handleEeprom(halMillis() + CONFIG_SETTLE_MS + 1);
+    config.init();
+    ok = ok && halNativeGetFlashBytesWritten() > bytes && config.getFrequency() == 200;
+    printf("  narrower and wider records: %s\n", ok ? "converted" : "FAILED");
+    return ok;
+}
+
+// Slider traffic on the config, once with whole struct EEPROM commits and
+// once with the config store, counting what reaches the flash. Then power
+// cuts, the import of an old EEPROM config and resized fields.
+int runConfig(int argc, char **argv) {
+    uint32_t minutes = 60;
+    uint32_t seed = 1;
+    uint32_t cuts = 2000;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--minutes")) {
+            minutes = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--cuts")) {
+            cuts = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || minutes == 0) return CMD_USAGE;
+
+    config_wear_t before, after;
+    runTraffic(false, seed, minutes, &before);
+    runTraffic(true, seed, minutes, &after);
+    printf("%u minutes of UI traffic, %u changes\n", minutes, after.changes);
+    printf("  EEPROM commits: %u, a sector erase each\n", before.commits);
+    printf("  config store:   %u erases (%u to %u per sector over %u), %llu bytes written\n", after.erases, after.minSectorErases,
+           after.maxSectorErases, HAL_NATIVE_FLASH_SECTORS, (unsigned long long)after.bytes);
+    printf("  erases per hour per sector: %.1f before, %.2f after\n", before.commits * 60.0 / minutes,
+           after.maxSectorErases * 60.0 / minutes);
+    printf("  load at boot: %llu ns/load\n", (unsigned long long)after.loadNs);
+    bool ok = before.reloaded && after.reloaded && after.changes == before.changes;
+    printf("  reboot loads the settings: %s\n", before.reloaded && after.reloaded ? "yes" : "NO");
+
+    uint32_t hits;
+    bool cutsOk = runCuts(seed, cuts, &hits);
+    printf("%u writes with a power cut armed, %u hit: %s\n", cuts, hits, cutsOk ? "every field old or new" : "FAILED");
+    printf("legacy EEPROM config\n");
+    bool importOk = runImport();
+    printf("field migration\n");
+    bool resizeOk = runResize();
+
+    ok = ok && cutsOk && importOk && resizeOk;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
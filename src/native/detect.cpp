@@ -0,0 +1,217 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "bench.h"
+#include "commands.h"
+#include "fixedkalman.h"
+#include "racesim.h"
+#include "trace.h"
+
+#define DETECT_MATCH_US 100000  // a detection this close to a true pass counts as that pass
+#define DETECT_MAX_TRACES 8
+
+typedef struct {
+    const char *name;
+    std::vector<RssiTrace> traces;
+} detect_scenario_t;
+
+typedef struct {
+    uint64_t passes;
+    uint64_t truePositives;
+    uint64_t falsePositives;
+    double biasSumUs;                  // signed pass time error, the filter delays every detector a bit
+    std::vector<uint32_t> lapErrorsUs;  // between consecutive matched passes, lap times cancel the bias
+} detect_score_t;
+
+static void score(const std::vector<uint32_t> &truth, const std::vector<uint32_t> &detected, detect_score_t *s) {
+    std::vector<bool> used(detected.size(), false);
+    std::vector<int64_t> matched(truth.size(), -1);
+    for (size_t t = 0; t < truth.size(); t++) {
+        int64_t best = -1;
+        for (size_t d = 0; d < detected.size(); d++) {
+            int64_t error = (int64_t)detected[d] - truth[t];
+            if (used[d] || llabs(error) > DETECT_MATCH_US) continue;
+            if (best < 0 || llabs(error) < llabs((int64_t)detected[best] - truth[t])) best = d;
+        }
+        if (best >= 0) {
+            used[best] = true;
+            matched[t] = detected[best];
+            s->truePositives++;
+            s->biasSumUs += (int64_t)detected[best] - truth[t];
+        }
+        if (t > 0 && matched[t] >= 0 && matched[t - 1] >= 0) {
+            int64_t error = (matched[t] - matched[t - 1]) - ((int64_t)truth[t] - truth[t - 1]);
+            s->lapErrorsUs.push_back(llabs(error));
+        }
+    }
+    s->passes += truth.size();
+    s->falsePositives += std::count(used.begin(), used.end(), false);
+}
+
+static void printScore(const char *scenario, detector_type_e type, const detect_score_t &s) {
+    uint64_t detections = s.truePositives + s.falsePositives;
+    printf("%-10s\t%-8s\t%llu\t%.3f\t\t%.3f\t%.0f\t\t%u\t%u\n", scenario, detectorName(type), (unsigned long long)s.passes,
+           detections ? (double)s.truePositives / detections : 1.0, s.passes ? (double)s.truePositives / s.passes : 1.0,
+           s.truePositives ? s.biasSumUs / s.truePositives : 0.0, percentile(s.lapErrorsUs, 0.5), percentile(s.lapErrorsUs, 0.95));
+}
+
+static volatile uint32_t detectSink;
+
+// every detector alone on the filtered samples, as LapTimer feeds it
+static double nsPerSample(detector_type_e type, const std::vector<detect_scenario_t> &corpus, uint8_t enter, uint8_t exit, uint64_t *samples) {
+    static PeakDetector peak;
+    static SlopeDetector slope;
+    static MatchedDetector matched;
+    LapDetector *detectors[DETECTOR_COUNT] = {&peak, &slope, &matched};
+    LapDetector *detector = detectors[type];
+    RssiFilterBank<1, 16> filter;
+    filter.setNoise(LAPTIMER_FILTER_Q * 0.01f, LAPTIMER_FILTER_R * 0.0001f);
+
+    std::vector<detector_sample_t> filtered;
+    double ns = 0;
+    *samples = 0;
+    uint32_t passes = 0;
+    for (const detect_scenario_t &scenario : corpus) {
+        for (const RssiTrace &trace : scenario.traces) {
+            filtered.clear();
+            filter.resetAll();
+            for (const trace_sample_t &s : trace.samples) {
+                uint8_t rssi = filter.filter(0, s.rssi);
+                filtered.push_back({s.timeUs, rssi, filter.raw(0)});
+            }
+            detector->reset();
+            auto begin = std::chrono::steady_clock::now();
+            for (const detector_sample_t &s : filtered) {
+                passes += detector->sample(s, enter, exit, true);
+            }
+            ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            *samples += filtered.size();
+        }
+    }
+    detectSink = passes;  // keeps the calls
+    return *samples ? ns / *samples : 0;
+}
+
+// Every detector through LapTimer on a labelled corpus: synthetic races with
+// the conditions the detectors differ on, plus recorded traces with pass lines.
+int runDetect(int argc, char **argv) {
+    uint32_t races = 10;
+    uint32_t seed = 1;
+    const char *tracePaths[DETECT_MAX_TRACES];
+    uint8_t traceCount = 0;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+    params.minLap = 1;  // short enough for multipath to be counted twice
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--enter")) {
+            params.enterRssi = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--exit")) {
+            params.exitRssi = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--min-lap")) {
+            params.minLap = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--trace") && traceCount < DETECT_MAX_TRACES) {
+            tracePaths[traceCount++] = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || synth.sampleRateHz == 0) return CMD_USAGE;
+
+    std::vector<detect_scenario_t> corpus(5);
+    corpus[0].name = "clean";
+    corpus[1].name = "noisy";
+    corpus[2].name = "multipath";
+    corpus[3].name = "fast low";
+    corpus[4].name = "recorded";
+    SimRandom rnd(seed);
+    for (uint32_t r = 0; r < races; r++) {
+        synth_params_t p = synth;
+        corpus[0].traces.emplace_back();
+        corpus[0].traces.back().synthesize(p, seed + r);
+
+        p.noiseStdDev = 8;
+        corpus[1].traces.emplace_back();
+        corpus[1].traces.back().synthesize(p, seed + r);
+
+        // a reflection cancelling the signal near the top, the pass splits in two
+        p = synth;
+        p.fadeDepth = 0.6f + rnd.uniform() * 0.35f;
+        p.fadeWidthMs = 8 + rnd.next() % 12;
+        p.fadeOffsetMs = (int32_t)(rnd.next() % 120) - 60;
+        corpus[2].traces.emplace_back();
+        corpus[2].traces.back().synthesize(p, seed + r);
+
+        // fast passes that barely reach enter, or not at all
+        p = synth;
+        p.passWidthMs = 25;
+        p.peakRssi = params.enterRssi - 8 + rnd.next() % 16;
+        corpus[3].traces.emplace_back();
+        corpus[3].traces.back().synthesize(p, seed + r);
+    }
+    for (uint8_t i = 0; i < traceCount; i++) {
+        corpus[4].traces.emplace_back();
+        if (!corpus[4].traces.back().load(tracePaths[i]) || corpus[4].traces.back().passTimesUs.empty()) {
+            printf("Cannot load trace %s, or it has no pass lines\n", tracePaths[i]);
+            return 1;
+        }
+    }
+    if (traceCount == 0) corpus.pop_back();
+
+    static RaceSimulator sim;
+    race_result_t result;
+    detect_score_t totals[DETECTOR_COUNT] = {};
+    printf("%u races per scenario at %u Hz, enter %u, exit %u, min lap %.1f s, match within %u ms\n", races, synth.sampleRateHz,
+           params.enterRssi, params.exitRssi, params.minLap / 10.0, DETECT_MATCH_US / 1000);
+    printf("scenario\tdetector\tpasses\tprecision\trecall\tbias us\t\tlap p50 us\tlap p95 us\n");
+    for (const detect_scenario_t &scenario : corpus) {
+        for (uint8_t d = 0; d < DETECTOR_COUNT; d++) {
+            detect_score_t s = {};
+            params.detector = (detector_type_e)d;
+            for (const RssiTrace &trace : scenario.traces) {
+                sim.run(&trace, params, &result);
+                // lap times back to pass times, the trace starts with the race
+                std::vector<uint32_t> detected;
+                uint32_t passUs = 0;
+                for (uint32_t lapUs : result.detectedUs) {
+                    passUs += lapUs;
+                    detected.push_back(passUs);
+                }
+                score(trace.passTimesUs, detected, &s);
+            }
+            printScore(scenario.name, (detector_type_e)d, s);
+            totals[d].passes += s.passes;
+            totals[d].truePositives += s.truePositives;
+            totals[d].falsePositives += s.falsePositives;
+            totals[d].biasSumUs += s.biasSumUs;
+            totals[d].lapErrorsUs.insert(totals[d].lapErrorsUs.end(), s.lapErrorsUs.begin(), s.lapErrorsUs.end());
+        }
+    }
+    for (uint8_t d = 0; d < DETECTOR_COUNT; d++) {
+        printScore("all", (detector_type_e)d, totals[d]);
+    }
+
+    printf("detector\tns/sample\n");
+    for (uint8_t d = 0; d < DETECTOR_COUNT; d++) {
+        uint64_t samples;
+        double ns = nsPerSample((detector_type_e)d, corpus, params.enterRssi, params.exitRssi, &samples);
+        printf("%-8s\t%.1f\n", detectorName((detector_type_e)d), ns);
+    }
+    return 0;
+}
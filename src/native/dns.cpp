@@ -0,0 +1,275 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "captivedns.h"
+#include "commands.h"
+#include "hal_native.h"
+#include "probe.h"
+#include "scheduler.h"
+
+#define DNS_AP_ADDRESS 0x14000001   // 20.0.0.1, what the timer's AP answers with
+#define DNS_TICK_MS 2               // the flood sends a query every tick
+#define DNS_PHONE_TICKS 50          // a phone asks every 100 ms, A and AAAA in turn
+#define DNS_MALFORMED_TICKS 250     // and the first one sends garbage every 500 ms
+#define DNS_TARGET_P99_US 5000
+#define DNS_PHONE_ADDRESS 0x7F00000A  // 127.0.0.10 and up, one address a client like on the AP
+#define DNS_FLOOD_ADDRESS 0x7F0000FA
+
+typedef struct {
+    int fd;
+    uint32_t address;
+    bool flood;
+    std::vector<uint32_t> sentUs;  // by query id
+    std::vector<uint32_t> latencies;
+    uint32_t queries;
+    uint32_t answered;
+    uint32_t bad;  // wrong bytes, or an answer to a query that had none coming
+    uint32_t malformed;
+} dns_client_t;
+
+static const char *names[] = {"connectivitycheck.gstatic.com", "captive.apple.com", "www.msftconnecttest.com", "plt.local"};
+
+static WallClock wall;
+
+static int openSocket(uint32_t address, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(address);
+    addr.sin_port = htons(port);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a query the way phones send it, with an EDNS record after the question
+static size_t makeQuery(uint16_t id, const char *name, uint16_t type, uint8_t *out) {
+    const uint8_t header[12] = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 1};
+    memcpy(out, header, sizeof(header));
+    size_t at = sizeof(header);
+    for (const char *label = name; *label;) {
+        const char *dot = strchr(label, '.');
+        size_t n = dot ? dot - label : strlen(label);
+        out[at++] = n;
+        memcpy(&out[at], label, n);
+        at += n;
+        label += n + (dot ? 1 : 0);
+    }
+    out[at++] = 0;
+    const uint8_t tail[] = {(uint8_t)(type >> 8), (uint8_t)type, 0, 1, 0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(&out[at], tail, sizeof(tail));
+    return at + sizeof(tail);
+}
+
+static uint16_t queryType(uint16_t id) {
+    return id & 1 ? 28 : 1;  // AAAA, A
+}
+
+// byte for byte what the timer must answer: the question back, the address for an A
+static bool checkResponse(const uint8_t *r, size_t len, uint16_t id) {
+    uint8_t query[CAPTIVEDNS_MAX_SIZE];
+    size_t n = makeQuery(id, names[id % (sizeof(names) / sizeof(names[0]))], queryType(id), query) - 11;  // without the EDNS record
+    const uint8_t answer[CAPTIVEDNS_ANSWER_SIZE] = {0xC0, 12, 0, 1, 0, 1, 0, 0, 0, CAPTIVEDNS_TTL_S, 0, 4, 20, 0, 0, 1};
+    bool a = queryType(id) == 1;
+    if (len != n + (a ? sizeof(answer) : 0)) return false;
+    const uint8_t header[12] = {(uint8_t)(id >> 8), (uint8_t)id, 0x85, 0x80, 0, 1, 0, (uint8_t)a, 0, 0, 0, 0};
+    if (memcmp(r, header, sizeof(header)) || memcmp(&r[12], &query[12], n - 12)) return false;
+    return !a || !memcmp(&r[n], answer, sizeof(answer));
+}
+
+static void receiveResponses(std::vector<dns_client_t> &clients, volatile bool *done) {
+    std::vector<pollfd> fds;
+    for (dns_client_t &c : clients) fds.push_back({c.fd, POLLIN, 0});
+    uint8_t buf[CAPTIVEDNS_MAX_SIZE];
+    while (!*done) {
+        if (poll(fds.data(), fds.size(), 20) <= 0) continue;
+        uint32_t nowUs = wall.micros();
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            dns_client_t &c = clients[i];
+            ssize_t len = recv(c.fd, buf, sizeof(buf), 0);
+            if (len < 2) continue;
+            uint16_t id = (buf[0] << 8) | buf[1];
+            if (id >= c.sentUs.size() || !c.sentUs[id] || !checkResponse(buf, len, id)) {
+                c.bad++;
+                continue;
+            }
+            c.answered++;
+            c.latencies.push_back(nowUs - c.sentUs[id]);
+            c.sentUs[id] = 0;  // a second answer is a bad one
+        }
+    }
+}
+
+// one query as it arrives, or as the web service finds it on its pass
+static void respond(CaptiveDns *dns, int fd) {
+    uint8_t in[CAPTIVEDNS_MAX_SIZE], out[CAPTIVEDNS_MAX_SIZE];
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t len = recvfrom(fd, in, sizeof(in), MSG_DONTWAIT, (sockaddr *)&from, &fromLen);
+    if (len < 0) return;
+    uint32_t startCycles = halCycles();
+    size_t n = dns->handle(in, len, ntohl(from.sin_addr.s_addr), wall.micros() / 1000, out, sizeof(out));
+    if (n) sendto(fd, out, n, 0, (sockaddr *)&from, fromLen);
+    probeRecord(PROBE_DNS, halCycles() - startCycles);
+}
+
+/*
+ * Phones and a flooding client on their own loopback addresses against the
+ * responder on another thread: polled means DNSServer::processNextRequest()
+ * from the web service, one query a pass at the longest scheduler wait;
+ * else the query is answered as its datagram arrives, like the AsyncUDP
+ * callback. Returns the queries sent.
+ */
+static uint32_t sendQueries(CaptiveDns *dns, std::vector<dns_client_t> &clients, int server, uint16_t port, bool polled, uint32_t seconds) {
+    dns->init(DNS_AP_ADDRESS);
+    probeReset();
+    uint32_t ticks = seconds * 1000 / DNS_TICK_MS;
+    for (dns_client_t &c : clients) {
+        c.sentUs.assign(ticks + 1, 0);
+        c.latencies.clear();
+        c.queries = c.answered = c.bad = c.malformed = 0;
+        while (recv(c.fd, NULL, 0, MSG_DONTWAIT) >= 0) {
+        }
+    }
+    while (recv(server, NULL, 0, MSG_DONTWAIT) >= 0) {  // what the last run left
+    }
+    wall.start();
+    volatile bool done = false;
+
+    std::thread responder([&]() {
+        pollfd fd = {server, POLLIN, 0};
+        while (!done) {
+            if (polled) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(SCHEDULER_MAX_WAIT_MS));
+                respond(dns, server);
+            } else if (poll(&fd, 1, 20) > 0) {
+                respond(dns, server);
+            }
+        }
+    });
+    std::thread receiver([&]() { receiveResponses(clients, &done); });
+
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(port);
+    uint8_t query[CAPTIVEDNS_MAX_SIZE];
+    uint32_t sent = 0;
+    for (uint32_t tick = 0; tick < ticks; tick++) {
+        std::this_thread::sleep_until(wall.at(tick * DNS_TICK_MS));
+        for (size_t i = 0; i < clients.size(); i++) {
+            dns_client_t &c = clients[i];
+            if (!c.flood && (tick + i * 7) % DNS_PHONE_TICKS) continue;
+            uint16_t id = tick;
+            size_t len = makeQuery(id, names[id % (sizeof(names) / sizeof(names[0]))], queryType(id), query);
+            c.sentUs[id] = wall.micros() | 1;
+            if (sendto(c.fd, query, len, 0, (sockaddr *)&to, sizeof(to)) != (ssize_t)len) continue;
+            c.queries++;
+            sent++;
+        }
+        if (tick % DNS_MALFORMED_TICKS == DNS_MALFORMED_TICKS / 2) {
+            const uint8_t garbage[] = {0xFF, 0xFF, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0, 63, 'x'};  // a label past the end
+            if (sendto(clients[0].fd, garbage, sizeof(garbage), 0, (sockaddr *)&to, sizeof(to)) == sizeof(garbage)) {
+                clients[0].malformed++;
+                sent++;
+            }
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SCHEDULER_MAX_WAIT_MS * 2));  // the last ones out
+    done = true;
+    responder.join();
+    receiver.join();
+    return sent;
+}
+
+// Captive portal DNS on loopback: phones and a flood, polled once per web
+// pass like DNSServer against answered as each query arrives.
+int runDns(int argc, char **argv) {
+    uint32_t seconds = 3;
+    uint32_t phones = 8;
+    uint16_t port = 10053;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--seconds")) {
+            seconds = val;
+        } else if (!strcmp(argv[i], "--clients")) {
+            phones = val;
+        } else if (!strcmp(argv[i], "--port")) {
+            port = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || seconds == 0 || seconds > 60 || phones == 0 || phones >= CAPTIVEDNS_CLIENTS || port == 0) return CMD_USAGE;
+
+    halNativeReset();
+    static CaptiveDns dns;
+    int server = openSocket(INADDR_LOOPBACK, port);
+    std::vector<dns_client_t> clients(phones + 1);
+    for (uint32_t i = 0; i <= phones; i++) {
+        clients[i].flood = i == phones;
+        clients[i].address = clients[i].flood ? DNS_FLOOD_ADDRESS : DNS_PHONE_ADDRESS + i;
+        clients[i].fd = openSocket(clients[i].address, 0);
+        if (clients[i].fd < 0) server = -1;
+    }
+    if (server < 0) {
+        printf("no loopback sockets on port %u\n", port);
+        return 1;
+    }
+
+    printf("real time, %u s each, %u phones asking every %u ms, one client flooding every %u ms\n", seconds, phones, DNS_PHONE_TICKS * DNS_TICK_MS,
+           DNS_TICK_MS);
+    printf("responder\tsent\tphones\t\tflood\tp50\t\tp99\t\tmax\n");
+    bool ok = true;
+    for (int polled = 1; polled >= 0; polled--) {
+        uint32_t sent = sendQueries(&dns, clients, server, port, polled, seconds);
+        std::vector<uint32_t> latencies;
+        uint32_t asked = 0, answered = 0, bad = 0;
+        for (dns_client_t &c : clients) {
+            bad += c.bad;
+            if (c.flood) continue;
+            asked += c.queries;
+            answered += c.answered;
+            latencies.insert(latencies.end(), c.latencies.begin(), c.latencies.end());
+        }
+        const dns_client_t &flood = clients[phones];
+        uint32_t p99 = percentile(latencies, 0.99);
+        printf("%s\t%u\t%u of %u\t%u\t%u us\t\t%u us\t\t%u us\n", polled ? "polled" : "on arrival", sent, answered, asked, flood.answered,
+               percentile(latencies, 0.5), p99, percentile(latencies, 1.0));
+        if (polled) continue;
+
+        captive_dns_stats_t stats;
+        dns.getStats(&stats);
+        probe_summary_t probe;
+        probeSummary(PROBE_DNS, &probe);
+        char json[CAPTIVEDNS_JSON_SIZE];
+        dns.toJson(json, sizeof(json));
+        printf("stats:\t\t%s, %s probe p99 %.1f us\n", json, probeName(PROBE_DNS), probe.p99Us);
+        uint32_t floodMax = CAPTIVEDNS_BURST + CAPTIVEDNS_RATE_QPS * (seconds + 1);
+        ok = ok && answered == asked && !bad && p99 < DNS_TARGET_P99_US && flood.answered <= floodMax && flood.answered >= floodMax / 2;
+        ok = ok && stats.queries == sent && stats.malformed == clients[0].malformed && stats.limited == sent - stats.answered - stats.empty - stats.malformed;
+        ok = ok && stats.answered + stats.empty == answered + flood.answered;
+    }
+    for (dns_client_t &c : clients) close(c.fd);
+    close(server);
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
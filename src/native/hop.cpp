@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "racesim.h"
+#include "trace.h"
+
+// Several pilots on one receiver: a synthetic trace per pilot, the receiver
+// hops between their frequencies and each pilot's laps are checked on its own.
+// With --receivers the pilots are shared out to that many modules on one bus.
+int runHop(int argc, char **argv) {
+    uint32_t races = 10;
+    uint32_t seed = 1;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+    params.pilots = CONFIG_MAX_PILOTS;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--pilots")) {
+            params.pilots = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--receivers")) {
+            params.receivers = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--laps")) {
+            synth.laps = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--noise")) {
+            synth.noiseStdDev = strtof(val, NULL);
+        } else if (!strcmp(argv[i], "--width")) {
+            synth.passWidthMs = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || params.pilots < 1 || params.pilots > CONFIG_MAX_PILOTS || synth.sampleRateHz == 0) return CMD_USAGE;
+    if (params.receivers < 1 || params.receivers > BOARD_MAX_RECEIVERS) return CMD_USAGE;
+
+    static RssiTrace traces[CONFIG_MAX_PILOTS];
+    static RaceSimulator sim;
+    race_result_t results[CONFIG_MAX_PILOTS];
+
+    uint64_t lapsExpected[CONFIG_MAX_PILOTS] = {};
+    uint64_t lapsDetected[CONFIG_MAX_PILOTS] = {};
+    uint64_t rateSum[CONFIG_MAX_PILOTS] = {};
+    uint32_t worstGapUs[CONFIG_MAX_PILOTS] = {};
+    double errorSum[CONFIG_MAX_PILOTS] = {};
+    double errorMax[CONFIG_MAX_PILOTS] = {};
+    uint32_t racesExact = 0;
+
+    for (uint32_t r = 0; r < races; r++) {
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            traces[i].synthesize(synth, seed + r * CONFIG_MAX_PILOTS + i);
+        }
+        sim.run(traces, params, results);
+
+        bool exact = true;
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            race_result_t &result = results[i];
+            lapsExpected[i] += result.lapsExpected;
+            lapsDetected[i] += result.lapsDetected;
+            rateSum[i] += result.effectiveRateHz;
+            if (result.worstGapUs > worstGapUs[i]) worstGapUs[i] = result.worstGapUs;
+            errorSum[i] += result.meanAbsErrorMs * result.lapsExpected;
+            if (result.maxAbsErrorMs > errorMax[i]) errorMax[i] = result.maxAbsErrorMs;
+            if (result.lapsDetected != result.lapsExpected) exact = false;
+        }
+        if (exact) racesExact++;
+    }
+
+    printf("%u races, %u pilots, %u Hz, dwell %u ms per pilot", races, params.pilots, synth.sampleRateHz, FREQHOP_DWELL_MS);
+    if (params.receivers > 1) printf(", %u receivers", params.receivers);
+    printf("\n");
+    printf("pilot\tMHz\tlaps\tdetected\trate Hz\tworst gap ms\tmean error ms\tmax error ms\n");
+    for (uint8_t i = 0; i < params.pilots; i++) {
+        printf("%u\t%u\t%llu\t%llu\t\t%llu\t%.1f\t\t%.2f\t\t%.2f\n", i + 1, params.frequency[i], (unsigned long long)lapsExpected[i],
+               (unsigned long long)lapsDetected[i], (unsigned long long)(races ? rateSum[i] / races : 0), worstGapUs[i] / 1000.0,
+               lapsExpected[i] ? errorSum[i] / lapsExpected[i] : 0.0, errorMax[i]);
+    }
+    printf("races with every lap of every pilot: %u\n", racesExact);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <new>
+
+#include "commands.h"
+#include "config.h"
+#include "hal_native.h"
+
+#define JSON_TEXT_SIZE 1024
+
+// every operator new of the program, counted while a measurement runs
+static bool counting = false;
+static uint64_t newBytes = 0;
+static uint32_t newCalls = 0;
+
+void *operator new(size_t size) {
+    if (counting) {
+        newBytes += size;
+        newCalls++;
+    }
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+// what a JsonDocument takes from the heap
+class CountingAllocator : public ArduinoJson::Allocator {
+   public:
+    uint64_t bytes = 0;
+    uint32_t calls = 0;
+
+    void *allocate(size_t size) override {
+        bytes += size;
+        calls++;
+        return malloc(size);
+    }
+
+    void deallocate(void *p) override {
+        free(p);
+    }
+
+    void *reallocate(void *p, size_t size) override {
+        bytes += size;
+        calls++;
+        return realloc(p, size);
+    }
+};
+
+typedef struct {
+    char text[JSON_TEXT_SIZE];
+    size_t length;
+} json_text_t;
+
+static void printToText(void *arg, const char *text) {
+    json_text_t *out = (json_text_t *)arg;
+    size_t n = strlen(text);
+    if (out->length + n >= sizeof(out->text)) n = sizeof(out->text) - 1 - out->length;
+    memcpy(out->text + out->length, text, n);
+    out->length += n;
+    out->text[out->length] = 0;
+}
+
+// Config::toJson and toJsonString as they were, a document filled per request
+static void documentJson(const laptimer_config_t *conf, JsonDocument &config) {
+    config["freq"] = conf->frequency;
+    config["minLap"] = conf->minLap;
+    config["alarm"] = conf->alarm;
+    config["anType"] = conf->announcerType;
+    config["anRate"] = conf->announcerRate;
+    config["enterRssi"] = conf->enterRssi;
+    config["exitRssi"] = conf->exitRssi;
+    config["name"] = (char *)conf->pilotName;
+    config["ssid"] = (char *)conf->ssid;
+    config["pwd"] = (char *)conf->password;
+    config["pilots"] = conf->pilots;
+    JsonArray freqs = config["pilotFreq"].to<JsonArray>();
+    JsonArray enters = config["pilotEnter"].to<JsonArray>();
+    JsonArray exits = config["pilotExit"].to<JsonArray>();
+    for (uint8_t i = 0; i < CONFIG_MAX_PILOTS - 1; i++) {
+        freqs.add(conf->pilotFrequency[i]);
+        enters.add(conf->pilotEnterRssi[i]);
+        exits.add(conf->pilotExitRssi[i]);
+    }
+    config["detector"] = conf->detector;
+    JsonArray floors = config["floorRssi"].to<JsonArray>();
+    for (uint8_t i = 0; i < CONFIG_MAX_PILOTS; i++) {
+        floors.add(conf->floorRssi[i]);
+    }
+}
+
+static uint64_t nsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A POST with odd strings, a pilot count out of range and arrays with gaps,
+// then /config and /status written both ways: the same text, and what each
+// takes from the heap per request.
+int runJson(int argc, char **argv) {
+    uint32_t requests = 10000;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--requests")) {
+            requests = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || requests == 0) return CMD_USAGE;
+
+    static Config config;
+    static Config parsed;
+    static json_text_t text;
+    char expected[JSON_TEXT_SIZE];
+    bool ok = true;
+    halNativeReset();
+    config.init();
+
+    const char *body =
+        "{\"freq\":5800,\"minLap\":55,\"enterRssi\":140,\"name\":\"Ace \\\"Q\\\" \\\\ 1\",\"ssid\":\"field\\tnet\",\"pilots\":9,"
+        "\"pilotFreq\":[5740,null,5880],\"detector\":1,\"floorRssi\":[60,61]}";
+    JsonDocument request;
+    DeserializationError error = deserializeJson(request, body);
+    if (error) {
+        printf("request body: %s\n", error.c_str());
+        return 1;
+    }
+    counting = true;
+    newBytes = newCalls = 0;
+    config.fromJson(request.as<JsonObject>());
+    counting = false;
+    const laptimer_config_t *c = config.getConfig();
+    bool applied = c->frequency == 5800 && c->minLap == 55 && c->alarm == 36 && !strcmp(c->pilotName, "Ace \"Q\" \\ 1") &&
+                   !strcmp(c->ssid, "field\tnet") && c->pilots == CONFIG_MAX_PILOTS && c->pilotFrequency[0] == 5740 &&
+                   c->pilotFrequency[1] == 5732 && c->pilotFrequency[2] == 5880 && c->floorRssi[1] == 61 && c->floorRssi[2] == 0;
+    printf("fromJson: %s, %llu bytes in %u allocations\n", applied ? "applied, missing members kept, pilots clamped" : "WRONG",
+           (unsigned long long)newBytes, newCalls);
+    ok = applied && newCalls == 0;
+
+    for (int pretty = 0; pretty < 2; pretty++) {
+        CountingAllocator allocator;
+        uint64_t documentNs = 0, tableNs = 0;
+        uint64_t tableBytes = 0;
+        uint32_t tableCalls = 0;
+        for (uint32_t i = 0; i < requests; i++) {
+            auto start = std::chrono::steady_clock::now();
+            {
+                JsonDocument document(&allocator);
+                documentJson(c, document);
+                if (pretty) {
+                    serializeJsonPretty(document, expected, sizeof(expected));
+                } else {
+                    serializeJson(document, expected, sizeof(expected));
+                }
+            }
+            documentNs += nsSince(start);
+
+            text.length = 0;
+            text.text[0] = 0;
+            newBytes = newCalls = 0;
+            counting = true;
+            start = std::chrono::steady_clock::now();
+            config.toJson(pretty, printToText, &text);
+            tableNs += nsSince(start);
+            counting = false;
+            tableBytes += newBytes;
+            tableCalls += newCalls;
+        }
+        bool same = !strcmp(expected, text.text);
+        printf("%s, %u requests: %s\n", pretty ? "/status (pretty)" : "/config", requests, same ? "same text" : "DIFFERENT");
+        if (!same) printf("  document: %s\n  table:    %s\n", expected, text.text);
+        printf("  JsonDocument: %.1f bytes in %.1f allocations per request, %llu ns/request\n", (double)allocator.bytes / requests,
+               (double)allocator.calls / requests, (unsigned long long)(documentNs / requests));
+        printf("  field table:  %.1f bytes in %.1f allocations per request, %llu ns/request\n", (double)tableBytes / requests,
+               (double)tableCalls / requests, (unsigned long long)(tableNs / requests));
+        ok = ok && same && tableCalls == 0;
+    }
+
+    // what /config sends has to come back as the same settings
+    parsed.init();
+    JsonDocument echo;
+    text.length = 0;
+    config.toJson(false, printToText, &text);
+    ok = ok && !deserializeJson(echo, text.text);
+    parsed.fromJson(echo.as<JsonObject>());
+    bool same = !memcmp(parsed.getConfig(), config.getConfig(), sizeof(laptimer_config_t));
+    printf("round trip: %s\n", same ? "same settings" : "DIFFERENT");
+    ok = ok && same;
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
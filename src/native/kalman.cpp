@@ -0,0 +1,128 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "commands.h"
+#include "fixedkalman.h"
+#include "kalman.h"
+#include "trace.h"
+
+#define BENCH_CHANNELS 4
+
+// LapTimer's filter settings
+static const float measurementNoise = 2000 * 0.01f;
+static const float processNoise = 40 * 0.0001f;
+
+static volatile uint32_t sink;
+
+template <typename F>
+static double nsPerSample(const std::vector<uint8_t> &input, uint32_t repeats, F &&run) {
+    auto begin = std::chrono::steady_clock::now();
+    uint32_t sum = 0;
+    for (uint32_t r = 0; r < repeats; r++) {
+        sum += run();
+    }
+    sink = sum;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    return ns / ((double)input.size() * repeats);
+}
+
+template <uint8_t FRAC_BITS>
+static void compare(const char *name, const std::vector<uint8_t> &input, uint32_t repeats) {
+    // accuracy against the float filter, sample by sample
+    KalmanFilter reference;
+    reference.setMeasurementNoise(measurementNoise);
+    reference.setProcessNoise(processNoise);
+    FixedKalmanFilter<FRAC_BITS> fixed;
+    fixed.setNoise(measurementNoise, processNoise);
+
+    double maxRawError = 0;
+    uint32_t maxRoundedError = 0;
+    uint32_t mismatches = 0;
+    for (uint8_t z : input) {
+        float expected = reference.filter(z, 0);
+        uint8_t out = fixed.filter(z);
+        double rawError = fabs(fixed.raw() / (double)(1UL << FRAC_BITS) - expected);
+        uint32_t roundedError = abs((int)out - (int)lroundf(expected));
+        if (rawError > maxRawError) maxRawError = rawError;
+        if (roundedError > maxRoundedError) maxRoundedError = roundedError;
+        if (roundedError) mismatches++;
+    }
+
+    double ns = nsPerSample(input, repeats, [&]() {
+        FixedKalmanFilter<FRAC_BITS> f;
+        f.setNoise(measurementNoise, processNoise);
+        uint32_t sum = 0;
+        for (uint8_t z : input) sum += f.filter(z);
+        return sum;
+    });
+
+    static RssiFilterBank<BENCH_CHANNELS, FRAC_BITS> bank;
+    bank.setNoise(measurementNoise, processNoise);
+    double nsBank = nsPerSample(input, repeats, [&]() {
+        uint32_t sum = 0;
+        for (uint8_t z : input) {
+            for (uint8_t c = 0; c < BENCH_CHANNELS; c++) sum += bank.filter(c, z + c);
+        }
+        return sum;
+    }) / BENCH_CHANNELS;
+
+    printf("%s\t%6.2f ns\t%6.2f ns\t\t%.6f\t%u (%u samples)\t%u steps\n", name, ns, nsBank, maxRawError, maxRoundedError, mismatches,
+           fixed.gains().scheduleLength());
+}
+
+int runKalman(int argc, char **argv) {
+    uint32_t samples = 200000;
+    uint32_t repeats = 20;
+    uint32_t seed = 1;
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--samples")) {
+            samples = val;
+        } else if (!strcmp(argv[i], "--repeats")) {
+            repeats = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || samples == 0) return CMD_USAGE;
+
+    // synthetic race at 10 kHz, a realistic mix of noise floor and passes
+    synth_params_t synth;
+    synthDefaults(&synth);
+    synth.sampleRateHz = 10000;
+    synth.noiseStdDev = 6;
+    synth.lapTimeMs = 3000;
+    synth.lapJitterMs = 500;
+    synth.firstPassMs = 1000;
+    RssiTrace trace;
+    std::vector<uint8_t> input;
+    while (input.size() < samples) {
+        trace.synthesize(synth, seed++);
+        for (const trace_sample_t &s : trace.samples) {
+            if (input.size() < samples) input.push_back(s.rssi);
+        }
+    }
+
+    double nsFloat = nsPerSample(input, repeats, [&]() {
+        KalmanFilter f;
+        f.setMeasurementNoise(measurementNoise);
+        f.setProcessNoise(processNoise);
+        uint32_t sum = 0;
+        for (uint8_t z : input) sum += (uint8_t)round(f.filter(z, 0));  // as LapTimer used it
+        return sum;
+    });
+
+    printf("%u samples x %u, Q = %.2f, R = %.4f\n", samples, repeats, measurementNoise, processNoise);
+    printf("filter\t\tns/sample\tns/sample x%u bank\tmax raw error\tmax rounded error\tgain schedule\n", BENCH_CHANNELS);
+    printf("float\t%6.2f ns\n", nsFloat);
+    compare<16>("Q16", input, repeats);
+    compare<15>("Q15", input, repeats);
+    return 0;
+}
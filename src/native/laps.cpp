@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "commands.h"
+#include "hal.h"
+#include "lapqueue.h"
+
+// every field follows from the sequence number, so a torn record shows
+static lap_event_t makeEvent(uint32_t seq) {
+    lap_event_t event = {LAP_EVENT_LAP, (uint8_t)(seq & 3), (uint8_t)(seq >> 2), (uint8_t)(seq * 13), (uint16_t)seq, seq * 7 + 1, ~seq, seq * 3};
+    return event;
+}
+
+static bool checkEvent(const lap_event_t &event, uint32_t *seq) {
+    *seq = ~event.timeUs;
+    lap_event_t expected = makeEvent(*seq);
+    return !memcmp(&event, &expected, sizeof(event));
+}
+
+typedef struct {
+    std::vector<uint32_t> accepted;
+    std::vector<uint32_t> received;
+    uint32_t torn;
+    uint32_t rejected;
+    uint32_t counted;  // by the queue
+    double seconds;
+} laps_run_t;
+
+/*
+ * One producer and one consumer thread on a LapQueue. The producer pushes
+ * events numbered 0..n-1 in random bursts, dropping them when the queue is
+ * full, or retrying until they fit with lossless; the consumer pops random
+ * bursts too, so the queue runs both empty and full. What came out has to be
+ * exactly what went in, in order, and the drop counter has to match.
+ */
+static void run(uint32_t events, bool lossless, uint32_t seed, laps_run_t *r) {
+    static LapQueue queue;
+    queue.clear();
+    r->accepted.clear();
+    r->received.clear();
+    r->accepted.reserve(events);
+    r->received.reserve(events);
+    r->torn = 0;
+    r->rejected = 0;
+    volatile bool done = false;
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        uint32_t rnd = seed;
+        lap_event_t event;
+        for (;;) {
+            bool finished = done;  // read before the last pop, nothing can come after
+            halMemoryBarrier();
+            // random bursts, then the other side gets a turn even on a single core
+            rnd = rnd * 1103515245 + 12345;
+            uint32_t burst = finished ? UINT32_MAX : (rnd >> 16) % (2 * LAPQUEUE_SIZE) + 1;
+            uint32_t popped = 0;
+            while (popped < burst && queue.pop(&event)) {
+                uint32_t seq;
+                if (!checkEvent(event, &seq)) r->torn++;
+                r->received.push_back(seq);
+                popped++;
+            }
+            if (finished) break;
+            std::this_thread::yield();
+        }
+    });
+    uint32_t rnd = ~seed;
+    uint32_t burst = 0;
+    for (uint32_t seq = 0; seq < events; seq++) {
+        if (burst-- == 0) {
+            rnd = rnd * 1103515245 + 12345;
+            burst = (rnd >> 16) % (2 * LAPQUEUE_SIZE);
+            std::this_thread::yield();
+        }
+        lap_event_t event = makeEvent(seq);
+        if (lossless) {
+            while (!queue.push(event)) {
+                r->rejected++;
+                std::this_thread::yield();
+            }
+        } else if (!queue.push(event)) {
+            continue;
+        }
+        r->accepted.push_back(seq);
+    }
+    halMemoryBarrier();
+    done = true;
+    consumer.join();
+    r->counted = queue.getDropped();
+    r->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int runLaps(int argc, char **argv) {
+    uint32_t events = 2000000;
+    uint32_t seed = 1;
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--events")) {
+            events = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || events == 0) return CMD_USAGE;
+
+    bool ok = true;
+    laps_run_t r;
+    printf("%u events through a %u slot queue, producer and consumer on their own threads\n", events, LAPQUEUE_SIZE);
+    printf("mode\t\tpushed\t\tdropped (counted)\treceived\ttorn\tin order\tns/event\n");
+    for (uint8_t lossless = 0; lossless < 2; lossless++) {
+        run(events, lossless, seed, &r);
+        uint32_t dropped = events - r.accepted.size();
+        bool same = r.received == r.accepted;
+        // retries count as drops too, the queue can't tell them apart
+        uint32_t expectedCounted = lossless ? r.rejected : dropped;
+        printf("%s\t%zu\t\t%u (%u)\t%zu\t\t%u\t%s\t\t%.1f\n", lossless ? "lossless" : "dropping", r.accepted.size(), dropped, r.counted,
+               r.received.size(), r.torn, same ? "yes" : "NO", r.seconds * 1e9 / events);
+        if (!same || r.torn || r.counted != expectedCounted) ok = false;
+        if (lossless && dropped) ok = false;
+    }
+    printf("result:\t\t%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
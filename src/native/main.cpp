@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+
+/*
+ * Host build of the timing core. Every command works on the simulated
+ * hardware from lib/HAL, so it runs as fast as the host allows.
+ */
+
+typedef struct {
+    const char *name;
+    int (*run)(int argc, char **argv);
+    const char *usage;
+} command_t;
+
+static const command_t commands[] = {
+    {"sim", runSim,
+     "[--trace file] [--dump file] [--races n] [--seed n] [--rate hz] [--laps n] [--lap-ms ms]\n"
+     "\t[--jitter-ms ms] [--tail-ms ms] [--noise sd]\n"
+     "\t[--enter rssi] [--exit rssi] [--min-lap 0.1s] [--detector peak|slope|matched]\n"
+     "\treplay a recorded trace or synthetic races through LapTimer and compare detected laps"},
+    {"adc", runAdc,
+     "[--rate hz] [--seconds s] [--max-stall ms] [--buffer frames] [--seed n]\n"
+     "\tdrain a synthetic continuous ADC source with a jittery reader, check rate and drops"},
+    {"clock", runClock,
+     "[--ppm n] [--races n] [--seed n]\n"
+     "\traces on an ADC running off its nominal rate, frames timed from that rate against the scan clock, lap error and measured rate"},
+    {"kalman", runKalman,
+     "[--samples n] [--repeats n] [--seed n]\n"
+     "\tbenchmark the fixed point RSSI filters against KalmanFilter, speed and error"},
+    {"peak", runPeak,
+     "[--races n] [--seed n] [--rate hz] [--noise sd] [--width ms]\n"
+     "\tlap timing error against known pass times, fitted peak versus highest sample"},
+    {"hop", runHop,
+     "[--pilots n] [--receivers n] [--races n] [--seed n] [--rate hz] [--laps n] [--noise sd] [--width ms]\n"
+     "\tseveral pilots on one receiver hopping between their frequencies, or shared out to receivers, laps, rate and error per pilot"},
+    {"bus", runBus,
+     "[--verbose]\n"
+     "\trecord the RX5808 bus for a series of frequency changes, bit-banged reference against the ticker driven driver"},
+    {"ws", runWs,
+     "[--races n] [--seed n] [--rate hz] [--stream hz] [--batch ms] [--pilots n]\n"
+     "\tRSSI for the calibration chart, SSE text events against batched binary WebSocket frames, bytes and messages per second"},
+    {"sessions", runSessions,
+     "[--cycles n] [--seed n] [--laps n] [--session-laps n] [--dir path]\n"
+     "\tsession log under random power cuts, synced laps must all come back, then logging and read back cost"},
+    {"detect", runDetect,
+     "[--races n] [--seed n] [--rate hz] [--enter rssi] [--exit rssi] [--min-lap 0.1s] [--trace file]...\n"
+     "\tevery lap detector on a labelled corpus, precision, recall, timing error and ns per sample"},
+    {"calib", runCalib,
+     "[--races n] [--seed n] [--rate hz]\n"
+     "\tcalibrate on practice passes at gates of different distance and noise floor, then race with the proposal and the defaults"},
+    {"laps", runLaps,
+     "[--events n] [--seed n]\n"
+     "\thammer the lap event queue from a producer and a consumer thread, nothing may be lost, duplicated or torn"},
+    {"probes", runProbes,
+     "[--races n] [--seed n] [--rate hz] [--pilots n] [--detector peak|slope|matched] [--json]\n"
+     "\tsimulated races with the hot path probes on, the same report as /metrics on the timer, in the native_probes build"},
+    {"assets", runAssets,
+     "[--dir path] [--source path]\n"
+     "\tthe web UI as scripts/assets.py builds it, every file has to resolve, inflate to its content and revalidate by ETag"},
+    {"json", runJson,
+     "[--requests n]\n"
+     "\t/config and /status JSON from the field table against an ArduinoJson document, same text and heap bytes per request"},
+    {"config", runConfig,
+     "[--minutes n] [--seed n] [--cuts n]\n"
+     "\tslider traffic on the config, flash erases with EEPROM commits and with the config store, then power cuts, old EEPROM imports and resized fields"},
+    {"sched", runSched,
+     "[--seconds n] [--seed n] [--pilots n]\n"
+     "\tthe service task driven by deadlines against polling, same pin edges, then CPU idle and lap event latency on a real thread"},
+    {"scan", runScan,
+     "[--step mhz] [--settle ms] [--receivers n] [--sweeps n] [--seed n]\n"
+     "\tspectrum sweeps over simulated transmitters on modules that take time to settle, peaks, error against the truth, max-hold and sweep time"},
+    {"sync", runSync,
+     "[--nodes n] [--seconds s] [--drift ppm] [--loss %] [--seed n]\n"
+     "\tnode processes on loopback UDP with drifting clocks, race start skew, laps on the master and clock error against their bounds"},
+    {"rhnode", runRhNode,
+     "[--races n] [--seed n] [--pilots n]\n"
+     "\ta RotorHazard server on the node protocol, byte exact discovery and settings, every pass read back from the lap stats, answer time"},
+    {"push", runPush,
+     "[--seconds n] [--seed n] [--stall ms]\n"
+     "\tlap events to the clients from the service task against a push task of their own, while services block, p50 and p99 on a real thread"},
+    {"tick", runTick,
+     "[--races n] [--rate hz] [--stall ms] [--seed n]\n"
+     "\tthe timing loop from loop() against the tick task with interrupt latency and stalls, same laps, missed ticks, jitter and work per tick"},
+    {"ota", runOta,
+     "[--size kb] [--seed n] [--base file --target file] [--dir path]\n"
+     "\tdelta updates applied into a file backed OTA slot, patch size and upload time against the full image, broken patches refused"},
+    {"otadiff", runOtaDiff,
+     "old.bin new.bin patch.bin\n"
+     "\tthe delta update from the image a timer runs to a new one, upload it with POST /ota/delta"},
+    {"dns", runDns,
+     "[--seconds n] [--clients n] [--port n]\n"
+     "\tcaptive portal DNS on loopback, polled once per web pass against answered on arrival, byte exact answers, a flooding client limited, p50 and p99"},
+};
+
+static void usage(const command_t *command) {
+    for (const command_t &c : commands) {
+        if (!command || command == &c) {
+            printf("program %s %s\n", c.name, c.usage);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    for (const command_t &c : commands) {
+        if (argc >= 2 && !strcmp(argv[1], c.name)) {
+            int ret = c.run(argc - 2, argv + 2);
+            if (ret == CMD_USAGE) {
+                usage(&c);
+                return 1;
+            }
+            return ret;
+        }
+    }
+    usage(NULL);
+    return 1;
+}
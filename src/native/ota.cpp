@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "otadelta.h"
+#include "sha256.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+#define OTA_SLOT_SIZE 0x140000     // app0 and app1 in partitions.csv
+#define OTA_LINK_KBIT 250          // what an upload gets over WIFI_PROTOCOL_LR
+#define OTA_TCP_SEGMENT 1460       // most the web server hands the body handler at once
+#define OTA_IMAGE_BASE 0x400D0000  // where code addresses in a synthetic image point
+#define OTA_LITERAL_ZEROS 3        // zeros in a row that end a literal run of the add bytes
+
+typedef std::vector<uint8_t> bytes_t;
+
+// the suffixes of old in order, by prefix doubling
+static std::vector<int32_t> suffixArray(const bytes_t &old) {
+    int32_t n = old.size();
+    std::vector<int32_t> sa(n), rank(n), next(n);
+    for (int32_t i = 0; i < n; i++) {
+        sa[i] = i;
+        rank[i] = old[i];
+    }
+    for (int32_t k = 1; k < n; k <<= 1) {
+        auto key = [&](int32_t i) { return std::make_pair(rank[i], i + k < n ? rank[i + k] : -1); };
+        std::sort(sa.begin(), sa.end(), [&](int32_t a, int32_t b) { return key(a) < key(b); });
+        next[sa[0]] = 0;
+        for (int32_t i = 1; i < n; i++) {
+            next[sa[i]] = next[sa[i - 1]] + (key(sa[i - 1]) < key(sa[i]));
+        }
+        rank.swap(next);
+        if (rank[sa[n - 1]] == n - 1) break;
+    }
+    return sa;
+}
+
+static int32_t matchLen(const bytes_t &old, int32_t from, const bytes_t &target, int32_t at) {
+    int32_t len = 0;
+    while (from + len < (int32_t)old.size() && at + len < (int32_t)target.size() && old[from + len] == target[at + len]) len++;
+    return len;
+}
+
+// the longest match of target at in old, by binary search over the suffixes
+static int32_t search(const std::vector<int32_t> &sa, const bytes_t &old, const bytes_t &target, int32_t at, int32_t *pos) {
+    int32_t lo = 0, hi = sa.size() - 1;
+    while (hi - lo > 1) {
+        int32_t mid = lo + (hi - lo) / 2;
+        int32_t len = matchLen(old, sa[mid], target, at);
+        bool less = sa[mid] + len == (int32_t)old.size() || (at + len < (int32_t)target.size() && old[sa[mid] + len] < target[at + len]);
+        if (less) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    int32_t lenLo = matchLen(old, sa[lo], target, at);
+    int32_t lenHi = matchLen(old, sa[hi], target, at);
+    *pos = lenLo >= lenHi ? sa[lo] : sa[hi];
+    return lenLo >= lenHi ? lenLo : lenHi;
+}
+
+static void putVarint(bytes_t *out, uint32_t v) {
+    while (v >= 0x80) {
+        out->push_back((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out->push_back(v);
+}
+
+static void put32(bytes_t *out, uint32_t v) {
+    for (uint8_t i = 0; i < 4; i++) out->push_back(v >> (8 * i));
+}
+
+static void sha256(const bytes_t &data, uint8_t *hash) {
+    Sha256 sha;
+    sha.init();
+    sha.update(data.data(), data.size());
+    sha.final(hash);
+}
+
+// add bytes as runs of zeros and literals, a literal run goes on over short gaps
+static void putAdd(bytes_t *out, const bytes_t &diff) {
+    size_t i = 0;
+    do {
+        size_t zeros = 0;
+        while (i + zeros < diff.size() && !diff[i + zeros]) zeros++;
+        i += zeros;
+        size_t end = i;
+        while (end < diff.size()) {
+            size_t gap = 0;
+            while (end + gap < diff.size() && !diff[end + gap] && gap < OTA_LITERAL_ZEROS) gap++;
+            if (gap == OTA_LITERAL_ZEROS || end + gap == diff.size()) break;
+            end += gap + 1;
+        }
+        putVarint(out, zeros);
+        putVarint(out, end - i);
+        out->insert(out->end(), diff.begin() + i, diff.begin() + end);
+        i = end;
+    } while (i < diff.size());
+}
+
+static void putOp(bytes_t *out, const bytes_t &diff, const bytes_t &extra, int32_t seek) {
+    putVarint(out, diff.size());
+    putVarint(out, extra.size());
+    putVarint(out, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+    if (!diff.empty()) putAdd(out, diff);
+    out->insert(out->end(), extra.begin(), extra.end());
+}
+
+/*
+ * The patch from old to target, after bsdiff 4: grow exact matches found in
+ * the suffix array into approximate ones, which turns code that moved with
+ * its addresses changed into add bytes that are mostly zero.
+ */
+static bytes_t makeDelta(const bytes_t &old, const bytes_t &target) {
+    bytes_t out(OTA_DELTA_MAGIC, OTA_DELTA_MAGIC + 4);
+    out.insert(out.end(), {OTA_DELTA_VERSION, 0, 0, 0});
+    uint8_t hash[SHA256_SIZE];
+    put32(&out, old.size());
+    sha256(old, hash);
+    out.insert(out.end(), hash, hash + SHA256_SIZE);
+    put32(&out, target.size());
+    sha256(target, hash);
+    out.insert(out.end(), hash, hash + SHA256_SIZE);
+
+    std::vector<int32_t> sa = suffixArray(old);
+    int32_t oldSize = old.size(), newSize = target.size();
+    int32_t scan = 0, len = 0, pos = 0, lastScan = 0, lastPos = 0, lastOffset = 0;
+    while (scan < newSize) {
+        int32_t oldScore = 0;
+        int32_t scsc = scan += len;
+        for (; scan < newSize; scan++) {
+            len = search(sa, old, target, scan, &pos);
+            for (; scsc < scan + len; scsc++) {
+                if (scsc + lastOffset < oldSize && old[scsc + lastOffset] == target[scsc]) oldScore++;
+            }
+            if ((len == oldScore && len != 0) || len > oldScore + 8) break;
+            if (scan + lastOffset < oldSize && old[scan + lastOffset] == target[scan]) oldScore--;
+        }
+        if (len == oldScore && scan != newSize) continue;
+
+        // how far the last match reaches forward and the new one back
+        int32_t s = 0, best = 0, lenF = 0;
+        for (int32_t i = 0; lastScan + i < scan && lastPos + i < oldSize;) {
+            if (old[lastPos + i] == target[lastScan + i]) s++;
+            i++;
+            if (s * 2 - i > best * 2 - lenF) {
+                best = s;
+                lenF = i;
+            }
+        }
+        int32_t lenB = 0;
+        if (scan < newSize) {
+            s = best = 0;
+            for (int32_t i = 1; scan >= lastScan + i && pos >= i; i++) {
+                if (old[pos - i] == target[scan - i]) s++;
+                if (s * 2 - i > best * 2 - lenB) {
+                    best = s;
+                    lenB = i;
+                }
+            }
+        }
+        if (lastScan + lenF > scan - lenB) {
+            int32_t overlap = (lastScan + lenF) - (scan - lenB);
+            int32_t lenS = 0;
+            s = best = 0;
+            for (int32_t i = 0; i < overlap; i++) {
+                if (target[lastScan + lenF - overlap + i] == old[lastPos + lenF - overlap + i]) s++;
+                if (target[scan - lenB + i] == old[pos - lenB + i]) s--;
+                if (s > best) {
+                    best = s;
+                    lenS = i + 1;
+                }
+            }
+            lenF += lenS - overlap;
+            lenB -= lenS;
+        }
+
+        bytes_t diff(lenF), extra(target.begin() + lastScan + lenF, target.begin() + scan - lenB);
+        for (int32_t i = 0; i < lenF; i++) {
+            diff[i] = target[lastScan + i] - old[lastPos + i];
+        }
+        putOp(&out, diff, extra, (pos - lenB) - (lastPos + lenF));
+        lastScan = scan - lenB;
+        lastPos = pos - lenB;
+        lastOffset = pos - scan;
+    }
+    return out;
+}
+
+static bool readFile(const char *path, bytes_t *data) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    data->clear();
+    uint8_t buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) data->insert(data->end(), buf, buf + got);
+    fclose(f);
+    return true;
+}
+
+static bool writeFile(const fs::path &path, const bytes_t &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+// an ESP32 app as far as a diff cares: code, literal pools with addresses into it, strings, the build stamp
+static bytes_t synthImage(size_t size, SimRandom *rnd) {
+    static const char *strings[] = {"PhobosLT", "RX5808 frequency not matching", "/timer/start", "application/json", "Node sync: master"};
+    uint8_t ops[256][3];
+    for (auto &op : ops) {
+        for (uint8_t &b : op) b = rnd->next();
+    }
+    bytes_t image = {HAL_NATIVE_IMAGE_MAGIC};
+    while (image.size() < size) {
+        uint32_t kind = rnd->next() % 16;
+        if (kind < 12) {
+            const uint8_t *op = ops[(rnd->next() % 16) * (rnd->next() % 16)];  // a few opcodes are most of the code
+            image.insert(image.end(), op, op + 2 + rnd->next() % 2);
+        } else if (kind < 15) {
+            put32(&image, OTA_IMAGE_BASE + (rnd->next() % size & ~3u));
+        } else {
+            const char *s = strings[rnd->next() % 5];
+            image.insert(image.end(), s, s + strlen(s) + 1);
+        }
+    }
+    image.resize(size);
+    return image;
+}
+
+static void stamp(bytes_t *image, SimRandom *rnd) {
+    for (size_t i = 1; i < 33; i++) (*image)[i] = rnd->next();  // build date and time
+    for (size_t i = image->size() - SHA256_SIZE; i < image->size(); i++) (*image)[i] = rnd->next();  // the appended hash
+}
+
+// a function added in the middle: what follows moves, and so do the addresses pointing there
+static bytes_t changeCode(const bytes_t &old, SimRandom *rnd) {
+    size_t at = old.size() / 4 + rnd->next() % (old.size() / 2);
+    size_t added = 256 + rnd->next() % 2048;
+    bytes_t image(old.begin(), old.begin() + at);
+    for (size_t i = 0; i < added; i++) image.push_back(rnd->next());
+    image.insert(image.end(), old.begin() + at, old.end());
+    for (size_t i = 0; i + 4 <= image.size(); i++) {
+        uint32_t word = image[i] | (image[i + 1] << 8) | (image[i + 2] << 16) | ((uint32_t)image[i + 3] << 24);
+        if (word >= OTA_IMAGE_BASE + at && word < OTA_IMAGE_BASE + old.size() && !(word & 3)) {
+            word += added & ~3u;
+            for (uint8_t k = 0; k < 4; k++) image[i + k] = word >> (8 * k);
+            i += 3;
+        }
+    }
+    for (uint8_t n = 0; n < 20; n++) image[rnd->next() % image.size()] = rnd->next();  // constants changed here and there
+    stamp(&image, rnd);
+    return image;
+}
+
+typedef struct {
+    bool ok;
+    ota_delta_error_e error;
+    bool activated;
+    uint32_t erases;
+    double applyMs;
+} apply_result_t;
+
+// through OtaDelta as the web server feeds it, chunk by chunk with 0 for TCP segments of random size
+static apply_result_t apply(const fs::path &running, const fs::path &slot, const bytes_t &patch, size_t chunk, SimRandom *rnd) {
+    static OtaDelta delta;
+    delta = OtaDelta();
+    halNativeSetImageFiles(running.c_str(), slot.c_str(), OTA_SLOT_SIZE);
+    halNativeReset();
+    apply_result_t r = {};
+    auto start = std::chrono::steady_clock::now();
+    while (!delta.hashImage()) {
+    }
+    bool ok = delta.begin();
+    for (size_t at = 0; ok && at < patch.size();) {
+        size_t n = chunk ? chunk : 1 + rnd->next() % OTA_TCP_SEGMENT;
+        if (n > patch.size() - at) n = patch.size() - at;
+        ok = delta.write(&patch[at], n);
+        at += n;
+    }
+    r.ok = ok && delta.end();
+    r.applyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    r.error = delta.getError();
+    r.activated = halNativeUpdateActivated();
+    r.erases = halNativeGetUpdateErases();
+    return r;
+}
+
+static bool slotHolds(const fs::path &slot, const bytes_t &image) {
+    bytes_t data;
+    return readFile(slot.c_str(), &data) && data.size() >= image.size() && std::equal(image.begin(), image.end(), data.begin());
+}
+
+static double linkSeconds(size_t bytes) {
+    return bytes * 8.0 / (OTA_LINK_KBIT * 1000);
+}
+
+// Writes the patch from one image to another, the host tool for delta updates.
+int runOtaDiff(int argc, char **argv) {
+    if (argc != 3) return CMD_USAGE;
+    bytes_t old, target;
+    if (!readFile(argv[0], &old) || !readFile(argv[1], &target) || old.empty() || target.empty()) {
+        printf("Can't read %s or %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    bytes_t patch = makeDelta(old, target);
+    if (!writeFile(argv[2], patch)) {
+        printf("Can't write %s\n", argv[2]);
+        return 1;
+    }
+    uint8_t hash[SHA256_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256(old, hash);
+    Sha256::toHex(hash, hex);
+    printf("%s: %zu bytes against %s (sha256 %s), %zu bytes, %.1f%% of the image\n", argv[2], patch.size(), argv[0], hex, target.size(),
+           100.0 * patch.size() / target.size());
+    return 0;
+}
+
+// Patches made by runOtaDiff applied through OtaDelta into a file backed
+// OTA slot: a rebuild, a code change and an unrelated image have to come out
+// byte exact and boot, a patch for another base, a corrupt and a cut one must
+// not. With --base and --target real images are used for the change.
+int runOta(int argc, char **argv) {
+    uint32_t sizeKb = 1024;
+    uint32_t seed = 1;
+    const char *base = NULL;
+    const char *targetFile = NULL;
+    const char *dir = NULL;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--size")) {
+            sizeKb = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--base")) {
+            base = val;
+        } else if (!strcmp(argv[i], "--target")) {
+            targetFile = val;
+        } else if (!strcmp(argv[i], "--dir")) {
+            dir = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || sizeKb < 16 || sizeKb * 1024 > OTA_SLOT_SIZE || !base != !targetFile) return CMD_USAGE;
+
+    fs::path root = dir ? fs::path(dir) : fs::temp_directory_path() / ("ota-" + std::to_string(seed));
+    fs::create_directories(root);
+    fs::path running = root / "running.bin", slot = root / "slot.bin";
+    SimRandom rnd(seed);
+
+    bytes_t old, changed;
+    if (base) {
+        if (!readFile(base, &old) || !readFile(targetFile, &changed) || old.empty() || changed.size() > OTA_SLOT_SIZE) {
+            printf("Can't use %s and %s as images\n", base, targetFile);
+            return 1;
+        }
+    } else {
+        old = synthImage(sizeKb * 1024, &rnd);
+        stamp(&old, &rnd);
+        changed = changeCode(old, &rnd);
+    }
+    bytes_t rebuilt = old;
+    stamp(&rebuilt, &rnd);
+    bytes_t unrelated = synthImage(old.size(), &rnd);
+
+    typedef struct {
+        const char *name;
+        const bytes_t *image;
+    } scenario_t;
+    const scenario_t scenarios[] = {{"rebuild", &rebuilt}, {"code change", &changed}, {"unrelated", &unrelated}};
+    printf("%zu byte image, %u KB slot, upload at %u kbit/s, patches applied in %zu bytes of RAM\n", old.size(), OTA_SLOT_SIZE / 1024,
+           OTA_LINK_KBIT, sizeof(OtaDelta));
+    printf("update\t\timage\tpatch\tratio\tdiff ms\tapply ms\tupload full\tdelta\n");
+    bool ok = writeFile(running, old);
+    bytes_t changePatch;
+    for (const scenario_t &s : scenarios) {
+        auto start = std::chrono::steady_clock::now();
+        bytes_t patch = makeDelta(old, *s.image);
+        double diffMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        apply_result_t r = apply(running, slot, patch, 0, &rnd);
+        bool exact = r.ok && r.activated && slotHolds(slot, *s.image);
+        printf("%s%s\t%zu\t%zu\t%.1f%%\t%.0f\t%.0f\t\t%.1f s\t\t%.1f s%s\n", s.name, strlen(s.name) < 8 ? "\t" : "", s.image->size(), patch.size(),
+               100.0 * patch.size() / s.image->size(), diffMs, r.applyMs, linkSeconds(s.image->size()), linkSeconds(patch.size()),
+               exact ? "" : "\tFAILED");
+        ok = ok && exact;
+        if (s.image == &changed) changePatch = patch;
+    }
+
+    // the change once more a byte at a time, the parser has to pick up anywhere
+    apply_result_t r = apply(running, slot, changePatch, 1, &rnd);
+    bool bytewise = r.ok && slotHolds(slot, changed);
+    printf("byte by byte:\t%s\n", bytewise ? "same image" : OtaDelta::errorName(r.error));
+    ok = ok && bytewise;
+
+    typedef struct {
+        const char *name;
+        bytes_t patch;
+        bool otherBase;
+    } broken_t;
+    broken_t broken[] = {{"other base", changePatch, true}, {"corrupt", changePatch, false}, {"cut short", changePatch, false}};
+    broken[1].patch[OTA_DELTA_HEADER_SIZE + rnd.next() % (changePatch.size() - OTA_DELTA_HEADER_SIZE)] ^= 1 << (rnd.next() % 8);
+    broken[2].patch.resize(changePatch.size() / 2);
+    for (broken_t &b : broken) {
+        ok = ok && writeFile(running, b.otherBase ? rebuilt : old);
+        apply_result_t r = apply(running, slot, b.patch, 0, &rnd);
+        bool refused = !r.ok && !r.activated && (!b.otherBase || (r.error == OTA_DELTA_ERR_BASE && r.erases == 0));
+        printf("%s:\t%s%s, %u sectors erased%s\n", b.name, strlen(b.name) < 7 ? "\t" : "", OtaDelta::errorName(r.error), r.erases,
+               refused ? ", not booted" : ", FAILED");
+        ok = ok && refused;
+    }
+
+    if (!dir) fs::remove_all(root);
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
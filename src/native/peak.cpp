@@ -0,0 +1,83 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "bench.h"
+#include "commands.h"
+#include "racesim.h"
+#include "trace.h"
+
+typedef struct {
+    std::vector<double> lapErrorUs;  // laps after the hole shot, absolute
+    double holeShotSumUs;
+    uint32_t holeShots;
+    uint32_t racesSkipped;
+} peak_stats_t;
+
+// Timing error of LapTimer against the known pass times of synthetic races,
+// with and without the parabola fit of the peak.
+int runPeak(int argc, char **argv) {
+    uint32_t races = 20;
+    uint32_t seed = 1;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--noise")) {
+            synth.noiseStdDev = strtof(val, NULL);
+        } else if (!strcmp(argv[i], "--width")) {
+            synth.passWidthMs = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || synth.sampleRateHz == 0) return CMD_USAGE;
+
+    static RssiTrace trace;
+    static RaceSimulator sim;
+    race_result_t result;
+    peak_stats_t stats[2] = {};
+
+    for (uint32_t r = 0; r < races; r++) {
+        trace.synthesize(synth, seed + r);
+        for (int fit = 0; fit < 2; fit++) {
+            params.peakFit = fit;
+            sim.run(&trace, params, &result);
+            if (result.lapsDetected != result.lapsExpected) {
+                stats[fit].racesSkipped++;  // misdetection, not a timing error
+                continue;
+            }
+            stats[fit].holeShotSumUs += (double)result.detectedUs[0] - (double)result.expectedUs[0];
+            stats[fit].holeShots++;
+            for (size_t i = 1; i < result.detectedUs.size(); i++) {
+                stats[fit].lapErrorUs.push_back(fabs((double)result.detectedUs[i] - (double)result.expectedUs[i]));
+            }
+        }
+    }
+
+    printf("%u races at %u Hz, noise sd %.1f, pass width %u ms\n", races, synth.sampleRateHz, synth.noiseStdDev, synth.passWidthMs);
+    printf("peak\t\tlaps\tp50 us\tp95 us\tmax us\thole shot bias us\tskipped races\n");
+    for (int fit = 1; fit >= 0; fit--) {
+        peak_stats_t &s = stats[fit];
+        size_t laps = s.lapErrorUs.size();
+        double p50 = percentile(s.lapErrorUs, 0.5);
+        double p95 = percentile(s.lapErrorUs, 0.95);
+        double max = percentile(s.lapErrorUs, 1.0);
+        printf("%s\t%zu\t%.0f\t%.0f\t%.0f\t%.0f\t\t\t%u\n", fit ? "fitted" : "highest sample", laps, p50, p95, max,
+               s.holeShots ? s.holeShotSumUs / s.holeShots : 0.0, s.racesSkipped);
+    }
+    return 0;
+}
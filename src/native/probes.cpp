@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "probe.h"
+#include "racesim.h"
+#include "trace.h"
+
+static void printToStdout(void *arg, const char *text) {
+    fputs(text, stdout);
+}
+
+// Races through LapTimer with the probes on, the report is what /metrics
+// serves. Probe times are host ns here, latencies simulated time.
+int runProbes(int argc, char **argv) {
+    uint32_t races = 5;
+    uint32_t seed = 1;
+    bool json = false;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+
+    int i = 0;
+    while (i < argc) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+            i++;
+            continue;
+        }
+        if (i + 1 >= argc) return CMD_USAGE;
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--pilots")) {
+            params.pilots = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--detector")) {
+            params.detector = detectorFromName(val);
+        } else {
+            return CMD_USAGE;
+        }
+        i += 2;
+    }
+    if (races == 0 || synth.sampleRateHz == 0 || params.pilots < 1 || params.pilots > CONFIG_MAX_PILOTS || params.detector == DETECTOR_COUNT) {
+        return CMD_USAGE;
+    }
+    if (!probesEnabled()) {
+        printf("Probes are compiled out, build the native_probes environment\n");
+        return 1;
+    }
+
+    static RaceSimulator sim;
+    static RssiTrace traces[CONFIG_MAX_PILOTS];
+    race_result_t results[CONFIG_MAX_PILOTS];
+    uint32_t laps = 0;
+    for (uint32_t r = 0; r < races; r++) {
+        for (uint8_t p = 0; p < params.pilots; p++) {
+            traces[p].synthesize(synth, seed + r * CONFIG_MAX_PILOTS + p);
+        }
+        sim.run(traces, params, results);
+        for (uint8_t p = 0; p < params.pilots; p++) {
+            laps += results[p].lapsDetected;
+        }
+    }
+    if (!json) {
+        printf("%u races, %u pilots, %u Hz, %s detector, %u laps\n", races, params.pilots, synth.sampleRateHz, detectorName(params.detector), laps);
+    }
+    probeReport(json, printToStdout, NULL);
+    printf("\n");
+    return 0;
+}
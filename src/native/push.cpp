@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "commands.h"
+#include "hal_native.h"
+#include "lappush.h"
+#include "lapqueue.h"
+#include "probe.h"
+#include "scheduler.h"
+
+#define PUSH_EVENT_MIN_US 5000      // between two lap events, up to this plus the spread
+#define PUSH_EVENT_SPREAD_US 45000
+#define PUSH_TARGET_P99_US 10000    // single digit ms from the pass to the sockets
+#define PUSH_WEB_PERIOD_MS 50       // a web pass, DNS answers and RSSI batches under WiFi load
+#define PUSH_BUS_PERIOD_MS 31       // a hop, the RX5808 write blocks for the bus
+#define PUSH_BUS_STALL_US 1200
+#define PUSH_COMMIT_PERIOD_MS 1000  // an EEPROM commit, sliders moved on the config page
+
+typedef struct {
+    bool pushTask;  // a task of its own for the push, or the service task as before
+    uint32_t stallMs;
+    PeriodicService web, bus, commit;  // block in their drivers, the web a random part of the longest stall
+    LapQueue timerQueue;  // LapTimer's
+    LapPush lapPush;
+    std::vector<uint32_t> raisedUs;  // by lap, when loop() saw the pass
+    std::vector<uint32_t> latencies;
+    uint32_t forwarded;
+    uint32_t outOfOrder;
+    uint32_t lastLap;
+} push_bench_t;
+
+static WallClock wall;
+
+// stands in for Webserver::handleLapEvent, the frames are on the sockets when it returns
+static void pushLap(void *arg, const lap_event_t &event) {
+    push_bench_t *b = (push_bench_t *)arg;
+    b->latencies.push_back(wall.micros() - b->raisedUs[event.lap]);
+}
+
+static uint32_t serviceLaps(void *arg, uint32_t currentTimeMs) {
+    push_bench_t *b = (push_bench_t *)arg;
+    lap_event_t event;
+    if (!b->pushTask) {
+        while (b->timerQueue.pop(&event)) pushLap(b, event);
+        return SCHEDULER_IDLE;
+    }
+    while (b->lapPush.popLapEvent(&event)) {
+        if (b->forwarded && event.lap != b->lastLap + 1) b->outOfOrder++;
+        b->lastLap = event.lap;
+        b->forwarded++;
+    }
+    return SCHEDULER_IDLE;
+}
+
+/*
+ * loop() raising lap events at random on one thread, the service task on
+ * another with services that block, and with pushTask the lap push task on
+ * a third, woken by loop() directly. On a host with more than one core the
+ * push thread runs next to a blocked service the way the higher priority
+ * task preempts it on the ESP32. Returns the lap events raised.
+ */
+static uint32_t raiseLapEvents(push_bench_t *b, uint32_t seconds, uint32_t seed) {
+    static Scheduler scheduler;
+    static Waker serviceWaker, pushWaker;
+    scheduler = Scheduler();
+    serviceWaker.reset();
+    pushWaker.reset();
+    b->web.init(PUSH_WEB_PERIOD_MS, 0, b->stallMs * 1000 / 2, seed);
+    b->commit.init(PUSH_COMMIT_PERIOD_MS, b->stallMs * 1000, 0);
+    b->bus.init(PUSH_BUS_PERIOD_MS, PUSH_BUS_STALL_US, 0);
+    scheduler.add(serviceLaps, b, PROBE_TASK_LAPS);
+    scheduler.add(PeriodicService::run, &b->web, PROBE_TASK_WEB);
+    scheduler.add(PeriodicService::run, &b->commit, PROBE_TASK_EEPROM);
+    scheduler.add(PeriodicService::run, &b->bus, PROBE_TASK_HOPPER);
+    scheduler.setNotify(Waker::wake, &serviceWaker);
+    b->timerQueue.clear();
+    b->lapPush.init(pushLap, b);
+    b->raisedUs.assign((size_t)seconds * 1000000 / PUSH_EVENT_MIN_US + 1, 0);
+    b->latencies.clear();
+    b->latencies.reserve(b->raisedUs.size());
+    b->forwarded = b->outOfOrder = b->lastLap = 0;
+    probeReset();
+    wall.start();
+    volatile bool done = false;
+
+    std::thread service([&]() {
+        while (serviceWaker.wait(scheduler.run(wall.millis()), &done)) {
+        }
+        serviceLaps(b, wall.millis());
+    });
+    std::thread push;
+    if (b->pushTask) {
+        push = std::thread([&]() {
+            lap_event_t event;
+            while (pushWaker.wait(SCHEDULER_MAX_WAIT_MS, &done)) {
+                while (b->timerQueue.pop(&event)) b->lapPush.handleLapEvent(event);
+                scheduler.wake();
+            }
+        });
+    }
+
+    SimRandom rnd(seed ^ 0x5A5A);
+    uint16_t raised = 0;
+    auto end = wall.at(seconds * 1000);
+    for (;;) {
+        auto next = std::chrono::steady_clock::now() + std::chrono::microseconds(PUSH_EVENT_MIN_US + rnd.next() % PUSH_EVENT_SPREAD_US);
+        if (next >= end || raised >= b->raisedUs.size()) break;
+        std::this_thread::sleep_until(next);
+        lap_event_t event = {};
+        event.type = LAP_EVENT_LAP;
+        event.lap = raised;
+        event.sampleTimeUs = halMicros();
+        b->raisedUs[raised] = wall.micros();
+        if (b->timerQueue.push(event)) raised++;
+        if (b->pushTask) {
+            Waker::wake(&pushWaker);
+        } else {
+            scheduler.wake();
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(b->stallMs + PUSH_WEB_PERIOD_MS));  // the last ones out
+    done = true;
+    Waker::wake(&serviceWaker);
+    Waker::wake(&pushWaker);
+    if (push.joinable()) push.join();
+    service.join();
+    return raised;
+}
+
+// Lap events from loop() to the clients: popped by the service task between
+// services that block, against a push task of their own woken right away.
+int runPush(int argc, char **argv) {
+    uint32_t seconds = 3;
+    uint32_t seed = 1;
+    static push_bench_t bench;
+    bench.stallMs = 40;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--seconds")) {
+            seconds = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else if (!strcmp(argv[i], "--stall")) {
+            bench.stallMs = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || seconds == 0 || bench.stallMs == 0) return CMD_USAGE;
+
+    halNativeReset();
+    printf("real time, %u s each, lap events every %u-%u ms, services blocking up to %u ms\n", seconds, PUSH_EVENT_MIN_US / 1000,
+           (PUSH_EVENT_MIN_US + PUSH_EVENT_SPREAD_US) / 1000, bench.stallMs);
+    printf("path\t\tevents\tpushed\tp50\t\tp99\t\tmax\n");
+    bool ok = true;
+    for (int pushTask = 0; pushTask < 2; pushTask++) {
+        bench.pushTask = pushTask;
+        uint32_t raised = raiseLapEvents(&bench, seconds, seed);
+        uint32_t p99 = percentile(bench.latencies, 0.99);
+        printf("%s\t%u\t%u\t%u us\t\t%u us\t\t%u us\n", pushTask ? "push task" : "service task", raised, (unsigned)bench.latencies.size(),
+               percentile(bench.latencies, 0.5), p99, percentile(bench.latencies, 1.0));
+        ok = ok && raised > 0 && bench.latencies.size() == raised;
+        if (!pushTask) continue;
+
+        probe_summary_t probe;
+        probeSummary(PROBE_LAP_PUSH, &probe);
+        printf("handed on:\t%u of %u to the service task, %u out of order, %u dropped; %s probe %u laps\n", bench.forwarded, raised,
+               bench.outOfOrder, bench.lapPush.getDropped(), probeName(PROBE_LAP_PUSH), probe.count);
+        ok = ok && bench.forwarded == raised && !bench.outOfOrder && probe.count == raised && p99 < PUSH_TARGET_P99_US;
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
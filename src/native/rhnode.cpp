@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "bands.h"
+#include "bench.h"
+#include "commands.h"
+#include "hal_native.h"
+#include "racesim.h"
+#include "rhnode.h"
+#include "trace.h"
+
+#define RH_POLL_MS 100             // the server reads the lap stats of every node this often
+#define RH_PARTIAL_WRITE_MS 10     // half a write goes out then, the next read comes after the write timeout
+#define RH_PASS_TOLERANCE_US 1000  // of a pass told by the lap stats from the detected one, the ms it is sent in
+#define RH_PEAK_WINDOW_US 300000   // where the peak of a pass is looked for
+#define RH_LATENCY_LIMIT_NS 100000  // p99 of an answer on the host
+#define RH_LINK_ERRORS 3           // bad checksum, unknown command and lost write, plus a bad frequency per node
+
+typedef struct {
+    RhNode node;
+    RhLink link;
+    const race_params_t *params;
+    bool discovered;
+    bool partialSent;
+    bool partialChecked;
+    uint32_t lastPollMs;
+    uint64_t failures;
+
+    // per race, as the server tells them from the lap stats
+    uint8_t lastPasses[CONFIG_MAX_PILOTS];
+    uint32_t increments[CONFIG_MAX_PILOTS];
+    std::vector<uint32_t> passesUs[CONFIG_MAX_PILOTS];
+    std::vector<uint32_t> peaksUs[CONFIG_MAX_PILOTS];
+
+    std::vector<uint32_t> answerNs;
+    std::vector<uint32_t> reportMs;  // how old a pass is when the server first sees it
+    uint64_t polls;
+    uint64_t extremums;
+} rh_bench_t;
+
+static void add(std::vector<uint8_t> &bytes, std::initializer_list<uint8_t> values) {
+    bytes.insert(bytes.end(), values);
+}
+
+// a read answer: the value and its checksum
+static void addAnswer(std::vector<uint8_t> &bytes, const uint8_t *value, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        bytes.push_back(value[i]);
+        sum += value[i];
+    }
+    bytes.push_back(sum);
+}
+
+static void addAnswer(std::vector<uint8_t> &bytes, std::initializer_list<uint8_t> value) {
+    addAnswer(bytes, value.begin(), value.size());
+}
+
+static void addText(std::vector<uint8_t> &bytes, const char *text) {
+    uint8_t value[RHNODE_TEXT_SIZE] = {};
+    strncpy((char *)value, text, sizeof(value));
+    addAnswer(bytes, value, sizeof(value));
+}
+
+static void addWrite(std::vector<uint8_t> &bytes, uint8_t command, uint16_t value, bool wide) {
+    bytes.push_back(command);
+    if (wide) {
+        add(bytes, {(uint8_t)(value >> 8), (uint8_t)value, (uint8_t)((value >> 8) + value)});
+    } else {
+        add(bytes, {(uint8_t)value, (uint8_t)value});
+    }
+}
+
+static size_t transact(rh_bench_t *b, const uint8_t *in, size_t len, uint8_t *out, size_t size) {
+    auto start = std::chrono::steady_clock::now();
+    size_t n = b->link.handle(in, len, out, size);
+    b->answerNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    return n;
+}
+
+static void expect(rh_bench_t *b, const char *what, const std::vector<uint8_t> &in, const std::vector<uint8_t> &expected, bool byByte) {
+    uint8_t out[1024];
+    size_t n = 0;
+    if (byByte) {
+        for (uint8_t byte : in) {
+            n += transact(b, &byte, 1, &out[n], sizeof(out) - n);
+        }
+    } else {
+        n = transact(b, in.data(), in.size(), out, sizeof(out));
+    }
+    if (n == expected.size() && !memcmp(out, expected.data(), n)) return;
+    b->failures++;
+    printf("%s: %u bytes back, %u expected\n", what, (unsigned)n, (unsigned)expected.size());
+    for (size_t i = 0; i < n || i < expected.size(); i++) {
+        if (i < n && i < expected.size() && out[i] == expected[i]) continue;
+        printf("\tat %u: 0x%02x, 0x%02x expected\n", (unsigned)i, i < n ? out[i] : 0, i < expected.size() ? expected[i] : 0);
+        break;
+    }
+}
+
+// what the server asks a node interface for when it starts, once in one go and once a byte at a time
+static void discover(rh_bench_t *b) {
+    const race_params_t &p = *b->params;
+    std::vector<uint8_t> in, expected;
+    add(in, {RH_READ_REVISION_CODE, RH_READ_RHFEAT_FLAGS, RH_READ_MULTINODE_COUNT});
+    addAnswer(expected, {0x25, RHNODE_API_LEVEL});
+    addAnswer(expected, {0, 0});
+    addAnswer(expected, {p.pilots});
+    for (uint8_t i = 0; i < p.pilots; i++) {
+        addWrite(in, RH_WRITE_CURNODE_INDEX, i, false);
+        add(in, {RH_READ_CURNODE_INDEX, RH_READ_NODE_SLOTIDX, RH_READ_FW_VERSION, RH_READ_FW_PROCTYPE, RH_READ_FREQUENCY,
+                 RH_READ_ENTER_AT_LEVEL, RH_READ_EXIT_AT_LEVEL});
+        addAnswer(expected, {i});
+        addAnswer(expected, {i});
+        addText(expected, "PhobosLT");
+        addText(expected, "native");
+        addAnswer(expected, {(uint8_t)(p.frequency[i] >> 8), (uint8_t)p.frequency[i]});
+        addAnswer(expected, {p.enterRssi});
+        addAnswer(expected, {p.exitRssi});
+    }
+    expect(b, "discovery", in, expected, false);
+    expect(b, "discovery by the byte", in, expected, true);
+}
+
+// the settings the server writes, each read back, and writes it has to ignore
+static void configure(rh_bench_t *b) {
+    const race_params_t &p = *b->params;
+    for (uint8_t i = 0; i < p.pilots; i++) {
+        uint16_t other = p.frequency[i] == 5740 ? 5760 : 5740;
+        std::vector<uint8_t> in, expected;
+        addWrite(in, RH_WRITE_CURNODE_INDEX, i, false);
+        addWrite(in, RH_WRITE_FREQUENCY, other, true);
+        in.push_back(RH_READ_FREQUENCY);
+        addAnswer(expected, {(uint8_t)(other >> 8), (uint8_t)other});
+        addWrite(in, RH_WRITE_FREQUENCY, BAND_MAX_MHZ + 100, true);  // out of the band, ignored
+        in.push_back(RH_READ_FREQUENCY);
+        addAnswer(expected, {(uint8_t)(other >> 8), (uint8_t)other});
+        addWrite(in, RH_WRITE_FREQUENCY, p.frequency[i], true);
+        in.push_back(RH_READ_FREQUENCY);
+        addAnswer(expected, {(uint8_t)(p.frequency[i] >> 8), (uint8_t)p.frequency[i]});
+
+        addWrite(in, RH_WRITE_ENTER_AT_LEVEL, p.enterRssi + 5, false);
+        addWrite(in, RH_WRITE_EXIT_AT_LEVEL, p.exitRssi + 5, false);
+        add(in, {RH_READ_ENTER_AT_LEVEL, RH_READ_EXIT_AT_LEVEL});
+        addAnswer(expected, {(uint8_t)(p.enterRssi + 5)});
+        addAnswer(expected, {(uint8_t)(p.exitRssi + 5)});
+        addWrite(in, RH_WRITE_ENTER_AT_LEVEL, p.enterRssi, false);
+        addWrite(in, RH_WRITE_EXIT_AT_LEVEL, p.exitRssi, false);
+        addWrite(in, RH_SEND_STATUS_MESSAGE, 0x0102, true);
+        add(in, {RH_READ_ENTER_AT_LEVEL, RH_READ_EXIT_AT_LEVEL});
+        addAnswer(expected, {p.enterRssi});
+        addAnswer(expected, {p.exitRssi});
+        expect(b, "settings", in, expected, false);
+    }
+
+    // a write with a bad checksum and an unknown command, the link has to be back in step after either
+    std::vector<uint8_t> in, expected;
+    add(in, {RH_WRITE_ENTER_AT_LEVEL, (uint8_t)(p.enterRssi + 10), 0, RH_READ_ENTER_AT_LEVEL});
+    addAnswer(expected, {p.enterRssi});
+    add(in, {0x01, RH_READ_REVISION_CODE});
+    addAnswer(expected, {0x25, RHNODE_API_LEVEL});
+    expect(b, "bad writes", in, expected, false);
+}
+
+static void poll(rh_bench_t *b) {
+    const race_params_t &p = *b->params;
+    uint32_t nowUs = halMicros();
+    for (uint8_t i = 0; i < p.pilots; i++) {
+        uint8_t in[] = {RH_WRITE_CURNODE_INDEX, i, i, RH_READ_LAP_STATS};
+        uint8_t out[RHNODE_RESPONSE_MAX];
+        size_t n = transact(b, in, sizeof(in), out, sizeof(out));
+        b->polls++;
+        uint8_t sum = 0;
+        for (size_t k = 0; k + 1 < n; k++) {
+            sum += out[k];
+        }
+        if (n != RHNODE_RESPONSE_MAX || sum != out[n - 1]) {
+            b->failures++;
+            printf("lap stats: %u bytes back, checksum 0x%02x\n", (unsigned)n, n ? out[n - 1] : 0);
+            continue;
+        }
+
+        uint8_t passes = out[0];
+        uint32_t sinceMs = (out[1] << 8) | out[2];
+        if (passes != b->lastPasses[i]) {
+            b->increments[i] += (uint8_t)(passes - b->lastPasses[i]);
+            b->lastPasses[i] = passes;
+            b->passesUs[i].push_back(nowUs - sinceMs * 1000);
+            b->reportMs.push_back(sinceMs);
+        }
+        if (out[11]) {
+            b->extremums++;
+            if (out[8] & RH_LAPSTATS_FLAG_PEAK) b->peaksUs[i].push_back(nowUs - ((out[12] << 8) | out[13]) * 1000);
+        }
+    }
+}
+
+static void serviceHook(void *arg, uint32_t currentTimeMs) {
+    rh_bench_t *b = (rh_bench_t *)arg;
+    if (!b->discovered) {
+        b->discovered = true;
+        b->node.attach();  // as the transports do on the first bytes
+        discover(b);
+        configure(b);
+        return;
+    }
+    if (!b->partialSent && currentTimeMs >= RH_PARTIAL_WRITE_MS) {
+        b->partialSent = true;
+        uint8_t in = RH_WRITE_EXIT_AT_LEVEL;
+        uint8_t out[RHNODE_RESPONSE_MAX];
+        b->link.handle(&in, 1, out, sizeof(out));
+        return;
+    }
+    if (!b->partialChecked && currentTimeMs >= RH_PARTIAL_WRITE_MS + RHNODE_WRITE_TIMEOUT_MS + 1) {
+        b->partialChecked = true;
+        std::vector<uint8_t> in, expected;
+        add(in, {RH_READ_REVISION_CODE});
+        addAnswer(expected, {0x25, RHNODE_API_LEVEL});
+        expect(b, "after a lost write", in, expected, false);
+        return;
+    }
+    if (currentTimeMs < SIM_RACE_START_MS || currentTimeMs - b->lastPollMs < RH_POLL_MS) return;
+    b->lastPollMs = currentTimeMs;
+    poll(b);
+}
+
+// true passes against what a RotorHazard server reads from the node, every
+// pass once and on time, then how long the answers take on the host
+int runRhNode(int argc, char **argv) {
+    uint32_t races = 3;
+    uint32_t seed = 1;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--races")) {
+            races = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else if (!strcmp(argv[i], "--pilots")) {
+            params.pilots = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || params.pilots < 1 || params.pilots > CONFIG_MAX_PILOTS) {
+        return CMD_USAGE;
+    }
+
+    static RssiTrace traces[CONFIG_MAX_PILOTS];
+    static RaceSimulator sim;
+    static rh_bench_t bench;
+    race_result_t results[CONFIG_MAX_PILOTS];
+    bench.params = &params;
+    sim.setRhNode(&bench.node);
+    sim.setServiceHook(serviceHook, &bench);
+
+    uint64_t passes = 0, seen = 0, missed = 0, truePasses = 0, peaks = 0, dropped = 0, errors = 0;
+    double errorSumUs = 0;
+    uint32_t errorMaxUs = 0;
+    const uint32_t expectedErrors = RH_LINK_ERRORS + params.pilots;
+    for (uint32_t r = 0; r < races; r++) {
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            traces[i].synthesize(synth, seed + r * CONFIG_MAX_PILOTS + i);
+        }
+        bench.link.init(&bench.node);
+        bench.discovered = bench.partialSent = bench.partialChecked = false;
+        bench.lastPollMs = 0;
+        memset(bench.lastPasses, 0, sizeof(bench.lastPasses));
+        memset(bench.increments, 0, sizeof(bench.increments));
+        for (uint8_t i = 0; i < CONFIG_MAX_PILOTS; i++) {
+            bench.passesUs[i].clear();
+            bench.peaksUs[i].clear();
+        }
+        sim.run(traces, params, results);
+        poll(&bench);  // the passes at the end of the trace
+        errors += bench.link.getErrors();
+        if (bench.link.getErrors() != expectedErrors) {
+            bench.failures++;
+            printf("race %u: %u link errors, %u expected\n", r, bench.link.getErrors(), expectedErrors);
+        }
+
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            if (bench.increments[i] != results[i].lapsDetected) {
+                bench.failures++;
+                printf("race %u pilot %u: lap id went up %u times for %u laps\n", r, i + 1, bench.increments[i], results[i].lapsDetected);
+            }
+            // the passes as the timer detected them, the lap times add up from the start
+            uint32_t detectedUs = (uint32_t)SIM_RACE_START_MS * 1000;
+            for (size_t k = 0; k < results[i].detectedUs.size(); k++) {
+                detectedUs += results[i].detectedUs[k];
+                passes++;
+                uint32_t errorUs = k < bench.passesUs[i].size() ? (uint32_t)abs((int32_t)(bench.passesUs[i][k] - detectedUs)) : 0xFFFFFFFF;
+                if (errorUs > RH_PASS_TOLERANCE_US) {
+                    missed++;
+                } else {
+                    seen++;
+                    errorSumUs += errorUs;
+                    if (errorUs > errorMaxUs) errorMaxUs = errorUs;
+                }
+            }
+            for (uint32_t passUs : traces[i].passTimesUs) {
+                uint32_t trueUs = (uint32_t)SIM_RACE_START_MS * 1000 + passUs;
+                truePasses++;
+                for (uint32_t us : bench.peaksUs[i]) {
+                    if (us - (trueUs - RH_PEAK_WINDOW_US) <= 2 * RH_PEAK_WINDOW_US) {
+                        peaks++;
+                        break;
+                    }
+                }
+            }
+            dropped += bench.node.getHistory()->getDropped(i);
+        }
+    }
+
+    uint32_t p50 = percentile(bench.answerNs, 0.5);
+    uint32_t p99 = percentile(bench.answerNs, 0.99);
+    printf("%u races, %u pilots, %u ms lap stats polls\n", races, params.pilots, RH_POLL_MS);
+    printf("passes:\t\t%llu detected, %llu read back from the lap stats, %llu missed or off\n", (unsigned long long)passes,
+           (unsigned long long)seen, (unsigned long long)missed);
+    printf("pass time:\tmean error %.0f us, max %u us; seen %u ms after the pass at p50, %u ms at max\n", seen ? errorSumUs / seen : 0.0,
+           errorMaxUs, percentile(bench.reportMs, 0.5), percentile(bench.reportMs, 1.0));
+    printf("history:\t%llu turning points read, a peak near %llu of %llu true passes, %llu dropped unread\n",
+           (unsigned long long)bench.extremums, (unsigned long long)peaks, (unsigned long long)truePasses, (unsigned long long)dropped);
+    printf("link:\t\t%llu polls, %llu errors from the bad commands sent, answer p50 %u ns, p99 %u ns\n", (unsigned long long)bench.polls,
+           (unsigned long long)errors, p50, p99);
+    if (missed || p99 > RH_LATENCY_LIMIT_NS) bench.failures++;
+    printf("%s\n", bench.failures ? "FAIL" : "OK");
+    return bench.failures ? 1 : 0;
+}
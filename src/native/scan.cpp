@@ -0,0 +1,371 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bands.h"
+#include "buzzer.h"
+#include "commands.h"
+#include "config.h"
+#include "hal_native.h"
+#include "hopper.h"
+#include "laptimer.h"
+#include "led.h"
+#include "RX5808.h"
+#include "rx5808model.h"
+#include "scanner.h"
+#include "trace.h"
+#include "wsframe.h"
+
+#define SCAN_RATE_HZ 10000
+#define SCAN_MODEL_SETTLE_US 8000  // the module's PLL and RSSI filter catching up after a write
+#define SCAN_FLOOR 40
+#define SCAN_NOISE 3       // uniform, either way
+#define SCAN_WIDTH_MHZ 7.0f  // of the RSSI bump around a transmitter
+#define SCAN_TIMEOUT_MS 60000
+#define SCAN_PEAK_ERROR 10  // what a held peak may be off from the level of the transmitter
+
+// as on BOARD_NODE4
+static const board_receiver_t scanReceivers[BOARD_MAX_RECEIVERS] = {{PIN_RX5808_RSSI, PIN_RX5808_SELECT}, {32, 18}, {34, 16}, {39, 17}};
+
+typedef struct {
+    uint16_t mhz;
+    uint8_t level;
+    bool firstSweepOnly;
+} scan_tx_t;
+
+static const scan_tx_t transmitters[] = {
+    {5658, 200, false},  // R1
+    {5800, 160, false},  // F4
+    {5436, 120, false},  // L3
+    {5905, 180, true},   // E6, gone after the first sweep
+};
+#define SCAN_TX_COUNT (sizeof(transmitters) / sizeof(transmitters[0]))
+
+typedef struct {
+    uint16_t fromMhz;
+    uint16_t toMhz;
+    uint64_t writeEndUs;
+    size_t seen;  // bus frames of the model looked at
+} scan_tuning_t;
+
+/*
+ * The RSSI pins of the receivers as the DMA source converts them, from the
+ * frequency each module is really on: it starts to move when the write is
+ * on the wire and slides over to the new one within SCAN_MODEL_SETTLE_US.
+ */
+class SpectrumSource : public RssiSource {
+   public:
+    Rx5808Model *models;
+    uint8_t receivers = 1;
+    SimRandom rnd = SimRandom(1);
+    bool firstSweep = true;  // the transmitter that is there once is on
+
+    bool begin(uint32_t sampleRateHz) override {
+        nextUs = halNativeMicros64();
+        memset(tuning, 0, sizeof(tuning));
+        return true;
+    }
+
+    size_t read(rssi_frame_t *frames, size_t maxFrames) override {
+        size_t n = 0;
+        uint64_t nowUs = halNativeMicros64();
+        while (nextUs <= nowUs && n + receivers <= maxFrames) {
+            for (uint8_t r = 0; r < receivers; r++) {
+                float noise = (float)(rnd.next() % (2 * SCAN_NOISE + 1)) - SCAN_NOISE;
+                float rssi = levelAt(mhzAt(r, nextUs), firstSweep) + noise;
+                frames[n].timeUs = (uint32_t)nextUs;
+                frames[n].rssi = rssi < 0 ? 0 : rssi > 255 ? 255 : (uint8_t)rssi;
+                frames[n].receiver = r;
+                n++;
+            }
+            nextUs += 1000000 / SCAN_RATE_HZ;
+        }
+        return n;
+    }
+
+    uint32_t getSampleRateHz() override {
+        return SCAN_RATE_HZ;
+    }
+
+    uint32_t getDroppedFrames() override {
+        return 0;
+    }
+
+    static float levelAt(float mhz, bool withFirstSweepOnly) {
+        float level = SCAN_FLOOR;
+        for (size_t i = 0; i < SCAN_TX_COUNT; i++) {
+            if (transmitters[i].firstSweepOnly && !withFirstSweepOnly) continue;
+            float d = (mhz - transmitters[i].mhz) / SCAN_WIDTH_MHZ;
+            float tx = SCAN_FLOOR + (transmitters[i].level - SCAN_FLOOR) * expf(-d * d);
+            if (tx > level) level = tx;
+        }
+        return level;
+    }
+
+    // what the module is tuned to for a requested frequency, the register has 2 MHz steps
+    static uint16_t registerMhz(uint16_t mhz) {
+        return (mhz - 479) / 2 * 2 + 479;
+    }
+
+   private:
+    uint64_t nextUs = 0;
+    scan_tuning_t tuning[BOARD_MAX_RECEIVERS];
+
+    float mhzAt(uint8_t receiver, uint64_t timeUs) {
+        scan_tuning_t &t = tuning[receiver];
+        const std::vector<bus_frame_t> &frames = models[receiver].frames;
+        while (t.seen < frames.size() && frames[t.seen].endUs <= timeUs) {
+            const bus_frame_t &f = frames[t.seen++];
+            bool write = (f.value >> 4) & 1;
+            if (f.bits != 25 || !write || (f.value & 0xF) != RX5808_REG_FREQUENCY) continue;
+            uint32_t reg = f.value >> 5;
+            t.fromMhz = (uint16_t)slide(t, f.endUs);
+            t.toMhz = ((reg >> 7) * 32 + (reg & 0x7F)) * 2 + 479;
+            t.writeEndUs = f.endUs;
+        }
+        return slide(t, timeUs);
+    }
+
+    static float slide(const scan_tuning_t &t, uint64_t timeUs) {
+        if (!t.fromMhz || timeUs - t.writeEndUs >= SCAN_MODEL_SETTLE_US) return t.toMhz;
+        return t.fromMhz + ((float)t.toMhz - t.fromMhz) * (timeUs - t.writeEndUs) / SCAN_MODEL_SETTLE_US;
+    }
+};
+
+typedef struct {
+    scanner_spectrum_t spectrum;
+    double meanError;  // of the mean against the spectrum without noise
+    bool resumed;      // the hopper is back on the pilot once stopped
+} scan_result_t;
+
+// A node with its receivers, LapTimer and hopper, scanned for a number of sweeps and stopped
+static void scanNode(const scanner_params_t &params, uint8_t receiverCount, uint32_t sweeps, uint32_t seed, scan_result_t *result) {
+    static RX5808Bus bus;
+    static RX5808 receivers[BOARD_MAX_RECEIVERS];
+    static Config config;
+    static Buzzer buzzer;
+    static Led led;
+    static FrequencyHopper hopper;
+    static LapTimer timer;
+    static SpectrumScanner scanner;
+    static SpectrumSource source;
+    std::vector<Rx5808Model> models;
+
+    halNativeReset();
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        models.push_back(Rx5808Model(PIN_RX5808_DATA, scanReceivers[i].selectPin, PIN_RX5808_CLOCK));
+    }
+    for (uint8_t i = 0; i + 1 < receiverCount; i++) {
+        models[i].setNext(&models[i + 1]);
+    }
+    models[0].attach();
+
+    bus.init(PIN_RX5808_DATA, PIN_RX5808_CLOCK);
+    for (uint8_t i = 0; i < receiverCount; i++) {
+        receivers[i] = RX5808(scanReceivers[i].rssiPin, scanReceivers[i].selectPin, &bus);
+        receivers[i].init();
+    }
+    config.init();
+    config.setFrequency(5800);
+    hopper.init(&config, receivers, receiverCount);
+    buzzer.init(PIN_BUZZER, BUZZER_INVERTED);
+    led.init(PIN_LED, false);
+    source = SpectrumSource();
+    source.models = models.data();
+    source.receivers = receiverCount;
+    source.rnd = SimRandom(seed);
+    timer = LapTimer();
+    timer.init(&config, &hopper, &source, &buzzer, &led);
+    scanner.init(&hopper, receivers, receiverCount);
+    timer.setScanner(&scanner);
+    source.begin(0);
+
+    // the loop and service task of main.cpp, one iteration per simulated ms
+    bool started = false, stopped = false;
+    uint32_t stopMs = 0;
+    while (halMillis() < SCAN_TIMEOUT_MS) {
+        halNativeAdvanceMicros(1000);
+        uint32_t nowMs = halMillis();
+        if (!started && nowMs >= 200) {
+            scanner.start(params);
+            started = true;
+        }
+        source.firstSweep = scanner.getSweeps() == 0;
+        if (!stopped && scanner.isRunning() && scanner.getSweeps() >= sweeps) {
+            scanner.getSpectrum(&result->spectrum);
+            scanner.stop();
+            stopped = true;
+            stopMs = nowMs;
+        }
+        if (stopped && nowMs - stopMs >= 200) break;
+        hopper.handleHop(nowMs);
+        scanner.handleScan(nowMs);
+        timer.handleLapTimerUpdate();
+    }
+    if (!stopped) scanner.getSpectrum(&result->spectrum);
+    models[0].detach();
+
+    result->meanError = 0;
+    const scanner_spectrum_t &s = result->spectrum;
+    for (uint16_t b = 0; b < s.bins; b++) {
+        float truth = SpectrumSource::levelAt(SpectrumSource::registerMhz(s.fromMhz + b * s.stepMhz), false);
+        result->meanError += fabs(s.mean[b] - truth);
+    }
+    if (s.bins) result->meanError /= s.bins;
+    result->resumed = stopped && !scanner.isRunning() && receivers[0].getFrequency() == 5800 && hopper.pilotAt(0, halMicros()) == 0;
+}
+
+static int16_t binOf(const scanner_spectrum_t &s, uint16_t mhz) {
+    if (mhz < s.fromMhz) return -1;
+    uint16_t bin = (mhz - s.fromMhz + s.stepMhz / 2) / s.stepMhz;
+    return bin < s.bins ? bin : -1;
+}
+
+// the highest peak within two bins of each steady transmitter has to be its nearest bin, or one next to it
+static bool checkPeaks(const scanner_spectrum_t &s) {
+    bool ok = true;
+    for (size_t i = 0; i < SCAN_TX_COUNT; i++) {
+        const scan_tx_t &tx = transmitters[i];
+        int16_t bin = binOf(s, tx.mhz);
+        if (tx.firstSweepOnly || bin < 0) continue;
+        int16_t best = bin;
+        for (int16_t b = bin - 2; b <= bin + 2; b++) {
+            if (b >= 0 && b < s.bins && s.peak[b] > s.peak[best]) best = b;
+        }
+        uint8_t band, channel;
+        bandLookup(tx.mhz, &band, &channel);
+        bool found = abs(best - bin) <= 1 && s.peak[best] > SCAN_FLOOR + 40;
+        printf("  %c%u %u MHz: peak %u at %u MHz%s\n", bands[band].name, channel + 1, tx.mhz, s.peak[best], s.fromMhz + best * s.stepMhz,
+               found ? "" : ", WRONG");
+        ok = ok && found;
+    }
+    return ok;
+}
+
+// the JSON the web UI takes its band table from, read back number by number
+static bool checkBands() {
+    char json[BANDS_JSON_SIZE];
+    size_t length = bandsToJson(json);
+    if (length >= sizeof(json)) return false;
+    char names[BAND_COUNT + 1];
+    for (uint8_t b = 0; b < BAND_COUNT; b++) {
+        names[b] = bands[b].name;
+    }
+    names[BAND_COUNT] = 0;
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "{\"names\":\"%s\",\"freq\":[[", names);
+    if (strncmp(json, prefix, strlen(prefix))) return false;
+    const char *p = json + strlen(prefix);
+    for (uint8_t b = 0; b < BAND_COUNT; b++) {
+        for (uint8_t c = 0; c < BAND_CHANNELS; c++) {
+            char *end;
+            if (strtoul(p, &end, 10) != bands[b].frequency[c]) return false;
+            p = end + strspn(end, ",[]");
+            uint8_t band, channel;
+            if (!bandLookup(bands[b].frequency[c], &band, &channel) || bands[band].frequency[channel] != bands[b].frequency[c]) return false;
+        }
+    }
+    uint8_t band, channel;
+    return !strcmp(p, "}") && bandLookup(5800, &band, &channel) && bands[band].name == 'F' && channel == 3 && !bandLookup(5801, &band, &channel);
+}
+
+static bool checkFrame(const scanner_spectrum_t &s) {
+    static uint8_t buf[WS_SPECTRUM_FRAME_SIZE];
+    static ws_frame_t frame;
+    WsFrameWriter writer(buf, sizeof(buf));
+    if (!writer.addSpectrum(s)) return false;
+    WsFrameReader reader(buf, writer.length());
+    if (!reader.next(&frame) || frame.type != WS_FRAME_SPECTRUM) return false;
+    bool same = frame.count == s.bins && frame.fromMhz == s.fromMhz && frame.stepMhz == s.stepMhz && frame.hold == s.hold &&
+                frame.sweeps == s.sweeps && frame.periodUs == s.sweepTimeUs;
+    for (uint16_t b = 0; same && b < s.bins; b++) {
+        same = frame.rssi[b].max == s.peak[b] && frame.rssi[b].mean == s.mean[b];
+    }
+    return same && !reader.next(&frame) && !reader.isMalformed();
+}
+
+// Sweeps of a simulated band with a few transmitters, one of them only on
+// during the first sweep, on modules that take a while to settle after a
+// write. Peaks have to be on the transmitter channels and the spectrum close
+// to the truth; without a settle time it is smeared, max-hold keeps what was
+// only there once.
+int runScan(int argc, char **argv) {
+    scanner_params_t params;
+    scannerDefaults(&params);
+    uint32_t receivers = 1;
+    uint32_t sweeps = 3;
+    uint32_t seed = 1;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--step")) {
+            params.stepMhz = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--settle")) {
+            params.settleMs = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--receivers")) {
+            receivers = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--sweeps")) {
+            sweeps = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || params.stepMhz < 1 || params.stepMhz > 50 || receivers < 1 || receivers > BOARD_MAX_RECEIVERS || sweeps < 2) return CMD_USAGE;
+
+    static scan_result_t held, unsettled, parallel;
+    scan_result_t result;
+    bool ok = checkBands();
+    printf("band table: %s\n", ok ? "same in /bands" : "WRONG");
+
+    scanNode(params, receivers, sweeps, seed, &result);
+    const scanner_spectrum_t &s = result.spectrum;
+    printf("%u-%u MHz in %u bins, settle %u ms, %u receivers: %u sweeps, %.0f ms per sweep\n", s.fromMhz, s.fromMhz + (s.bins - 1) * s.stepMhz,
+           s.bins, params.settleMs, receivers, s.sweeps, s.sweepTimeUs / 1000.0);
+    ok = checkPeaks(s) && ok;
+    bool timed = s.sweeps >= sweeps && s.sweepTimeUs >= (uint32_t)s.bins * (params.settleMs + SCANNER_DWELL_MS) * 1000 / receivers;
+    printf("  mean error %.1f, hopper %s\n", result.meanError, result.resumed ? "back on the pilot" : "NOT RESUMED");
+    ok = ok && timed && result.resumed;
+
+    if (params.settleMs > 0) {
+        scanner_params_t noSettle = params;
+        noSettle.settleMs = 0;
+        scanNode(noSettle, receivers, sweeps, seed, &unsettled);
+        bool smeared = unsettled.meanError > result.meanError * 1.5;
+        printf("settle 0 ms: mean error %.1f, %.0f ms per sweep%s\n", unsettled.meanError, unsettled.spectrum.sweepTimeUs / 1000.0,
+               smeared ? "" : ", NOT WORSE");
+        ok = ok && smeared;
+    }
+
+    // the transmitter that was there once: gone without hold, kept with it
+    scanner_params_t maxHold = params;
+    maxHold.hold = SCANNER_HOLD_MAX;
+    scanNode(maxHold, receivers, sweeps, seed, &held);
+    const scan_tx_t &once = transmitters[SCAN_TX_COUNT - 1];
+    int16_t bin = binOf(s, once.mhz);
+    if (bin >= 0) {
+        float level = SpectrumSource::levelAt(SpectrumSource::registerMhz(s.fromMhz + bin * s.stepMhz), true);
+        bool gone = s.peak[bin] < SCAN_FLOOR + 3 * SCAN_NOISE;
+        bool kept = fabs(held.spectrum.peak[bin] - level) <= SCAN_PEAK_ERROR;
+        printf("%u MHz on for the first sweep only: peak %u, %u with max-hold%s\n", once.mhz, s.peak[bin], held.spectrum.peak[bin],
+               gone && kept ? "" : ", WRONG");
+        ok = ok && gone && kept;
+    }
+
+    if (receivers == 1) {
+        scanNode(params, BOARD_MAX_RECEIVERS, sweeps, seed, &parallel);
+        bool faster = parallel.spectrum.sweepTimeUs < s.sweepTimeUs;
+        printf("%u receivers: %.0f ms per sweep, mean error %.1f%s\n", BOARD_MAX_RECEIVERS, parallel.spectrum.sweepTimeUs / 1000.0,
+               parallel.meanError, faster ? "" : ", NOT FASTER");
+        ok = ok && faster && checkPeaks(parallel.spectrum);
+    }
+
+    bool framed = checkFrame(held.spectrum);
+    printf("spectrum frame: %s\n", framed ? "same after the round trip" : "DIFFERENT");
+    ok = ok && framed;
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
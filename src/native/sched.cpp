@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "battery.h"
+#include "bench.h"
+#include "buzzer.h"
+#include "commands.h"
+#include "config.h"
+#include "hal_native.h"
+#include "hopper.h"
+#include "lapqueue.h"
+#include "led.h"
+#include "probe.h"
+#include "racesim.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "wsframe.h"
+
+#define SCHED_LOW_VBAT_RAW 1900  // ~3.2V, below the default alarm
+#define SCHED_ALARM 36
+#define SCHED_DEADLINE_MS 20000
+
+typedef struct {
+    uint64_t timeUs;
+    uint8_t pin;
+    uint8_t value;
+} pin_edge_t;
+
+// the service task's duties, minus the network and the session files
+static RX5808 rx(PIN_RX5808_RSSI, PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+static Config config;
+static FrequencyHopper hopper;
+static Buzzer buzzer;
+static Led led;
+static BatteryMonitor monitor;
+static LapQueue laps;
+static PeriodicService web;  // Webserver::handleWebUpdate with a client on /ws, its batches set the pace
+
+static WallClock wall;
+static std::vector<uint32_t> latencies;
+
+static void setup(uint8_t pilots, uint16_t vbatRaw) {
+    halNativeSetFlashSectors(HAL_NATIVE_FLASH_SECTORS);
+    halNativeReset();
+    halNativeSetAnalog(PIN_VBAT, vbatRaw);
+    config.init();
+    config.setPilotCount(pilots);
+    config.write();
+    rx = RX5808(PIN_RX5808_RSSI, PIN_RX5808_DATA, PIN_RX5808_SELECT, PIN_RX5808_CLOCK);
+    rx.init();
+    hopper.init(&config, &rx);
+    buzzer.init(PIN_BUZZER, BUZZER_INVERTED);
+    led.init(PIN_LED, false);
+    monitor.init(PIN_VBAT, VBAT_SCALE, VBAT_ADD, &buzzer, &led);
+    laps.clear();
+    web.init(WS_BATCH_MS, 0, 0);
+    web.reset(halMillis());
+    latencies.clear();
+}
+
+static uint32_t serviceLaps(void *arg, uint32_t currentTimeMs) {
+    lap_event_t event;
+    while (laps.pop(&event)) latencies.push_back(wall.micros() - event.sampleTimeUs);
+    return SCHEDULER_IDLE;
+}
+
+static uint32_t serviceEeprom(void *arg, uint32_t currentTimeMs) {
+    return config.handleEeprom(currentTimeMs);
+}
+
+static uint32_t serviceHopper(void *arg, uint32_t currentTimeMs) {
+    return hopper.handleHop(currentTimeMs);
+}
+
+static uint32_t serviceBattery(void *arg, uint32_t currentTimeMs) {
+    return monitor.checkBatteryState(currentTimeMs, SCHED_ALARM);
+}
+
+static uint32_t serviceBuzzer(void *arg, uint32_t currentTimeMs) {
+    return buzzer.handleBuzzer(currentTimeMs);
+}
+
+static uint32_t serviceLed(void *arg, uint32_t currentTimeMs) {
+    return led.handleLed(currentTimeMs);
+}
+
+static void addServices(Scheduler &scheduler) {
+    scheduler.add(serviceLaps, NULL, PROBE_TASK_LAPS);
+    scheduler.add(PeriodicService::run, &web, PROBE_TASK_WEB);
+    scheduler.add(serviceEeprom, NULL, PROBE_TASK_EEPROM);
+    scheduler.add(serviceHopper, NULL, PROBE_TASK_HOPPER);
+    scheduler.add(serviceBattery, NULL, PROBE_TASK_BATTERY);
+    scheduler.add(serviceBuzzer, NULL, PROBE_TASK_BUZZER);
+    scheduler.add(serviceLed, NULL, PROBE_TASK_LED);
+}
+
+// one pass of parallelTask as it was, buzzer and LED twice
+static void spinPass(uint32_t currentTimeMs) {
+    buzzer.handleBuzzer(currentTimeMs);
+    led.handleLed(currentTimeMs);
+    serviceLaps(NULL, currentTimeMs);
+    PeriodicService::run(&web, currentTimeMs);
+    config.handleEeprom(currentTimeMs);
+    hopper.handleHop(currentTimeMs);
+    monitor.checkBatteryState(currentTimeMs, SCHED_ALARM);
+    buzzer.handleBuzzer(currentTimeMs);
+    led.handleLed(currentTimeMs);
+}
+
+static void recordEdge(void *arg, uint8_t pin) {
+    std::vector<pin_edge_t> *edges = (std::vector<pin_edge_t> *)arg;
+    edges->push_back({halNativeMicros64(), pin, halNativeGetPin(pin)});
+}
+
+static bool edgeBefore(const pin_edge_t &a, const pin_edge_t &b) {
+    if (a.timeUs != b.timeUs) return a.timeUs < b.timeUs;
+    if (a.pin != b.pin) return a.pin < b.pin;
+    return a.value < b.value;
+}
+
+static void wakeFlag(void *arg) {
+    *(bool *)arg = true;
+}
+
+// What another task would do at a given time: beeps, blinks, config changes.
+static bool touch(uint32_t ms) {
+    switch (ms) {
+        case 100:
+            led.on(400);
+            buzzer.beep(200);
+            return true;
+        case 1500:
+            led.blink(200, 300);
+            return true;
+        case 3999:
+            led.off();
+            return true;
+        case 4000:
+        case 4080:
+        case 4150:
+            config.setMinLap(60 + ms % 7);
+            return true;
+        case 9000:
+            config.setPilotCount(1);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * The same changes on simulated time, the services polled every millisecond
+ * as the old loop did at best and once driven by their deadlines. Every pin
+ * edge (LED, buzzer, RX5808 bus) has to come at the same microsecond.
+ */
+static bool runDeadlines(uint32_t *spinPasses, uint32_t *schedPasses) {
+    std::vector<pin_edge_t> spinEdges, schedEdges;
+    uint64_t spinFlash, schedFlash;
+
+    setup(2, SCHED_LOW_VBAT_RAW);
+    halNativeSetPinHook(recordEdge, &spinEdges);
+    for (uint32_t ms = 0; ms < SCHED_DEADLINE_MS; ms++) {
+        touch(ms);
+        spinPass(halMillis());
+        halNativeAdvanceMicros(1000);
+    }
+    halNativeSetPinHook(NULL, NULL);
+    spinFlash = halNativeGetFlashBytesWritten();
+    *spinPasses = SCHED_DEADLINE_MS;
+
+    Scheduler scheduler;
+    bool woken = false;
+    addServices(scheduler);
+    scheduler.setNotify(wakeFlag, &woken);
+    setup(2, SCHED_LOW_VBAT_RAW);
+    halNativeSetPinHook(recordEdge, &schedEdges);
+    uint32_t dueMs = 0;
+    for (uint32_t ms = 0; ms < SCHED_DEADLINE_MS; ms++) {
+        if (touch(ms)) scheduler.wake();
+        if (woken || ms >= dueMs) {
+            woken = false;
+            dueMs = ms + scheduler.run(halMillis());
+        }
+        halNativeAdvanceMicros(1000);
+    }
+    halNativeSetPinHook(NULL, NULL);
+    schedFlash = halNativeGetFlashBytesWritten();
+    *schedPasses = scheduler.getPasses();
+
+    std::sort(spinEdges.begin(), spinEdges.end(), edgeBefore);
+    std::sort(schedEdges.begin(), schedEdges.end(), edgeBefore);
+    bool same = spinEdges.size() == schedEdges.size() && spinFlash == schedFlash;
+    for (size_t i = 0; same && i < spinEdges.size(); i++) {
+        const pin_edge_t &a = spinEdges[i];
+        const pin_edge_t &b = schedEdges[i];
+        if (a.timeUs == b.timeUs && a.pin == b.pin && a.value == b.value) continue;
+        printf("  edge %zu: pin %u to %u at %llu us polled, pin %u to %u at %llu us scheduled\n", i, a.pin, a.value,
+               (unsigned long long)a.timeUs, b.pin, b.value, (unsigned long long)b.timeUs);
+        same = false;
+    }
+    printf("  %zu pin edges, %llu flash bytes: %s\n", spinEdges.size(), (unsigned long long)spinFlash, same ? "same" : "DIFFERENT");
+    return same;
+}
+
+typedef struct {
+    double idlePercent;
+    double passesPerSecond;
+    uint32_t events;
+    uint32_t p50Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+} sched_run_t;
+
+static uint64_t threadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the simulated clock follows the wall clock, tickers on the way fire
+static uint32_t followWallClock(uint64_t baseUs) {
+    uint64_t targetUs = baseUs + wall.micros();
+    uint64_t nowUs = halNativeMicros64();
+    if (targetUs > nowUs) halNativeAdvanceMicros(targetUs - nowUs);
+    return halMillis();
+}
+
+/*
+ * The service task on a thread of its own in real time, busy spinning or
+ * sleeping between deadlines, while another thread hands it lap events at
+ * random and wakes it. Measures the CPU the service thread took and the
+ * time from a push to its pop.
+ */
+static void runRealTime(bool scheduled, uint32_t seconds, uint8_t pilots, uint32_t seed, sched_run_t *r) {
+    static Scheduler scheduler;
+    static Waker waker;
+    scheduler = Scheduler();
+    waker.reset();
+    addServices(scheduler);
+    scheduler.setNotify(Waker::wake, &waker);
+    setup(pilots, SIM_VBAT_RAW);
+    wall.start();
+    uint64_t baseUs = halNativeMicros64();
+    volatile bool done = false;
+    uint32_t passes = 0;
+    uint64_t cpuNs = 0;
+
+    std::thread service([&]() {
+        uint64_t startNs = threadCpuNs();
+        while (!done) {
+            uint32_t nowMs = followWallClock(baseUs);
+            passes++;
+            if (!scheduled) {
+                spinPass(nowMs);
+                continue;
+            }
+            waker.wait(scheduler.run(nowMs), &done);
+        }
+        serviceLaps(NULL, 0);
+        cpuNs = threadCpuNs() - startNs;
+    });
+
+    SimRandom rnd(seed);
+    uint32_t pushed = 0;
+    auto end = wall.at(seconds * 1000);
+    for (;;) {
+        auto next = std::chrono::steady_clock::now() + std::chrono::microseconds(5000 + rnd.next() % 45000);
+        if (next >= end) break;
+        std::this_thread::sleep_until(next);
+        lap_event_t event = {};
+        event.type = LAP_EVENT_LAP;
+        event.sampleTimeUs = wall.micros();
+        if (laps.push(event)) pushed++;
+        scheduler.wake();
+    }
+    std::this_thread::sleep_until(end);
+    done = true;
+    Waker::wake(&waker);
+    service.join();
+    double wallNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - wall.at(0)).count();
+
+    size_t n = latencies.size();
+    r->idlePercent = 100.0 * (1.0 - cpuNs / wallNs);
+    if (r->idlePercent < 0) r->idlePercent = 0;
+    r->passesPerSecond = passes * 1e9 / wallNs;
+    r->events = n == pushed ? n : 0;
+    r->p50Us = percentile(latencies, 0.5);
+    r->p99Us = percentile(latencies, 0.99);
+    r->maxUs = percentile(latencies, 1.0);
+}
+
+// The deadline scheduler against the busy spinning service task: the same
+// pin edges on simulated time, then CPU idle and lap event latency on a
+// real thread.
+int runSched(int argc, char **argv) {
+    uint32_t seconds = 3;
+    uint32_t seed = 1;
+    uint8_t pilots = 2;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--seconds")) {
+            seconds = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--pilots")) {
+            pilots = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || seconds == 0 || pilots < 1 || pilots > CONFIG_MAX_PILOTS) return CMD_USAGE;
+
+    uint32_t spinPasses, schedPasses;
+    printf("deadlines against polling every ms, %u s simulated\n", SCHED_DEADLINE_MS / 1000);
+    bool ok = runDeadlines(&spinPasses, &schedPasses);
+    printf("  passes: %u polled, %u scheduled\n", spinPasses, schedPasses);
+
+    printf("real time, %u s each, %u pilots, lap events every 5-50 ms\n", seconds, pilots);
+    printf("task\t\tidle\tpasses/s\tevents\tlatency p50\tp99\tmax\n");
+    for (int scheduled = 0; scheduled < 2; scheduled++) {
+        sched_run_t r;
+        runRealTime(scheduled, seconds, pilots, seed, &r);
+        printf("%s\t%.1f%%\t%.0f\t\t%u\t%u us\t\t%u us\t%u us\n", scheduled ? "scheduler" : "busy spin", r.idlePercent, r.passesPerSecond,
+               r.events, r.p50Us, r.p99Us, r.maxUs);
+        ok = ok && r.events > 0;
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
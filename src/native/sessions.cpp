@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "racesim.h"
+#include "sessionjson.h"
+#include "sessionlog.h"
+
+#define SESSIONS_MAX_CUT_BYTES 2000  // a power cut hits within this many written bytes
+#define SESSIONS_READ_CHUNK 7        // odd sized reads to cross every element boundary
+
+typedef struct {
+    uint8_t pilot;
+    uint32_t lapTimeUs;
+} model_lap_t;
+
+// what the test handed to the log, per session
+typedef struct {
+    uint32_t id;  // 0 until a completed handleSessionLog call started it
+    uint8_t pilots;
+    std::vector<model_lap_t> laps;
+    size_t synced;  // laps a completed handleSessionLog call wrote
+    bool ended;
+    bool verified;  // came back from a power cut before
+} model_session_t;
+
+typedef struct {
+    uint64_t sessions;
+    uint64_t recovered;
+    uint64_t lapsKept;
+    uint64_t lapsTorn;  // queued but lost with the power, never synced
+    uint64_t errors;
+} sessions_stats_t;
+
+static void fail(sessions_stats_t *stats, uint32_t cycle, const char *what, uint32_t id) {
+    if (stats->errors++ < 10) printf("cycle %u: session %u: %s\n", cycle, id, what);
+}
+
+// checks what came back after a power cut against what was logged, then
+// makes the model match it
+static void verify(SessionLog *log, std::vector<model_session_t> *model, sessions_stats_t *stats, uint32_t cycle) {
+    session_info_t list[SESSIONLOG_MAX_SESSIONS];
+    size_t count = log->getSessions(list, SESSIONLOG_MAX_SESSIONS);
+    std::vector<model_session_t> kept;
+
+    for (size_t i = 0; i < count; i++) {
+        const session_info_t &info = list[i];
+        if (i > 0 && info.id <= list[i - 1].id) fail(stats, cycle, "out of order", info.id);
+        if (!(info.flags & SESSION_CLOSED)) fail(stats, cycle, "still open", info.id);
+
+        // sessions started in the call the power cut hit have no id yet, ids go up in start order
+        model_session_t *m = nullptr;
+        for (model_session_t &s : *model) {
+            if (s.id == info.id) m = &s;
+        }
+        for (size_t j = 0; !m && j < model->size(); j++) {
+            if ((*model)[j].id == 0) {
+                m = &(*model)[j];
+                m->id = info.id;
+            }
+        }
+        if (!m) {
+            fail(stats, cycle, "not in the model", info.id);
+            continue;
+        }
+
+        SessionReader reader;
+        session_record_t record;
+        std::vector<uint16_t> lapNumbers(CONFIG_MAX_PILOTS, 0);
+        size_t n = 0;
+        reader.open(info.id);
+        while (reader.next(&record)) {
+            if (n >= m->laps.size() || record.pilot != m->laps[n].pilot || record.value != m->laps[n].lapTimeUs) {
+                fail(stats, cycle, "lap differs from what was logged", info.id);
+                break;
+            }
+            if (record.lap != lapNumbers[record.pilot]++) fail(stats, cycle, "lap number skips", info.id);
+            n++;
+        }
+        if (n != info.laps) fail(stats, cycle, "index lap count differs from the log", info.id);
+        if (n < m->synced) fail(stats, cycle, "synced laps lost", info.id);
+        if (info.pilots != m->pilots) fail(stats, cycle, "pilot count differs", info.id);
+        if (!m->verified) {
+            if (info.flags & SESSION_RECOVERED) stats->recovered++;
+            stats->lapsTorn += m->laps.size() - n;
+            stats->lapsKept += n;
+        }
+
+        model_session_t s = *m;
+        s.laps.resize(n);
+        s.synced = n;
+        s.ended = true;
+        s.verified = true;
+        kept.push_back(s);
+    }
+
+    // everything started by a completed call survives, unless retention made room
+    // for it or for the session the power cut then lost
+    uint32_t oldest = count >= SESSIONLOG_MAX_SESSIONS - 1 ? list[0].id : 0;
+    for (const model_session_t &s : *model) {
+        if (s.id == 0 || s.id < oldest) continue;
+        bool found = false;
+        for (const model_session_t &k : kept) {
+            found |= k.id == s.id;
+        }
+        if (!found) fail(stats, cycle, "lost", s.id);
+    }
+    *model = kept;
+}
+
+// after a completed call everything queued so far is on flash, and the
+// sessions it started are the newest in the log
+static void synced(SessionLog *log, std::vector<model_session_t> *model) {
+    session_info_t list[SESSIONLOG_MAX_SESSIONS];
+    size_t count = log->getSessions(list, SESSIONLOG_MAX_SESSIONS);
+    for (size_t i = model->size(); i-- > 0;) {
+        model_session_t &s = (*model)[i];
+        s.synced = s.laps.size();
+        if (count > 0 && s.id == 0) s.id = list[count - 1].id;
+        if (count > 0) count--;
+    }
+}
+
+static bool readJson(ChunkedJson *json, std::string *out) {
+    uint8_t buf[SESSIONS_READ_CHUNK];
+    size_t n;
+    while ((n = json->read(buf, sizeof(buf))) > 0) {
+        out->append((const char *)buf, n);
+        if (out->size() > 1 << 20) return false;
+    }
+    return true;
+}
+
+static size_t countElements(const std::string &json) {
+    size_t count = 0;
+    for (char c : json) {
+        count += c == '{';
+    }
+    return count;
+}
+
+// Random race logging hit by power cuts in the middle of flash writes, every
+// boot checks that the synced laps are all back, nothing else is, and that
+// logging carries on. Then the cost of logging and reading back.
+int runSessions(int argc, char **argv) {
+    uint32_t cycles = 500;
+    uint32_t seed = 1;
+    uint32_t laps = 20000;
+    uint32_t sessionLaps = 500;
+    const char *dir = NULL;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--cycles")) {
+            cycles = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--laps")) {
+            laps = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--session-laps")) {
+            sessionLaps = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--dir")) {
+            dir = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || sessionLaps == 0 || sessionLaps > SESSIONLOG_MAX_LAPS) return CMD_USAGE;
+
+    namespace fs = std::filesystem;
+    fs::path root = dir ? fs::path(dir) : fs::temp_directory_path() / ("sessions-" + std::to_string(seed));
+    fs::remove_all(root);
+    fs::create_directories(root / "cut");
+    fs::create_directories(root / "bench");
+    std::string cutRoot = (root / "cut").string();
+    std::string benchRoot = (root / "bench").string();
+
+    // power cuts
+    halNativeReset();
+    halNativeSetFsRoot(cutRoot.c_str());
+    SimRandom rnd(seed);
+    std::vector<model_session_t> model;
+    sessions_stats_t stats = {};
+    uint32_t timeUs = 0;
+    for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+        SessionLog log;
+        if (!log.init()) {
+            fail(&stats, cycle, "init failed", 0);
+            break;
+        }
+        verify(&log, &model, &stats, cycle);
+
+        halNativeSetPowerCut(halNativeGetFsBytesWritten() + 1 + rnd.next() % SESSIONS_MAX_CUT_BYTES);
+        while (!halNativePowerCutHit()) {
+            uint32_t events = 1 + rnd.next() % 4;
+            for (uint32_t e = 0; e < events; e++) {
+                uint32_t r = rnd.next() % 100;
+                bool open = !model.empty() && !model.back().ended;
+                timeUs += 1000 + rnd.next() % 100000;
+                if (!open || r < 3) {
+                    uint8_t pilots = 1 + rnd.next() % CONFIG_MAX_PILOTS;
+                    if (open) model.back().ended = true;
+                    model.push_back({0, pilots, {}, 0, false, false});
+                    log.beginSession(pilots, timeUs);
+                    stats.sessions++;
+                } else if (r < 8 || model.back().laps.size() >= sessionLaps) {
+                    model.back().ended = true;
+                    log.endSession(timeUs);
+                } else {
+                    model_lap_t lap = {(uint8_t)(rnd.next() % model.back().pilots), rnd.next()};
+                    model.back().laps.push_back(lap);
+                    log.addLap(lap.pilot, lap.lapTimeUs, timeUs);
+                }
+            }
+            log.handleSessionLog(timeUs / 1000);
+            if (!halNativePowerCutHit()) synced(&log, &model);
+        }
+        halNativePowerLoss(rnd.next());
+    }
+    {
+        SessionLog log;
+        log.init();
+        verify(&log, &model, &stats, cycles);
+        // and logging still works on what all those cuts left behind
+        log.beginSession(1, timeUs);
+        log.addLap(0, 12345678, timeUs + 12345678);
+        log.endSession(timeUs + 20000000);
+        log.handleSessionLog(0);
+        session_info_t infos[SESSIONLOG_MAX_SESSIONS];
+        size_t count = log.getSessions(infos, SESSIONLOG_MAX_SESSIONS);
+        SessionReader reader;
+        session_record_t record;
+        if (count == 0 || infos[count - 1].laps != 1 || !(infos[count - 1].flags & SESSION_CLOSED) || !reader.open(infos[count - 1].id) ||
+            !reader.next(&record) || record.value != 12345678) {
+            fail(&stats, cycles, "can't log after recovery", count ? infos[count - 1].id : 0);
+        }
+    }
+
+    // cost of logging, a sync per lap as on the timer
+    halNativeReset();
+    halNativeSetFsRoot(benchRoot.c_str());
+    SessionLog bench;
+    bench.init();
+    double producerNs = 0, writerNs = 0;
+    uint32_t logged = 0;
+    timeUs = 0;
+    while (logged < laps) {
+        bench.beginSession(1, timeUs);
+        for (uint32_t i = 0; i < sessionLaps && logged < laps; i++, logged++) {
+            timeUs += 20000000;
+            auto t0 = std::chrono::steady_clock::now();
+            bench.addLap(0, 20000000, timeUs);
+            auto t1 = std::chrono::steady_clock::now();
+            bench.handleSessionLog(timeUs / 1000);
+            auto t2 = std::chrono::steady_clock::now();
+            producerNs += std::chrono::duration<double, std::nano>(t1 - t0).count();
+            writerNs += std::chrono::duration<double, std::nano>(t2 - t1).count();
+        }
+        bench.endSession(timeUs);
+        bench.handleSessionLog(timeUs / 1000);
+    }
+    uint64_t benchBytes = halNativeGetFsBytesWritten();
+    uint32_t benchSyncs = halNativeGetFsSyncs();
+
+    // reading back, paged and in one go
+    session_info_t infos[SESSIONLOG_MAX_SESSIONS];
+    size_t retained = bench.getSessions(infos, SESSIONLOG_MAX_SESSIONS);
+    size_t expected = (logged + sessionLaps - 1) / sessionLaps;
+    if (expected > SESSIONLOG_MAX_SESSIONS) expected = SESSIONLOG_MAX_SESSIONS;
+    session_info_t newest = retained ? infos[retained - 1] : session_info_t{};
+    std::string sessionsJson, all, paged;
+    SessionListJson list(&bench);
+    readJson(&list, &sessionsJson);
+    auto r0 = std::chrono::steady_clock::now();
+    SessionLapsJson lapsJson;
+    bool readOk = retained && lapsJson.open(newest.id) && readJson(&lapsJson, &all);
+    double readSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - r0).count();
+    size_t pages = 0;
+    for (size_t offset = 0; readOk; offset += 100, pages++) {
+        std::string page;
+        SessionLapsJson pageJson;
+        readOk = pageJson.open(newest.id, offset, 100) && readJson(&pageJson, &page);
+        if (page == "[]") break;
+        paged += paged.empty() ? page.substr(0, page.size() - 1) : "," + page.substr(1, page.size() - 2);
+    }
+    if (!paged.empty()) paged += "]";
+    if (!readOk || countElements(all) != newest.laps || paged != all || retained != expected || countElements(sessionsJson) != retained) {
+        fail(&stats, cycles, "read back differs", newest.id);
+    }
+
+    printf("power cuts:\t%u, %llu sessions started, %llu closed on recovery\n", cycles, (unsigned long long)stats.sessions,
+           (unsigned long long)stats.recovered);
+    printf("laps:\t\t%llu kept, %llu lost unsynced with the power\n", (unsigned long long)stats.lapsKept, (unsigned long long)stats.lapsTorn);
+    printf("logging:\t%u laps in sessions of %u, %.0f laps/s, %.1f us per lap written and synced\n", logged, sessionLaps,
+           logged / (writerNs / 1e9), writerNs / 1e3 / logged);
+    printf("flash:\t\t%.1f bytes and %.2f syncs per lap\n", (double)benchBytes / logged, (double)benchSyncs / logged);
+    printf("timing side:\t%.0f ns per addLap\n", producerNs / logged);
+    printf("read back:\t%u laps as %u bytes of JSON in %.2f ms, %u pages of 100 the same\n", newest.laps, (unsigned)all.size(), readSeconds * 1e3,
+           (unsigned)pages);
+    printf("result:\t\t%s\n", stats.errors ? "ERRORS" : "ok");
+    if (!dir) fs::remove_all(root);
+    return stats.errors ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "commands.h"
+#include "racesim.h"
+#include "trace.h"
+
+int runSim(int argc, char **argv) {
+    const char *tracePath = NULL;
+    const char *dumpPath = NULL;
+    uint32_t races = 1;
+    uint32_t seed = 1;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+
+    for (int i = 0; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!val) {
+            return CMD_USAGE;
+        }
+        if (!strcmp(arg, "--trace")) {
+            tracePath = val;
+        } else if (!strcmp(arg, "--dump")) {
+            dumpPath = val;
+        } else if (!strcmp(arg, "--races")) {
+            races = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--rate")) {
+            synth.sampleRateHz = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--laps")) {
+            synth.laps = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--lap-ms")) {
+            synth.lapTimeMs = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--jitter-ms")) {
+            synth.lapJitterMs = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--tail-ms")) {
+            synth.tailMs = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--noise")) {
+            synth.noiseStdDev = strtof(val, NULL);
+        } else if (!strcmp(arg, "--enter")) {
+            params.enterRssi = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--exit")) {
+            params.exitRssi = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--min-lap")) {
+            params.minLap = strtoul(val, NULL, 0);
+        } else if (!strcmp(arg, "--detector")) {
+            params.detector = detectorFromName(val);
+            if (params.detector == DETECTOR_COUNT) return CMD_USAGE;
+        } else {
+            return CMD_USAGE;
+        }
+        i++;
+    }
+
+    static RssiTrace trace;
+    static RaceSimulator sim;
+    race_result_t result;
+
+    if (tracePath && !trace.load(tracePath)) {
+        printf("Cannot load trace %s\n", tracePath);
+        return 1;
+    }
+
+    uint64_t samples = 0;
+    uint64_t lapsExpected = 0;
+    uint64_t lapsDetected = 0;
+    uint32_t racesExact = 0;
+    double errorSum = 0;
+    double errorMax = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < races; r++) {
+        if (!tracePath) {
+            trace.synthesize(synth, seed + r);
+            if (r == 0 && dumpPath) trace.save(dumpPath);
+        }
+        sim.run(&trace, params, &result);
+
+        samples += result.samples;
+        lapsExpected += result.lapsExpected;
+        lapsDetected += result.lapsDetected;
+        if (result.lapsDetected == result.lapsExpected) racesExact++;
+        errorSum += result.meanAbsErrorMs * result.lapsExpected;
+        if (result.maxAbsErrorMs > errorMax) errorMax = result.maxAbsErrorMs;
+
+        if (races == 1) {
+            size_t rows = result.expectedUs.size() > result.detectedUs.size() ? result.expectedUs.size() : result.detectedUs.size();
+            printf("lap\texpected ms\tdetected ms\n");
+            for (size_t i = 0; i < rows; i++) {
+                printf("%zu\t", i);
+                if (i < result.expectedUs.size()) printf("%.3f", result.expectedUs[i] / 1000.0);
+                printf("\t");
+                if (i < result.detectedUs.size()) printf("%.3f", result.detectedUs[i] / 1000.0);
+                printf("\n");
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("races:\t\t%u (%u with exact lap count)\n", races, racesExact);
+    printf("laps:\t\t%llu expected, %llu detected\n", (unsigned long long)lapsExpected, (unsigned long long)lapsDetected);
+    printf("lap error:\tmean %.2f ms, max %.2f ms\n", lapsExpected ? errorSum / lapsExpected : 0.0, errorMax);
+    printf("throughput:\t%.0f races/s, %.1f M samples/s, %.0f ns/sample\n", races / seconds, samples / seconds / 1e6, samples ? seconds * 1e9 / samples : 0.0);
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "nodesync.h"
+#include "trace.h"
+
+#define SYNC_START_MS 4000      // the master starts the race, the clocks had time to settle and fit the drift
+#define SYNC_FIRST_LAP_MS 5500  // passes of every node from then on
+#define SYNC_LAP_MS 900
+#define SYNC_NODE_GAP_MS 37     // between the passes of two nodes
+#define SYNC_STOP_LEFT_MS 2000  // the master stops this long before the end, time for the laps left to be resent
+#define SYNC_SLACK_US 2         // the clocks are whole microseconds, the true times are not
+
+typedef struct {
+    uint32_t id;
+    double bootUs;  // clock at wall time 0
+    double rate;    // clock microseconds per wall microsecond
+} sync_clock_t;
+
+// what a node process hands back through its pipe
+typedef struct {
+    bool opened;
+    bool master;
+    bool started;
+    double startWallUs;     // when the timer would start
+    uint32_t startBoundUs;  // of the start against the master clock
+    bool synced;
+    int32_t clockErrorUs;   // of the master clock as the node sees it at the end
+    uint32_t clockBoundUs;
+    int32_t driftPpb;
+    bool racing;
+    uint8_t nodes;
+    uint16_t laps;
+    nodesync_lap_t lap[NODESYNC_RACE_LAPS];
+} sync_report_t;
+
+static std::chrono::steady_clock::time_point origin;
+static NodeSync nodeSync;
+static const sync_clock_t *nodeClock;
+static sync_report_t report;
+
+static double wallUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+static double clockAt(const sync_clock_t &c, double wallUs) {
+    return c.bootUs + wallUs * c.rate;
+}
+
+// the 32 bit time of the clock, unwrapped around the simulated clock of now
+static double wallOf(const sync_clock_t &c, uint32_t timeUs) {
+    uint64_t nowUs = halNativeMicros64();
+    double localUs = (double)nowUs + (int32_t)(timeUs - (uint32_t)nowUs);
+    return (localUs - c.bootUs) / c.rate;
+}
+
+static double passWallUs(uint8_t node, uint16_t lap) {
+    return (SYNC_FIRST_LAP_MS + lap * SYNC_LAP_MS + node * SYNC_NODE_GAP_MS) * 1000.0;
+}
+
+static void startRace(void *arg, uint32_t startUs) {
+    uint32_t masterUs;
+    report.started = true;
+    report.startWallUs = wallOf(*nodeClock, startUs);
+    nodeSync.toMaster(startUs, &masterUs, &report.startBoundUs);
+}
+
+static void stopRace(void *arg) {
+}
+
+// one node with its own drifting clock, until the end of the run
+static void runNode(uint8_t index, const sync_clock_t *clocks, uint8_t nodes, uint32_t seconds, uint8_t loss, uint32_t seed) {
+    const sync_clock_t &c = clocks[index];
+    nodeClock = &c;
+    memset(&report, 0, sizeof(report));
+    halNativeReset();
+    halNativeSetUdpNodes(index, nodes);
+    halNativeSetUdpLoss(loss, seed + index);
+    nodeSync.init(c.id, startRace, stopRace, NULL);
+    report.opened = nodeSync.begin();
+
+    bool master = true;
+    for (uint8_t i = 0; i < nodes; i++) {
+        if (clocks[i].id < c.id) master = false;
+    }
+    bool startRequested = false, stopRequested = false;
+    uint16_t nextLap = 0;
+    double endUs = seconds * 1e6;
+    double stopUs = endUs - SYNC_STOP_LEFT_MS * 1000.0;
+    while (report.opened) {
+        halNativeUdpWait(1000);
+        double nowUs = wallUs();
+        if (nowUs >= endUs) break;
+        uint64_t targetUs = (uint64_t)clockAt(c, nowUs);
+        if (targetUs > halNativeMicros64()) halNativeAdvanceMicros(targetUs - halNativeMicros64());
+
+        if (master && !startRequested && nowUs >= SYNC_START_MS * 1000.0) {
+            nodeSync.start();
+            startRequested = true;
+        }
+        if (master && !stopRequested && nowUs >= stopUs) {
+            nodeSync.stop();
+            stopRequested = true;
+        }
+        if (passWallUs(index, nextLap) < stopUs && nowUs >= passWallUs(index, nextLap)) {
+            lap_event_t event = {};
+            event.type = LAP_EVENT_LAP;
+            event.lap = nextLap;
+            event.lapTimeUs = SYNC_LAP_MS * 1000;
+            event.timeUs = (uint32_t)(uint64_t)llround(clockAt(c, passWallUs(index, nextLap)));
+            nodeSync.handleLapEvent(event);
+            nextLap++;
+        }
+        nodeSync.handleSync(halMillis());
+    }
+
+    nodesync_status_t status;
+    nodeSync.getStatus(&status);
+    uint32_t localUs = halMicros();
+    uint32_t masterUs;
+    report.master = nodeSync.isMaster();
+    report.synced = nodeSync.toMaster(localUs, &masterUs, &report.clockBoundUs);
+    const sync_clock_t *m = &clocks[0];
+    for (uint8_t i = 1; i < nodes; i++) {
+        if (clocks[i].id < m->id) m = &clocks[i];
+    }
+    uint32_t trueUs = (uint32_t)(uint64_t)llround(clockAt(*m, wallOf(c, localUs)));
+    report.clockErrorUs = (int32_t)(masterUs - trueUs);
+    report.driftPpb = status.driftPpb;
+    report.racing = status.racing;
+    report.nodes = status.nodes;
+    for (report.laps = 0; report.laps < NODESYNC_RACE_LAPS && nodeSync.getLap(report.laps, &report.lap[report.laps]); report.laps++) {
+    }
+    halUdpEnd();
+}
+
+static bool readReport(int fd, sync_report_t *r) {
+    size_t got = 0;
+    while (got < sizeof(*r)) {
+        ssize_t n = read(fd, (uint8_t *)r + got, sizeof(*r) - got);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+/*
+ * Several nodes as processes of their own on loopback UDP, each with a clock
+ * booted at a random time and running off by up to --drift ppm, --loss
+ * percent of the datagrams dropped. The master starts a race, every node
+ * passes the gate at known wall times. Every node has to start within its
+ * bound of the master, the master has to get every lap with its pass within
+ * the bound on its clock, and every clock has to be within its bound at the
+ * end.
+ */
+int runSync(int argc, char **argv) {
+    uint32_t nodes = 3;
+    uint32_t seconds = 12;
+    float driftPpm = 40;
+    uint32_t loss = 10;
+    uint32_t seed = 1;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        const char *val = argv[i + 1];
+        if (!strcmp(argv[i], "--nodes")) {
+            nodes = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seconds")) {
+            seconds = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--drift")) {
+            driftPpm = atof(val);
+        } else if (!strcmp(argv[i], "--loss")) {
+            loss = strtoul(val, NULL, 0);
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = strtoul(val, NULL, 0);
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    uint32_t minSeconds = (SYNC_FIRST_LAP_MS + SYNC_LAP_MS + SYNC_STOP_LEFT_MS) / 1000 + 1;
+    if ((argc % 2) || nodes < 2 || nodes > NODESYNC_MAX_NODES || seconds < minSeconds || loss > 50 || driftPpm < 0 ||
+        driftPpm > NODESYNC_MAX_DRIFT_PPM / 2) {
+        return CMD_USAGE;
+    }
+
+    // the master is the lowest id, which one that is comes from the seed
+    SimRandom rng(seed);
+    sync_clock_t clocks[NODESYNC_MAX_NODES];
+    uint8_t master = 0;
+    for (uint8_t i = 0; i < nodes; i++) {
+        clocks[i].bootUs = rng.next();
+        clocks[i].rate = 1 + driftPpm * (2 * rng.uniform() - 1) * 1e-6;
+        clocks[i].id = rng.next() | 1;
+        if (clocks[i].id < clocks[master].id) master = i;
+    }
+
+    printf("%u nodes, %u s, clocks off by up to %.0f ppm, %u%% of the datagrams lost\n", nodes, seconds, driftPpm, loss);
+    fflush(stdout);
+    origin = std::chrono::steady_clock::now();
+    pid_t pids[NODESYNC_MAX_NODES];
+    int fds[NODESYNC_MAX_NODES];
+    for (uint8_t i = 0; i < nodes; i++) {
+        int p[2];
+        if (pipe(p) < 0) return 1;
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            close(p[0]);
+            runNode(i, clocks, nodes, seconds, loss, seed);
+            bool written = write(p[1], &report, sizeof(report)) == (ssize_t)sizeof(report);
+            _exit(written ? 0 : 1);
+        }
+        close(p[1]);
+        fds[i] = p[0];
+    }
+
+    static sync_report_t reports[NODESYNC_MAX_NODES];
+    bool ok = true;
+    for (uint8_t i = 0; i < nodes; i++) {
+        ok = readReport(fds[i], &reports[i]) && ok;
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+    if (!ok) {
+        printf("a node process failed\nFAILED\n");
+        return 1;
+    }
+
+    const sync_report_t &m = reports[master];
+    for (uint8_t i = 0; i < nodes; i++) {
+        const sync_report_t &r = reports[i];
+        if (!r.opened) {
+            printf("node %u: no socket on port %u\n", i + 1, NODESYNC_PORT + i);
+            ok = false;
+            continue;
+        }
+        bool right = r.master == (i == master) && r.nodes == nodes && r.started && !r.racing;
+        if (i == master) {
+            printf("node %u %08x: master, %u nodes, race %s\n", i + 1, clocks[i].id, r.nodes,
+                   right ? "started and stopped" : "WRONG");
+            ok = ok && right;
+            continue;
+        }
+        double skewUs = r.startWallUs - m.startWallUs;
+        int32_t truePpb = (int32_t)lround((clocks[master].rate / clocks[i].rate - 1) * 1e9);
+        bool startWithin = fabs(skewUs) <= r.startBoundUs + SYNC_SLACK_US;
+        bool clockWithin = r.synced && (uint32_t)abs(r.clockErrorUs) <= r.clockBoundUs + SYNC_SLACK_US;
+        printf("node %u %08x: start %+.0f us of the master, bound %u; clock %+d us, bound %u; drift %d ppb, true %d%s\n", i + 1, clocks[i].id,
+               skewUs, r.startBoundUs, r.clockErrorUs, r.clockBoundUs, r.driftPpb, truePpb,
+               right && startWithin && clockWithin ? "" : ", WRONG");
+        ok = ok && right && startWithin && clockWithin;
+    }
+
+    // every pass of every node once, on the master clock within its bound
+    uint32_t expected = 0, found = 0, outside = 0;
+    double worstUs = 0;
+    uint32_t worstBoundUs = 0;
+    double stopUs = (seconds * 1000.0 - SYNC_STOP_LEFT_MS) * 1000;
+    for (uint8_t i = 0; i < nodes; i++) {
+        for (uint16_t lap = 0; passWallUs(i, lap) < stopUs; lap++) {
+            expected++;
+            uint8_t copies = 0;
+            for (uint16_t n = 0; n < m.laps; n++) {
+                const nodesync_lap_t &l = m.lap[n];
+                if (l.node != clocks[i].id || l.lap != lap) continue;
+                copies++;
+                double trueUs = clockAt(clocks[master], passWallUs(i, lap));
+                double errorUs = fabs((double)(int32_t)(l.passUs - (uint32_t)(uint64_t)llround(trueUs)));
+                if (errorUs > l.errorUs + SYNC_SLACK_US) outside++;
+                if (errorUs > worstUs) worstUs = errorUs;
+                if (l.errorUs > worstBoundUs) worstBoundUs = l.errorUs;
+            }
+            if (copies == 1) found++;
+        }
+    }
+    bool lapsRight = found == expected && m.laps == expected && outside == 0;
+    printf("laps on the master: %u of %u, worst error %.0f us, worst bound %u us, %u outside their bound%s\n", found, expected, worstUs,
+           worstBoundUs, outside, lapsRight ? "" : ", WRONG");
+    ok = ok && lapsRight;
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
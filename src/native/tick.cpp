@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "probe.h"
+#include "racesim.h"
+#include "trace.h"
+
+#define TICK_JITTER_US 20        // of the task switch after the interrupt, every tick
+#define TICK_STALL_ONE_IN 2000   // ticks that wait on a flash write or a higher priority ISR
+
+typedef struct {
+    SimRandom rnd = SimRandom(1);
+    uint32_t stallUs;
+    std::vector<uint32_t> latencies;  // as the tick task was handed them, one per run
+} tick_latency_t;
+
+static uint32_t tickLatency(void *arg) {
+    tick_latency_t *t = (tick_latency_t *)arg;
+    uint32_t us = t->rnd.next() % (TICK_JITTER_US + 1);
+    if (t->rnd.next() % TICK_STALL_ONE_IN == 0) us += 1 + t->rnd.next() % t->stallUs;
+    t->latencies.push_back(us);
+    return us;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t tickHz;
+    uint16_t frameBudget;
+    uint64_t laps;
+    uint32_t lapsOff;  // laps other than in the loop run, or lap times that differ
+    tick_stats_t stats;
+    uint32_t expectedMissed;
+    uint32_t expectedLateMaxUs;
+    size_t maxFrames;
+    probe_summary_t late;
+    probe_summary_t work;
+} tick_mode_t;
+
+static tick_mode_t tickMode(const char *name, uint32_t tickHz, uint16_t frameBudget) {
+    tick_mode_t mode = {};
+    mode.name = name;
+    mode.tickHz = tickHz;
+    mode.frameBudget = frameBudget;
+    return mode;
+}
+
+// The timing loop from loop() against the tick task with injected interrupt
+// latency, with and without a frame budget: same laps, every interrupt late
+// by a stall is counted as missed, and a budget bounds the frames a tick takes.
+int runTick(int argc, char **argv) {
+    uint32_t races = 10;
+    uint32_t seed = 1;
+    uint32_t tickHz = TICK_RATE_HZ;
+    uint32_t stallMs = 5;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--races")) {
+            races = val;
+        } else if (!strcmp(argv[i], "--rate")) {
+            tickHz = val;
+        } else if (!strcmp(argv[i], "--stall")) {
+            stallMs = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || tickHz == 0 || tickHz > 1000000 || stallMs == 0) return CMD_USAGE;
+
+    // as main.cpp sizes it, twice what a period brings
+    uint16_t budget = 2 * synth.sampleRateHz / tickHz;
+    if (budget < 1) budget = 1;
+    tick_mode_t modes[] = {tickMode("loop()", 0, 0), tickMode("tick", tickHz, 0), tickMode("tick+budget", tickHz, budget)};
+    static RssiTrace trace;
+    static RaceSimulator sim;
+    static tick_latency_t latency;
+    std::vector<std::vector<uint32_t>> loopLaps(races);
+    race_result_t result;
+    latency.stallUs = stallMs * 1000;
+
+    for (tick_mode_t &mode : modes) {
+        params.tickHz = mode.tickHz;
+        params.frameBudget = mode.frameBudget;
+        latency.rnd = SimRandom(seed ^ 0x71C4);
+        halNativeSetTickLatency(mode.tickHz ? tickLatency : NULL, &latency);
+        probeReset();
+        for (uint32_t r = 0; r < races; r++) {
+            trace.synthesize(synth, seed + r);
+            latency.latencies.clear();
+            sim.run(&trace, params, &result);
+
+            mode.laps += result.lapsDetected;
+            if (!mode.tickHz) {
+                loopLaps[r] = result.detectedUs;
+            } else if (result.detectedUs != loopLaps[r]) {
+                mode.lapsOff++;
+            }
+            if (!mode.tickHz) continue;
+
+            tick_stats_t stats;
+            sim.getTickStats(&stats);
+            mode.stats.periodUs = stats.periodUs;
+            mode.stats.budgetUs = stats.budgetUs;
+            mode.stats.ticks += stats.ticks;
+            mode.stats.missed += stats.missed;
+            mode.stats.overBudget += stats.overBudget;
+            if (stats.lateMaxUs > mode.stats.lateMaxUs) mode.stats.lateMaxUs = stats.lateMaxUs;
+            if (stats.workMaxUs > mode.stats.workMaxUs) mode.stats.workMaxUs = stats.workMaxUs;
+            // the latency drawn after the last run was never served
+            for (uint32_t k = 0; k < stats.ticks && k < latency.latencies.size(); k++) {
+                uint32_t us = latency.latencies[k];
+                mode.expectedMissed += us / stats.periodUs;
+                if (us > mode.expectedLateMaxUs) mode.expectedLateMaxUs = us;
+            }
+            if (sim.getMaxTickFrames() > mode.maxFrames) mode.maxFrames = sim.getMaxTickFrames();
+        }
+        probeSummary(PROBE_TICK_LATE, &mode.late);
+        probeSummary(PROBE_TICK_WORK, &mode.work);
+    }
+    halNativeSetTickLatency(NULL, NULL);
+
+    printf("%u races at %u Hz RSSI, tick at %u Hz, jitter up to %u us, a stall of up to %u ms one tick in %u\n", races, synth.sampleRateHz, tickHz,
+           TICK_JITTER_US, stallMs, TICK_STALL_ONE_IN);
+    printf("mode\t\tlaps\toff\tticks\tmissed\tover\tlate p50\tlate p99\tlate max\twork p50\twork p99\twork max\tframes max\n");
+    bool ok = true;
+    for (tick_mode_t &mode : modes) {
+        printf("%s%s\t%llu\t%u", mode.name, strlen(mode.name) < 8 ? "\t" : "", (unsigned long long)mode.laps, mode.lapsOff);
+        if (!mode.tickHz) {
+            printf("\n");
+            continue;
+        }
+        printf("\t%u\t%u\t%u\t%.0f us\t\t%.0f us\t\t%u us\t%.1f us\t\t%.1f us\t\t%u us\t\t%u\n", mode.stats.ticks, mode.stats.missed,
+               mode.stats.overBudget, mode.late.p50Us, mode.late.p99Us, mode.stats.lateMaxUs, mode.work.p50Us, mode.work.p99Us,
+               mode.stats.workMaxUs, (unsigned)mode.maxFrames);
+        bool counted = mode.stats.missed == mode.expectedMissed && mode.stats.lateMaxUs == mode.expectedLateMaxUs;
+        if (!counted) {
+            printf("\texpected %u missed, late at most %u us\n", mode.expectedMissed, mode.expectedLateMaxUs);
+        }
+        ok = ok && counted && mode.laps == modes[0].laps && !mode.lapsOff && mode.stats.ticks > 0;
+        if (mode.frameBudget) ok = ok && mode.maxFrames <= mode.frameBudget;
+    }
+    printf("frame budget %u a tick; without it a stalled tick takes %u\n", budget, (unsigned)modes[1].maxFrames);
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "commands.h"
+#include "hal_native.h"
+#include "racesim.h"
+#include "trace.h"
+#include "wsframe.h"
+
+#define SSE_RSSI_PERIOD_MS 200  // WEB_RSSI_SEND_TIMEOUT_MS
+#define TCPIP_HEADER_SIZE 40    // IPv4 + TCP, one segment per message
+#define PASS_WINDOW_US 200000   // where the peak of a pass is looked for
+#define HISTORY_CHECK_BUCKETS 100
+
+typedef struct {
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t samples;
+} ws_path_t;
+
+typedef struct {
+    RssiStream stream;
+    RssiHistory history;
+    uint32_t batchMs;
+    uint32_t lastBatchMs;
+    uint32_t lastSseMs;
+    uint8_t lastRssi;
+    bool started;
+
+    ws_path_t sse;
+    ws_path_t sseFull;
+    ws_path_t ws;
+    uint64_t mismatches;
+
+    // pilot 1 as the page sees it, for the current race
+    std::vector<rssi_sample_t> received;
+    std::vector<trace_sample_t> sseReceived;
+} ws_bench_t;
+
+// what AsyncEventSource puts on the wire for events.send(data, event)
+static size_t sseMessageSize(const char *event, const char *data) {
+    return strlen("event: ") + strlen(event) + strlen("\r\ndata: ") + strlen(data) + strlen("\r\n\r\n");
+}
+
+// server to client frames are not masked
+static size_t wsMessageSize(size_t payload) {
+    return payload + (payload < 126 ? 2 : 4);
+}
+
+static void sendBatch(ws_bench_t *b) {
+    static rssi_sample_t samples[WS_BATCH_SAMPLES];
+    static uint8_t buf[WS_BUFFER_SIZE];
+    static ws_frame_t frame;
+    size_t count;
+    do {
+        count = b->stream.pop(samples, WS_BATCH_SAMPLES);
+        if (count == 0) break;
+        for (size_t i = 0; i < count; i++) {
+            char text[16];
+            snprintf(text, sizeof(text), "%u,%u,%u", samples[i].rssi.min, samples[i].rssi.max, samples[i].rssi.mean);
+            b->sseFull.messages++;
+            b->sseFull.bytes += sseMessageSize("rssi", text);
+            b->sseFull.samples++;
+        }
+        b->lastRssi = samples[count - 1].rssi.mean;
+
+        WsFrameWriter writer(buf, sizeof(buf));
+        size_t added = writer.addRssi(samples, count, b->stream.getPeriodUs());
+        b->ws.messages++;
+        b->ws.bytes += wsMessageSize(writer.length());
+        b->ws.samples += added;
+        b->mismatches += count - added;
+
+        // decode it again the way the page does and compare
+        WsFrameReader reader(buf, writer.length());
+        size_t n = 0;
+        while (reader.next(&frame)) {
+            for (uint16_t i = 0; i < frame.count; i++, n++) {
+                rssi_sample_t s = {frame.timeUs + i * frame.periodUs, frame.pilot, frame.rssi[i]};
+                if (n >= added || memcmp(&s.rssi, &samples[n].rssi, sizeof(s.rssi)) || s.pilot != samples[n].pilot || s.timeUs != samples[n].timeUs) {
+                    b->mismatches++;
+                }
+                if (s.pilot == 0) b->received.push_back(s);
+            }
+        }
+        if (reader.isMalformed() || n != added) b->mismatches++;
+    } while (count == WS_BATCH_SAMPLES);
+}
+
+static void serviceHook(void *arg, uint32_t currentTimeMs) {
+    ws_bench_t *b = (ws_bench_t *)arg;
+    if (!b->started) {
+        b->lastBatchMs = b->lastSseMs = currentTimeMs;
+        b->started = true;
+    }
+    if ((currentTimeMs - b->lastBatchMs) >= b->batchMs) {
+        sendBatch(b);
+        b->lastBatchMs = currentTimeMs;
+    }
+    if ((currentTimeMs - b->lastSseMs) > SSE_RSSI_PERIOD_MS) {
+        char text[8];
+        snprintf(text, sizeof(text), "%u", b->lastRssi);
+        b->sse.messages++;
+        b->sse.bytes += sseMessageSize("rssi", text);
+        b->sse.samples++;
+        b->sseReceived.push_back({(uint32_t)halMicros(), b->lastRssi});
+        b->lastSseMs = currentTimeMs;
+    }
+}
+
+// the coarse history has to have the same min and max as the stream buckets it covers
+static uint64_t checkHistory(ws_bench_t *b, size_t *historyBytes) {
+    static rssi_bucket_t buckets[WS_HISTORY_BUCKETS];
+    static uint8_t buf[WS_HISTORY_HEADER_SIZE + sizeof(buckets)];
+    static ws_frame_t frame;
+    uint32_t firstUs, bucketUs;
+    size_t count = b->history.query(RSSI_HISTORY_BUCKETS * RSSI_HISTORY_BUCKET_US, HISTORY_CHECK_BUCKETS, buckets, &firstUs, &bucketUs);
+    WsFrameWriter writer(buf, sizeof(buf));
+    writer.addHistory(0, buckets, count, firstUs, bucketUs);
+    *historyBytes = wsMessageSize(writer.length());
+
+    WsFrameReader reader(buf, writer.length());
+    if (!reader.next(&frame) || frame.count != count) return 1;
+    uint64_t mismatches = 0;
+    for (uint16_t i = 0; i < frame.count; i++) {
+        uint32_t startUs = frame.timeUs + i * frame.periodUs;
+        rssi_bucket_t expected = RSSI_BUCKET_EMPTY;
+        uint32_t sum = 0, used = 0;
+        for (const rssi_sample_t &s : b->received) {
+            if (s.timeUs - startUs >= frame.periodUs) continue;
+            if (s.rssi.min < expected.min) expected.min = s.rssi.min;
+            if (s.rssi.max > expected.max) expected.max = s.rssi.max;
+            sum += s.rssi.mean;
+            used++;
+        }
+        if (used) expected.mean = (sum + used / 2) / used;
+        const rssi_bucket_t &got = frame.rssi[i];
+        if (got.min != expected.min || got.max != expected.max || abs(got.mean - expected.mean) > 1) mismatches++;
+    }
+    return mismatches;
+}
+
+static void printPath(const char *name, const ws_path_t &p, double seconds) {
+    double perSample = p.samples ? (double)p.bytes / p.samples : 0;
+    printf("%s\t%.1f\t\t%.1f\t\t%.0f\t\t%.0f\t\t%.2f\n", name, p.samples / seconds, p.messages / seconds, p.bytes / seconds,
+           (p.bytes + p.messages * TCPIP_HEADER_SIZE) / seconds, perSample);
+}
+
+// RSSI to the calibration chart: SSE text events as sent before against
+// batched binary WebSocket frames, on the RSSI of simulated races.
+int runWs(int argc, char **argv) {
+    uint32_t races = 3;
+    uint32_t seed = 1;
+    uint32_t streamHz = WS_RSSI_DEFAULT_HZ;
+    static ws_bench_t bench;
+    synth_params_t synth;
+    race_params_t params;
+    synthDefaults(&synth);
+    raceDefaults(&params);
+    synth.sampleRateHz = RSSI_SAMPLE_RATE_HZ;
+    bench.batchMs = WS_BATCH_MS;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        uint32_t val = strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "--races")) {
+            races = val;
+        } else if (!strcmp(argv[i], "--seed")) {
+            seed = val;
+        } else if (!strcmp(argv[i], "--rate")) {
+            synth.sampleRateHz = val;
+        } else if (!strcmp(argv[i], "--stream")) {
+            streamHz = val;
+        } else if (!strcmp(argv[i], "--batch")) {
+            bench.batchMs = val;
+        } else if (!strcmp(argv[i], "--pilots")) {
+            params.pilots = val;
+        } else {
+            return CMD_USAGE;
+        }
+    }
+    if ((argc % 2) || races == 0 || synth.sampleRateHz == 0 || streamHz < RSSI_STREAM_MIN_HZ || streamHz > RSSI_STREAM_MAX_HZ ||
+        bench.batchMs == 0 || params.pilots < 1 || params.pilots > CONFIG_MAX_PILOTS) {
+        return CMD_USAGE;
+    }
+
+    static RssiTrace traces[CONFIG_MAX_PILOTS];
+    static RaceSimulator sim;
+    race_result_t results[CONFIG_MAX_PILOTS];
+    bench.stream.setRateHz(streamHz);
+    sim.setRssiStream(&bench.stream);
+    sim.setRssiHistory(&bench.history);
+    sim.setServiceHook(serviceHook, &bench);
+    // history buckets line up with stream buckets only at the same period and without hopping gaps
+    const bool historyCheck = bench.stream.getPeriodUs() == RSSI_HISTORY_BUCKET_US && params.pilots == 1;
+
+    double seconds = 0;
+    uint64_t laps = 0;
+    uint64_t passes = 0;
+    uint64_t historyMismatches = 0;
+    size_t historyBytes = 0;
+    double peakMax = 0, peakMean = 0, peakSse = 0;
+    for (uint32_t r = 0; r < races; r++) {
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            traces[i].synthesize(synth, seed + r * CONFIG_MAX_PILOTS + i);
+        }
+        bench.started = false;
+        bench.received.clear();
+        bench.sseReceived.clear();
+        sim.run(traces, params, results);
+        sendBatch(&bench);
+        seconds += traces[0].durationUs() / 1e6;
+        for (uint8_t i = 0; i < params.pilots; i++) {
+            laps += results[i].lapsDetected;
+        }
+        if (historyCheck) historyMismatches += checkHistory(&bench, &historyBytes);
+
+        // how high pilot 1's passes look on the chart, the trace starts with the race
+        for (uint32_t passUs : traces[0].passTimesUs) {
+            uint32_t centerUs = (uint32_t)SIM_RACE_START_MS * 1000 + passUs;
+            uint8_t streamMax = 0, streamMean = 0, sse = 0;
+            for (const rssi_sample_t &s : bench.received) {
+                if (s.timeUs - (centerUs - PASS_WINDOW_US) > 2 * PASS_WINDOW_US) continue;
+                if (s.rssi.max > streamMax) streamMax = s.rssi.max;
+                if (s.rssi.mean > streamMean) streamMean = s.rssi.mean;
+            }
+            for (const trace_sample_t &s : bench.sseReceived) {
+                if (s.timeUs - (centerUs - PASS_WINDOW_US) <= 2 * PASS_WINDOW_US && s.rssi > sse) sse = s.rssi;
+            }
+            peakMax += streamMax;
+            peakMean += streamMean;
+            peakSse += sse;
+            passes++;
+        }
+    }
+
+    printf("%u races, %.0f s, %u pilots, %u Hz ADC, %u Hz stream, %u ms batches\n", races, seconds, params.pilots, synth.sampleRateHz,
+           bench.stream.getRateHz(), bench.batchMs);
+    printf("path\t\tsamples/s\tmessages/s\tbytes/s\t\twire bytes/s\tbytes/sample\n");
+    printPath("sse (before)", bench.sse, seconds);
+    printPath("sse per bucket", bench.sseFull, seconds);
+    printPath("ws binary", bench.ws, seconds);
+    printf("laps:\t\t%llu, %u bytes each on ws against %u on sse (\"lap\" and \"pilotlap\")\n", (unsigned long long)laps,
+           (unsigned)wsMessageSize(WS_LAP_FRAME_SIZE), (unsigned)(sseMessageSize("lap", "12345678") + sseMessageSize("pilotlap", "1,12345678")));
+    if (passes) {
+        printf("pass peaks:\tmean height %.1f on the bucket max, %.1f on the bucket mean, %.1f on the sse samples\n", peakMax / passes,
+               peakMean / passes, peakSse / passes);
+    }
+    if (historyCheck) {
+        printf("history:\t%u buckets of the last minute in %u bytes, %llu differ from the stream\n", HISTORY_CHECK_BUCKETS, (unsigned)historyBytes,
+               (unsigned long long)historyMismatches);
+    } else {
+        printf("history:\tnot checked, needs a %u Hz stream and one pilot\n", 1000000 / RSSI_HISTORY_BUCKET_US);
+    }
+    printf("decode:\t\t%llu buckets, %llu mismatches, %u dropped by the stream\n", (unsigned long long)bench.ws.samples,
+           (unsigned long long)bench.mismatches, bench.stream.getDropped());
+    return bench.mismatches || historyMismatches || bench.stream.getDropped() ? 1 : 0;
+}